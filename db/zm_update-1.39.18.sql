@@ -0,0 +1,5 @@
+--
+-- Add the Adaptive decoding mode: keyframes only, switching to every frame
+-- while there is activity.
+--
+ALTER TABLE `Monitors` MODIFY `Decoding` enum('None','Ondemand','KeyFrames','KeyFrames+Ondemand','Always','Adaptive') NOT NULL default 'Always';
@@ -0,0 +1,214 @@
+//
+// ZoneMinder Background Model Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_background_model.h"
+
+#include "zm_config.h"
+#include "zm_image.h"
+#include "zm_utils.h"
+#include <cstdlib>
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE)
+#include <emmintrin.h>
+#endif
+
+BackgroundModel::BackgroundModel() : width_(0), height_(0) {
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE)
+  if (config.cpu_extensions && sse_version >= 20) {
+    fptr_delta8 = &sse2_background_delta8;
+    fptr_update8 = &sse2_background_update8;
+    return;
+  }
+#endif
+  fptr_delta8 = &std_background_delta8;
+  fptr_update8 = &std_background_update8;
+}
+
+int BackgroundModel::BlendShift(int blend_perc) {
+  if (blend_perc <= 0) return 0;
+  // Nearest power of two, 1/2 to 1/128
+  int shift = 1;
+  while (shift < kFractionBits && blend_perc * (141 << shift) < 10000)
+    shift++;
+  return shift;
+}
+
+bool BackgroundModel::Matches(const Image &image) const {
+  if (image.Width() != width_ || image.Height() != height_) {
+    Error("Background model is %ux%u, image is %ux%u", width_, height_, image.Width(), image.Height());
+    return false;
+  }
+  return true;
+}
+
+bool BackgroundModel::Reset(const Image &image) {
+  if (zm_bytes_per_pixel(image.PixFormat()) != 1) {
+    Error("Background model needs a luma image, not %s", av_get_pix_fmt_name(image.PixFormat()));
+    return false;
+  }
+  width_ = image.Width();
+  height_ = image.Height();
+  mean_.resize(static_cast<size_t>(width_) * height_);
+  deviation_.assign(mean_.size(), 0);
+
+  int16_t *mean = mean_.data();
+  for (unsigned int y = 0; y < height_; y++) {
+    const uint8_t *row = image.Buffer(0, y);
+    for (unsigned int x = 0; x < width_; x++)
+      *mean++ = row[x] << kFractionBits;
+  }
+  return true;
+}
+
+bool BackgroundModel::Delta(const Image &image, Image *target) const {
+  if (!Matches(image)) return false;
+
+  uint8_t *out = target->WriteBuffer(width_, height_, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  if (!out) return false;
+
+  for (unsigned int y = 0; y < height_; y++) {
+    const size_t offset = static_cast<size_t>(y) * width_;
+    (*fptr_delta8)(image.Buffer(0, y), mean_.data() + offset, deviation_.data() + offset,
+                   out + y * target->LineSize(), width_);
+  }
+  return true;
+}
+
+bool BackgroundModel::Update(const Image &image, int blend_perc) {
+  if (!Matches(image)) return false;
+
+  const int shift = BlendShift(blend_perc);
+  if (!shift) return true;
+
+  for (unsigned int y = 0; y < height_; y++) {
+    const size_t offset = static_cast<size_t>(y) * width_;
+    (*fptr_update8)(image.Buffer(0, y), mean_.data() + offset, deviation_.data() + offset, shift, width_);
+  }
+  return true;
+}
+
+void BackgroundModel::Mean(Image &target) const {
+  if (!Initialised()) return;
+  uint8_t *out = target.WriteBuffer(width_, height_, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  if (!out) return;
+
+  const int16_t *mean = mean_.data();
+  for (unsigned int y = 0; y < height_; y++) {
+    uint8_t *row = out + y * target.LineSize();
+    for (unsigned int x = 0; x < width_; x++)
+      row[x] = (*mean++ + (1 << (kFractionBits - 1))) >> kFractionBits;
+  }
+}
+
+/************************************************* KERNELS *************************************************/
+
+/* Difference from the mean less kNoiseMultiplier deviations, floored at 0 */
+__attribute__((noinline)) void std_background_delta8(const uint8_t *in, const int16_t *mean, const int16_t *deviation,
+                                                     uint8_t *result, unsigned long count) {
+  constexpr int bits = BackgroundModel::kFractionBits;
+  for (unsigned long i = 0; i < count; i++) {
+    const int mu = (mean[i] + (1 << (bits - 1))) >> bits;
+    const int dev = (deviation[i] + (1 << (bits - 1))) >> bits;
+    const int diff = abs(in[i] - mu) - BackgroundModel::kNoiseMultiplier * dev;
+    result[i] = diff > 0 ? diff : 0;
+  }
+}
+
+/* SSE2 version, 16 pixels per iteration. Identical results to std_background_delta8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_background_delta8(const uint8_t *in, const int16_t *mean, const int16_t *deviation,
+                            uint8_t *result, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE))
+  static_assert(BackgroundModel::kNoiseMultiplier == 3, "sse2_background_delta8 multiplies by 3");
+  constexpr int bits = BackgroundModel::kFractionBits;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rounding = _mm_set1_epi16(1 << (bits - 1));
+  unsigned long i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i values[2] = {_mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero)};
+    __m128i deltas[2];
+    for (int half = 0; half < 2; half++) {
+      __m128i mu = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mean + i + 8*half));
+      __m128i dev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(deviation + i + 8*half));
+      mu = _mm_srli_epi16(_mm_add_epi16(mu, rounding), bits);
+      dev = _mm_srli_epi16(_mm_add_epi16(dev, rounding), bits);
+      __m128i diff = _mm_sub_epi16(_mm_max_epi16(values[half], mu), _mm_min_epi16(values[half], mu));
+      diff = _mm_sub_epi16(diff, _mm_add_epi16(dev, _mm_add_epi16(dev, dev)));
+      deltas[half] = _mm_max_epi16(diff, zero);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result + i), _mm_packus_epi16(deltas[0], deltas[1]));
+  }
+  std_background_delta8(in + i, mean + i, deviation + i, result + i, count - i);
+#else
+  Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* Exponential moving average of the value and its absolute difference from the mean */
+__attribute__((noinline)) void std_background_update8(const uint8_t *in, int16_t *mean, int16_t *deviation,
+                                                      int shift, unsigned long count) {
+  const int rounding = 1 << (shift - 1);
+  for (unsigned long i = 0; i < count; i++) {
+    const int diff = (in[i] << BackgroundModel::kFractionBits) - mean[i];
+    const int abs_diff = diff < 0 ? -diff : diff;
+    mean[i] += (diff + rounding) >> shift;
+    deviation[i] += (abs_diff - deviation[i] + rounding) >> shift;
+  }
+}
+
+/* SSE2 version, 16 pixels per iteration. Identical results to std_background_update8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_background_update8(const uint8_t *in, int16_t *mean, int16_t *deviation,
+                             int shift, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE))
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rounding = _mm_set1_epi16(1 << (shift - 1));
+  const __m128i shift_count = _mm_cvtsi32_si128(shift);
+  unsigned long i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i values[2] = {
+      _mm_slli_epi16(_mm_unpacklo_epi8(pixels, zero), BackgroundModel::kFractionBits),
+      _mm_slli_epi16(_mm_unpackhi_epi8(pixels, zero), BackgroundModel::kFractionBits)
+    };
+    for (int half = 0; half < 2; half++) {
+      __m128i *mean_ptr = reinterpret_cast<__m128i *>(mean + i + 8*half);
+      __m128i *deviation_ptr = reinterpret_cast<__m128i *>(deviation + i + 8*half);
+      __m128i mu = _mm_loadu_si128(mean_ptr);
+      __m128i dev = _mm_loadu_si128(deviation_ptr);
+      const __m128i diff = _mm_sub_epi16(values[half], mu);
+      const __m128i abs_diff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+      mu = _mm_add_epi16(mu, _mm_sra_epi16(_mm_add_epi16(diff, rounding), shift_count));
+      dev = _mm_add_epi16(dev, _mm_sra_epi16(_mm_add_epi16(_mm_sub_epi16(abs_diff, dev), rounding), shift_count));
+      _mm_storeu_si128(mean_ptr, mu);
+      _mm_storeu_si128(deviation_ptr, dev);
+    }
+  }
+  std_background_update8(in + i, mean + i, deviation + i, shift, count - i);
+#else
+  Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
@@ -0,0 +1,82 @@
+//
+// ZoneMinder Background Model Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_BACKGROUND_MODEL_H
+#define ZM_BACKGROUND_MODEL_H
+
+#include "zm_define.h"
+#include <vector>
+
+class Image;
+
+// Per pixel running mean and mean absolute deviation of the luma, the
+// statistical alternative to blending a reference image (ZM_ANALYSIS_ENGINE).
+// Both are kept as 8.7 fixed point so that updates and deltas are a handful
+// of 16 bit operations per pixel.  The delta it produces is how far each
+// pixel is from its mean beyond kNoiseMultiplier deviations, so the zone
+// pixel thresholds apply on top of the noise the pixel normally shows.
+class BackgroundModel {
+ public:
+  static constexpr int kFractionBits = 7;
+  static constexpr int kNoiseMultiplier = 3;
+
+  BackgroundModel();
+
+  bool Initialised() const { return width_ != 0; }
+  unsigned int Width() const { return width_; }
+  unsigned int Height() const { return height_; }
+
+  // Starts over from image with no learnt noise.  image must be GRAY8 or
+  // planar with a luma plane, as must those passed to Delta and Update.
+  bool Reset(const Image &image);
+  // Writes the GRAY8 delta of image against the model into target
+  bool Delta(const Image &image, Image *target) const;
+  // Moves the mean and deviation towards image at about blend_perc % per
+  // frame, rounded to a power of two.  0 leaves the model alone.
+  bool Update(const Image &image, int blend_perc);
+  // The current mean as a GRAY8 image, for diagnostics
+  void Mean(Image &target) const;
+
+  // Learning rate shift for a blend percentage, 0 for none
+  static int BlendShift(int blend_perc);
+
+ private:
+  bool Matches(const Image &image) const;
+
+  unsigned int width_;
+  unsigned int height_;
+  std::vector<int16_t> mean_;
+  std::vector<int16_t> deviation_;
+
+  void (*fptr_delta8)(const uint8_t *in, const int16_t *mean, const int16_t *deviation,
+                      uint8_t *result, unsigned long count);
+  void (*fptr_update8)(const uint8_t *in, int16_t *mean, int16_t *deviation,
+                       int shift, unsigned long count);
+};
+
+void std_background_delta8(const uint8_t *in, const int16_t *mean, const int16_t *deviation,
+                           uint8_t *result, unsigned long count);
+void sse2_background_delta8(const uint8_t *in, const int16_t *mean, const int16_t *deviation,
+                            uint8_t *result, unsigned long count);
+void std_background_update8(const uint8_t *in, int16_t *mean, int16_t *deviation,
+                            int shift, unsigned long count);
+void sse2_background_update8(const uint8_t *in, int16_t *mean, int16_t *deviation,
+                             int shift, unsigned long count);
+
+#endif // ZM_BACKGROUND_MODEL_H
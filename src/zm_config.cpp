@@ -20,6 +20,7 @@
 #include "zm_config.h"
 
 #include "zm_db.h"
+#include "zm_db_snapshot.h"
 #include "zm_logger.h"
 #include "zm_utils.h"
 #include <cerrno>
@@ -62,6 +63,13 @@ void zmLoadStaticConfig() {
   }
 }
 
+static void zmSetFileFormats() {
+  staticConfig.capture_file_format = stringtf("%%s/%%0%dd-capture.jpg", config.event_image_digits);
+  staticConfig.analyse_file_format = stringtf("%%s/%%0%dd-analyse.jpg", config.event_image_digits);
+  staticConfig.general_file_format = stringtf("%%s/%%0%dd-%%s", config.event_image_digits);
+  staticConfig.video_file_format = "%s/%s";
+}
+
 void zmLoadDBConfig() {
   if (!zmDbConnected) {
     Fatal("Not connected to the database. Can't continue.");
@@ -102,10 +110,23 @@ void zmLoadDBConfig() {
     Debug(3, "Single server configuration assumed because no Server ID or Name was specified.");
   }
 
-  staticConfig.capture_file_format = stringtf("%%s/%%0%dd-capture.jpg", config.event_image_digits);
-  staticConfig.analyse_file_format = stringtf("%%s/%%0%dd-analyse.jpg", config.event_image_digits);
-  staticConfig.general_file_format = stringtf("%%s/%%0%dd-%%s", config.event_image_digits);
-  staticConfig.video_file_format = "%s/%s";
+  zmSetFileFormats();
+}
+
+bool zmLoadSnapshotConfig() {
+  // Resolving a server name to an id, or the other way round, needs the Servers table
+  if (staticConfig.SERVER_ID ? staticConfig.SERVER_NAME.empty() : !staticConfig.SERVER_NAME.empty())
+    return false;
+
+  if (!dbSnapshot.Open(DbSnapshot::Path(), DbSnapshot::SchemaHash()))
+    return false;
+  if (!config.Load(dbSnapshot)) {
+    dbSnapshot.Close();
+    return false;
+  }
+  config.Assign();
+  zmSetFileFormats();
+  return true;
 }
 
 void process_configfile(char const *configFile) {
@@ -358,8 +379,10 @@ Config::~Config() {
   }
 }
 
+std::string load_config_sql = "SELECT `Name`, `Value`, `Type` FROM `Config` ORDER BY `Id`";
+
 void Config::Load() {
-  MYSQL_RES *result = zmDbFetch("SELECT `Name`, `Value`, `Type` FROM `Config` ORDER BY `Id`");
+  MYSQL_RES *result = zmDbFetch(load_config_sql);
   if (!result) {
     exit(-1);
   }
@@ -386,6 +409,28 @@ void Config::Load() {
   mysql_free_result(result);
 }
 
+bool Config::Load(const DbSnapshot &snapshot) {
+  const DbSnapshot::Table *table = snapshot.Find("Config");
+  if (!table or table->Fields() != 3 or table->Rows() <= ZM_MAX_CFG_ID) {
+    Debug(1, "Database snapshot has no usable config");
+    return false;
+  }
+
+  if (items) {
+    for ( int i = 0; i < n_items; i++ ) {
+      delete items[i];
+    }
+    delete[] items;
+  }
+  n_items = table->Rows();
+  items = new ConfigItem *[n_items];
+  for ( int i = 0; i < n_items; i++ ) {
+    MYSQL_ROW row = table->Row(i);
+    items[i] = new ConfigItem(row[0], row[1] ? row[1] : "", row[2]);
+  }
+  return true;
+}
+
 void Config::Assign() {
   ZM_CFG_ASSIGN_LIST
 }
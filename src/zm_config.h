@@ -42,6 +42,8 @@
 
 void zmLoadStaticConfig();
 void zmLoadDBConfig();
+// Loads the db config from the database snapshot, false if there isn't a usable one
+bool zmLoadSnapshotConfig();
 
 extern void process_configfile(char const *configFile);
 
@@ -74,6 +76,8 @@ struct StaticConfig {
 
 extern StaticConfig staticConfig;
 
+class DbSnapshot;
+
 class ConfigItem {
  private:
   char *name;
@@ -131,10 +135,13 @@ class Config {
   ~Config();
 
   void Load();
+  bool Load(const DbSnapshot &snapshot);
   void Assign();
   const ConfigItem &Item( int id );
 };
 
 extern Config config;
 
+extern std::string load_config_sql;
+
 #endif // ZM_CONFIG_H
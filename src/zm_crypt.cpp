@@ -183,3 +183,42 @@ std::string generateKey(const int length) {
 
 
 }
+
+namespace zm {
+namespace crypto {
+
+SHA1::Digest HmacSHA1(const std::string &key, const std::string &message) {
+  constexpr size_t block_size = 64;
+  std::array<uint8, block_size> key_block = {};
+  if (key.size() > block_size) {
+    SHA1::Digest key_digest = SHA1::GetDigestOf(key);
+    std::copy(key_digest.begin(), key_digest.end(), key_block.begin());
+  } else {
+    std::copy(key.begin(), key.end(), key_block.begin());
+  }
+
+  std::array<uint8, block_size> pad;
+  for (size_t i = 0; i < block_size; i++) pad[i] = key_block[i] ^ 0x36;
+  SHA1 inner;
+  inner.UpdateData(pad);
+  inner.UpdateData(message);
+  inner.Finalize();
+
+  for (size_t i = 0; i < block_size; i++) pad[i] = key_block[i] ^ 0x5c;
+  SHA1 outer;
+  outer.UpdateData(pad);
+  outer.UpdateData(inner.GetDigest());
+  outer.Finalize();
+  return outer.GetDigest();
+}
+
+bool ConstantTimeEquals(const std::string &a, const std::string &b) {
+  if (a.size() != b.size()) return false;
+  unsigned char diff = 0;
+  for (size_t i = 0; i < a.size(); i++)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+}
+}
@@ -51,6 +51,11 @@ namespace zm {
 namespace crypto {
 using MD5 = impl::Hash<impl::HashAlgorithms::kMD5>;
 using SHA1 = impl::Hash<impl::HashAlgorithms::kSHA1>;
+
+// RFC 2104 HMAC of message keyed with key
+SHA1::Digest HmacSHA1(const std::string &key, const std::string &message);
+// Compares without stopping at the first difference, for secrets
+bool ConstantTimeEquals(const std::string &a, const std::string &b);
 }
 }
 
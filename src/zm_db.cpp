@@ -375,8 +375,18 @@ std::string zmDbEscapeString(const std::string& to_escape) {
   // due to unicode conversions + null terminator.
   std::string escaped((to_escape.length() * 2) + 1, '\0');
 
-
-  size_t escaped_len = mysql_real_escape_string(&dbconn, &escaped[0], to_escape.c_str(), to_escape.length());
+  // Processes started from the database snapshot may not have connected yet,
+  // and escaping with an uninitialised handle is undefined.
+  if (!zmDbConnected) {
+    std::lock_guard<std::mutex> lck(db_mutex);
+    zmDbConnect();
+  }
+  size_t escaped_len;
+  if (zmDbConnected) {
+    escaped_len = mysql_real_escape_string(&dbconn, &escaped[0], to_escape.c_str(), to_escape.length());
+  } else {
+    escaped_len = mysql_escape_string(&escaped[0], to_escape.c_str(), to_escape.length());
+  }
   escaped.resize(escaped_len);
 
   return escaped;
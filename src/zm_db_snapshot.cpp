@@ -0,0 +1,331 @@
+//
+// ZoneMinder Database Snapshot Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_db_snapshot.h"
+
+#include "zm_config.h"
+#include "zm_logger.h"
+#include "zm_monitor.h"
+#include "zm_storage.h"
+#include "zm_utils.h"
+#include "zm_zone.h"
+#include <cinttypes>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'Z', 'M', 'D', 'B', 'S', 'N', 'A', 'P'};
+const uint32_t kNullLength = 0xffffffff;
+
+// Layout of the start of the file.  Everything is host byte order, the
+// snapshot never leaves the machine that wrote it.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t schema;
+  int64_t created;
+  uint64_t size;
+  uint32_t table_count;
+  uint32_t reserved;
+};
+
+void AppendU32(std::string &data, uint32_t value) {
+  data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Bounds checked reads from the mapping
+class Reader {
+ public:
+  Reader(char *data, size_t size) : data_(data), size_(size), offset_(0) {}
+
+  bool U32(uint32_t &value) {
+    if (size_ - offset_ < sizeof(value)) return false;
+    memcpy(&value, data_ + offset_, sizeof(value));
+    offset_ += sizeof(value);
+    return true;
+  }
+  // A string of length bytes followed by its NUL
+  char *String(uint32_t length) {
+    if (size_ - offset_ <= length or data_[offset_ + length] != '\0') return nullptr;
+    char *value = data_ + offset_;
+    offset_ += length + 1;
+    return value;
+  }
+  void Seek(size_t offset) { offset_ = offset; }
+  bool AtEnd() const { return offset_ == size_; }
+
+ private:
+  char *data_;
+  size_t size_;
+  size_t offset_;
+};
+
+uint32_t Fnv1a(uint32_t hash, const std::string &value) {
+  for (unsigned char c : value) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+}  // namespace
+
+DbSnapshot dbSnapshot;
+
+void DbSnapshot::Builder::AddTable(const std::string &name, unsigned int fields) {
+  AppendU32(data_, name.size());
+  data_.append(name.c_str(), name.size() + 1);
+  AppendU32(data_, fields);
+  rows_offset_ = data_.size();
+  AppendU32(data_, 0);
+  fields_ = fields;
+  table_count_++;
+}
+
+void DbSnapshot::Builder::AddRow(const MYSQL_ROW row) {
+  for (unsigned int i = 0; i < fields_; i++) {
+    if (!row[i]) {
+      AppendU32(data_, kNullLength);
+      continue;
+    }
+    const size_t length = strlen(row[i]);
+    AppendU32(data_, length);
+    data_.append(row[i], length + 1);
+  }
+
+  uint32_t rows;
+  memcpy(&rows, &data_[rows_offset_], sizeof(rows));
+  rows++;
+  memcpy(&data_[rows_offset_], &rows, sizeof(rows));
+}
+
+bool DbSnapshot::Builder::AddQuery(const std::string &name, const std::string &sql) {
+  MYSQL_RES *result = zmDbFetch(sql);
+  if (!result) return false;
+
+  AddTable(name, mysql_num_fields(result));
+  while (MYSQL_ROW dbrow = mysql_fetch_row(result))
+    AddRow(dbrow);
+  mysql_free_result(result);
+  return true;
+}
+
+bool DbSnapshot::Builder::Save(const std::string &path, uint32_t schema, SystemTimePoint created) const {
+  SnapshotHeader header = {};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.schema = schema;
+  header.created = std::chrono::duration_cast<Seconds>(created.time_since_epoch()).count();
+  header.size = sizeof(header) + data_.size();
+  header.table_count = table_count_;
+
+  // zms runs as the web user, so keep it out of reach of everyone else
+  std::string tmp_path = stringtf("%s.%d", path.c_str(), getpid());
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    Error("Can't open %s: %s", tmp_path.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header))
+            and write(fd, data_.data(), data_.size()) == static_cast<ssize_t>(data_.size());
+  if (!ok)
+    Error("Can't write %s: %s", tmp_path.c_str(), strerror(errno));
+  close(fd);
+
+  if (ok and rename(tmp_path.c_str(), path.c_str()) != 0) {
+    Error("Can't rename %s to %s: %s", tmp_path.c_str(), path.c_str(), strerror(errno));
+    ok = false;
+  }
+  if (!ok) unlink(tmp_path.c_str());
+  return ok;
+}
+
+DbSnapshot::DbSnapshot() : map_(nullptr), map_size_(0) {}
+
+DbSnapshot::~DbSnapshot() {
+  Close();
+}
+
+bool DbSnapshot::Open(const std::string &path, uint32_t schema, Seconds max_age) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Debug(1, "No database snapshot at %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) < 0 or static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+    Debug(1, "Database snapshot %s is too short", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  // Private so the rows can be handed out as the non-const MYSQL_ROW
+  map_size_ = st.st_size;
+  map_ = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    Error("Can't map %s: %s", path.c_str(), strerror(errno));
+    map_ = nullptr;
+    return false;
+  }
+
+  SnapshotHeader header;
+  memcpy(&header, map_, sizeof(header));
+  const Seconds age = std::chrono::duration_cast<Seconds>(
+                        std::chrono::system_clock::now().time_since_epoch()) - Seconds(header.created);
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+      or header.format_version != kFormatVersion
+      or header.schema != schema
+      or header.size != map_size_) {
+    Debug(1, "Database snapshot %s doesn't match this version", path.c_str());
+  } else if (age < Seconds(0) or age > max_age) {
+    Debug(1, "Database snapshot %s is %" PRIi64 "s old", path.c_str(), static_cast<int64_t>(age.count()));
+  } else if (!Parse()) {
+    Warning("Database snapshot %s is damaged, ignoring it", path.c_str());
+  } else {
+    Debug(1, "Using database snapshot %s, %" PRIi64 "s old", path.c_str(), static_cast<int64_t>(age.count()));
+    return true;
+  }
+  Close();
+  return false;
+}
+
+bool DbSnapshot::Parse() {
+  SnapshotHeader header;
+  memcpy(&header, map_, sizeof(header));
+
+  Reader reader(static_cast<char *>(map_), map_size_);
+  reader.Seek(sizeof(header));
+  for (uint32_t t = 0; t < header.table_count; t++) {
+    uint32_t name_length, fields, rows;
+    if (!reader.U32(name_length)) return false;
+    const char *name = reader.String(name_length);
+    if (!name or !reader.U32(fields) or !reader.U32(rows)) return false;
+    // Every field takes at least its length
+    if (fields and rows > map_size_ / (fields * sizeof(uint32_t))) return false;
+
+    const size_t count = static_cast<size_t>(fields) * rows;
+    std::vector<char *> cells;
+    cells.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      uint32_t length;
+      if (!reader.U32(length)) return false;
+      if (length == kNullLength) {
+        cells.push_back(nullptr);
+      } else if (char *value = reader.String(length)) {
+        cells.push_back(value);
+      } else {
+        return false;
+      }
+    }
+    tables_[name] = Table(fields, std::move(cells));
+  }
+  return reader.AtEnd();
+}
+
+void DbSnapshot::Close() {
+  tables_.clear();
+  if (map_) {
+    munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+  }
+}
+
+const DbSnapshot::Table *DbSnapshot::Find(const std::string &name) const {
+  auto it = tables_.find(name);
+  return it == tables_.end() ? nullptr : &it->second;
+}
+
+MYSQL_ROW DbSnapshot::FindRow(const std::string &name, unsigned int column, unsigned int value) const {
+  const Table *table = Find(name);
+  if (!table or column >= table->Fields()) return nullptr;
+
+  const std::string key = std::to_string(value);
+  for (size_t i = 0; i < table->Rows(); i++) {
+    MYSQL_ROW row = table->Row(i);
+    if (row[column] and key == row[column]) return row;
+  }
+  return nullptr;
+}
+
+std::vector<MYSQL_ROW> DbSnapshot::FindRows(const std::string &name, unsigned int column, unsigned int value) const {
+  std::vector<MYSQL_ROW> rows;
+  const Table *table = Find(name);
+  if (!table or column >= table->Fields()) return rows;
+
+  const std::string key = std::to_string(value);
+  for (size_t i = 0; i < table->Rows(); i++) {
+    MYSQL_ROW row = table->Row(i);
+    if (row[column] and key == row[column]) rows.push_back(row);
+  }
+  return rows;
+}
+
+std::string DbSnapshot::Path() {
+  return staticConfig.PATH_MAP + "/zm.dbsnapshot";
+}
+
+uint32_t DbSnapshot::SchemaHash() {
+  uint32_t hash = 2166136261u;
+  hash = Fnv1a(hash, ZM_VERSION);
+  hash = Fnv1a(hash, load_config_sql);
+  hash = Fnv1a(hash, load_monitor_sql);
+  hash = Fnv1a(hash, load_zone_sql);
+  hash = Fnv1a(hash, load_storage_sql);
+  return hash;
+}
+
+bool DbSnapshot::Refresh() {
+  if (!config.db_snapshot) return false;
+
+  Builder builder;
+  if (!builder.AddQuery("Config", load_config_sql)
+      or !builder.AddQuery("Monitors", load_monitor_sql)
+      or !builder.AddQuery("Zones", load_zone_sql + " ORDER BY `MonitorId`, `Type`, `Id`")
+      or !builder.AddQuery("Storage", load_storage_sql)) {
+    return false;
+  }
+  return builder.Save(Path(), SchemaHash(), std::chrono::system_clock::now());
+}
+
+bool DbSnapshot::RefreshIfStale(Seconds max_age) {
+  if (!config.db_snapshot) return false;
+
+  // Held until closed.  Without it we just risk querying more than once.
+  const std::string lock_path = Path() + ".lock";
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (lock_fd < 0) {
+    Debug(1, "Can't open %s: %s", lock_path.c_str(), strerror(errno));
+  } else if (flock(lock_fd, LOCK_EX) != 0) {
+    Debug(1, "Can't lock %s: %s", lock_path.c_str(), strerror(errno));
+  }
+
+  DbSnapshot current;
+  bool ok = current.Open(Path(), SchemaHash(), max_age) or Refresh();
+  if (lock_fd >= 0) close(lock_fd);
+  return ok;
+}
@@ -0,0 +1,112 @@
+//
+// ZoneMinder Database Snapshot Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_DB_SNAPSHOT_H
+#define ZM_DB_SNAPSHOT_H
+
+#include "zm_db.h"
+#include "zm_time.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// A read only copy of the rows that zms and zmu need at startup (Config,
+// Monitors, Zones and Storage), kept in a file under ZM_PATH_MAP so that a
+// burst of stream requests doesn't turn into a burst of identical queries.
+// The file is memory mapped and its rows handed out as MYSQL_ROWs, so the
+// usual Load(MYSQL_ROW) code parses them.  It is rejected, and the caller
+// falls back to the database, if it was written by a different version or
+// with different queries, is older than kMaxAge, or is damaged.
+class DbSnapshot {
+ public:
+  static constexpr uint32_t kFormatVersion = 1;
+  static constexpr Seconds kMaxAge = Seconds(60);
+  // zmc rewrites the snapshot once it is older than this, checking every
+  // kRefreshInterval, so that zms and zmu normally find a current one
+  static constexpr Seconds kRefreshAge = Seconds(30);
+  static constexpr Seconds kRefreshInterval = Seconds(10);
+
+  class Table {
+   public:
+    Table() : fields_(0) {}
+    Table(unsigned int fields, std::vector<char *> &&cells) : fields_(fields), cells_(std::move(cells)) {}
+
+    unsigned int Fields() const { return fields_; }
+    size_t Rows() const { return fields_ ? cells_.size() / fields_ : 0; }
+    MYSQL_ROW Row(size_t row) const { return const_cast<MYSQL_ROW>(&cells_[row * fields_]); }
+
+   private:
+    unsigned int fields_;
+    std::vector<char *> cells_;
+  };
+
+  // Accumulates tables in memory and writes them out as a snapshot file
+  class Builder {
+   public:
+    void AddTable(const std::string &name, unsigned int fields);
+    // Adds a row to the last table added
+    void AddRow(const MYSQL_ROW row);
+    // Adds every row of a query as a table, false if the query failed
+    bool AddQuery(const std::string &name, const std::string &sql);
+    // Written to a temporary file and renamed into place, so readers only
+    // ever see a complete snapshot
+    bool Save(const std::string &path, uint32_t schema, SystemTimePoint created) const;
+
+   private:
+    std::string data_;
+    unsigned int table_count_ = 0;
+    unsigned int fields_ = 0;
+    size_t rows_offset_ = 0;
+  };
+
+  DbSnapshot();
+  ~DbSnapshot();
+
+  bool Open(const std::string &path, uint32_t schema, Seconds max_age = kMaxAge);
+  void Close();
+  bool IsOpen() const { return map_ != nullptr; }
+
+  const Table *Find(const std::string &name) const;
+  // The first row of a table whose column matches value, nullptr if none
+  MYSQL_ROW FindRow(const std::string &name, unsigned int column, unsigned int value) const;
+  // All rows of a table whose column matches value, in snapshot order
+  std::vector<MYSQL_ROW> FindRows(const std::string &name, unsigned int column, unsigned int value) const;
+
+  static std::string Path();
+  // Identifies the queries the snapshot tables were loaded with
+  static uint32_t SchemaHash();
+  // Queries the database and replaces the snapshot, if ZM_DB_SNAPSHOT is on
+  static bool Refresh();
+  // Refreshes only if there isn't a snapshot younger than max_age.  The
+  // check and the refresh happen under a lock, so that of the processes
+  // finding it stale together only one queries the database and the rest
+  // see what it wrote.
+  static bool RefreshIfStale(Seconds max_age = kMaxAge);
+
+ private:
+  bool Parse();
+
+  void *map_;
+  size_t map_size_;
+  std::map<std::string, Table> tables_;
+};
+
+extern DbSnapshot dbSnapshot;
+
+#endif // ZM_DB_SNAPSHOT_H
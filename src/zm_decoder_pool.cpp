@@ -0,0 +1,140 @@
+//
+// ZoneMinder Decoder Pool Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_decoder_pool.h"
+
+#include "zm_logger.h"
+#include "zm_monitor.h"
+#include "zm_signal.h"
+
+#include <algorithm>
+
+DecoderPool &DecoderPool::Get() {
+  static DecoderPool pool;
+  return pool;
+}
+
+DecoderPool::DecoderPool() : terminate_(false) {
+  unsigned int count = std::max(1u, std::thread::hardware_concurrency());
+  Debug(1, "Starting %u decoder pool threads", count);
+  workers_.reserve(count);
+  for (unsigned int i = 0; i < count; i++)
+    workers_.emplace_back(&DecoderPool::Run, this);
+}
+
+DecoderPool::~DecoderPool() {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    terminate_ = true;
+  }
+  cond_.notify_all();
+  for (std::thread &worker : workers_) {
+    if (worker.joinable()) worker.join();
+  }
+}
+
+void DecoderPool::Add(Monitor *monitor) {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    entries_.push_back({monitor, std::chrono::steady_clock::now(), false, false, false});
+  }
+  Debug(2, "Added monitor %d to decoder pool", monitor->Id());
+  cond_.notify_one();
+}
+
+void DecoderPool::Remove(Monitor *monitor) {
+  std::unique_lock<std::mutex> lck(mutex_);
+  auto it = std::find_if(entries_.begin(), entries_.end(),
+      [monitor](const Entry &e) { return e.monitor == monitor; });
+  if (it == entries_.end()) return;
+
+  it->removed = true;
+  idle_cond_.wait(lck, [it] { return !it->busy; });
+  entries_.erase(it);
+  Debug(2, "Removed monitor %d from decoder pool", monitor->Id());
+}
+
+void DecoderPool::Wake(Monitor *monitor) {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+        [monitor](const Entry &e) { return e.monitor == monitor; });
+    if (it == entries_.end()) return;
+    if (it->busy) {
+      it->woken = true;
+      return;
+    }
+    TimePoint now = std::chrono::steady_clock::now();
+    if (it->ready_at <= now) return;  // Already due, a worker will get to it
+    it->ready_at = now;
+  }
+  cond_.notify_one();
+}
+
+void DecoderPool::Run() {
+  std::unique_lock<std::mutex> lck(mutex_);
+
+  while (!(terminate_ or zm_terminate)) {
+    // Pick the idle monitor that has been due the longest
+    TimePoint now = std::chrono::steady_clock::now();
+    TimePoint next = now + Microseconds(ZM_SUSPENDED_RATE);
+    auto entry = entries_.end();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->busy or it->removed) continue;
+      if (it->ready_at <= now) {
+        if (entry == entries_.end() or it->ready_at < entry->ready_at) entry = it;
+      } else if (it->ready_at < next) {
+        next = it->ready_at;
+      }
+    }
+    if (entry == entries_.end()) {
+      cond_.wait_until(lck, next);
+      continue;
+    }
+
+    entry->busy = true;
+    entry->woken = false;
+    Monitor *monitor = entry->monitor;
+    lck.unlock();
+
+    bool progress = false;
+    for (int i = 0; i < max_burst_ and !(zm_terminate); i++) {
+      if (!monitor->Decode(false)) {
+        progress = false;
+        break;
+      }
+      progress = true;
+    }
+
+    lck.lock();
+    entry->busy = false;
+    if (entry->removed) {
+      idle_cond_.notify_all();
+      continue;
+    }
+    if (progress or entry->woken) {
+      // Go to the back of the line behind monitors that are already due
+      entry->ready_at = std::chrono::steady_clock::now();
+    } else {
+      // Nothing to decode, come back later unless Wake() gets there first
+      entry->ready_at = std::chrono::steady_clock::now() +
+        (monitor->Active() ? Microseconds(ZM_SAMPLE_RATE) : Microseconds(ZM_SUSPENDED_RATE));
+    }
+  }
+}
@@ -0,0 +1,73 @@
+//
+// ZoneMinder Decoder Pool Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_DECODER_POOL_H
+#define ZM_DECODER_POOL_H
+
+#include "zm_time.h"
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Monitor;
+
+// Runs Monitor::Decode() for all the monitors of a process on a fixed set of
+// worker threads, one per core, instead of a thread per monitor. A monitor is
+// only ever handed to one worker at a time, so its packets are still decoded
+// in order.
+class DecoderPool {
+ public:
+  static DecoderPool &Get();
+  ~DecoderPool();
+  DecoderPool(const DecoderPool &) = delete;
+  DecoderPool &operator=(const DecoderPool &) = delete;
+
+  void Add(Monitor *monitor);
+  // Returns once no worker is decoding for the monitor any more
+  void Remove(Monitor *monitor);
+  // New packets have been queued, schedule the monitor now
+  void Wake(Monitor *monitor);
+
+ private:
+  DecoderPool();
+  void Run();
+
+  struct Entry {
+    Monitor *monitor;
+    TimePoint ready_at;
+    bool busy;
+    bool woken;  // Wake() was called while busy
+    bool removed;
+  };
+
+  // How many packets a worker decodes for one monitor before moving on
+  static constexpr int max_burst_ = 8;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable idle_cond_;
+  std::list<Entry> entries_;
+  std::vector<std::thread> workers_;
+  bool terminate_;
+};
+
+#endif
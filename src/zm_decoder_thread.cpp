@@ -1,23 +1,34 @@
 #include "zm_decoder_thread.h"
 
+#include "zm_decoder_pool.h"
 #include "zm_monitor.h"
 #include "zm_signal.h"
 
 DecoderThread::DecoderThread(Monitor *monitor) :
-  monitor_(monitor), terminate_(false) {
-  thread_ = std::thread(&DecoderThread::Run, this);
+  monitor_(monitor), terminate_(false), pooled_(config.decoder_pool), in_pool_(false) {
+  if (pooled_) {
+    DecoderPool::Get().Add(monitor_);
+    in_pool_ = true;
+  } else {
+    thread_ = std::thread(&DecoderThread::Run, this);
+  }
 }
 
 DecoderThread::~DecoderThread() {
   Stop();
-  if (thread_.joinable()) thread_.join();
+  Join();
 }
 
 void DecoderThread::Start() {
   Stop();  // Signal any running thread to terminate first
-  if (thread_.joinable()) thread_.join();
+  Join();
   terminate_ = false;
-  thread_ = std::thread(&DecoderThread::Run, this);
+  if (pooled_) {
+    DecoderPool::Get().Add(monitor_);
+    in_pool_ = true;
+  } else {
+    thread_ = std::thread(&DecoderThread::Run, this);
+  }
 }
 
 void DecoderThread::Stop() {
@@ -25,9 +36,19 @@ void DecoderThread::Stop() {
 }
 
 void DecoderThread::Join() {
+  if (in_pool_) {
+    DecoderPool::Get().Remove(monitor_);
+    in_pool_ = false;
+    // Run() does this for the unpooled case
+    monitor_->flushDecoderQueue();
+  }
   if (thread_.joinable()) thread_.join();
 }
 
+void DecoderThread::Wake() {
+  if (in_pool_) DecoderPool::Get().Wake(monitor_);
+}
+
 void DecoderThread::Run() {
   Debug(2, "DecoderThread::Run() for %d", monitor_->Id());
 
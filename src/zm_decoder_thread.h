@@ -7,6 +7,8 @@
 
 class Monitor;
 
+// Decodes for one monitor, either on its own thread or, with
+// ZM_DECODER_POOL, on the process-wide DecoderPool.
 class DecoderThread {
  public:
   explicit DecoderThread(Monitor *monitor);
@@ -17,6 +19,8 @@ class DecoderThread {
   void Start();
   void Stop();
   void Join();
+  // Called when packets have been queued
+  void Wake();
 
  private:
   void Run();
@@ -24,6 +28,8 @@ class DecoderThread {
   Monitor *monitor_;
   std::atomic<bool> terminate_;
   std::thread thread_;
+  const bool pooled_;
+  std::atomic<bool> in_pool_;
 };
 
 #endif
@@ -49,7 +49,8 @@ Event::Event(
   packetqueue_iterator *p_packetqueue_it,
   SystemTimePoint p_start_time,
   const std::string &p_cause,
-  const StringSetMap &p_noteSetMap
+  const StringSetMap &p_noteSetMap,
+  std::shared_ptr<SegmentHandoff> p_handoff
 ) :
   id(0),
   monitor(p_monitor),
@@ -76,7 +77,11 @@ Event::Event(
   have_video_keyframe(false),
   //scheme
   save_jpegs(0),
-  terminate_(false) {
+  terminate_(false),
+  handoff_in_(std::move(p_handoff)),
+  handoff_requested_(false),
+  video_closed_(false),
+  video_bytes_(0) {
   std::string notes;
   createNotes(notes);
 
@@ -189,8 +194,14 @@ Event::Event(
 }
 
 Event::~Event() {
-  Debug(1, "~Event %" PRIu64 ": calling Stop", id);
-  Stop();
+  // When handing off, Run() returns by itself once it has reached the boundary
+  // keyframe and given the VideoStore away. Don't wait forever on a stalled camera.
+  if (handoff_requested_ and handoff_out_->WaitGiven(MAX_SEGMENT_HANDOFF_WAIT)) {
+    Debug(1, "~Event %" PRIu64 ": handed off to the next event", id);
+  } else {
+    Debug(1, "~Event %" PRIu64 ": calling Stop", id);
+    Stop();
+  }
 
   if (thread_.joinable()) {
     Debug(1, "~Event %" PRIu64 ": joining Run thread", id);
@@ -208,15 +219,15 @@ Event::~Event() {
     // finalize() must run before writeM3U8 so the manifest contains every
     // fragment (including the one no later keyframe was around to close).
     videoStore->finalize();
-
-    std::string m3u8_path = path + "/index.m3u8";
-    std::string video_url_tmp = "index.php?view=view_video&eid=" + std::to_string(id)
-      + "&file=" + video_incomplete_file;
-    videoStore->writeM3U8(m3u8_path, video_url_tmp, true);
+    WriteFinalM3U8();
 
     Debug(1, "~Event %" PRIu64 ": deleting video store", id);
     delete videoStore;
     videoStore = nullptr;
+    video_closed_ = true;
+  }
+  if (video_closed_) {
+    std::string m3u8_path = path + "/index.m3u8";
     // Hard-link rather than rename so the file is reachable under BOTH the
     // incomplete.* and final <Id>-video.* names for the whole window in which
     // the DB still advertises the old DefaultVideo. The DefaultVideo=final
@@ -250,10 +261,16 @@ Event::~Event() {
             content.replace(pos, video_incomplete_file.size(), video_file);
           }
         }
-        fp = fopen(m3u8_path.c_str(), "w");
+        // Replace via rename so live readers never see a truncated manifest
+        std::string tmp_path = m3u8_path + ".tmp";
+        fp = fopen(tmp_path.c_str(), "w");
         if (fp) {
           fputs(content.c_str(), fp);
           fclose(fp);
+          if (rename(tmp_path.c_str(), m3u8_path.c_str()) != 0) {
+            Error("Failed renaming %s to %s: %s", tmp_path.c_str(), m3u8_path.c_str(), strerror(errno));
+            unlink(tmp_path.c_str());
+          }
         }
       }
     }
@@ -271,6 +288,7 @@ Event::~Event() {
         std::chrono::duration_cast<FPSeconds>(end_time.time_since_epoch()).count());
 
   if (frame_data.size()) WriteDbFrames();
+  frame_table.Close();
 
   uint64_t video_size = 0;
   DIR *video_dir;
@@ -432,9 +450,12 @@ void Event::AddPacket_(const std::shared_ptr<ZMPacket>packet) {
   if (videoStore) {
     if (have_video_keyframe) {
       size_t frags_before = videoStore->fragments().size();
+      size_t parts_before = videoStore->parts().size();
       videoStore->writePacket(packet);
-      // Update m3u8 whenever a new fragment is completed (live HLS)
-      if (videoStore->fragments().size() > frags_before) {
+      video_bytes_ = videoStore->bytes_written();
+      // Update m3u8 whenever a new fragment or LL-HLS part is completed (live HLS)
+      if (videoStore->fragments().size() > frags_before
+          or videoStore->parts().size() > parts_before) {
         std::string m3u8_path = path + "/index.m3u8";
         std::string video_url = "index.php?view=view_video&eid=" + std::to_string(id)
           + "&file=" + video_incomplete_file;
@@ -636,8 +657,10 @@ void Event::AddFrame(const std::shared_ptr<ZMPacket>&packet) {
     max_score_frame_id = frames;
   }
 
+  Microseconds delta_time = std::chrono::duration_cast<Microseconds>(packet->timestamp - start_time);
+  frame_table.Append(delta_time, frame_type, score, db_frame);
+
   if (db_frame) {
-    Microseconds delta_time = std::chrono::duration_cast<Microseconds>(packet->timestamp - start_time);
     Debug(1, "Frame delta is %.2f s - %.2f s = %.2f s, score %u zone_stats.size %zu",
           FPSeconds(packet->timestamp.time_since_epoch()).count(),
           FPSeconds(start_time.time_since_epoch()).count(),
@@ -658,6 +681,8 @@ void Event::AddFrame(const std::shared_ptr<ZMPacket>&packet) {
       Debug(1, "Adding %zu frames to DB because write_to_db:%d or frames > analysis fps %f or BULK(%d)",
             frame_data.size(), write_to_db, fps, (frame_type == BULK));
       WriteDbFrames();
+      // Keep the frame table as far along as the Frames table for live viewers
+      frame_table.Flush();
       last_db_frame = frames;
 
       std::string sql = stringtf(
@@ -810,24 +835,47 @@ void Event::Run() {
 
   snapshot_file = path + "/snapshot.jpg";
   alarm_file = path + "/alarm.jpg";
+  // Without it playback reads the Frames table instead
+  frame_table.Open(path + "/" + EventFrameTable::kFileName);
 
   video_incomplete_path = path + "/" + video_incomplete_file;
 
+  // Set when we continue the previous event's muxer, in which case packets
+  // before the handoff keyframe were already written by that event.
+  bool wait_for_boundary = false;
   if (monitor->GetOptVideoWriter() != 0) {
-    /* Save as video */
-    videoStore = new VideoStore(
-      video_incomplete_path.c_str(),
-      container.c_str(),
-      monitor->GetVideoStream(),
-      monitor->GetVideoCodecContext(),
-      ( monitor->RecordAudio() ? monitor->GetAudioStream() : nullptr ),
-      ( monitor->RecordAudio() ? monitor->GetAudioCodecContext() : nullptr ),
-      monitor );
-
-    if (!videoStore->open()) {
+    if (handoff_in_) {
+      videoStore = handoff_in_->Take(terminate_);
+      if (videoStore) {
+        if (videoStore->openSegment(video_incomplete_path)) {
+          wait_for_boundary = true;
+        } else {
+          Warning("Failed to continue previous event's videostore, opening a new one");
+          delete videoStore;
+          videoStore = nullptr;
+        }
+      }
+    }
+
+    if (!videoStore) {
+      /* Save as video */
+      videoStore = new VideoStore(
+        video_incomplete_path.c_str(),
+        container.c_str(),
+        monitor->GetVideoStream(),
+        monitor->GetVideoCodecContext(),
+        ( monitor->RecordAudio() ? monitor->GetAudioStream() : nullptr ),
+        ( monitor->RecordAudio() ? monitor->GetAudioCodecContext() : nullptr ),
+        monitor );
+
+      if (!videoStore->open()) {
+        delete videoStore;
+        videoStore = nullptr;
+      }
+    }
+
+    if (!videoStore) {
       Warning("Failed to open videostore, turning on jpegs");
-      delete videoStore;
-      videoStore = nullptr;
       if (!(save_jpegs & 1)) {
         save_jpegs |= 1; // Turn on jpeg storage
         zmDbDo(stringtf("UPDATE Events SET SaveJpegs=%d WHERE Id=%" PRIu64, save_jpegs, id));
@@ -878,6 +926,20 @@ void Event::Run() {
         continue;
       }
 
+      if (wait_for_boundary) {
+        if (!handoff_in_->IsBoundary(packet)) {
+          Debug(1, "Skipping packet %d, written by the previous event", packet->image_index);
+          packetqueue->increment_it(packetqueue_it, false);
+          continue;
+        }
+        wait_for_boundary = false;
+      }
+      if (handoff_requested_ and handoff_out_->IsBoundary(packet)) {
+        packet_lock.unlock();
+        HandOffVideoStore();
+        break;
+      }
+
       Debug(1, "Adding packet %d", packet->image_index);
       this->AddPacket_(packet);
 
@@ -899,13 +961,68 @@ void Event::Run() {
       // while we were in AddPacket_ without the queue lock.
       packetqueue->increment_it(packetqueue_it, false);
     } else {
-      if (terminate_ or zm_terminate) return;
+      if (terminate_ or zm_terminate) break;
       packetqueue->wait_for(Microseconds(10000));
     }
   }  // end while
+  // Never leave the next event waiting on a handoff we didn't get to make.
+  if (handoff_requested_) handoff_out_->Give(nullptr);
   Debug(1, "Event::Run %" PRIu64 ": exiting, terminate_=%d zm_terminate=%d", id, terminate_.load(), zm_terminate.load());
 }  // end Run()
 
+void Event::WriteFinalM3U8() {
+  std::string m3u8_path = path + "/index.m3u8";
+  std::string video_url_tmp = "index.php?view=view_video&eid=" + std::to_string(id)
+    + "&file=" + video_incomplete_file;
+  videoStore->writeM3U8(m3u8_path, video_url_tmp, true);
+}
+
+void Event::HandOffVideoStore() {
+  if (videoStore and videoStore->closeSegment()) {
+    Debug(1, "Event %" PRIu64 ": handing video store over to the next event", id);
+    WriteFinalM3U8();
+    handoff_out_->Give(videoStore);
+    videoStore = nullptr;
+    video_closed_ = true;
+  } else {
+    // ~Event will finalize the store the usual way
+    handoff_out_->Give(nullptr);
+  }
+}
+
+Event::SegmentHandoff::~SegmentHandoff() {
+  // Nobody took it, so the muxer still needs tearing down.
+  delete video_store_;
+}
+
+bool Event::SegmentHandoff::IsBoundary(const std::shared_ptr<ZMPacket> &packet) const {
+  return (packet->codec_type == AVMEDIA_TYPE_VIDEO) and packet->keyframe
+    and (packet->timestamp >= boundary);
+}
+
+void Event::SegmentHandoff::Give(VideoStore *video_store) {
+  std::lock_guard<std::mutex> lck(mutex_);
+  if (given_) return;
+  video_store_ = video_store;
+  given_ = true;
+  cond_.notify_all();
+}
+
+bool Event::SegmentHandoff::WaitGiven(Seconds timeout) {
+  std::unique_lock<std::mutex> lck(mutex_);
+  return cond_.wait_for(lck, timeout, [this] { return given_ or zm_terminate; }) and given_;
+}
+
+VideoStore *Event::SegmentHandoff::Take(const std::atomic<bool> &terminate) {
+  std::unique_lock<std::mutex> lck(mutex_);
+  while (!given_ and !terminate and !zm_terminate) {
+    cond_.wait_for(lck, Milliseconds(100));
+  }
+  VideoStore *video_store = video_store_;
+  video_store_ = nullptr;
+  return video_store;
+}
+
 int Event::MonitorId() const {
   return monitor->Id();
 }
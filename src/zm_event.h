@@ -22,6 +22,7 @@
 
 #include "zm_config.h"
 #include "zm_define.h"
+#include "zm_event_frame_table.h"
 #include "zm_packet.h"
 #include "zm_packetqueue.h"
 #include "zm_storage.h"
@@ -50,6 +51,8 @@ class Zone;
 
 // Maximum number of prealarm frames that can be stored
 #define MAX_PRE_ALARM_FRAMES  16
+// How long a closing event waits to reach the keyframe it hands off at
+#define MAX_SEGMENT_HANDOFF_WAIT Seconds(30)
 
 typedef uint64_t event_id_t;
 
@@ -63,6 +66,33 @@ class Event {
   typedef std::set<std::string> StringSet;
   typedef std::map<std::string, StringSet> StringSetMap;
 
+  // Passes a still-open VideoStore from a closing continuous event to the one
+  // that replaces it, so that section rollover neither re-opens the muxer nor
+  // leaves a gap. The closing event keeps writing up to the first video
+  // keyframe at or after boundary, closes its file there and gives the store
+  // away. The opening event skips packets up to that same keyframe.
+  class SegmentHandoff {
+   public:
+    explicit SegmentHandoff(SystemTimePoint p_boundary) :
+      boundary(p_boundary), video_store_(nullptr), given_(false) {}
+    ~SegmentHandoff();
+
+    bool IsBoundary(const std::shared_ptr<ZMPacket> &packet) const;
+    // Called by the closing event. nullptr if it never reached the boundary.
+    void Give(VideoStore *video_store);
+    bool WaitGiven(Seconds timeout);
+    // Called by the opening event, waits until Give has been called.
+    VideoStore *Take(const std::atomic<bool> &terminate);
+
+    const SystemTimePoint boundary;
+
+   private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    VideoStore *video_store_;
+    bool given_;
+  };
+
  protected:
   static const char * frame_type_names[3];
 
@@ -106,6 +136,7 @@ class Event {
   std::string video_incomplete_path;
 
   int        last_db_frame;
+  EventFrameTable::Writer frame_table;  // Every frame, for playback
   bool have_video_keyframe; // a flag to tell us if we have had a video keyframe when writing an mp4.  The first frame SHOULD be a video keyframe.
   Storage::Schemes  scheme;
   int save_jpegs;
@@ -117,6 +148,15 @@ class Event {
   std::atomic<bool> terminate_;
   std::thread thread_;
 
+  std::shared_ptr<SegmentHandoff> handoff_in_;   // from the previous event
+  std::shared_ptr<SegmentHandoff> handoff_out_;  // to the next event
+  std::atomic<bool> handoff_requested_;
+  bool video_closed_;  // video file has been completed, by finalize() or by handoff
+  std::atomic<int64_t> video_bytes_;
+
+  void HandOffVideoStore();
+  void WriteFinalM3U8();
+
   std::map<const std::string,Tag> tags;
  public:
   static bool OpenFrameSocket(int);
@@ -126,7 +166,8 @@ class Event {
       packetqueue_iterator * p_packetqueue_it,
       SystemTimePoint p_start_time,
       const std::string &p_cause,
-      const StringSetMap &p_noteSetMap);
+      const StringSetMap &p_noteSetMap,
+      std::shared_ptr<SegmentHandoff> p_handoff = nullptr);
   ~Event();
 
   uint64_t Id() const { return id; }
@@ -153,6 +194,17 @@ class Event {
     packetqueue->notify_all();
   }
   bool Stopped() const { return terminate_; }
+  // Keep the VideoStore open for the next event instead of finalizing it.
+  // Must be called before the event is deleted.
+  void HandOff(std::shared_ptr<SegmentHandoff> handoff) {
+    handoff_out_ = std::move(handoff);
+    handoff_requested_ = true;
+  }
+  int64_t VideoBytes() const { return video_bytes_; }
+  // Wait for a requested handoff to happen, see HandOff()
+  void WaitHandOff() {
+    if (handoff_requested_) handoff_out_->WaitGiven(MAX_SEGMENT_HANDOFF_WAIT);
+  }
 
  private:
   void WriteDbFrames();
@@ -0,0 +1,491 @@
+//
+// ZoneMinder Event Export Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_event_export.h"
+
+#include "zm_db.h"
+#include "zm_logger.h"
+#include "zm_signal.h"
+#include "zm_storage.h"
+#include "zm_utils.h"
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Starts reading the next video into the page cache while this one is copied
+void ReadAhead(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+AVCodecParameters *CopyParameters(const AVCodecParameters *par) {
+  AVCodecParameters *copy = avcodec_parameters_alloc();
+  if (copy and avcodec_parameters_copy(copy, par) < 0)
+    avcodec_parameters_free(&copy);
+  return copy;
+}
+
+}  // namespace
+
+EventExporter::Item::Item(Item &&other) noexcept :
+  type(other.type),
+  segment(other.segment),
+  video_par(other.video_par),
+  audio_par(other.audio_par),
+  video_time_base(other.video_time_base),
+  audio_time_base(other.audio_time_base),
+  packet(std::move(other.packet)),
+  audio(other.audio) {
+  other.video_par = nullptr;
+  other.audio_par = nullptr;
+}
+
+EventExporter::Item &EventExporter::Item::operator=(Item &&other) noexcept {
+  if (this != &other) {
+    avcodec_parameters_free(&video_par);
+    avcodec_parameters_free(&audio_par);
+    type = other.type;
+    segment = other.segment;
+    video_par = other.video_par;
+    audio_par = other.audio_par;
+    video_time_base = other.video_time_base;
+    audio_time_base = other.audio_time_base;
+    packet = std::move(other.packet);
+    audio = other.audio;
+    other.video_par = nullptr;
+    other.audio_par = nullptr;
+  }
+  return *this;
+}
+
+EventExporter::Item::~Item() {
+  avcodec_parameters_free(&video_par);
+  avcodec_parameters_free(&audio_par);
+}
+
+EventExporter::EventExporter() :
+  queued_bytes_(0),
+  cancelled_(false),
+  output_(nullptr),
+  video_out_(nullptr),
+  audio_out_(nullptr),
+  video_in_time_base_{0, 1},
+  audio_in_time_base_{0, 1},
+  segment_usable_(false),
+  segment_audio_(false),
+  have_segment_origin_(false),
+  last_video_dts_(AV_NOPTS_VALUE),
+  last_audio_dts_(AV_NOPTS_VALUE) {
+}
+
+EventExporter::~EventExporter() {
+  if (output_) {
+    avio_closep(&output_->pb);
+    avformat_free_context(output_);
+  }
+}
+
+bool EventExporter::ParseTime(const std::string &text, SystemTimePoint &time) {
+  if (text.empty()) return false;
+
+  if (text.find_first_not_of("0123456789") == std::string::npos) {
+    time = SystemTimePoint(Seconds(strtoll(text.c_str(), nullptr, 10)));
+    return true;
+  }
+
+  std::string formatted = text;
+  if (formatted.size() > 10 and formatted[10] == 'T') formatted[10] = ' ';
+  tm tm_time = {};
+  const char *end = strptime(formatted.c_str(), "%Y-%m-%d %H:%M:%S", &tm_time);
+  if (!end or *end != '\0') return false;
+  tm_time.tm_isdst = -1;
+  time_t seconds = mktime(&tm_time);
+  if (seconds == -1) return false;
+  time = std::chrono::system_clock::from_time_t(seconds);
+  return true;
+}
+
+std::vector<EventExporter::Segment> EventExporter::FindSegments(unsigned int monitor_id,
+                                                                SystemTimePoint from,
+                                                                SystemTimePoint to) {
+  std::vector<Segment> segments;
+
+  std::string sql = stringtf("SELECT `Id`, `StorageId`, unix_timestamp(`StartDateTime`), `DefaultVideo`, `Scheme` "
+                             "FROM `Events` WHERE `MonitorId` = %u AND `DefaultVideo` != '' "
+                             "AND `StartDateTime` < from_unixtime(%" PRIi64 ") "
+                             "AND (`EndDateTime` IS NULL OR `EndDateTime` > from_unixtime(%" PRIi64 ")) "
+                             "ORDER BY `StartDateTime`, `Id`",
+                             monitor_id,
+                             static_cast<int64>(std::chrono::system_clock::to_time_t(to)),
+                             static_cast<int64>(std::chrono::system_clock::to_time_t(from)));
+  MYSQL_RES *result = zmDbFetch(sql);
+  if (!result) {
+    Error("Unable to look up events for monitor %u", monitor_id);
+    return segments;
+  }
+
+  std::map<unsigned int, std::unique_ptr<Storage>> storage_areas;
+  // Events that zma re-analysed hard link the original's video, so the same
+  // footage can turn up under more than one event.
+  std::set<std::pair<dev_t, ino_t>> videos;
+  while (MYSQL_ROW dbrow = mysql_fetch_row(result)) {
+    Segment segment;
+    segment.event_id = strtoull(dbrow[0], nullptr, 10);
+    unsigned int storage_id = dbrow[1] ? atoi(dbrow[1]) : 0;
+    segment.start_time = SystemTimePoint(Seconds(dbrow[2] ? atoi(dbrow[2]) : 0));
+    Storage::Schemes scheme = Storage::SchemeFromString(dbrow[4] ? dbrow[4] : "");
+
+    std::unique_ptr<Storage> &storage = storage_areas[storage_id];
+    if (!storage) storage = std::make_unique<Storage>(storage_id);
+    segment.video_path = Storage::EventPath(storage->Path(), scheme, monitor_id, segment.event_id, segment.start_time)
+                         + "/" + dbrow[3];
+
+    struct stat st;
+    if (stat(segment.video_path.c_str(), &st) == 0 and !videos.emplace(st.st_dev, st.st_ino).second) {
+      Debug(1, "Skipping event %" PRIu64 ", its video %s is already being exported",
+            segment.event_id, segment.video_path.c_str());
+      continue;
+    }
+    segments.push_back(std::move(segment));
+  }
+  mysql_free_result(result);
+  return segments;
+}
+
+bool EventExporter::Push(Item item) {
+  std::unique_lock<std::mutex> lck(mutex_);
+  condition_.wait(lck, [this] {
+    return cancelled_ or (queue_.size() < kQueuePackets and queued_bytes_ < kQueueBytes);
+  });
+  if (cancelled_) return false;
+  if (item.packet) queued_bytes_ += item.packet->size;
+  queue_.push_back(std::move(item));
+  condition_.notify_all();
+  return true;
+}
+
+EventExporter::Item EventExporter::Pop() {
+  std::unique_lock<std::mutex> lck(mutex_);
+  condition_.wait(lck, [this] { return !queue_.empty(); });
+  Item item = std::move(queue_.front());
+  queue_.pop_front();
+  if (item.packet) queued_bytes_ -= item.packet->size;
+  condition_.notify_all();
+  return item;
+}
+
+void EventExporter::Read(const std::vector<Segment> &segments, SystemTimePoint from, SystemTimePoint to) {
+  for (size_t i = 0; i < segments.size() and !zm_terminate; i++) {
+    if (i + 1 < segments.size()) ReadAhead(segments[i + 1].video_path);
+
+    const Segment &segment = segments[i];
+    Microseconds skip = std::max(Microseconds(0),
+                                 std::chrono::duration_cast<Microseconds>(from - segment.start_time));
+    Microseconds stop = std::chrono::duration_cast<Microseconds>(to - segment.start_time);
+    ReadSegment(i, segment, skip, stop);
+
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (cancelled_) return;
+  }
+  Push(Item());
+}
+
+void EventExporter::ReadSegment(size_t index, const Segment &segment, Microseconds skip, Microseconds stop) {
+  AVFormatContext *input = nullptr;
+  int ret = avformat_open_input(&input, segment.video_path.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    Warning("Skipping event %" PRIu64 ", can't open %s: %s",
+            segment.event_id, segment.video_path.c_str(), av_make_error_string(ret).c_str());
+    return;
+  }
+  std::unique_ptr<AVFormatContext *, void (*)(AVFormatContext **)> input_guard(&input, avformat_close_input);
+
+  ret = avformat_find_stream_info(input, nullptr);
+  if (ret < 0) {
+    Warning("Skipping event %" PRIu64 ", can't read the streams of %s: %s",
+            segment.event_id, segment.video_path.c_str(), av_make_error_string(ret).c_str());
+    return;
+  }
+  const int video_stream_id = av_find_best_stream(input, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (video_stream_id < 0) {
+    Warning("Skipping event %" PRIu64 ", %s has no video", segment.event_id, segment.video_path.c_str());
+    return;
+  }
+  const int audio_stream_id = av_find_best_stream(input, AVMEDIA_TYPE_AUDIO, -1, video_stream_id, nullptr, 0);
+  AVStream *video = input->streams[video_stream_id];
+  AVStream *audio = audio_stream_id >= 0 ? input->streams[audio_stream_id] : nullptr;
+
+  Item start;
+  start.type = SEGMENT;
+  start.segment = index;
+  start.video_par = CopyParameters(video->codecpar);
+  start.video_time_base = video->time_base;
+  if (audio) {
+    start.audio_par = CopyParameters(audio->codecpar);
+    start.audio_time_base = audio->time_base;
+  }
+  if (!start.video_par or (audio and !start.audio_par)) {
+    Error("Can't copy the stream parameters of %s", segment.video_path.c_str());
+    return;
+  }
+  if (!Push(std::move(start))) return;
+
+  const int64_t file_start = input->start_time != AV_NOPTS_VALUE ? input->start_time : 0;
+  if (skip > Microseconds(0)) {
+    // Lands on the keyframe at or before from, so the export starts cleanly
+    ret = av_seek_frame(input, -1, file_start + skip.count(), AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+      Warning("Can't seek %s, reading it from the start: %s",
+              segment.video_path.c_str(), av_make_error_string(ret).c_str());
+    }
+  }
+
+  bool have_keyframe = false;
+  av_packet_ptr packet{av_packet_alloc()};
+  while (!zm_terminate) {
+    ret = av_read_frame(input, packet.get());
+    if (ret < 0) {
+      if (ret != AVERROR_EOF)
+        Warning("Error reading %s: %s", segment.video_path.c_str(), av_make_error_string(ret).c_str());
+      break;
+    }
+
+    const bool is_video = packet->stream_index == video_stream_id;
+    const bool is_audio = packet->stream_index == audio_stream_id;
+    const int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    if ((!is_video and !is_audio) or ts == AV_NOPTS_VALUE) {
+      av_packet_unref(packet.get());
+      continue;
+    }
+
+    const int64_t offset = av_rescale_q(ts, input->streams[packet->stream_index]->time_base, AV_TIME_BASE_Q) - file_start;
+    if (offset >= stop.count()) {
+      av_packet_unref(packet.get());
+      if (is_video) break;
+      continue;
+    }
+    if (!have_keyframe) {
+      if (!is_video or !(packet->flags & AV_PKT_FLAG_KEY)) {
+        av_packet_unref(packet.get());
+        continue;
+      }
+      have_keyframe = true;
+    }
+
+    Item item;
+    item.type = PACKET;
+    item.segment = index;
+    item.audio = is_audio;
+    item.packet = av_packet_ptr{av_packet_alloc()};
+    av_packet_move_ref(item.packet.get(), packet.get());
+    if (!Push(std::move(item))) break;
+  }
+}
+
+bool EventExporter::OpenOutput(const std::string &output_path, const Item &first) {
+  int ret = avformat_alloc_output_context2(&output_, nullptr, "mp4", output_path.c_str());
+  if (ret < 0 or !output_) {
+    Error("Can't create output for %s: %s", output_path.c_str(), av_make_error_string(ret).c_str());
+    output_ = nullptr;
+    return false;
+  }
+
+  video_out_ = avformat_new_stream(output_, nullptr);
+  if (!video_out_ or avcodec_parameters_copy(video_out_->codecpar, first.video_par) < 0) {
+    Error("Can't add the video stream to %s", output_path.c_str());
+    avformat_free_context(output_);
+    output_ = nullptr;
+    return false;
+  }
+  // The input's tag may not be valid in mp4, let the muxer choose
+  video_out_->codecpar->codec_tag = 0;
+  video_out_->time_base = first.video_time_base;
+
+  if (first.audio_par) {
+    audio_out_ = avformat_new_stream(output_, nullptr);
+    if (audio_out_ and avcodec_parameters_copy(audio_out_->codecpar, first.audio_par) >= 0) {
+      audio_out_->codecpar->codec_tag = 0;
+      audio_out_->time_base = first.audio_time_base;
+    } else {
+      Warning("Can't add the audio stream to %s, exporting video only", output_path.c_str());
+      audio_out_ = nullptr;
+    }
+  }
+
+  ret = avio_open(&output_->pb, output_path.c_str(), AVIO_FLAG_WRITE);
+  if (ret < 0) {
+    Error("Can't open %s: %s", output_path.c_str(), av_make_error_string(ret).c_str());
+    avformat_free_context(output_);
+    output_ = nullptr;
+    return false;
+  }
+
+  // The moov goes at the front so the export plays while it downloads
+  AVDictionary *opts = nullptr;
+  av_dict_set(&opts, "movflags", "+faststart", 0);
+  ret = avformat_write_header(output_, &opts);
+  av_dict_free(&opts);
+  if (ret < 0) {
+    Error("Can't write the header of %s: %s", output_path.c_str(), av_make_error_string(ret).c_str());
+    avio_closep(&output_->pb);
+    avformat_free_context(output_);
+    output_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool EventExporter::Compatible(const Item &segment) const {
+  const AVCodecParameters *out = video_out_->codecpar;
+  const AVCodecParameters *in = segment.video_par;
+  // Parameter sets live in the extradata, and the output only has one copy
+  return in->codec_id == out->codec_id
+         and in->width == out->width
+         and in->height == out->height
+         and in->extradata_size == out->extradata_size
+         and (!in->extradata_size or memcmp(in->extradata, out->extradata, in->extradata_size) == 0);
+}
+
+bool EventExporter::WritePacket(Item &item) {
+  AVPacket *packet = item.packet.get();
+  AVStream *out = item.audio ? audio_out_ : video_out_;
+  const AVRational in_time_base = item.audio ? audio_in_time_base_ : video_in_time_base_;
+
+  const int64_t dts = av_rescale_q(packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts,
+                                   in_time_base, AV_TIME_BASE_Q);
+  if (!have_segment_origin_) {
+    timeline_.StartSegment(dts);
+    have_segment_origin_ = true;
+  }
+  const int64_t mapped_dts = timeline_.Map(dts);
+  const int64_t duration = av_rescale_q(packet->duration, in_time_base, AV_TIME_BASE_Q);
+  timeline_.Extend(mapped_dts, duration);
+
+  if (packet->pts != AV_NOPTS_VALUE)
+    packet->pts = av_rescale_q(timeline_.Map(av_rescale_q(packet->pts, in_time_base, AV_TIME_BASE_Q)),
+                               AV_TIME_BASE_Q, out->time_base);
+  packet->dts = av_rescale_q(mapped_dts, AV_TIME_BASE_Q, out->time_base);
+  packet->duration = av_rescale_q(packet->duration, in_time_base, out->time_base);
+
+  // Segments butting up against each other can round onto the same tick
+  int64_t &last_dts = item.audio ? last_audio_dts_ : last_video_dts_;
+  if (last_dts != AV_NOPTS_VALUE and packet->dts <= last_dts) {
+    packet->dts = last_dts + 1;
+    if (packet->pts != AV_NOPTS_VALUE and packet->pts < packet->dts)
+      packet->pts = packet->dts;
+  }
+  last_dts = packet->dts;
+
+  packet->stream_index = out->index;
+  packet->pos = -1;
+  int ret = av_interleaved_write_frame(output_, packet);
+  if (ret < 0) {
+    Error("Error writing packet: %s", av_make_error_string(ret).c_str());
+    return false;
+  }
+  return true;
+}
+
+bool EventExporter::Export(const std::vector<Segment> &segments, SystemTimePoint from, SystemTimePoint to,
+                           const std::string &output_path) {
+  if (segments.empty()) {
+    Error("No events to export");
+    return false;
+  }
+
+  std::thread reader(&EventExporter::Read, this, std::cref(segments), from, to);
+
+  bool ok = true;
+  size_t written = 0;
+  while (ok) {
+    Item item = Pop();
+    if (item.type == END) break;
+
+    if (item.type == SEGMENT) {
+      const Segment &segment = segments[item.segment];
+      if (!output_) {
+        ok = OpenOutput(output_path, item);
+        segment_usable_ = ok;
+      } else {
+        segment_usable_ = Compatible(item);
+        if (!segment_usable_)
+          Warning("Skipping event %" PRIu64 ", its video doesn't match the earlier events", segment.event_id);
+      }
+      segment_audio_ = segment_usable_ and audio_out_ and item.audio_par
+                       and item.audio_par->codec_id == audio_out_->codecpar->codec_id
+                       and item.audio_par->sample_rate == audio_out_->codecpar->sample_rate;
+      video_in_time_base_ = item.video_time_base;
+      audio_in_time_base_ = item.audio_time_base;
+      have_segment_origin_ = false;
+      Debug(1, "Exporting event %" PRIu64 " from %s", segment.event_id, segment.video_path.c_str());
+      continue;
+    }
+
+    if (!segment_usable_) continue;
+    // Audio that doesn't match the output's is dropped, and not counted
+    if (item.audio and !segment_audio_) continue;
+    ok = WritePacket(item);
+    if (ok) written++;
+  }
+
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    cancelled_ = true;
+  }
+  condition_.notify_all();
+  reader.join();
+  queue_.clear();
+  queued_bytes_ = 0;
+
+  if (ok and !written) {
+    Error("Nothing to export between the given times");
+    ok = false;
+  }
+  if (output_) {
+    if (ok) {
+      int ret = av_write_trailer(output_);
+      if (ret < 0) {
+        Error("Can't finish %s: %s", output_path.c_str(), av_make_error_string(ret).c_str());
+        ok = false;
+      }
+    }
+    avio_closep(&output_->pb);
+    avformat_free_context(output_);
+    output_ = nullptr;
+  }
+  if (!ok) {
+    unlink(output_path.c_str());
+    return false;
+  }
+
+  Info("Exported %zu packets, %.3f seconds, to %s", written,
+       FPSeconds(Microseconds(timeline_.End())).count(), output_path.c_str());
+  return true;
+}
@@ -0,0 +1,141 @@
+//
+// ZoneMinder Event Export Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_EVENT_EXPORT_H
+#define ZM_EVENT_EXPORT_H
+
+#include "zm_ffmpeg.h"
+#include "zm_time.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Joins the videos of the events covering a stretch of a monitor's
+// recording into one mp4, without re-encoding.  Packets are copied from
+// each event's video in turn, trimmed to the requested range, and given
+// timestamps that carry on from where the previous event's left off, so the
+// result plays straight through the gaps between events.  A reader thread
+// opens and demuxes the videos ahead of the muxer, through a bounded queue.
+class EventExporter {
+ public:
+  // Packets the reader may get ahead of the muxer by
+  static constexpr size_t kQueuePackets = 1024;
+  static constexpr size_t kQueueBytes = 64 * 1024 * 1024;
+
+  struct Segment {
+    uint64_t event_id;
+    std::string video_path;
+    SystemTimePoint start_time;
+  };
+
+  // Keeps output timestamps continuous across segments whose own
+  // timestamps each start wherever their file did.  Everything is in
+  // microseconds.
+  class Timeline {
+   public:
+    Timeline() : end_(0), offset_(0), started_(false) {}
+
+    // Maps the first timestamp of a new segment onto the end of the output
+    void StartSegment(int64_t first_ts) {
+      offset_ = end_ - first_ts;
+      started_ = true;
+    }
+    bool Started() const { return started_; }
+    int64_t Map(int64_t ts) const { return ts + offset_; }
+    // Records that the output now reaches mapped_ts + duration
+    void Extend(int64_t mapped_ts, int64_t duration) {
+      end_ = std::max(end_, mapped_ts + std::max<int64_t>(duration, 0));
+    }
+    int64_t End() const { return end_; }
+
+   private:
+    int64_t end_;
+    int64_t offset_;
+    bool started_;
+  };
+
+  // The events of monitor_id with a video that overlap [from, to), in order,
+  // each video only once however many events share it
+  static std::vector<Segment> FindSegments(unsigned int monitor_id, SystemTimePoint from, SystemTimePoint to);
+  // Unix seconds, or local time as YYYY-MM-DD HH:MM:SS
+  static bool ParseTime(const std::string &text, SystemTimePoint &time);
+
+  EventExporter();
+  ~EventExporter();
+
+  // Writes the part of segments inside [from, to) to output_path
+  bool Export(const std::vector<Segment> &segments, SystemTimePoint from, SystemTimePoint to,
+              const std::string &output_path);
+
+ private:
+  enum ItemType { SEGMENT, PACKET, END };
+
+  struct Item {
+    ItemType type;
+    size_t segment;
+    // SEGMENT: the segment's streams, PACKET: is this audio
+    AVCodecParameters *video_par;
+    AVCodecParameters *audio_par;
+    AVRational video_time_base;
+    AVRational audio_time_base;
+    // PACKET
+    av_packet_ptr packet;
+    bool audio;
+
+    Item() : type(END), segment(0), video_par(nullptr), audio_par(nullptr),
+      video_time_base{0, 1}, audio_time_base{0, 1}, audio(false) {}
+    Item(Item &&other) noexcept;
+    Item &operator=(Item &&other) noexcept;
+    ~Item();
+  };
+
+  void Read(const std::vector<Segment> &segments, SystemTimePoint from, SystemTimePoint to);
+  void ReadSegment(size_t index, const Segment &segment, Microseconds skip, Microseconds stop);
+  // Blocks while the queue is full, false if the muxer has given up
+  bool Push(Item item);
+  Item Pop();
+
+  bool OpenOutput(const std::string &output_path, const Item &first);
+  bool Compatible(const Item &segment) const;
+  bool WritePacket(Item &item);
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<Item> queue_;
+  size_t queued_bytes_;
+  bool cancelled_;
+
+  // Only used by the muxer
+  AVFormatContext *output_;
+  AVStream *video_out_;
+  AVStream *audio_out_;
+  AVRational video_in_time_base_;
+  AVRational audio_in_time_base_;
+  bool segment_usable_;
+  bool segment_audio_;  // Audio of this segment goes in the output
+  bool have_segment_origin_;
+  Timeline timeline_;
+  int64_t last_video_dts_;
+  int64_t last_audio_dts_;
+};
+
+#endif // ZM_EVENT_EXPORT_H
@@ -0,0 +1,200 @@
+//
+// ZoneMinder Event Frame Table Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_event_frame_table.h"
+
+#include "zm_logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'Z', 'M', 'F', 'R', 'A', 'M', 'E', 'S'};
+
+struct TableHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t record_size;
+};
+
+static_assert(sizeof(TableHeader) == 16, "frame table header must not have padding");
+static_assert(sizeof(EventFrameTable::Record) == 16, "frame table records must not have padding");
+
+bool WriteAll(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size) {
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+}  // namespace
+
+EventFrameTable::Writer::Writer() : fd_(-1) {}
+
+EventFrameTable::Writer::~Writer() {
+  Close();
+}
+
+bool EventFrameTable::Writer::Open(const std::string &path) {
+  Close();
+
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ < 0) {
+    Error("Can't open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  path_ = path;
+
+  TableHeader header = {};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.record_size = sizeof(Record);
+  if (!WriteAll(fd_, &header, sizeof(header))) {
+    Error("Can't write %s: %s", path_.c_str(), strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    unlink(path.c_str());
+    return false;
+  }
+  pending_.reserve(kFlushRecords);
+  return true;
+}
+
+void EventFrameTable::Writer::Append(Microseconds offset, int type, int score, bool in_db) {
+  if (fd_ < 0) return;
+
+  Record record = {};
+  record.offset = offset.count();
+  record.score = score;
+  record.type = type;
+  record.in_db = in_db;
+  pending_.push_back(record);
+  if (pending_.size() >= kFlushRecords) Flush();
+}
+
+bool EventFrameTable::Writer::Flush() {
+  if (fd_ < 0 or pending_.empty()) return fd_ >= 0;
+
+  if (!WriteAll(fd_, pending_.data(), pending_.size() * sizeof(Record))) {
+    // Playback falls back to the Frames table without it
+    Error("Can't write %s, removing it: %s", path_.c_str(), strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    unlink(path_.c_str());
+    pending_.clear();
+    return false;
+  }
+  pending_.clear();
+  return true;
+}
+
+void EventFrameTable::Writer::Close() {
+  if (fd_ < 0) return;
+  Flush();
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+EventFrameTable::EventFrameTable() : map_(nullptr), map_size_(0), count_(0) {}
+
+EventFrameTable::~EventFrameTable() {
+  Close();
+}
+
+bool EventFrameTable::Open(const std::string &path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Debug(1, "No frame table at %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) < 0 or static_cast<size_t>(st.st_size) < sizeof(TableHeader)) {
+    Debug(1, "Frame table %s is too short", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  map_size_ = st.st_size;
+  map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    Error("Can't map %s: %s", path.c_str(), strerror(errno));
+    map_ = nullptr;
+    map_size_ = 0;
+    return false;
+  }
+
+  TableHeader header;
+  memcpy(&header, map_, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+      or header.format_version != kFormatVersion
+      or header.record_size != sizeof(Record)) {
+    Warning("Frame table %s doesn't match this version, ignoring it", path.c_str());
+    Close();
+    return false;
+  }
+  // A partly written last record belongs to an event still being recorded
+  count_ = (map_size_ - sizeof(TableHeader)) / sizeof(Record);
+  Debug(1, "Mapped %zu frames from %s", count_, path.c_str());
+  return true;
+}
+
+void EventFrameTable::Close() {
+  if (map_) {
+    munmap(map_, map_size_);
+    map_ = nullptr;
+  }
+  map_size_ = 0;
+  count_ = 0;
+}
+
+EventFrameTable::Record EventFrameTable::At(size_t index) const {
+  Record record;
+  memcpy(&record, static_cast<const char *>(map_) + sizeof(TableHeader) + index * sizeof(Record), sizeof(record));
+  return record;
+}
+
+size_t EventFrameTable::UpperBound(Microseconds offset) const {
+  size_t low = 0;
+  size_t high = count_;
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (Offset(middle) <= offset) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
@@ -0,0 +1,96 @@
+//
+// ZoneMinder Event Frame Table Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_EVENT_FRAME_TABLE_H
+#define ZM_EVENT_FRAME_TABLE_H
+
+#include "zm_time.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Every frame of an event, one fixed size record each, in a file in the
+// event directory.  The Frames table only gets a row for the frames that
+// matter to analysis, so playback used to load all of them and interpolate
+// the rest, which for a long continuous event means hundreds of thousands of
+// rows before the first frame can be sent.  The file is memory mapped
+// instead, and any frame is found by indexing into it.  Records are only ever
+// appended, so the file of an event still being recorded can be read at any
+// time, it just ends at whatever was last flushed.
+class EventFrameTable {
+ public:
+  static constexpr uint32_t kFormatVersion = 1;
+  static constexpr const char *kFileName = "frames.idx";
+
+  // Host byte order, like the rest of the event it lives with
+  struct Record {
+    int64_t offset;    // Microseconds since the start of the event
+    int32_t score;
+    uint8_t type;      // FrameType
+    uint8_t in_db;     // Also has a row in Frames
+    uint16_t reserved;
+  };
+
+  class Writer {
+   public:
+    // Records are written out in batches of this many
+    static constexpr size_t kFlushRecords = 64;
+
+    Writer();
+    ~Writer();
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    bool Open(const std::string &path);
+    bool IsOpen() const { return fd_ >= 0; }
+    // Frames must be appended in order, frame id n being the nth record
+    void Append(Microseconds offset, int type, int score, bool in_db);
+    bool Flush();
+    void Close();
+
+   private:
+    int fd_;
+    std::string path_;
+    std::vector<Record> pending_;
+  };
+
+  EventFrameTable();
+  ~EventFrameTable();
+  EventFrameTable(const EventFrameTable &) = delete;
+  EventFrameTable &operator=(const EventFrameTable &) = delete;
+
+  bool Open(const std::string &path);
+  void Close();
+  bool IsOpen() const { return map_ != nullptr; }
+
+  size_t Size() const { return count_; }
+  // The record for frame id index+1
+  Record At(size_t index) const;
+  Microseconds Offset(size_t index) const { return Microseconds(At(index).offset); }
+  // Index of the first frame with an offset greater than offset, as
+  // std::upper_bound would give
+  size_t UpperBound(Microseconds offset) const;
+
+ private:
+  void *map_;
+  size_t map_size_;
+  size_t count_;
+};
+
+#endif // ZM_EVENT_FRAME_TABLE_H
@@ -0,0 +1,459 @@
+//
+// ZoneMinder Event Frame Prefetcher Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_event_prefetcher.h"
+
+#include "zm_config.h"
+#include "zm_ffmpeg_input.h"
+#include "zm_logger.h"
+#include "zm_sendfile.h"
+#include "zm_utils.h"
+#include <algorithm>
+#include <cinttypes>
+#include <filesystem>
+#include <unistd.h>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+namespace {
+
+// Further ahead than this it is quicker to seek than to decode our way there.
+// Well beyond a typical GOP, as in FFmpeg_Input::get_frame.
+const Microseconds kSeekDistance = Seconds(5);
+
+}  // namespace
+
+EventFramePrefetcher::EventFramePrefetcher() :
+  window_(0),
+  max_capacity_(kMinCacheFrames),
+  cache_(kMinCacheFrames),
+  head_(0),
+  step_(1),
+  keyframes_only_(false),
+  generation_(0),
+  done_generation_(0),
+  batch_first_(0),
+  batch_last_(0),
+  batch_keyframes_only_(false),
+  terminate_(false),
+  input_failed_(false),
+  have_position_(false),
+  position_(0),
+  gop_frames_(0),
+  since_keyframe_(0),
+  convert_context_(nullptr) {
+}
+
+EventFramePrefetcher::~EventFramePrefetcher() {
+  Stop();
+}
+
+void EventFramePrefetcher::Start(Source source) {
+  Stop();
+
+  // Jpegs are only paths, so without a video nothing decoded is kept
+  const size_t capacity = source.video_path.empty() ? kMaxCacheFrames : CacheFrames(source.width, source.height);
+  max_capacity_ = source.video_path.empty() ? kMaxCacheFrames
+                  : std::max(capacity, CacheFrames(source.width, source.height, kMaxCacheBytes));
+  source_ = std::move(source);
+  frame_table_.Close();
+  if (!source_.frame_table_path.empty() and !frame_table_.Open(source_.frame_table_path))
+    Warning("Unable to map %s for prefetching", source_.frame_table_path.c_str());
+  // Half ahead of the play head, leaving the rest for frames just shown
+  window_ = capacity / 2;
+  cache_ = LruCache<int, Fetched>(capacity);
+  head_ = 0;
+  step_ = 1;
+  keyframes_only_ = false;
+  generation_ = done_generation_ = 0;
+  terminate_ = false;
+  input_failed_ = false;
+  have_position_ = false;
+  gop_frames_ = since_keyframe_ = 0;
+
+  Debug(1, "Prefetching %zu frames ahead for %s", window_, source_.event_path.c_str());
+  thread_ = std::thread(&EventFramePrefetcher::Run, this);
+}
+
+void EventFramePrefetcher::Stop() {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    terminate_ = true;
+  }
+  condition_.notify_all();
+  if (thread_.joinable()) thread_.join();
+
+  input_.reset();
+  if (convert_context_) {
+    sws_freeContext(convert_context_);
+    convert_context_ = nullptr;
+  }
+  last_picture_.reset();
+  last_image_.reset();
+  std::lock_guard<std::mutex> lck(mutex_);
+  cache_.Clear();
+}
+
+void EventFramePrefetcher::Request(int frame_id, int step, bool keyframes_only) {
+  if (step == 0) step = 1;
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (frame_id == head_ and step == step_ and keyframes_only == keyframes_only_) return;
+    if (keyframes_only != keyframes_only_) {
+      Debug(1, "%s keyframe only prefetching", keyframes_only ? "Starting" : "Stopping");
+      keyframes_only_ = keyframes_only;
+      cache_.Clear();
+    }
+    head_ = frame_id;
+    step_ = step;
+    generation_++;
+  }
+  condition_.notify_all();
+}
+
+bool EventFramePrefetcher::Get(int frame_id, Frame &frame, Microseconds timeout) {
+  Fetched fetched;
+  {
+    std::unique_lock<std::mutex> lck(mutex_);
+    if (!thread_.joinable()) return false;
+
+    Fetched *cached = nullptr;
+    condition_.wait_for(lck, timeout, [&] {
+      cached = cache_.Find(frame_id);
+      return cached or terminate_;
+    });
+    if (!cached) {
+      Debug(1, "Frame %d wasn't prefetched in time", frame_id);
+      return false;
+    }
+    fetched = *cached;
+  }
+
+  frame.path = fetched.path;
+  frame.image = nullptr;
+  if (fetched.picture) {
+    // Converted here, for the frames actually shown, rather than for
+    // everything decoded
+    if (fetched.picture != last_picture_) {
+      last_image_ = ConvertFrame(fetched.picture.get());
+      last_picture_ = fetched.picture;
+    }
+    frame.image = last_image_;
+  }
+  return true;
+}
+
+std::string EventFramePrefetcher::FramePath(const std::string &event_path, int save_jpegs, bool analysis, int frame_id) {
+  std::string path;
+  // exists() with an error_code treats any failure as "not present" without throwing
+  std::error_code exists_ec;
+
+  if (analysis and (save_jpegs & 2)) {
+    path = stringtf(staticConfig.analyse_file_format.c_str(), event_path.c_str(), frame_id);
+    if (std::filesystem::exists(path, exists_ec)) return path;
+    Debug(1, "analyze file %s not found will try to stream from other", path.c_str());
+    path = stringtf(staticConfig.capture_file_format.c_str(), event_path.c_str(), frame_id);
+    if (std::filesystem::exists(path, exists_ec)) return path;
+    Debug(1, "capture file %s not found either", path.c_str());
+  } else if (save_jpegs & 1) {
+    path = stringtf(staticConfig.capture_file_format.c_str(), event_path.c_str(), frame_id);
+    if (std::filesystem::exists(path, exists_ec)) return path;
+    Debug(1, "Capture file %s not found (bulk/interpolated frame %d), trying ffmpeg_input",
+          path.c_str(), frame_id);
+  }
+  return "";
+}
+
+std::vector<int> EventFramePrefetcher::Window(int frame_id, int step, size_t count, int frame_count) {
+  std::vector<int> frame_ids;
+  if (step == 0) step = 1;
+  for (int id = frame_id; id >= 1 and id <= frame_count and frame_ids.size() < count; id += step)
+    frame_ids.push_back(id);
+  return frame_ids;
+}
+
+int EventFramePrefetcher::FrameCount() const {
+  return static_cast<int>(frame_table_.IsOpen() ? frame_table_.Size() : source_.offsets.size());
+}
+
+Microseconds EventFramePrefetcher::Offset(int frame_id) const {
+  return frame_table_.IsOpen() ? frame_table_.Offset(frame_id - 1) : source_.offsets[frame_id - 1];
+}
+
+size_t EventFramePrefetcher::WindowFrames(size_t window, size_t gop_frames, int step, size_t limit) {
+  if (step >= 0 or !gop_frames) return window;
+  const size_t gop_window = (gop_frames + (-step) - 1) / (-step);
+  return std::max(window, std::min(gop_window, limit));
+}
+
+size_t EventFramePrefetcher::CacheFrames(int width, int height, size_t bytes) {
+  const size_t frame_size = static_cast<size_t>(std::max(width, 1)) * std::max(height, 1) * 3 / 2;
+  return std::clamp(bytes / frame_size, kMinCacheFrames, kMaxCacheFrames);
+}
+
+void EventFramePrefetcher::Run() {
+  std::unique_lock<std::mutex> lck(mutex_);
+  while (!terminate_) {
+    if (head_ < 1 or done_generation_ == generation_) {
+      condition_.wait(lck);
+      continue;
+    }
+
+    const int generation = generation_;
+    done_generation_ = generation;
+    size_t window_frames = window_;
+    if (!keyframes_only_) {
+      window_frames = WindowFrames(window_, gop_frames_, step_, max_capacity_ - kMinCacheFrames);
+      if (window_frames + kMinCacheFrames > cache_.Capacity()) {
+        Debug(1, "Growing the cache to hold a GOP of %zu frames", gop_frames_);
+        cache_.SetCapacity(window_frames + kMinCacheFrames);
+      }
+    }
+    const std::vector<int> window = Window(head_, step_, window_frames, FrameCount());
+    std::vector<int> missing;
+    for (int frame_id : window) {
+      if (!cache_.Find(frame_id)) missing.push_back(frame_id);
+    }
+    // Unless the play head itself is missing, let half the window be used up
+    // before fetching more, so that each seek pays for a batch of frames.
+    if (missing.empty() or (missing.front() != window.front() and missing.size() < window.size() / 2))
+      continue;
+
+    std::sort(missing.begin(), missing.end());
+    batch_first_ = missing.front();
+    batch_last_ = missing.back();
+    batch_keyframes_only_ = keyframes_only_;
+    const bool keyframes_only = keyframes_only_;
+    lck.unlock();
+
+    std::vector<int> video_frame_ids;
+    for (int frame_id : missing) {
+      std::string path = FramePath(source_.event_path, source_.save_jpegs, source_.analysis, frame_id);
+      if (!path.empty()) {
+        FetchJpeg(frame_id, path);
+      } else if (!source_.video_path.empty()) {
+        video_frame_ids.push_back(frame_id);
+      } else {
+        Store(frame_id, Fetched());
+      }
+    }
+    if (!video_frame_ids.empty() and Wanted(generation)) {
+      if (keyframes_only) {
+        DecodeKeyframes(video_frame_ids, generation);
+      } else {
+        DecodeVideo(video_frame_ids, generation);
+      }
+    }
+
+    lck.lock();
+  }  // end while !terminate_
+}
+
+bool EventFramePrefetcher::Wanted(int generation) {
+  std::lock_guard<std::mutex> lck(mutex_);
+  if (terminate_) return false;
+  if (generation == generation_) return true;
+  // The play head moving on through the batch doesn't make it any less useful
+  return (keyframes_only_ == batch_keyframes_only_) and (head_ >= batch_first_ and head_ <= batch_last_);
+}
+
+void EventFramePrefetcher::Store(int frame_id, Fetched fetched) {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    cache_.Insert(frame_id, std::move(fetched));
+  }
+  condition_.notify_all();
+}
+
+void EventFramePrefetcher::FetchJpeg(int frame_id, const std::string &path) {
+  // Decoding stays with the stream, Image's jpeg decoder is shared by the
+  // whole process.  Having the file in the page cache is most of the win.
+  zm_readahead(path);
+  Store(frame_id, Fetched{path, nullptr});
+}
+
+bool EventFramePrefetcher::OpenVideo() {
+  if (!input_ and !input_failed_) {
+    input_ = std::make_unique<FFmpeg_Input>();
+    if (input_->Open(source_.video_path.c_str()) < 0 or input_->get_video_stream_id() < 0) {
+      Warning("Unable to open %s for prefetching", source_.video_path.c_str());
+      input_.reset();
+      input_failed_ = true;
+    }
+  }
+  return input_ != nullptr;
+}
+
+void EventFramePrefetcher::DecodeVideo(const std::vector<int> &frame_ids, int generation) {
+  size_t next = 0;
+  if (OpenVideo()) {
+    input_->set_keyframes_only(false);
+    const int stream_id = input_->get_video_stream_id();
+    const AVStream *stream = input_->get_video_stream();
+
+    // frame_ids are in order, so we only ever decode forwards from here
+    const Microseconds first = Offset(frame_ids.front());
+    if (!have_position_ or first <= position_ or first > position_ + kSeekDistance) {
+      const int64_t target = av_rescale_q(first.count(), AV_TIME_BASE_Q, stream->time_base);
+      Debug(2, "Seeking to keyframe before frame %d at %" PRId64, frame_ids.front(), target);
+      int ret = av_seek_frame(input_->get_format_context(), stream_id, target, AVSEEK_FLAG_BACKWARD);
+      if (ret < 0) {
+        Error("Unable to seek in %s: %s", source_.video_path.c_str(), av_make_error_string(ret).c_str());
+        next = frame_ids.size();
+      } else {
+        avcodec_flush_buffers(input_->get_video_codec_context());
+      }
+      have_position_ = false;
+      since_keyframe_ = 0;
+    }
+
+    while (next < frame_ids.size()) {
+      if (!Wanted(generation)) return;
+
+      AVFrame *frame = input_->get_frame(stream_id);
+      if (!frame) {
+        Debug(1, "No frames in %s after frame %d", source_.video_path.c_str(), frame_ids[next]);
+        break;
+      }
+      if (frame->pts == AV_NOPTS_VALUE) continue;
+
+#if LIBAVCODEC_VERSION_CHECK(60, 3, 0, 3, 0)
+      const int64_t duration = frame->duration;
+#else
+      const int64_t duration = frame->pkt_duration;
+#endif
+      position_ = Microseconds(av_rescale_q(frame->pts + duration, stream->time_base, AV_TIME_BASE_Q));
+      have_position_ = true;
+
+#if LIBAVUTIL_VERSION_CHECK(58, 7, 100, 7, 100)
+      const bool keyframe = frame->flags & AV_FRAME_FLAG_KEY;
+#else
+      const bool keyframe = frame->key_frame;
+#endif
+      since_keyframe_ = keyframe ? 0 : since_keyframe_ + 1;
+      gop_frames_ = std::max(gop_frames_, since_keyframe_ + 1);
+
+      // Each decoded frame stands in for every event frame whose offset it
+      // covers, the same frame that get_frame(stream, offset) would return.
+      std::shared_ptr<AVFrame> picture;
+      while (next < frame_ids.size() and Offset(frame_ids[next]) <= position_) {
+        if (!picture) picture = CopyFrame(frame);
+        Store(frame_ids[next++], Fetched{"", picture});
+      }
+    }  // end while frames to decode
+  }
+
+  // Whatever is left isn't in the video, don't keep trying
+  while (next < frame_ids.size())
+    Store(frame_ids[next++], Fetched());
+}
+
+void EventFramePrefetcher::DecodeKeyframes(const std::vector<int> &frame_ids, int generation) {
+  size_t next = 0;
+  if (OpenVideo()) {
+    input_->set_keyframes_only(true);
+    // Keyframe seeks leave the demuxer wherever they like
+    have_position_ = false;
+
+    const int stream_id = input_->get_video_stream_id();
+    std::shared_ptr<AVFrame> picture;
+    int64_t picture_pts = AV_NOPTS_VALUE;
+    for (; next < frame_ids.size(); next++) {
+      if (!Wanted(generation)) return;
+
+      AVFrame *frame = input_->get_frame(stream_id, FPSeconds(Offset(frame_ids[next])).count());
+      if (!frame) {
+        Debug(1, "No keyframe in %s for frame %d", source_.video_path.c_str(), frame_ids[next]);
+        break;
+      }
+      // Every frame up to the next keyframe shares this one's picture
+      if (!picture or frame->pts != picture_pts) {
+        picture = CopyFrame(frame);
+        picture_pts = frame->pts;
+      }
+      Store(frame_ids[next], Fetched{"", picture});
+    }
+  }
+
+  while (next < frame_ids.size())
+    Store(frame_ids[next++], Fetched());
+}
+
+std::shared_ptr<AVFrame> EventFramePrefetcher::CopyFrame(const AVFrame *frame) {
+  // A copy rather than a reference, which would hold on to the decoder's own
+  // buffers for as long as the frame is cached
+  std::shared_ptr<AVFrame> copy(av_frame_alloc(), [](AVFrame *f) { av_frame_free(&f); });
+  if (!copy) return nullptr;
+
+  int ret;
+  if (frame->hw_frames_ctx) {
+    ret = av_hwframe_transfer_data(copy.get(), frame, 0);
+  } else {
+    copy->format = frame->format;
+    copy->width = frame->width;
+    copy->height = frame->height;
+    ret = av_frame_get_buffer(copy.get(), 0);
+    if (ret >= 0) ret = av_frame_copy(copy.get(), frame);
+  }
+  if (ret >= 0) ret = av_frame_copy_props(copy.get(), frame);
+  if (ret < 0) {
+    Error("Unable to copy decoded frame: %s", av_make_error_string(ret).c_str());
+    return nullptr;
+  }
+  return copy;
+}
+
+std::shared_ptr<Image> EventFramePrefetcher::ConvertFrame(const AVFrame *frame) {
+  // Image::Assign(frame) converts with a context shared by the whole process,
+  // so we keep our own.
+  const AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+  convert_context_ = sws_getCachedContext(
+                       convert_context_,
+                       frame->width, frame->height, fix_deprecated_pix_fmt(format),
+                       source_.width, source_.height, AV_PIX_FMT_RGBA,
+                       SWS_BICUBIC,
+                       nullptr, nullptr, nullptr);
+  if (!convert_context_) {
+    Error("Unable to create conversion context");
+    return nullptr;
+  }
+  zm_sws_set_input_range(convert_context_, format);
+
+  auto image = std::make_shared<Image>(source_.width, source_.height, ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA);
+  if (!image->Assign(frame, convert_context_)) return nullptr;
+
+  switch (source_.orientation) {
+  case Monitor::ROTATE_0 :
+    break;
+  case Monitor::ROTATE_90 :
+  case Monitor::ROTATE_180 :
+  case Monitor::ROTATE_270 :
+    image->Rotate((source_.orientation-1)*90);
+    break;
+  case Monitor::FLIP_HORI :
+  case Monitor::FLIP_VERT :
+    image->Flip(source_.orientation==Monitor::FLIP_HORI);
+    break;
+  default:
+    Error("Invalid Orientation: %d", source_.orientation);
+  }
+  return image;
+}
@@ -0,0 +1,163 @@
+//
+// ZoneMinder Event Frame Prefetcher Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_EVENT_PREFETCHER_H
+#define ZM_EVENT_PREFETCHER_H
+
+#include "zm_event_frame_table.h"
+#include "zm_image.h"
+#include "zm_lru_cache.h"
+#include "zm_monitor.h"
+#include "zm_time.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FFmpeg_Input;
+struct SwsContext;
+
+// Fetches the frames of an event ahead of an EventStream's play head, on its
+// own thread, in whichever direction and at whatever step the stream is
+// playing.  Frames stored as jpegs are located and read into the page cache.
+// Frames only stored in the video are decoded with a private decoder and kept
+// as decoded in a small LRU around the play head, only being converted to an
+// Image for the frame actually shown.  The video is only ever decoded
+// forwards, a batch at a time, and in reverse a batch covers at least a GOP,
+// so reverse play costs one seek and GOP decode per GOP of frames instead of
+// per frame.  When asked for keyframes only, each frame is just the keyframe
+// at or before it, for fast forward.
+class EventFramePrefetcher {
+ public:
+  // Memory allowed for decoded frames, which decides how far ahead we look.
+  // Frames are kept as decoded, normally 4:2:0 at 1.5 bytes a pixel.  Every
+  // zms viewer has its own, so this only covers a few frames either side of
+  // the play head: ten at 1080p.
+  static constexpr size_t kCacheBytes = 32 * 1024 * 1024;
+  // Reverse play grows the cache to hold a GOP, up to this: over forty
+  // frames at 1080p.
+  static constexpr size_t kMaxCacheBytes = 128 * 1024 * 1024;
+  static constexpr size_t kMinCacheFrames = 4;
+  static constexpr size_t kMaxCacheFrames = 64;
+
+  struct Frame {
+    std::string path;              // The frame's jpeg, empty if there isn't one
+    std::shared_ptr<Image> image;  // Decoded and rotated from the video, or null
+  };
+
+  struct Source {
+    std::string event_path;
+    int save_jpegs;
+    bool analysis;
+    std::string video_path;             // Empty if the event has no video
+    // The event's frame table, mapped by the prefetcher and indexed as it
+    // goes.  Empty if the event doesn't have one, when the offsets are
+    // given instead: the offset of frame id n is offsets[n-1].
+    std::string frame_table_path;
+    std::vector<Microseconds> offsets;
+    int width;
+    int height;
+    Monitor::Orientation orientation;   // Applied to frames decoded from the video
+  };
+
+  EventFramePrefetcher();
+  ~EventFramePrefetcher();
+  EventFramePrefetcher(const EventFramePrefetcher &) = delete;
+  EventFramePrefetcher &operator=(const EventFramePrefetcher &) = delete;
+
+  // Forgets everything fetched so far and starts on a new event
+  void Start(Source source);
+  void Stop();
+  bool Running() const { return thread_.joinable(); }
+
+  // Moves the play head.  step is the distance between displayed frames,
+  // negative when playing in reverse.  Switching keyframes_only throws away
+  // what has been fetched.
+  void Request(int frame_id, int step, bool keyframes_only = false);
+  // Waits up to timeout for frame_id to be fetched
+  bool Get(int frame_id, Frame &frame, Microseconds timeout);
+
+  // The jpeg to stream for a frame, or empty if it only exists in the video
+  static std::string FramePath(const std::string &event_path, int save_jpegs, bool analysis, int frame_id);
+  // Up to count frame ids starting at frame_id and moving by step, stopping
+  // at either end of an event of frame_count frames
+  static std::vector<int> Window(int frame_id, int step, size_t count, int frame_count);
+  // How many frames to look ahead.  In reverse, enough to cover a GOP of
+  // gop_frames, as seeking back decodes everything from the keyframe on
+  // anyway, but no more than limit.
+  static size_t WindowFrames(size_t window, size_t gop_frames, int step, size_t limit);
+  static size_t CacheFrames(int width, int height, size_t bytes = kCacheBytes);
+
+ private:
+  void Run();
+  // Whether the batch started at generation is still worth finishing
+  bool Wanted(int generation);
+  // What is cached for a frame: its jpeg, or the picture decoded for it,
+  // which frames up to the next one decoded share
+  struct Fetched {
+    std::string path;
+    std::shared_ptr<AVFrame> picture;
+  };
+
+  void Store(int frame_id, Fetched fetched);
+  void FetchJpeg(int frame_id, const std::string &path);
+  bool OpenVideo();
+  void DecodeVideo(const std::vector<int> &frame_ids, int generation);
+  void DecodeKeyframes(const std::vector<int> &frame_ids, int generation);
+  static std::shared_ptr<AVFrame> CopyFrame(const AVFrame *frame);
+  std::shared_ptr<Image> ConvertFrame(const AVFrame *frame);
+  int FrameCount() const;
+  Microseconds Offset(int frame_id) const;
+
+  Source source_;
+  EventFrameTable frame_table_;
+  size_t window_;
+  size_t max_capacity_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  LruCache<int, Fetched> cache_;
+  int head_;
+  int step_;
+  bool keyframes_only_;
+  int generation_;
+  int done_generation_;
+  int batch_first_;
+  int batch_last_;
+  bool batch_keyframes_only_;
+  bool terminate_;
+  std::thread thread_;
+
+  // Only used by the prefetch thread
+  std::unique_ptr<FFmpeg_Input> input_;
+  bool input_failed_;
+  bool have_position_;
+  Microseconds position_;  // End of the last frame decoded
+  size_t gop_frames_;      // Longest run of frames from a keyframe seen
+  size_t since_keyframe_;
+
+  // Only used by Get()
+  SwsContext *convert_context_;
+  std::shared_ptr<AVFrame> last_picture_;
+  std::shared_ptr<Image> last_image_;
+};
+
+#endif // ZM_EVENT_PREFETCHER_H
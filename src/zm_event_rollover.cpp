@@ -0,0 +1,78 @@
+//
+// ZoneMinder Event Rollover Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_event_rollover.h"
+
+#include "zm_config.h"
+#include "zm_logger.h"
+
+#include <algorithm>
+
+std::mutex EventRollover::mutex_;
+std::condition_variable EventRollover::cond_;
+int EventRollover::active_ = 0;
+EventRollover::Stats EventRollover::open_stats_ = {};
+EventRollover::Stats EventRollover::close_stats_ = {};
+
+EventRollover::Slot::Slot() {
+  std::unique_lock<std::mutex> lck(mutex_);
+  cond_.wait(lck, [] {
+    return config.event_close_concurrency <= 0 or active_ < config.event_close_concurrency;
+  });
+  active_++;
+}
+
+EventRollover::Slot::~Slot() {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    active_--;
+  }
+  cond_.notify_one();
+}
+
+Seconds EventRollover::Phase(unsigned int monitor_id, Seconds section_length) {
+  Seconds window = std::min(Seconds(config.event_section_stagger), section_length);
+  if (window <= Seconds(0)) return Seconds(0);
+  // Knuth's multiplicative hash, so that consecutive ids land far apart
+  uint32_t hash = static_cast<uint32_t>(monitor_id) * 2654435761u;
+  return Seconds(hash % static_cast<uint32_t>(window.count()));
+}
+
+void EventRollover::RecordOpen(unsigned int monitor_id, Microseconds latency) {
+  Record("open", open_stats_, monitor_id, latency);
+}
+
+void EventRollover::RecordClose(unsigned int monitor_id, Microseconds latency) {
+  Record("close", close_stats_, monitor_id, latency);
+}
+
+void EventRollover::Record(const char *what, Stats &stats, unsigned int monitor_id, Microseconds latency) {
+  std::lock_guard<std::mutex> lck(mutex_);
+  stats.count++;
+  stats.total += latency;
+  if (latency > stats.max) stats.max = latency;
+  Debug(1, "Monitor %u event %s took %.3fs", monitor_id, what, FPSeconds(latency).count());
+
+  if (stats.count % report_interval_ == 0) {
+    Info("Event %s latency over %" PRIu64 " rollovers: avg %.3fs max %.3fs",
+         what, stats.count,
+         FPSeconds(stats.total).count() / stats.count,
+         FPSeconds(stats.max).count());
+  }
+}
@@ -0,0 +1,72 @@
+//
+// ZoneMinder Event Rollover Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_EVENT_ROLLOVER_H
+#define ZM_EVENT_ROLLOVER_H
+
+#include "zm_time.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Process-wide coordination of continuous event section rollover. Monitors
+// get a deterministic phase offset for their section boundaries so that they
+// don't all close events in the same second, event finalization (trailer,
+// m3u8, DB update) is spread out rather than run for every monitor at once,
+// and rollover latency is tracked.
+class EventRollover {
+ public:
+  // Held while finalizing an event. Blocks while ZM_EVENT_CLOSE_CONCURRENCY
+  // other events are being finalized.
+  class Slot {
+   public:
+    Slot();
+    ~Slot();
+    Slot(const Slot &) = delete;
+    Slot &operator=(const Slot &) = delete;
+  };
+
+  // Offset of this monitor's section boundaries from wall clock multiples of
+  // section_length, within ZM_EVENT_SECTION_STAGGER seconds.
+  static Seconds Phase(unsigned int monitor_id, Seconds section_length);
+
+  // Time spent by the analysis thread opening the next event
+  static void RecordOpen(unsigned int monitor_id, Microseconds latency);
+  // Time from closeEvent() until the event has been finalized
+  static void RecordClose(unsigned int monitor_id, Microseconds latency);
+
+ private:
+  struct Stats {
+    uint64_t count;
+    Microseconds total;
+    Microseconds max;
+  };
+  static void Record(const char *what, Stats &stats, unsigned int monitor_id, Microseconds latency);
+
+  static constexpr uint64_t report_interval_ = 100;
+
+  static std::mutex mutex_;
+  static std::condition_variable cond_;
+  static int active_;
+  static Stats open_stats_;
+  static Stats close_stats_;
+};
+
+#endif // ZM_EVENT_ROLLOVER_H
@@ -30,7 +30,6 @@
 #include <memory>
 #include <sys/stat.h>
 
-#include <filesystem>
 
 #ifdef __FreeBSD__
 #include <netinet/in.h>
@@ -45,6 +44,43 @@ const std::string EventStream::StreamMode_Strings[4] = {
 
 constexpr Milliseconds EventStream::STREAM_PAUSE_WAIT;
 
+bool EventStream::FrameList::Map(const std::string &path, SystemTimePoint start_time) {
+  frames_.clear();
+  start_time_ = start_time;
+  return table_.Open(path);
+}
+
+EventStream::FrameData EventStream::FrameList::operator[](size_t index) const {
+  if (!table_.IsOpen()) return frames_[index];
+
+  const EventFrameTable::Record record = table_.At(index);
+  const Microseconds offset(record.offset);
+  const Microseconds delta = index ? offset - table_.Offset(index - 1) : offset;
+  return FrameData(index + 1, start_time_ + offset, offset, delta, record.in_db);
+}
+
+size_t EventStream::FrameList::LowerBound(SystemTimePoint timestamp) const {
+  size_t low = 0;
+  size_t high = size();
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if ((*this)[middle].timestamp < timestamp) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+size_t EventStream::FrameList::UpperBound(Microseconds offset) const {
+  if (table_.IsOpen()) return table_.UpperBound(offset);
+  return std::upper_bound(frames_.begin(), frames_.end(), offset,
+  [](const Microseconds &o, const FrameData &frame) {
+    return o < frame.offset;
+  }) - frames_.begin();
+}
+
 bool EventStream::loadInitialEventData(int monitor_id, SystemTimePoint event_time) {
   std::string sql = stringtf("SELECT `Id` FROM `Events` WHERE "
                              "`MonitorId` = %d AND unix_timestamp(`EndDateTime`) > %jd "
@@ -92,39 +128,36 @@ bool EventStream::seek(SystemTimePoint event_time) {
 
   // Binary search: frames are sorted by timestamp (ascending).
   // Find the first frame whose timestamp >= event_time.
-  auto it = std::lower_bound(
-    event_data->frames.begin(),
-    event_data->frames.end(),
-    event_time,
-    [](const FrameData &frame, const SystemTimePoint &t) {
-      return frame.timestamp < t;
-    });
+  const size_t num_frames = event_data->frames.size();
+  size_t index = event_data->frames.LowerBound(event_time);
 
   // If event_time is past all frame timestamps (e.g. at event end_time),
   // step back to the last frame so the delta check below can evaluate it.
-  if (it == event_data->frames.end() && it != event_data->frames.begin()) {
-    --it;
+  if (index == num_frames && index != 0) {
+    --index;
   }
 
   // Check if the previous frame's time window covers event_time.
   // Original logic: timestamp + delta >= event_time allows a frame whose
   // timestamp is before the target to match if its display window extends
   // past it.
-  if (it != event_data->frames.begin()) {
-    auto prev = std::prev(it);
-    if (prev->timestamp + prev->delta >= event_time) {
-      it = prev;
+  if (index != 0) {
+    const FrameData prev = event_data->frames[index - 1];
+    if (prev.timestamp + prev.delta >= event_time) {
+      --index;
     }
   }
 
-  if (it != event_data->frames.end() &&
-      (it->timestamp >= event_time || it->timestamp + it->delta >= event_time)) {
-    curr_frame_id = static_cast<int>(std::distance(event_data->frames.begin(), it)) + 1;
-    curr_stream_time = event_time;
-    Debug(3, "Set curr_stream_time: %.2f, curr_frame_id: %d",
-        FPSeconds(curr_stream_time.time_since_epoch()).count(),
-        curr_frame_id);
-    return true;
+  if (index != num_frames) {
+    const FrameData frame = event_data->frames[index];
+    if (frame.timestamp >= event_time || frame.timestamp + frame.delta >= event_time) {
+      curr_frame_id = static_cast<int>(index) + 1;
+      curr_stream_time = event_time;
+      Debug(3, "Set curr_stream_time: %.2f, curr_frame_id: %d",
+          FPSeconds(curr_stream_time.time_since_epoch()).count(),
+          curr_frame_id);
+      return true;
+    }
   }
     Warning("Requested an event time less than the start of the event. event_time %" PRIi64 " < start_time %" PRIi64,
         static_cast<int64>(std::chrono::duration_cast<Seconds>(event_time.time_since_epoch()).count()),
@@ -187,13 +220,7 @@ bool EventStream::loadEventData(uint64_t event_id) {
   event_data->duration = std::chrono::duration_cast<Microseconds>(dbrow[5] ? FPSeconds(atof(dbrow[5])) : event_data->end_time - event_data->start_time);
   event_data->video_file = dbrow[6] ? std::string(dbrow[6]) : std::string();
   std::string scheme_str = dbrow[7] ? std::string(dbrow[7]) : std::string();
-  if ( scheme_str == "Deep" ) {
-    event_data->scheme = Storage::DEEP;
-  } else if ( scheme_str == "Medium" ) {
-    event_data->scheme = Storage::MEDIUM;
-  } else {
-    event_data->scheme = Storage::SHALLOW;
-  }
+  event_data->scheme = Storage::SchemeFromString(scheme_str);
   event_data->SaveJPEGs = dbrow[8] == nullptr ? 0 : atoi(dbrow[8]);
   event_data->Orientation = (Monitor::Orientation)(dbrow[9] == nullptr ? 0 : atoi(dbrow[9]));
   mysql_free_result(result);
@@ -213,49 +240,8 @@ bool EventStream::loadEventData(uint64_t event_id) {
     delete storage;
     storage = new Storage(event_data->storage_id);
   }
-  const char *storage_path = storage->Path();
-
-  if (event_data->scheme == Storage::DEEP) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(event_data->start_time);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      event_data->path = stringtf("%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                                  storage_path, event_data->monitor_id,
-                                  event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                                  event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    } else {
-      event_data->path = stringtf("%s/%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                                  staticConfig.PATH_WEB.c_str(), storage_path, event_data->monitor_id,
-                                  event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                                  event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    }
-  } else if (event_data->scheme == Storage::MEDIUM) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(event_data->start_time);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      event_data->path = stringtf("%s/%u/%04d-%02d-%02d/%" PRIu64,
-                                  storage_path, event_data->monitor_id,
-                                  event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                                  event_data->event_id);
-    } else {
-      event_data->path = stringtf("%s/%s/%u/%04d-%02d-%02d/%" PRIu64,
-                                  staticConfig.PATH_WEB.c_str(), storage_path, event_data->monitor_id,
-                                  event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                                  event_data->event_id);
-    }
-  } else {
-    if (storage_path[0] == '/') {
-      event_data->path = stringtf("%s/%u/%" PRIu64, storage_path, event_data->monitor_id, event_data->event_id);
-    } else {
-      event_data->path = stringtf("%s/%s/%u/%" PRIu64,
-                                  staticConfig.PATH_WEB.c_str(), storage_path, event_data->monitor_id,
-                                  event_data->event_id);
-    }
-  }
+  event_data->path = Storage::EventPath(storage->Path(), event_data->scheme,
+                                        event_data->monitor_id, event_data->event_id, event_data->start_time);
 
   double fps = 1.0;
   if ((event_data->frame_count and event_data->duration != Seconds(0))) {
@@ -263,9 +249,73 @@ bool EventStream::loadEventData(uint64_t event_id) {
   }
   updateFrameRate(fps);
 
-  sql = stringtf("SELECT `FrameId`, unix_timestamp(`TimeStamp`), `Delta` "
-                 "FROM `Frames` WHERE `EventId` = %" PRIu64 " ORDER BY `FrameId` ASC", event_id);
-  result = zmDbFetch(sql);
+  if (event_data->frames.Map(event_data->path + "/" + EventFrameTable::kFileName, event_data->start_time)) {
+    // Events still being recorded get their Frames count updated less often
+    event_data->n_frames = event_data->frames.size();
+    if (event_data->frame_count < event_data->n_frames)
+      event_data->frame_count = event_data->n_frames;
+    event_data->last_frame_id = event_data->n_frames;
+  } else {
+    loadDbFrames();
+  }
+
+  if (!event_data->video_file.empty()) {
+    std::string filepath = event_data->path + "/" + event_data->video_file;
+    Debug(1, "Loading video file from %s", filepath.c_str());
+    delete ffmpeg_input;
+
+    ffmpeg_input = new FFmpeg_Input();
+    if (ffmpeg_input->Open(filepath.c_str()) < 0) {
+      Warning("Unable to open ffmpeg_input %s", filepath.c_str());
+      delete ffmpeg_input;
+      ffmpeg_input = nullptr;
+    }
+  }
+  // Started from sendFrame, once the frame type is known
+  prefetch_stale_ = true;
+
+  // Not sure about this
+  if ( forceEventChange || mode == MODE_ALL_GAPLESS ) {
+    if (event_data->frames.empty()) {
+      curr_stream_time = event_data->start_time;
+    } else if ( replay_rate > 0 ) {
+      curr_stream_time = event_data->frames[0].timestamp;
+    } else {
+      curr_stream_time = event_data->frames[event_data->frames.size()-1].timestamp;
+    }
+  }
+  if (logLevel() >= Logger::DEBUG2) {
+    // Query actual frame-span duration from the Frames table and compare
+    // against Event Length to diagnose DB queue lag, unclean shutdowns,
+    // clock jumps, or bulk frame gaps.
+    double frames_duration = 0.0;
+    std::string fdsql = stringtf(
+      "SELECT max(`Delta`)-min(`Delta`) FROM `Frames` WHERE `EventId` = %" PRIu64,
+      event_data->event_id);
+    MYSQL_RES *fdresult = zmDbFetch(fdsql);
+    if (fdresult) {
+      MYSQL_ROW fdrow = mysql_fetch_row(fdresult);
+      if (fdrow && fdrow[0])
+        frames_duration = atof(fdrow[0]);
+      mysql_free_result(fdresult);
+    }
+    Debug(2, "Event: %" PRIu64 ", Frames: %d, Last Frame ID (%d, Duration: %.2f s Frames Duration: %.2f s",
+          event_data->event_id,
+          event_data->frame_count,
+          event_data->last_frame_id,
+          FPSeconds(event_data->duration).count(),
+          frames_duration);
+  }
+
+  return true;
+} // bool EventStream::loadEventData( int event_id )
+
+// For events recorded without a frame table.  The Frames table only has rows
+// for some frames, so the rest are interpolated between them.
+void EventStream::loadDbFrames() {
+  std::string sql = stringtf("SELECT `FrameId`, unix_timestamp(`TimeStamp`), `Delta` "
+                             "FROM `Frames` WHERE `EventId` = %" PRIu64 " ORDER BY `FrameId` ASC", event_data->event_id);
+  MYSQL_RES *result = zmDbFetch(sql);
   if (!result) {
     exit(-1);
   }
@@ -286,7 +336,7 @@ bool EventStream::loadEventData(uint64_t event_id) {
 
   // Here are the issues: if showing jpegs, need FrameId.
   // Delta is the time since last frame, not since beginning of Event
-  while ((dbrow = mysql_fetch_row(result))) {
+  while (MYSQL_ROW dbrow = mysql_fetch_row(result)) {
     int id = atoi(dbrow[0]);
     //timestamp = atof(dbrow[1]); // timestamp is useless because it's just seconds.
     // What is in the Delta column is distance from StartTime.  We will call that offset.
@@ -391,55 +441,7 @@ bool EventStream::loadEventData(uint64_t event_id) {
     exit(mysql_errno(&dbconn));
   }
   mysql_free_result(result);
-
-  if (!event_data->video_file.empty()) {
-    std::string filepath = event_data->path + "/" + event_data->video_file;
-    Debug(1, "Loading video file from %s", filepath.c_str());
-    delete ffmpeg_input;
-
-    ffmpeg_input = new FFmpeg_Input();
-    if (ffmpeg_input->Open(filepath.c_str()) < 0) {
-      Warning("Unable to open ffmpeg_input %s", filepath.c_str());
-      delete ffmpeg_input;
-      ffmpeg_input = nullptr;
-    }
-  }
-
-  // Not sure about this
-  if ( forceEventChange || mode == MODE_ALL_GAPLESS ) {
-    if (event_data->frames.empty()) {
-      curr_stream_time = event_data->start_time;
-    } else if ( replay_rate > 0 ) {
-      curr_stream_time = event_data->frames[0].timestamp;
-    } else {
-      curr_stream_time = event_data->frames[event_data->frames.size()-1].timestamp;
-    }
-  }
-  if (logLevel() >= Logger::DEBUG2) {
-    // Query actual frame-span duration from the Frames table and compare
-    // against Event Length to diagnose DB queue lag, unclean shutdowns,
-    // clock jumps, or bulk frame gaps.
-    double frames_duration = 0.0;
-    std::string fdsql = stringtf(
-      "SELECT max(`Delta`)-min(`Delta`) FROM `Frames` WHERE `EventId` = %" PRIu64,
-      event_data->event_id);
-    MYSQL_RES *fdresult = zmDbFetch(fdsql);
-    if (fdresult) {
-      MYSQL_ROW fdrow = mysql_fetch_row(fdresult);
-      if (fdrow && fdrow[0])
-        frames_duration = atof(fdrow[0]);
-      mysql_free_result(fdresult);
-    }
-    Debug(2, "Event: %" PRIu64 ", Frames: %d, Last Frame ID (%d, Duration: %.2f s Frames Duration: %.2f s",
-          event_data->event_id,
-          event_data->frame_count,
-          event_data->last_frame_id,
-          FPSeconds(event_data->duration).count(),
-          frames_duration);
-  }
-
-  return true;
-} // bool EventStream::loadEventData( int event_id )
+}  // void EventStream::loadDbFrames()
 
 void EventStream::processCommand(const CmdMsg *msg) {
   Debug(2, "Got message, type %d, msg %d", msg->msg_type, msg->msg_data[0]);
@@ -655,19 +657,13 @@ void EventStream::processCommand(const CmdMsg *msg) {
 
     // Binary search: frames are sorted by offset (ascending).
     // Find the last frame whose offset <= the target offset.
-    auto it = std::upper_bound(
-      event_data->frames.begin(),
-      event_data->frames.end(),
-      offset,
-      [](const FPSeconds &o, const FrameData &frame) {
-        return o < frame.offset;
-      });
+    size_t index = event_data->frames.UpperBound(std::chrono::duration_cast<Microseconds>(offset));
 
     // upper_bound gives first frame with offset > target; step back one
-    if (it != event_data->frames.begin())
-      --it;
+    if (index != 0)
+      --index;
 
-    curr_frame_id = static_cast<int>(std::distance(event_data->frames.begin(), it)) + 1;
+    curr_frame_id = static_cast<int>(index) + 1;
 
     curr_stream_time = event_data->frames[curr_frame_id-1].timestamp;
     Debug(1, "Got SEEK command, to %f s (new current frame id: %d offset %f s)",
@@ -859,33 +855,28 @@ bool EventStream::sendFrame(Microseconds delta_us) {
     curr_frame_id = std::clamp(curr_frame_id, 1, (int)event_data->frames.size());
   }
 
+  if (prefetch_stale_) startPrefetch();
+  // Whatever the prefetch thread has already found or decoded for this frame
+  EventFramePrefetcher::Frame prefetched;
+  bool have_prefetched = false;
+  const bool keyframes_only = keyframesOnly();
+  if (prefetcher_.Running()) {
+    prefetcher_.Request(curr_frame_id, (replay_rate < 0 ? -1 : 1) * std::max(frame_mod, 1), keyframes_only);
+    have_prefetched = prefetcher_.Get(curr_frame_id, prefetched, PREFETCH_WAIT);
+  }
+
   // Reusable string member avoids per-frame heap allocations.
   // After the first frame, the string's buffer is reused (unless path exceeds capacity).
   reuse_filepath_.clear();
-  // exists() with an error_code overload mirrors stat()'s behaviour (treat any
-  // failure as "not present") without throwing or filling an unused struct stat.
-  std::error_code exists_ec;
 
   // This needs to be abstracted.  If we are saving jpgs, then load the capture file.
   // If we are only saving analysis frames, then send that.
-  if ((frame_type == FRAME_ANALYSIS) && (event_data->SaveJPEGs & 2)) {
-    reuse_filepath_ = stringtf(staticConfig.analyse_file_format.c_str(), event_data->path.c_str(), curr_frame_id);
-    if (!std::filesystem::exists(reuse_filepath_, exists_ec)) {
-      Debug(1, "analyze file %s not found will try to stream from other", reuse_filepath_.c_str());
-      reuse_filepath_ = stringtf(staticConfig.capture_file_format.c_str(), event_data->path.c_str(), curr_frame_id);
-      if (!std::filesystem::exists(reuse_filepath_, exists_ec)) {
-        Debug(1, "capture file %s not found either", reuse_filepath_.c_str());
-        reuse_filepath_.clear();
-      }
-    }
-  } else if (event_data->SaveJPEGs & 1) {
-    reuse_filepath_ = stringtf(staticConfig.capture_file_format.c_str(), event_data->path.c_str(), curr_frame_id);
-    if (!std::filesystem::exists(reuse_filepath_, exists_ec)) {
-      Debug(1, "Capture file %s not found (bulk/interpolated frame %d), trying ffmpeg_input",
-            reuse_filepath_.c_str(), curr_frame_id);
-      reuse_filepath_.clear();
-      // Fall through — ffmpeg_input will be tried below if available
-    }
+  if (have_prefetched) {
+    reuse_filepath_ = prefetched.path;
+  } else if (((frame_type == FRAME_ANALYSIS) && (event_data->SaveJPEGs & 2)) || (event_data->SaveJPEGs & 1)) {
+    // Empty if there is no jpeg, in which case ffmpeg_input will be tried below if available
+    reuse_filepath_ = EventFramePrefetcher::FramePath(event_data->path, event_data->SaveJPEGs,
+                                                      frame_type == FRAME_ANALYSIS, curr_frame_id);
   } else if (!ffmpeg_input) {
     Fatal("JPEGS not saved. zms is not capable of streaming jpegs from mp4 yet");
     return false;
@@ -918,9 +909,8 @@ bool EventStream::sendFrame(Microseconds delta_us) {
     bool send_raw = (type == STREAM_JPEG) && ((scale >= ZM_SCALE_BASE) && (zoom == ZM_SCALE_BASE)) && !reuse_filepath_.empty();
 
     if (send_raw) {
-      fprintf(stdout, "--" BOUNDARY "\r\n");
       if (!send_file(reuse_filepath_)) {
-        Error("Can't send %s: %s", reuse_filepath_.c_str(), strerror(errno));
+        Error("Can't send %s", reuse_filepath_.c_str());
         return false;
       }
     } else {
@@ -937,12 +927,16 @@ bool EventStream::sendFrame(Microseconds delta_us) {
         // malloc/free per streamed frame.
         reuse_image_.ReadJpeg(reuse_filepath_, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB);
         image = &reuse_image_;
+      } else if (prefetched.image) {
+        // Already decoded and rotated by the prefetch thread
+        image = prefetched.image.get();
       } else if (ffmpeg_input) {
         // Get the frame from the mp4 input
-        const FrameData *frame_data = &event_data->frames[curr_frame_id-1];
+        const FrameData frame_data = event_data->frames[curr_frame_id-1];
+        ffmpeg_input->set_keyframes_only(keyframes_only);
         AVFrame *frame = ffmpeg_input->get_frame(
                            ffmpeg_input->get_video_stream_id(),
-                           FPSeconds(frame_data->offset).count());
+                           FPSeconds(frame_data.offset).count());
         if (frame) {
           owned_image = std::make_unique<Image>(frame, monitor->Width(), monitor->Height());
           image = owned_image.get();
@@ -1027,6 +1021,36 @@ bool EventStream::sendFrame(Microseconds delta_us) {
   return true;
 }  // bool EventStream::sendFrame( int delta_us )
 
+void EventStream::startPrefetch() {
+  prefetch_stale_ = false;
+  prefetcher_.Stop();
+  if (!event_data) return;
+  const bool analysis = (frame_type == FRAME_ANALYSIS);
+  if (!(analysis and (event_data->SaveJPEGs & 2)) and !(event_data->SaveJPEGs & 1) and !ffmpeg_input) return;
+
+  EventFramePrefetcher::Source source;
+  source.event_path = event_data->path;
+  source.save_jpegs = event_data->SaveJPEGs;
+  source.analysis = analysis;
+  if (ffmpeg_input)
+    source.video_path = event_data->path + "/" + event_data->video_file;
+  if (event_data->frames.Mapped()) {
+    // Mapped again by the prefetcher, rather than paging the whole table in
+    // here to copy it on every load of an event still being recorded
+    source.frame_table_path = event_data->path + "/" + EventFrameTable::kFileName;
+  } else {
+    source.offsets.reserve(event_data->frames.size());
+    for (size_t i = 0; i < event_data->frames.size(); i++)
+      source.offsets.push_back(event_data->frames[i].offset);
+  }
+  source.width = monitor->Width();
+  source.height = monitor->Height();
+  // when stored as an mp4, we just have the rotation as a flag in the headers
+  source.orientation = (monitor->GetOptVideoWriter() == Monitor::PASSTHROUGH) ?
+                       event_data->Orientation : Monitor::ROTATE_0;
+  prefetcher_.Start(std::move(source));
+}  // void EventStream::startPrefetch()
+
 void EventStream::runStream() {
   openComms();
 
@@ -1153,8 +1177,8 @@ void EventStream::runStream() {
       if (!paused && !stopped && !event_data->frames.empty()
           && curr_frame_id >= 1 && curr_frame_id <= (int)event_data->frames.size()) {
         // Get current frame data, curr_frame_id may have changed
-        FrameData *last_frame_data = &event_data->frames[curr_frame_id-1];
-        curr_stream_time = last_frame_data->timestamp;
+        const FrameData last_frame_data = event_data->frames[curr_frame_id-1];
+        curr_stream_time = last_frame_data.timestamp;
         curr_frame_id += (replay_rate > 0 ? frame_mod : -1*frame_mod);
 
         // we incremented by replay_rate, so might have jumped past frames.size()
@@ -1168,24 +1192,24 @@ void EventStream::runStream() {
         }
 
         if (curr_frame_id >= 1 && curr_frame_id <= num_frames) {
-          const FrameData *next_frame_data = &event_data->frames[curr_frame_id-1];
+          const FrameData next_frame_data = event_data->frames[curr_frame_id-1];
           Debug(3, "Have Frame %d %d timestamp (%f s), offset (%f s) delta (%f s), in_db (%d)",
-                curr_frame_id, next_frame_data->id,
-                FPSeconds(next_frame_data->timestamp.time_since_epoch()).count(),
-                FPSeconds(next_frame_data->offset).count(),
-                FPSeconds(next_frame_data->delta).count(),
-                next_frame_data->in_db);
+                curr_frame_id, next_frame_data.id,
+                FPSeconds(next_frame_data.timestamp.time_since_epoch()).count(),
+                FPSeconds(next_frame_data.offset).count(),
+                FPSeconds(next_frame_data.delta).count(),
+                next_frame_data.in_db);
 
           // frame_data->delta is the time since last frame as a float in seconds
           // but what if we are skipping frames? We need the distance from the last frame sent
           // Also, what about reverse? needs to be absolute value
 
-          delta = abs(next_frame_data->offset - last_frame_data->offset);
+          delta = abs(next_frame_data.offset - last_frame_data.offset);
           if (frame_mod) delta /= frame_mod;
           Debug(2, "New delta: %fs from last frame offset %fs - next_frame_offset %fs",
                 FPSeconds(delta).count(),
-                FPSeconds(last_frame_data->offset).count(),
-                FPSeconds(next_frame_data->offset).count());
+                FPSeconds(last_frame_data.offset).count(),
+                FPSeconds(next_frame_data.offset).count());
           // if effective > base we should speed up frame delivery
           if (base_fps < effective_fps) {
             delta = std::chrono::duration_cast<Microseconds>((delta * base_fps) / effective_fps);
@@ -1207,8 +1231,8 @@ void EventStream::runStream() {
 
           Debug(2, "New delta: %fs from next frame offset %fs - last_frame_offset %fs - elapsed %fs",
                 FPSeconds(delta).count(),
-                FPSeconds(next_frame_data->offset).count(),
-                FPSeconds(last_frame_data->offset).count(),
+                FPSeconds(next_frame_data.offset).count(),
+                FPSeconds(last_frame_data.offset).count(),
                 FPSeconds(elapsed).count()
                );
         }  // end if not at end of event
@@ -1287,45 +1311,21 @@ void EventStream::runStream() {
 } // end void EventStream::runStream()
 
 bool EventStream::send_file(const std::string &filepath) {
-  FILE *fdj = fopen(filepath.c_str(), "rb");
-  if (!fdj) {
-    Error("Can't open %s: %s", filepath.c_str(), strerror(errno));
-    std::string error_message = stringtf("Can't open %s: %s", filepath.c_str(), strerror(errno));
+  fflush(stdout);
+  int err = zm_sendfile_part(fileno(stdout), filepath, "--" BOUNDARY "\r\nContent-Type: image/jpeg\r\n");
+  if (!err) return true;
+
+  if (err == ENOENT or err == EACCES) {
+    // Nothing has been written yet, so the error can go out as a frame of its own
+    Error("Can't open %s: %s", filepath.c_str(), strerror(err));
+    std::string error_message = stringtf("Can't open %s: %s", filepath.c_str(), strerror(err));
     return sendTextFrame(error_message.c_str());
   }
-  static struct stat filestat;
-  if (fstat(fileno(fdj), &filestat) < 0) {
-    fclose(fdj); /* Close the file handle */
-    Error("Failed getting information about file %s: %s", filepath.c_str(), strerror(errno));
-    return false;
-  }
-  if (!filestat.st_size) {
-    fclose(fdj); /* Close the file handle */
-    Info("File size is zero. Unable to send raw frame %d: %s", curr_frame_id, strerror(errno));
-    return false;
-  }
-  if (0 > fprintf(stdout, "Content-Length: %jd\r\n\r\n", static_cast<intmax_t>(filestat.st_size))) {
-    fclose(fdj); /* Close the file handle */
-    Info("Unable to send raw frame %d: %s", curr_frame_id, strerror(errno));
-    return false;
-  }
-  ssize_t remaining = filestat.st_size;
-
-  while (remaining > 0) {
-    ssize_t rc = zm_sendfile(fileno(stdout), fileno(fdj), nullptr, remaining);
-    if (rc < 0) break;
-    if (rc > 0) {
-      remaining -= rc;
-    }
-  }  // end while remaining
-
-  if (!remaining) {
-    // Success
-    fclose(fdj); /* Close the file handle */
-    return true;
+  if (err == ENODATA) {
+    Info("File size is zero. Unable to send raw frame %d", curr_frame_id);
+  } else {
+    Warning("Unable to send raw frame %d: %s", curr_frame_id, strerror(err));
   }
-  Warning("Unable to send raw frame %d: %s %zu remaining",
-          curr_frame_id, strerror(errno), remaining);
   return false;
 }  // end bool EventStream::send_file(const std::string &filepath)
 
@@ -21,6 +21,8 @@
 #define ZM_EVENTSTREAM_H
 
 #include "zm_define.h"
+#include "zm_event_frame_table.h"
+#include "zm_event_prefetcher.h"
 #include "zm_ffmpeg_input.h"
 #include "zm_monitor.h"
 #include "zm_storage.h"
@@ -32,7 +34,10 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
+#include <cstdlib>
 #include <mutex>
+#include <utility>
+#include <vector>
 
 class EventStream : public StreamBase {
  public:
@@ -56,6 +61,40 @@ class EventStream : public StreamBase {
     }
   };
 
+  // The frames of an event, indexed from 0 for frame id 1.  Mapped from the
+  // event's frame table when it has one, otherwise built from the Frames
+  // table.  Frames come back by value since mapped ones are made on demand.
+  class FrameList {
+   public:
+    FrameList() {}
+    FrameList(const FrameList &) = delete;
+    FrameList &operator=(const FrameList &) = delete;
+
+    bool Map(const std::string &path, SystemTimePoint start_time);
+    bool Mapped() const { return table_.IsOpen(); }
+
+    size_t size() const { return table_.IsOpen() ? table_.Size() : frames_.size(); }
+    bool empty() const { return size() == 0; }
+    FrameData operator[](size_t index) const;
+    void clear() {
+      frames_.clear();
+      table_.Close();
+    }
+    void reserve(size_t count) { frames_.reserve(count); }
+    template<typename... Args>
+    FrameData &emplace_back(Args &&... args) { return frames_.emplace_back(std::forward<Args>(args)...); }
+
+    // Index of the first frame at or after timestamp
+    size_t LowerBound(SystemTimePoint timestamp) const;
+    // Index of the first frame with an offset greater than offset
+    size_t UpperBound(Microseconds offset) const;
+
+   private:
+    std::vector<FrameData> frames_;
+    EventFrameTable table_;
+    SystemTimePoint start_time_;
+  };
+
   struct EventData {
     uint64_t  event_id;
     unsigned int    monitor_id;
@@ -67,7 +106,7 @@ class EventStream : public StreamBase {
     Microseconds duration;
     std::string path;
     int             n_frames;       // # of frame rows returned from database
-    std::vector<FrameData> frames;
+    FrameList       frames;
     std::string video_file;
     Storage::Schemes  scheme;
     int             SaveJPEGs;
@@ -76,6 +115,12 @@ class EventStream : public StreamBase {
 
  protected:
   static constexpr Milliseconds STREAM_PAUSE_WAIT = Milliseconds(250);
+  // How long to wait for the prefetcher before decoding a frame
+  // ourselves.  A few frame times, not a GOP decode.
+  static constexpr Milliseconds PREFETCH_WAIT = Milliseconds(100);
+  // From this replay rate, in either direction, video events only show
+  // keyframes rather than decoding every frame in between
+  static constexpr int KEYFRAME_ONLY_RATE = 8 * ZM_RATE_BASE;
 
   static const StreamMode DEFAULT_MODE = MODE_SINGLE;
 
@@ -92,12 +137,18 @@ class EventStream : public StreamBase {
 
  protected:
   bool loadEventData(uint64_t event_id);
+  void loadDbFrames();
   bool loadInitialEventData(uint64_t init_event_id, int init_frame_id);
   bool loadInitialEventData(int monitor_id, SystemTimePoint event_time);
 
   bool checkEventLoaded();
   void processCommand(const CmdMsg *msg) override;
   bool sendFrame(Microseconds delta);
+  bool keyframesOnly() const { return std::abs(replay_rate) >= KEYFRAME_ONLY_RATE; }
+  void startPrefetch();
+
+  EventFramePrefetcher prefetcher_;
+  bool prefetch_stale_;  // event_data has changed since the prefetcher was started
 
  public:
   EventStream() :
@@ -106,6 +157,7 @@ class EventStream : public StreamBase {
     curr_frame_id(0),
     send_frame(false),
     event_data(nullptr),
+    prefetch_stale_(false),
     storage(nullptr),
     ffmpeg_input(nullptr)
   {}
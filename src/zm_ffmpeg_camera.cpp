@@ -627,8 +627,9 @@ int FfmpegCamera::OpenFfmpeg() {
     // libavcodec defaults thread_count to 1, making software 1080p H.264
     // decode hit ~60ms/frame and saturate a core per camera.  Default to 2
     // frame-threads instead.  User can override (including 0 = auto) via
-    // thread_count in monitor Options.
-    mVideoCodecContext->thread_count = 2;
+    // thread_count in monitor Options.  The decoder pool already spreads
+    // monitors over all cores, so don't add codec threads on top of it.
+    mVideoCodecContext->thread_count = config.decoder_pool ? 1 : 2;
     mVideoCodecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
 
     // Set default options for this codec
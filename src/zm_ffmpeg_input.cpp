@@ -9,7 +9,9 @@ FFmpeg_Input::FFmpeg_Input() :
   audio_stream_id(-1),
   input_format_context(nullptr),
   last_seek_request(-1),
-  hw_device_ctx(nullptr)
+  hw_device_ctx(nullptr),
+  keyframes_only(false),
+  last_keyframe_index(-1)
 {
   FFMPEGInit();
 }
@@ -260,6 +262,9 @@ AVFrame *FFmpeg_Input::get_frame(int stream_id, double at) {
   seek_target = av_rescale_q(seek_target, AV_TIME_BASE_Q, input_format_context->streams[stream_id]->time_base);
   Debug(1, "Getting frame from stream %d at %" PRId64, stream_id, seek_target);
 
+  if (keyframes_only and (stream_id == video_stream_id))
+    return get_keyframe(stream_id, seek_target);
+
   int ret;
 
   if (!frame) {
@@ -378,3 +383,99 @@ AVFrame *FFmpeg_Input::get_frame(int stream_id, double at) {
 
   return get_frame(stream_id);
 }
+
+void FFmpeg_Input::set_keyframes_only(bool on) {
+  if (on == keyframes_only) return;
+  Debug(1, "%s keyframe only decoding", on ? "Starting" : "Stopping");
+  keyframes_only = on;
+
+  // Lets demuxers that can skip non key packets do so, and the decoder drop
+  // any that still get through.
+  const AVDiscard discard = on ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  if (input_format_context and (video_stream_id >= 0)) {
+    input_format_context->streams[video_stream_id]->discard = discard;
+    if (streams[video_stream_id].context)
+      streams[video_stream_id].context->skip_frame = discard;
+  }
+
+  // Neither mode can carry on from where the other left off
+  frame.reset();
+  last_seek_request = -1;
+  last_keyframe_index = -1;
+}
+
+/* The keyframe at or before seek_target, decoded on its own */
+AVFrame *FFmpeg_Input::get_keyframe(int stream_id, int64_t seek_target) {
+  AVStream *stream = input_format_context->streams[stream_id];
+
+  // The index tells us which keyframe we want without touching the file, so
+  // moving around within a GOP costs nothing.
+  int index = av_index_search_timestamp(stream, seek_target, AVSEEK_FLAG_BACKWARD);
+  if (frame and (index >= 0) and (index == last_keyframe_index)) {
+    Debug(2, "Still on keyframe %d for %" PRId64, index, seek_target);
+    return frame.get();
+  }
+
+  int ret = av_seek_frame(input_format_context, stream_id, seek_target, AVSEEK_FLAG_BACKWARD);
+  if (ret < 0) {
+    Error("Unable to seek in stream %d: %s", stream_id, av_make_error_string(ret).c_str());
+    return nullptr;
+  }
+  // Forget the old keyframe until we know which one the seek found
+  last_keyframe_index = -1;
+
+  av_packet_ptr packet{av_packet_alloc()};
+  if (!packet) {
+    Error("Unable to allocate packet.");
+    return nullptr;
+  }
+  while (true) {
+    ret = av_read_frame(input_format_context, packet.get());
+    if (ret < 0) {
+      if ((ret == AVERROR_EOF) or (input_format_context->pb and input_format_context->pb->eof_reached)) {
+        Info("av_read_frame returned %s.", av_make_error_string(ret).c_str());
+      } else {
+        Error("Unable to read packet from stream %d: error %d \"%s\".",
+              stream_id, ret, av_make_error_string(ret).c_str());
+      }
+      frame.reset();
+      return nullptr;
+    }
+    if ((packet->stream_index == stream_id) and (packet->flags & AV_PKT_FLAG_KEY)) break;
+    av_packet_unref(packet.get());
+  }
+  ZM_DUMP_STREAM_PACKET(stream, packet, "Keyframe packet");
+
+  // Decode the keyframe by itself and drain it straight out, rather than
+  // wait for packets that we are going to skip anyway.
+  AVCodecContext *context = streams[stream_id].context;
+  avcodec_flush_buffers(context);
+  ret = avcodec_send_packet(context, packet.get());
+  if (ret < 0) {
+    Error("Unable to send packet %d %s", ret, av_make_error_string(ret).c_str());
+    frame.reset();
+    return nullptr;
+  }
+  avcodec_send_packet(context, nullptr);
+
+  frame = av_frame_ptr{av_frame_alloc()};
+  if (!frame) {
+    Error("Unable to allocate frame.");
+    return nullptr;
+  }
+  ret = avcodec_receive_frame(context, frame.get());
+  // Draining leaves the decoder finished, so reset it for the next packet
+  avcodec_flush_buffers(context);
+  if (ret < 0) {
+    Error("Unable to decode keyframe: %d %s", ret, av_make_error_string(ret).c_str());
+    frame.reset();
+    return nullptr;
+  }
+  zm_dump_video_frame(frame.get(), "keyframe");
+
+  // The seek can land somewhere other than where the index said, so remember
+  // the keyframe we actually decoded, as the index has it.
+  last_keyframe_index = av_index_search_timestamp(stream,
+      (packet->dts != AV_NOPTS_VALUE) ? packet->dts : packet->pts, AVSEEK_FLAG_BACKWARD);
+  return frame.get();
+}  // end AVFrame *FFmpeg_Input::get_keyframe
@@ -25,6 +25,13 @@ class FFmpeg_Input {
   int Close();
   AVFrame *get_frame(int stream_id=-1);
   AVFrame *get_frame(int stream_id, double at);
+  // Decode nothing but keyframes, so that get_frame(stream_id, at) returns
+  // the keyframe at or before at instead of decoding its way up to at.
+  // Meant for fast forward and thumbnails.  Call after Open.
+  void set_keyframes_only(bool on);
+  bool is_keyframes_only() const {
+    return keyframes_only;
+  }
   int get_video_stream_id() const {
     return video_stream_id;
   }
@@ -55,6 +62,10 @@ class FFmpeg_Input {
   av_frame_ptr frame;
   int64_t last_seek_request;
   AVBufferRef *hw_device_ctx;
+  bool keyframes_only;
+  int last_keyframe_index;
+
+  AVFrame *get_keyframe(int stream_id, int64_t seek_target);
 };
 
 #endif
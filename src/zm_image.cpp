@@ -26,6 +26,10 @@
 
 #include <libavutil/pixdesc.h>
 
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE)
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
 #include <fcntl.h>
 #include <mutex>
@@ -83,6 +87,12 @@ static deinterlace_4field_fptr_t fptr_deinterlace_4field_gray8;
 /* Pointer to image buffer memory copy function */
 imgbufcpy_fptr_t fptr_imgbufcpy;
 
+/* Pointer to 2x2 box filter function */
+static halve_fptr_t fptr_halve8;
+
+/* Pointer to masked copy function */
+static maskcopy_fptr_t fptr_masked_copy8;
+
 /* Font */
 static ZmFont font;
 
@@ -140,7 +150,8 @@ Image::Image() :
   buffertype(ZM_BUFTYPE_DONTFREE),
   holdbuffer(0),
   blend_buffer_(nullptr),
-  blend_buffer_size_(0) {
+  blend_buffer_size_(0),
+  scale_scratch_(nullptr) {
   if (!initialised)
     Initialise();
   // Update blend to fast function determined by Initialise, I'm sure this can be improve.
@@ -165,6 +176,7 @@ Image::Image(const std::string &filename) {
   holdbuffer = 0;
   blend_buffer_ = nullptr;
   blend_buffer_size_ = 0;
+  scale_scratch_ = nullptr;
   ReadJpeg(filename, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB);
   update_function_pointers();
 }
@@ -180,7 +192,8 @@ Image::Image(int p_width, int p_height, int p_colours, int p_subpixelorder, uint
   buffer(p_buffer),
   holdbuffer(0),
   blend_buffer_(nullptr),
-  blend_buffer_size_(0) {
+  blend_buffer_size_(0),
+  scale_scratch_(nullptr) {
 
     if (!initialised)
       Initialise();
@@ -222,7 +235,8 @@ Image::Image(int p_width, int p_height, int p_colours, int p_subpixelorder, uint
   buffer(p_buffer),
   holdbuffer(0),
   blend_buffer_(nullptr),
-  blend_buffer_size_(0) {
+  blend_buffer_size_(0),
+  scale_scratch_(nullptr) {
 
   if (!initialised)
     Initialise();
@@ -264,7 +278,8 @@ Image::Image(int p_width, int p_linesize, int p_height, int p_colours, int p_sub
   subpixelorder(p_subpixelorder),
   buffer(p_buffer),
   blend_buffer_(nullptr),
-  blend_buffer_size_(0) {
+  blend_buffer_size_(0),
+  scale_scratch_(nullptr) {
   if ( !initialised )
     Initialise();
   pixels = width*height;
@@ -295,7 +310,8 @@ Image::Image(const AVFrame *frame, int p_width, int p_height) :
   buffer(0),
   holdbuffer(0),
   blend_buffer_(nullptr),
-  blend_buffer_size_(0) {
+  blend_buffer_size_(0),
+  scale_scratch_(nullptr) {
   width = (p_width == -1 ? frame->width : p_width);
   height = (p_height == -1 ? frame->height : p_height);
   pixels = width * height;
@@ -467,6 +483,7 @@ Image::Image(const Image &p_image) {
   holdbuffer = 0;
   blend_buffer_ = nullptr;
   blend_buffer_size_ = 0;
+  scale_scratch_ = nullptr;
   AllocImgBuffer(size);
   (*fptr_imgbufcpy)(buffer, p_image.buffer, size);
   annotation_ = p_image.annotation_;
@@ -481,6 +498,7 @@ Image::~Image() {
     blend_buffer_ = nullptr;
     blend_buffer_size_ = 0;
   }
+  delete scale_scratch_;
 }
 
 const std::string Image::toString() {
@@ -705,6 +723,25 @@ void Image::Initialise() {
   Debug(4, "Image buffer copy: Using standard memcpy");
 #endif
 
+#if defined(__i386__) || defined(__x86_64__)
+  if ( config.cpu_extensions && sse_version >= 20 ) {
+    fptr_halve8 = &sse2_halve8;
+    Debug(4, "Halve: Using SSE2 box filter");
+    fptr_masked_copy8 = &sse2_masked_copy8;
+    Debug(4, "Masked copy: Using SSE2 masked copy");
+  } else {
+    fptr_halve8 = &std_halve8;
+    Debug(4, "Halve: Using standard box filter");
+    fptr_masked_copy8 = &std_masked_copy8;
+    Debug(4, "Masked copy: Using standard masked copy");
+  }
+#else
+  fptr_halve8 = &std_halve8;
+  Debug(4, "Halve: Using standard box filter");
+  fptr_masked_copy8 = &std_masked_copy8;
+  Debug(4, "Masked copy: Using standard masked copy");
+#endif
+
   y_table = y_table_global;
   uv_table = uv_table_global;
   r_v_table = r_v_table_global;
@@ -1832,6 +1869,47 @@ bool Image::EncodeJpeg(JOCTET *outbuffer, size_t *outbuffer_size, int quality_ov
     jpeg_create_compress(cinfo);
   }
 
+  return EncodeJpeg(cinfo, jpg_err, outbuffer, outbuffer_size, quality);
+}
+
+namespace {
+
+struct ThreadJpegCompressor {
+  jpeg_compress_struct cinfo;
+  zm_error_mgr err;
+
+  ThreadJpegCompressor() {
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = zm_jpeg_error_exit;
+    err.pub.emit_message = zm_jpeg_emit_message;
+    jpeg_create_compress(&cinfo);
+  }
+  ~ThreadJpegCompressor() {
+    jpeg_destroy_compress(&cinfo);
+  }
+};
+
+}  // namespace
+
+bool Image::EncodeJpegThreadLocal(JOCTET *outbuffer, size_t *outbuffer_size, int quality_override) const {
+  if ( config.colour_jpeg_files && (imagePixFormat == AV_PIX_FMT_GRAY8) ) {
+    Image temp_image(*this);
+    temp_image.Colourise(ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB);
+    return temp_image.EncodeJpegThreadLocal(outbuffer, outbuffer_size, quality_override);
+  }
+
+  thread_local ThreadJpegCompressor compressor;
+  return EncodeJpeg(&compressor.cinfo, compressor.err, outbuffer, outbuffer_size,
+                    quality_override ? quality_override : config.jpeg_stream_quality);
+}
+
+bool Image::EncodeJpeg(jpeg_compress_struct *cinfo, zm_error_mgr &err,
+                       JOCTET *outbuffer, size_t *outbuffer_size, int quality) const {
+  if (setjmp(err.setjmp_buffer)) {
+    jpeg_abort_compress(cinfo);
+    return false;
+  }
+
   zm_jpeg_mem_dest(cinfo, outbuffer, outbuffer_size);
 
   cinfo->image_width = width;   /* image width and height, in pixels */
@@ -1998,7 +2076,7 @@ bool Image::Crop(const Box &limits) {
 
 /* Far from complete */
 /* Need to implement all possible of overlays possible */
-void Image::Overlay( const Image &image ) {
+void Image::Overlay( const Image &image, const Box *limits ) {
   if ( !(width == image.width && height == image.height) ) {
     Panic("Attempt to overlay different sized images, expected %dx%d, got %dx%d",
           width, height, image.width, image.height);
@@ -2021,6 +2099,26 @@ void Image::Overlay( const Image &image ) {
             colours, subpixelorder, image.colours, image.subpixelorder);
   }
 
+  // Only the pixels inside limits (inclusive, clipped to the image) are
+  // considered, so an overlay that is known to be black outside a box costs
+  // the box rather than the frame.
+  unsigned int lo_x = 0;
+  unsigned int lo_y = 0;
+  unsigned int hi_x = width - 1;
+  unsigned int hi_y = height - 1;
+  if (limits) {
+    int l_lo_x = std::max(limits->Lo().x_, 0);
+    int l_lo_y = std::max(limits->Lo().y_, 0);
+    int l_hi_x = std::min(limits->Hi().x_, static_cast<int>(width) - 1);
+    int l_hi_y = std::min(limits->Hi().y_, static_cast<int>(height) - 1);
+    if (l_lo_x > l_hi_x || l_lo_y > l_hi_y)
+      return;
+    lo_x = l_lo_x;
+    lo_y = l_lo_y;
+    hi_x = l_hi_x;
+    hi_y = l_hi_y;
+  }
+
   // Drive every branch row-by-row using each image's own linesize. Walking
   // linearly with `buffer + size` as the end was unsafe in two ways:
   // (a) source and destination linesizes can differ (e.g. one came in via
@@ -2047,17 +2145,15 @@ void Image::Overlay( const Image &image ) {
       Error("Overlay: av_image_fill_arrays failed for YUV420 %ux%u", width, height);
       return;
     }
-    for (unsigned int y = 0; y < height; y++) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
       const uint8_t *psrc = splane[0] + y * sstride[0];
       uint8_t *pdest = dplane[0] + y * dstride[0];
-      for (unsigned int x = 0; x < width; x++) {
+      for (unsigned int x = lo_x; x <= hi_x; x++) {
         if (psrc[x]) pdest[x] = psrc[x];
       }
     }
-    const unsigned int cw = (width + 1) / 2;
-    const unsigned int ch = (height + 1) / 2;
-    for (unsigned int cy = 0; cy < ch; cy++) {
-      for (unsigned int cx = 0; cx < cw; cx++) {
+    for (unsigned int cy = lo_y / 2; cy <= hi_y / 2; cy++) {
+      for (unsigned int cx = lo_x / 2; cx <= hi_x / 2; cx++) {
         bool marked = false;
         for (unsigned int dy = 0; dy < 2 && !marked; dy++) {
           const unsigned int ly = cy * 2 + dy;
@@ -2077,10 +2173,10 @@ void Image::Overlay( const Image &image ) {
     /* Grayscale/YUV420 on top of grayscale/YUV420 - complete */
   } else if ( zm_bytes_per_pixel(imagePixFormat) == 1 && zm_bytes_per_pixel(image.imagePixFormat) == 1 ) {
     // Overlay only the luma/primary plane. Width is shared (panic above).
-    for (unsigned int y = 0; y < height; y++) {
-      const uint8_t *psrc = image.buffer + y * image.linesize;
-      uint8_t *pdest = buffer + y * linesize;
-      for (unsigned int x = 0; x < width; x++, psrc++, pdest++) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const uint8_t *psrc = image.buffer + y * image.linesize + lo_x;
+      uint8_t *pdest = buffer + y * linesize + lo_x;
+      for (unsigned int x = lo_x; x <= hi_x; x++, psrc++, pdest++) {
         if (*psrc) *pdest = *psrc;
       }
     }
@@ -2089,10 +2185,10 @@ void Image::Overlay( const Image &image ) {
   } else if ( zm_bytes_per_pixel(imagePixFormat) == 1 && zm_is_rgb24(image.imagePixFormat) ) {
     Colourise(image.colours, image.subpixelorder);
 
-    for (unsigned int y = 0; y < height; y++) {
-      const uint8_t *psrc = image.buffer + y * image.linesize;
-      uint8_t *pdest = buffer + y * linesize;
-      for (unsigned int x = 0; x < width; x++, psrc += 3, pdest += 3) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const uint8_t *psrc = image.buffer + y * image.linesize + lo_x * 3;
+      uint8_t *pdest = buffer + y * linesize + lo_x * 3;
+      for (unsigned int x = lo_x; x <= hi_x; x++, psrc += 3, pdest += 3) {
         if (RED_PTR_RGBA(psrc) || GREEN_PTR_RGBA(psrc) || BLUE_PTR_RGBA(psrc)) {
           RED_PTR_RGBA(pdest) = RED_PTR_RGBA(psrc);
           GREEN_PTR_RGBA(pdest) = GREEN_PTR_RGBA(psrc);
@@ -2106,10 +2202,10 @@ void Image::Overlay( const Image &image ) {
     Colourise(image.colours, image.subpixelorder);
 
     const bool alpha_last = (imagePixFormat == AV_PIX_FMT_RGBA || imagePixFormat == AV_PIX_FMT_BGRA);
-    for (unsigned int y = 0; y < height; y++) {
-      const Rgb *prsrc = (const Rgb *)(image.buffer + y * image.linesize);
-      Rgb *prdest = (Rgb *)(buffer + y * linesize);
-      for (unsigned int x = 0; x < width; x++, prsrc++, prdest++) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const Rgb *prsrc = (const Rgb *)(image.buffer + y * image.linesize) + lo_x;
+      Rgb *prdest = (Rgb *)(buffer + y * linesize) + lo_x;
+      for (unsigned int x = lo_x; x <= hi_x; x++, prsrc++, prdest++) {
         if (alpha_last) {
           if (RED_PTR_RGBA(prsrc) || GREEN_PTR_RGBA(prsrc) || BLUE_PTR_RGBA(prsrc))
             *prdest = *prsrc;
@@ -2122,10 +2218,10 @@ void Image::Overlay( const Image &image ) {
 
     /* Grayscale/YUV420 on top of RGB24 - complete */
   } else if ( zm_is_rgb24(imagePixFormat) && zm_bytes_per_pixel(image.imagePixFormat) == 1 ) {
-    for (unsigned int y = 0; y < height; y++) {
-      const uint8_t *psrc = image.buffer + y * image.linesize;
-      uint8_t *pdest = buffer + y * linesize;
-      for (unsigned int x = 0; x < width; x++, psrc++, pdest += 3) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const uint8_t *psrc = image.buffer + y * image.linesize + lo_x;
+      uint8_t *pdest = buffer + y * linesize + lo_x * 3;
+      for (unsigned int x = lo_x; x <= hi_x; x++, psrc++, pdest += 3) {
         if (*psrc) {
           RED_PTR_RGBA(pdest) = GREEN_PTR_RGBA(pdest) = BLUE_PTR_RGBA(pdest) = *psrc;
         }
@@ -2134,10 +2230,10 @@ void Image::Overlay( const Image &image ) {
 
     /* RGB24 on top of RGB24 - not complete. need to take care of different subpixel orders */
   } else if ( zm_is_rgb24(imagePixFormat) && zm_is_rgb24(image.imagePixFormat) ) {
-    for (unsigned int y = 0; y < height; y++) {
-      const uint8_t *psrc = image.buffer + y * image.linesize;
-      uint8_t *pdest = buffer + y * linesize;
-      for (unsigned int x = 0; x < width; x++, psrc += 3, pdest += 3) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const uint8_t *psrc = image.buffer + y * image.linesize + lo_x * 3;
+      uint8_t *pdest = buffer + y * linesize + lo_x * 3;
+      for (unsigned int x = lo_x; x <= hi_x; x++, psrc += 3, pdest += 3) {
         if (RED_PTR_RGBA(psrc) || GREEN_PTR_RGBA(psrc) || BLUE_PTR_RGBA(psrc)) {
           RED_PTR_RGBA(pdest) = RED_PTR_RGBA(psrc);
           GREEN_PTR_RGBA(pdest) = GREEN_PTR_RGBA(psrc);
@@ -2153,10 +2249,10 @@ void Image::Overlay( const Image &image ) {
     /* Grayscale/YUV420 on top of RGB32 - complete */
   } else if ( zm_is_rgb32(imagePixFormat) && zm_bytes_per_pixel(image.imagePixFormat) == 1 ) {
     const bool alpha_last = (imagePixFormat == AV_PIX_FMT_RGBA || imagePixFormat == AV_PIX_FMT_BGRA);
-    for (unsigned int y = 0; y < height; y++) {
-      const uint8_t *psrc = image.buffer + y * image.linesize;
-      Rgb *prdest = (Rgb *)(buffer + y * linesize);
-      for (unsigned int x = 0; x < width; x++, psrc++, prdest++) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const uint8_t *psrc = image.buffer + y * image.linesize + lo_x;
+      Rgb *prdest = (Rgb *)(buffer + y * linesize) + lo_x;
+      for (unsigned int x = lo_x; x <= hi_x; x++, psrc++, prdest++) {
         if (*psrc) {
           if (alpha_last) {
             RED_PTR_RGBA(prdest) = *psrc;
@@ -2174,10 +2270,10 @@ void Image::Overlay( const Image &image ) {
     /* RGB32 on top of RGB32 - not complete. need to take care of different subpixel orders */
   } else if ( zm_is_rgb32(imagePixFormat) && zm_is_rgb32(image.imagePixFormat) ) {
     const bool alpha_last = (image.imagePixFormat == AV_PIX_FMT_RGBA || image.imagePixFormat == AV_PIX_FMT_BGRA);
-    for (unsigned int y = 0; y < height; y++) {
-      const Rgb *prsrc = (const Rgb *)(image.buffer + y * image.linesize);
-      Rgb *prdest = (Rgb *)(buffer + y * linesize);
-      for (unsigned int x = 0; x < width; x++, prsrc++, prdest++) {
+    for (unsigned int y = lo_y; y <= hi_y; y++) {
+      const Rgb *prsrc = (const Rgb *)(image.buffer + y * image.linesize) + lo_x;
+      Rgb *prdest = (Rgb *)(buffer + y * linesize) + lo_x;
+      for (unsigned int x = lo_x; x <= hi_x; x++, prsrc++, prdest++) {
         if (alpha_last) {
           if (RED_PTR_RGBA(prsrc) || GREEN_PTR_RGBA(prsrc) || BLUE_PTR_RGBA(prsrc))
             *prdest = *prsrc;
@@ -2193,12 +2289,12 @@ void Image::Overlay( const Image &image ) {
 
 /* RGB32 compatible: complete */
 void Image::Overlay( const Image &image, const unsigned int lo_x, const unsigned int lo_y ) {
-  if ( !(width < image.width || height < image.height) ) {
+  if ( width < image.width || height < image.height ) {
     Panic("Attempt to overlay image too big for destination, %dx%d > %dx%d",
           image.width, image.height, width, height );
   }
 
-  if ( !(width < (lo_x+image.width) || height < (lo_y+image.height)) ) {
+  if ( width < (lo_x+image.width) || height < (lo_y+image.height) ) {
     Panic("Attempt to overlay image outside of destination bounds, %dx%d @ %dx%d > %dx%d",
           image.width, image.height, lo_x, lo_y, width, height );
   }
@@ -2724,6 +2820,167 @@ void Image::Annotate(
   }
 }
 
+namespace {
+// Writes one annotation pixel exactly as the uncached Annotate does
+void annotation_pixel(uint8 *dst, unsigned int bytes_per_pixel, Rgb colour, unsigned int subpixelorder) {
+  if (bytes_per_pixel == 1) {
+    *dst = colour & 0xff;
+  } else if (bytes_per_pixel == 3) {
+    RED_PTR_RGBA(dst) = RED_VAL_RGBA(colour);
+    GREEN_PTR_RGBA(dst) = GREEN_VAL_RGBA(colour);
+    BLUE_PTR_RGBA(dst) = BLUE_VAL_RGBA(colour);
+  } else {
+    const Rgb converted = rgb_convert(colour, subpixelorder);
+    memcpy(dst, &converted, sizeof(converted));
+  }
+}
+}  // namespace
+
+void Image::Annotate(
+  AnnotationCache &cache,
+  const std::string &text,
+  const Vector2 &coord,
+  const uint8 size,
+  const Rgb fg_colour,
+  const Rgb bg_colour) {
+  unsigned int bytes_per_pixel;
+  if (zm_bytes_per_pixel(imagePixFormat) == 1) {
+    bytes_per_pixel = 1;
+  } else if (zm_is_rgb24(imagePixFormat)) {
+    bytes_per_pixel = 3;
+  } else if (zm_is_rgb32(imagePixFormat)) {
+    bytes_per_pixel = 4;
+  } else {
+    Error("Annotate called with unexpected colours: %d", colours);
+    return;
+  }
+  annotation_ = text;
+
+  std::lock_guard<std::mutex> lck(cache.mutex_);
+  if (cache.size_ != size || cache.fg_colour_ != fg_colour || cache.bg_colour_ != bg_colour
+      || cache.bytes_per_pixel_ != bytes_per_pixel || cache.subpixelorder_ != subpixelorder) {
+    cache.size_ = size;
+    cache.fg_colour_ = fg_colour;
+    cache.bg_colour_ = bg_colour;
+    cache.bytes_per_pixel_ = bytes_per_pixel;
+    cache.subpixelorder_ = subpixelorder;
+    for (std::vector<uint8_t> &glyph : cache.glyphs_) glyph.clear();
+    cache.lines_.clear();
+  }
+
+  FontVariant const &font_variant = font.GetFontVariant(size - 1);
+  const uint16 char_width = font_variant.GetCharWidth();
+  const uint16 char_height = font_variant.GetCharHeight();
+  const bool opaque = (bg_colour != kRGBTransparent);
+  // Glyph bits land in columns 1..char_width of their cell, the last one
+  // overhanging into the next cell, so glyphs are a column wider.
+  const size_t glyph_row_bytes = (char_width + 1) * bytes_per_pixel;
+  const size_t glyph_bytes = glyph_row_bytes * char_height;
+  const size_t cell_bytes = char_width * bytes_per_pixel;
+
+  auto get_glyph = [&](uint8 c) -> const std::vector<uint8_t> & {
+    std::vector<uint8_t> &glyph = cache.glyphs_[c];
+    if (!glyph.empty()) return glyph;
+    glyph.assign(2 * glyph_bytes, 0);
+    uint8_t *mask = glyph.data() + glyph_bytes;
+    unsigned int row = 0;
+    for (uint64 cp_row : font_variant.GetCodepoint(c)) {
+      uint8_t *pixels_row = glyph.data() + row * glyph_row_bytes;
+      uint8_t *mask_row = mask + row * glyph_row_bytes;
+      if (opaque) {
+        for (uint16 i = 0; i < char_width; i++)
+          annotation_pixel(pixels_row + i * bytes_per_pixel, bytes_per_pixel, bg_colour, subpixelorder);
+        memset(mask_row, 0xff, cell_bytes);
+      }
+      while (cp_row != 0) {
+        uint32 column_idx = char_width - __builtin_ctzll(cp_row) + font_variant.GetCharPadding();
+        if (column_idx <= char_width) {
+          annotation_pixel(pixels_row + column_idx * bytes_per_pixel, bytes_per_pixel, fg_colour, subpixelorder);
+          memset(mask_row + column_idx * bytes_per_pixel, 0xff, bytes_per_pixel);
+        }
+        cp_row = cp_row & (cp_row - 1);
+      }
+      row++;
+    }
+    return glyph;
+  };
+
+  std::vector<std::string> lines = Split(annotation_, '\n');
+  std::size_t max_line_length = 0;
+  for (const std::string &s : lines) {
+    max_line_length = std::max(max_line_length, s.size());
+  }
+
+  uint32 x0_max = width - (max_line_length * char_width);
+  uint32 y0_max = height - (lines.size() * char_height);
+  uint32 x0 = zm::clamp(static_cast<uint32>(coord.x_), 0u, x0_max);
+  uint32 y0 = zm::clamp(static_cast<uint32>(coord.y_), 0u, y0_max);
+  if (x0 >= width) return;
+
+  if (cache.lines_.size() != lines.size()) cache.lines_.resize(lines.size());
+
+  uint32 y = y0;
+  for (size_t l = 0; l < lines.size(); l++) {
+    const std::string &line = lines[l];
+    AnnotationCache::Line &cached = cache.lines_[l];
+    const size_t row_bytes = line.size() * cell_bytes + bytes_per_pixel;
+
+    // Re-render the cells whose character changed. A cell's first column
+    // can also hold the previous glyph's overhang, so the cell after a
+    // changed one is redone too.
+    bool full = false;
+    if (cached.text.size() != line.size()) {
+      cached.pixels.assign(row_bytes * char_height, 0);
+      cached.mask.assign(row_bytes * char_height, 0);
+      full = true;
+    }
+    bool previous_changed = false;
+    for (size_t i = 0; i < line.size(); i++) {
+      bool changed = full || (cached.text[i] != line[i]);
+      if (!(changed || previous_changed)) continue;
+      previous_changed = changed;
+
+      const std::vector<uint8_t> &glyph = get_glyph(line[i]);
+      const std::vector<uint8_t> *previous = i ? &get_glyph(line[i-1]) : nullptr;
+      for (unsigned int row = 0; row < char_height; row++) {
+        uint8_t *pixels_row = cached.pixels.data() + row * row_bytes + i * cell_bytes;
+        uint8_t *mask_row = cached.mask.data() + row * row_bytes + i * cell_bytes;
+        memcpy(pixels_row, glyph.data() + row * glyph_row_bytes, cell_bytes);
+        memcpy(mask_row, glyph.data() + glyph_bytes + row * glyph_row_bytes, cell_bytes);
+        // With a background the next cell covers the overhang
+        if (!opaque && previous) {
+          const size_t overhang = row * glyph_row_bytes + cell_bytes;
+          if (previous->data()[glyph_bytes + overhang]) {
+            memcpy(pixels_row, previous->data() + overhang, bytes_per_pixel);
+            memset(mask_row, 0xff, bytes_per_pixel);
+          }
+        }
+      }
+    }
+    if (!line.empty() && (full || cached.text.back() != line.back())) {
+      const std::vector<uint8_t> &glyph = get_glyph(line.back());
+      for (unsigned int row = 0; row < char_height; row++) {
+        const size_t overhang = row * glyph_row_bytes + cell_bytes;
+        memcpy(cached.pixels.data() + (row + 1) * row_bytes - bytes_per_pixel, glyph.data() + overhang, bytes_per_pixel);
+        memcpy(cached.mask.data() + (row + 1) * row_bytes - bytes_per_pixel, glyph.data() + glyph_bytes + overhang, bytes_per_pixel);
+      }
+    }
+    cached.text = line;
+
+    const size_t visible = std::min(row_bytes, static_cast<size_t>(width - x0) * bytes_per_pixel);
+    uint8_t *dst = &buffer[y * linesize + x0 * bytes_per_pixel];
+    for (unsigned int row = 0; row < char_height && y + row < height; row++) {
+      (*fptr_masked_copy8)(cached.pixels.data() + row * row_bytes, cached.mask.data() + row * row_bytes, dst, visible);
+      dst += linesize;
+    }
+
+    y += char_height;
+    if (y >= height) {
+      break;
+    }
+  }
+}
+
 void Image::Timestamp(const char *label, SystemTimePoint when, const Vector2 &coord, int label_size) {
   char time_text[64];
   tm when_tm = {};
@@ -3012,6 +3269,62 @@ void Image::Fill( Rgb colour, int density, const Box *limits ) {
   }
 }
 
+namespace {
+// Draws spans in colour, clipped to the image. One row of the colour, and of
+// the stipple mask when density > 1, is built across lo_x..hi_x so that each
+// span is a single memcpy or masked copy whatever the pixel format.
+void fill_spans(uint8_t *buffer, unsigned int linesize, unsigned int width, unsigned int height,
+                unsigned int bytes_per_pixel, Rgb colour, int density,
+                const std::vector<PolygonFill::Span> &spans, int32 lo_x, int32 hi_x) {
+  lo_x = std::max(lo_x, 0);
+  hi_x = std::min(hi_x, static_cast<int32>(width) - 1);
+  if (spans.empty() || lo_x > hi_x)
+    return;
+
+  const size_t row_pixels = hi_x - lo_x + 1;
+  std::vector<uint8_t> colour_row(row_pixels * bytes_per_pixel);
+  uint8_t pixel[4];
+  if (bytes_per_pixel == 4) {
+    memcpy(pixel, &colour, sizeof(pixel));
+  } else {
+    // Same bytes as RED_PTR_RGBA(p) = RED_VAL_RGBA(colour) etc.
+    for (unsigned int c = 0; c < bytes_per_pixel; c++)
+      pixel[c] = (colour >> (8 * c)) & 0xff;
+  }
+  for (size_t x = 0; x < row_pixels; x++)
+    memcpy(&colour_row[x * bytes_per_pixel], pixel, bytes_per_pixel);
+
+  std::vector<uint8_t> mask_row;
+  if (density > 1) {
+    mask_row.resize(colour_row.size());
+    for (size_t x = 0; x < row_pixels; x++) {
+      if (!((lo_x + x) % density))
+        memset(&mask_row[x * bytes_per_pixel], 0xff, bytes_per_pixel);
+    }
+  }
+
+  for (const PolygonFill::Span &span : spans) {
+    if (span.y < 0 || span.y >= static_cast<int32>(height))
+      continue;
+    if (density > 1 && (span.y % density))
+      continue;
+    int32 x1 = std::max(span.lo_x, lo_x);
+    int32 x2 = std::min(span.hi_x, hi_x);
+    if (x1 > x2)
+      continue;
+
+    uint8_t *dst = buffer + span.y * linesize + x1 * bytes_per_pixel;
+    size_t offset = (x1 - lo_x) * bytes_per_pixel;
+    size_t count = (x2 - x1 + 1) * bytes_per_pixel;
+    if (density > 1) {
+      (*fptr_masked_copy8)(colour_row.data() + offset, mask_row.data() + offset, dst, count);
+    } else {
+      memcpy(dst, colour_row.data() + offset, count);
+    }
+  }
+}
+}  // namespace
+
 /* RGB32 compatible: complete */
 void Image::Outline( Rgb colour, const Polygon &polygon ) {
   if ( !(zm_bytes_per_pixel(imagePixFormat) == 1 || zm_is_rgb24(imagePixFormat) || zm_is_rgb32(imagePixFormat)) ) {
@@ -3021,6 +3334,15 @@ void Image::Outline( Rgb colour, const Polygon &polygon ) {
   /* Convert the colour's RGBA subpixel order into the image's subpixel order */
   colour = rgb_convert(colour, subpixelorder);
 
+  // The polygon has the edge pixels already, unless it has to be clamped
+  const Box &extent = polygon.Extent();
+  if (extent.Lo().x_ >= 0 && extent.Lo().y_ >= 0
+      && extent.Hi().x_ < static_cast<int32>(width) && extent.Hi().y_ < static_cast<int32>(height)) {
+    fill_spans(buffer, linesize, width, height, zm_bytes_per_pixel(imagePixFormat), colour, 1,
+               polygon.OutlineSpans(), extent.Lo().x_, extent.Hi().x_);
+    return;
+  }
+
   size_t n_coords = polygon.GetVertices().size();
   for (size_t j = 0, i = n_coords - 1; j < n_coords; i = j++) {
     const Vector2 &p1 = polygon.GetVertices()[i];
@@ -3095,7 +3417,8 @@ void Image::Outline( Rgb colour, const Polygon &polygon ) {
   } // end foreach coordinate in the polygon
 }
 
-// Polygon filling is based on the Scan-line Polygon filling algorithm
+// Polygon filling is based on the Scan-line Polygon filling algorithm, the
+// spans of which the polygon keeps.
 void Image::Fill(Rgb colour, int density, const Polygon &polygon) {
   if (!(zm_bytes_per_pixel(imagePixFormat) == 1 || zm_is_rgb24(imagePixFormat) || zm_is_rgb32(imagePixFormat))) {
     Panic("Attempt to fill image with unexpected colours %d", colours);
@@ -3104,105 +3427,13 @@ void Image::Fill(Rgb colour, int density, const Polygon &polygon) {
   /* Convert the colour's RGBA subpixel order into the image's subpixel order */
   colour = rgb_convert(colour, subpixelorder);
 
-  size_t n_coords = polygon.GetVertices().size();
-  if (n_coords < 3) {
+  if (polygon.GetVertices().size() < 3) {
     Error("Not enough vertices in polygon!");
     return;
   }
 
-  std::vector<PolygonFill::Edge> global_edges;
-  global_edges.reserve(n_coords);
-  for (size_t j = 0, i = n_coords - 1; j < n_coords; i = j++) {
-    const Vector2 &p1 = polygon.GetVertices()[i];
-    const Vector2 &p2 = polygon.GetVertices()[j];
-
-    // Do not add horizontal edges to the global edge table.
-    if (p1.y_ == p2.y_)
-      continue;
-
-    Vector2 d = p2 - p1;
-
-    global_edges.emplace_back(std::min(p1.y_, p2.y_),
-                              std::max(p1.y_, p2.y_),
-                              p1.y_ < p2.y_ ? p1.x_ : p2.x_,
-                              d.x_ / static_cast<double>(d.y_));
-  }
-
-  if (global_edges.empty()) return;
-
-  std::sort(global_edges.begin(), global_edges.end(), PolygonFill::Edge::CompareYX);
-  std::vector<PolygonFill::Edge> active_edges;
-  active_edges.reserve(global_edges.size());
-  int32 scan_line = global_edges[0].min_y;
-  while (!global_edges.empty() || !active_edges.empty()) {
-    // Deactivate edges with max_y < current scan line
-    for (auto it = active_edges.begin(); it != active_edges.end();) {
-      if (scan_line >= it->max_y) {
-        it = active_edges.erase(it);
-      } else {
-        it->min_x += it->_1_m;
-        ++it;
-      }
-    }
-
-    // Activate edges with min_y == current scan line
-    for (auto it = global_edges.begin(); it != global_edges.end();) {
-      if (it->min_y == scan_line) {
-        active_edges.emplace_back(*it);
-        it = global_edges.erase(it);
-      } else {
-        ++it;
-      }
-    }
-
-    // Not enough edges to perform the fill operation.
-    // Continue to next line.
-    if (active_edges.size() < 2) {
-      continue;
-    }
-    std::sort(active_edges.begin(), active_edges.end(), PolygonFill::Edge::CompareX);
-
-    if (!(scan_line % density)) {
-      // Fill between pairs of active edges (parity rule). Stepping one
-      // edge at a time would incorrectly fill the gaps between arms of
-      // a non-convex polygon (e.g. a banana shape).
-      for (auto it = active_edges.begin(); it + 1 < active_edges.end(); it += 2) {
-        int32 lo_x = static_cast<int32>(it->min_x);
-        int32 hi_x = static_cast<int32>((it + 1)->min_x);
-        if (zm_bytes_per_pixel(imagePixFormat) == 1) {
-          uint8 *p = &buffer[scan_line * linesize + lo_x];
-
-          for (int32 x = lo_x; x <= hi_x; x++, p++) {
-            if (!(x % density)) {
-              *p = colour;
-            }
-          }
-        } else if (zm_is_rgb24(imagePixFormat)) {
-          constexpr uint8 bytesPerPixel = 3;
-          uint8 *ptr = &buffer[scan_line * linesize + lo_x * bytesPerPixel];
-
-          for (int32 x = lo_x; x <= hi_x; x++, ptr += bytesPerPixel) {
-            if (!(x % density)) {
-              RED_PTR_RGBA(ptr) = RED_VAL_RGBA(colour);
-              GREEN_PTR_RGBA(ptr) = GREEN_VAL_RGBA(colour);
-              BLUE_PTR_RGBA(ptr) = BLUE_VAL_RGBA(colour);
-            }
-          }
-        } else if (zm_is_rgb32(imagePixFormat)) {
-          constexpr uint8 bytesPerPixel = 4;
-          Rgb *ptr = reinterpret_cast<Rgb *>(&buffer[scan_line * linesize + lo_x * bytesPerPixel]);
-
-          for (int32 x = lo_x; x <= hi_x; x++, ptr++) {
-            if (!(x % density)) {
-              *ptr = colour;
-            }
-          }
-        }
-      }
-    }  // end if (!(scan_line % density))
-
-    scan_line++;
-  } // end while
+  fill_spans(buffer, linesize, width, height, zm_bytes_per_pixel(imagePixFormat), colour, density,
+             polygon.Spans(), polygon.Extent().Lo().x_, polygon.Extent().Hi().x_);
 }
 
 namespace {
@@ -3448,36 +3679,239 @@ void Image::Flip( bool leftright ) {
 void Image::Scale(const unsigned int new_width, const unsigned int new_height) {
   if (width == new_width and height == new_height) return;
 
-  // imagePixFormat is the canonical source of truth; the deprecated
-  // AVPixFormat() getter re-derives via (colours, subpixelorder) and would
-  // hit the GRAY8/YUV420P alias collision if those legacy fields ever drift.
-  const AVPixelFormat format = imagePixFormat;
-  // (new_width+1)*(new_height+1)*colours undercounts planar formats: for
-  // YUV420P, colours=1 due to the GRAY8 alias, but the buffer needs
-  // ~1.5x for chroma. Use av_image_get_buffer_size so this works for any
-  // AVPixelFormat. SWScale::Convert checks the buffer size against this
-  // and errors out if undersized.
-  int new_size = av_image_get_buffer_size(format, new_width, new_height, 32);
-  if (new_size < 0) {
-    Error("Scale: av_image_get_buffer_size failed for %s %ux%u", av_get_pix_fmt_name(format), new_width, new_height);
+  // Scale into the scratch image, whose buffer is reused like any
+  // destination of Scale(w, h, dest), then trade buffers with it, so that
+  // nothing is allocated or copied per call once the sizes have settled.
+  if (!scale_scratch_) scale_scratch_ = new Image();
+  if (!Scale(new_width, new_height, *scale_scratch_)) return;
+  TakeScaled();
+}
+
+// Makes the scaled image in scale_scratch_ ours.  A buffer we don't own
+// can't be handed over, so that gets a copy instead.
+void Image::TakeScaled() {
+  Image &scaled = *scale_scratch_;
+  if (holdbuffer or (buffer and buffertype == ZM_BUFTYPE_DONTFREE)) {
+    Assign(scaled);
     return;
   }
-  size_t scale_buffer_size = static_cast<size_t>(new_size);
-  uint8_t* scale_buffer = AllocBuffer(scale_buffer_size);
+  // The scratch image takes our old buffer along with the dimensions that
+  // describe it, so it knows when it has to grow.
+  std::swap(buffer, scaled.buffer);
+  std::swap(buffertype, scaled.buffertype);
+  std::swap(allocation, scaled.allocation);
+  std::swap(width, scaled.width);
+  std::swap(height, scaled.height);
+  std::swap(linesize, scaled.linesize);
+  std::swap(pixels, scaled.pixels);
+  std::swap(size, scaled.size);
+  std::swap(colours, scaled.colours);
+  std::swap(subpixelorder, scaled.subpixelorder);
+  std::swap(imagePixFormat, scaled.imagePixFormat);
+  update_function_pointers();
+  scaled.update_function_pointers();
+}
+
+bool Image::Scale(const unsigned int new_width, const unsigned int new_height, Image &dest) const {
+  uint8_t *dest_buffer = dest.WriteBuffer(new_width, new_height, colours, subpixelorder);
+  if (!dest_buffer) return false;
+  if (width == new_width and height == new_height) {
+    memcpy(dest_buffer, buffer, size);
+    return true;
+  }
 
   SWScale swscale;
   swscale.init();
-  // Both buffers use Image's align-32 layout: `buffer` is ours, and
-  // scale_buffer is adopted by AssignDirect below, which derives
-  // size/linesize with av_image_* at align=32.
-  if (swscale.Convert(buffer, allocation, scale_buffer, scale_buffer_size,
-                      format, format, width, height, new_width, new_height, 32, 32) < 0) {
+  if (swscale.Convert(buffer, allocation, dest_buffer, dest.allocation,
+                      imagePixFormat, imagePixFormat, width, height, new_width, new_height, 32, 32) < 0) {
     Error("Scale: sws_scale conversion failed (%ux%u %s -> %ux%u)",
-          width, height, av_get_pix_fmt_name(format), new_width, new_height);
-    DumpBuffer(scale_buffer, ZM_BUFTYPE_ZM);
-    return;
+          width, height, av_get_pix_fmt_name(imagePixFormat), new_width, new_height);
+    return false;
+  }
+  return true;
+}
+
+bool Image::Scale(const Box &limits, const unsigned int new_width, const unsigned int new_height, Image &dest) const {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(imagePixFormat);
+  if (!desc) {
+    Error("Scale: no descriptor for pixel format %d", imagePixFormat);
+    return false;
+  }
+
+  // The window has to start on a chroma sample for subsampled formats
+  unsigned int lo_x = limits.Lo().x_ & ~((1u << desc->log2_chroma_w) - 1);
+  unsigned int lo_y = limits.Lo().y_ & ~((1u << desc->log2_chroma_h) - 1);
+  unsigned int hi_x = std::min(static_cast<unsigned int>(limits.Hi().x_), width - 1);
+  unsigned int hi_y = std::min(static_cast<unsigned int>(limits.Hi().y_), height - 1);
+  if (lo_x > hi_x || lo_y > hi_y) {
+    Error("Invalid or reversed crop region %d,%d -> %d,%d", lo_x, lo_y, hi_x, hi_y);
+    return false;
+  }
+
+  uint8_t *dest_buffer = dest.WriteBuffer(new_width, new_height, colours, subpixelorder);
+  if (!dest_buffer) return false;
+
+  // Point each plane at the top left of the window instead of copying it out
+  uint8_t *data[4];
+  int linesizes[4];
+  if (av_image_fill_arrays(data, linesizes, buffer, imagePixFormat, width, height, 32) <= 0) {
+    Error("Scale: failed filling planes for %s %ux%u", av_get_pix_fmt_name(imagePixFormat), width, height);
+    return false;
+  }
+  int pixsteps[4];
+  av_image_fill_max_pixsteps(pixsteps, nullptr, desc);
+  for (int plane = 0; plane < 4 && data[plane]; plane++) {
+    bool chroma = (plane == 1 || plane == 2);
+    unsigned int x = chroma ? lo_x >> desc->log2_chroma_w : lo_x;
+    unsigned int y = chroma ? lo_y >> desc->log2_chroma_h : lo_y;
+    data[plane] += y * linesizes[plane] + x * pixsteps[plane];
+  }
+
+  SWScale swscale;
+  swscale.init();
+  if (swscale.Convert(data, linesizes, imagePixFormat, hi_x - lo_x + 1, hi_y - lo_y + 1,
+                      dest_buffer, dest.allocation, imagePixFormat, new_width, new_height, 32) < 0) {
+    Error("Scale: sws_scale conversion failed (%u,%u -> %u,%u of %ux%u %s -> %ux%u)",
+          lo_x, lo_y, hi_x, hi_y, width, height, av_get_pix_fmt_name(imagePixFormat), new_width, new_height);
+    return false;
   }
-  AssignDirect(new_width, new_height, colours, subpixelorder, scale_buffer, scale_buffer_size, ZM_BUFTYPE_ZM);
+  return true;
+}
+
+bool Image::HalfScale(Image &dest) const {
+  if (!dest.width || !dest.height || dest.width != width / 2 || dest.height != height / 2) {
+    Error("HalfScale: destination is %ux%u, need %ux%u", dest.width, dest.height, width / 2, height / 2);
+    return false;
+  }
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(imagePixFormat);
+  if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL)) || desc->comp[0].depth != 8) {
+    Error("HalfScale: unsupported pixel format %s", zm_get_pix_fmt_name(imagePixFormat));
+    return false;
+  }
+  if (dest.imagePixFormat != imagePixFormat && dest.AVPixFormat(imagePixFormat) != imagePixFormat)
+    return false;
+  if (dest.size > dest.allocation) {
+    Error("HalfScale: destination buffer %lu is too small for %u bytes", dest.allocation, dest.size);
+    return false;
+  }
+
+  uint8_t *src_planes[4], *dst_planes[4];
+  int src_strides[4], dst_strides[4];
+  if (av_image_fill_arrays(src_planes, src_strides, buffer, imagePixFormat, width, height, 32) <= 0 ||
+      av_image_fill_arrays(dst_planes, dst_strides, dest.buffer, imagePixFormat, dest.width, dest.height, 32) <= 0) {
+    Error("HalfScale: failed filling planes for %s", av_get_pix_fmt_name(imagePixFormat));
+    return false;
+  }
+  int pixsteps[4];
+  av_image_fill_max_pixsteps(pixsteps, nullptr, desc);
+
+  for (int plane = 0; plane < 4 && dst_planes[plane]; plane++) {
+    // Work in units of the plane's pixel step so packed formats average
+    // like with like; a step 1 plane is the common case and goes to the
+    // SIMD row function.
+    const unsigned int step = pixsteps[plane];
+    const unsigned int src_units = av_image_get_linesize(imagePixFormat, width, plane) / step;
+    const unsigned int dst_units = av_image_get_linesize(imagePixFormat, dest.width, plane) / step;
+    const bool chroma = (plane == 1 || plane == 2);
+    const unsigned int src_rows = chroma ? ceil_rshift(height, desc->log2_chroma_h) : height;
+    const unsigned int dst_rows = chroma ? ceil_rshift(dest.height, desc->log2_chroma_h) : dest.height;
+    const unsigned int whole = std::min(dst_units, src_units / 2);
+
+    for (unsigned int y = 0; y < dst_rows; y++) {
+      const uint8_t *row0 = src_planes[plane] + std::min(2 * y, src_rows - 1) * src_strides[plane];
+      const uint8_t *row1 = src_planes[plane] + std::min(2 * y + 1, src_rows - 1) * src_strides[plane];
+      uint8_t *out = dst_planes[plane] + y * dst_strides[plane];
+
+      if (step == 1) {
+        (*fptr_halve8)(row0, row1, out, whole);
+      } else {
+        for (unsigned int x = 0; x < whole; x++) {
+          const uint8_t *a = row0 + 2 * x * step;
+          const uint8_t *b = row1 + 2 * x * step;
+          for (unsigned int c = 0; c < step; c++)
+            out[x * step + c] = (a[c] + a[c + step] + b[c] + b[c + step] + 2) >> 2;
+        }
+      }
+      // A trailing odd chroma column only has one source column
+      for (unsigned int x = whole; x < dst_units; x++) {
+        unsigned int sx = std::min(2 * x, src_units - 1) * step;
+        for (unsigned int c = 0; c < step; c++)
+          out[x * step + c] = (row0[sx + c] + row1[sx + c] + 1) >> 1;
+      }
+    }
+  }
+  return true;
+}
+
+bool Image::DecimateLuma(unsigned int factor, Image &dest) const {
+  if (factor != 1 && factor != 2 && factor != 4) {
+    Error("DecimateLuma: unsupported factor %u", factor);
+    return false;
+  }
+  const unsigned int dest_width = width / factor;
+  const unsigned int dest_height = height / factor;
+  if (!dest_width || !dest_height) {
+    Error("DecimateLuma: %ux%u is too small to decimate by %u", width, height, factor);
+    return false;
+  }
+
+  // Grey level offsets within a packed pixel, as used by the gray8 converters
+  unsigned int r = 0, g = 0, b = 0;
+  const unsigned int step = zm_bytes_per_pixel(imagePixFormat);
+  if (step != 1) {
+    switch (subpixelorder) {
+      case ZM_SUBPIX_ORDER_BGR :
+      case ZM_SUBPIX_ORDER_BGRA :
+        r = 2; g = 1; b = 0;
+        break;
+      case ZM_SUBPIX_ORDER_ARGB :
+        r = 1; g = 2; b = 3;
+        break;
+      case ZM_SUBPIX_ORDER_ABGR :
+        r = 3; g = 2; b = 1;
+        break;
+      case ZM_SUBPIX_ORDER_RGB :
+      case ZM_SUBPIX_ORDER_RGBA :
+      default :
+        r = 0; g = 1; b = 2;
+        break;
+    }
+  }
+
+  uint8_t *out = dest.WriteBuffer(dest_width, dest_height, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  if (!out) return false;
+
+  // Only whole factor x factor blocks are used, so every source row read
+  // exists. Planar YUV and GRAY8 rows are the luma itself, packed RGB is
+  // reduced to grey a row at a time first.
+  const unsigned int src_width = dest_width * factor;
+  std::vector<uint8_t> grey(step == 1 ? 0 : 4 * src_width);
+  std::vector<uint8_t> halves(factor == 4 ? 2 * (src_width / 2) : 0);
+
+  auto luma_row = [&](unsigned int y, unsigned int slot) -> const uint8_t * {
+    const uint8_t *row = buffer + y * linesize;
+    if (step == 1) return row;
+    uint8_t *out_row = grey.data() + slot * src_width;
+    for (unsigned int x = 0; x < src_width; x++, row += step)
+      out_row[x] = (row[r] + row[r] + row[b] + row[g] + row[g] + row[g] + row[g] + row[g]) >> 3;
+    return out_row;
+  };
+
+  for (unsigned int y = 0; y < dest_height; y++) {
+    uint8_t *dest_row = out + y * dest.linesize;
+    if (factor == 1) {
+      memcpy(dest_row, luma_row(y, 0), dest_width);
+    } else if (factor == 2) {
+      (*fptr_halve8)(luma_row(2 * y, 0), luma_row(2 * y + 1, 1), dest_row, dest_width);
+    } else {
+      uint8_t *half0 = halves.data();
+      uint8_t *half1 = halves.data() + src_width / 2;
+      (*fptr_halve8)(luma_row(4 * y, 0), luma_row(4 * y + 1, 1), half0, src_width / 2);
+      (*fptr_halve8)(luma_row(4 * y + 2, 2), luma_row(4 * y + 3, 3), half1, src_width / 2);
+      (*fptr_halve8)(half0, half1, dest_row, dest_width);
+    }
+  }
+  return true;
 }
 
 void Image::Scale(const unsigned int factor) {
@@ -3489,12 +3923,16 @@ void Image::Scale(const unsigned int factor) {
     return;
   }
 
-  // Delegate to the (new_width, new_height) variant, which uses sws_scale.
-  // The previous hand-rolled pixel-doubling/decimation loops here did not
+  // Scaled with sws_scale, like the (new_width, new_height) variant. The
+  // previous hand-rolled pixel-doubling/decimation loops here did not
   // understand planar YUV layouts (only the Y plane was scaled, the U/V
   // planes were dropped), so a YUV420P image came out garbled.
   unsigned int new_width = (width*factor)/ZM_SCALE_BASE;
   unsigned int new_height = (height*factor)/ZM_SCALE_BASE;
+  if (!new_width or !new_height) {
+    Error("Scale factor %d leaves nothing of a %ux%u image", factor, width, height);
+    return;
+  }
   Scale(new_width, new_height);
 }
 
@@ -5524,6 +5962,73 @@ __attribute__((noinline)) void zm_convert_rgb565_rgba(const uint8_t* col1, uint8
   }
 }
 
+/************************************************* MASKED COPY FUNCTIONS *************************************************/
+
+/* Copy bytes of src where mask is 0xff, leaving result alone where it is 0 */
+__attribute__((noinline)) void std_masked_copy8(const uint8_t* src, const uint8_t* mask, uint8_t* result, unsigned long count) {
+  for (unsigned long i = 0; i < count; i++) {
+    result[i] = (result[i] & ~mask[i]) | (src[i] & mask[i]);
+  }
+}
+
+/* SSE2 version, 16 bytes per iteration */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_masked_copy8(const uint8_t* src, const uint8_t* mask, uint8_t* result, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE))
+  unsigned long i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask + i));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(result + i));
+    d = _mm_or_si128(_mm_andnot_si128(m, d), _mm_and_si128(m, s));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result + i), d);
+  }
+  std_masked_copy8(src + i, mask + i, result + i, count - i);
+#else
+  Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/************************************************* 2x2 BOX FILTER FUNCTIONS *************************************************/
+
+/* Average each 2x2 block of two rows of 8 bit samples, count is the number of output samples */
+__attribute__((noinline)) void std_halve8(const uint8_t* row0, const uint8_t* row1, uint8_t* result, unsigned long count) {
+  for (unsigned long i = 0; i < count; i++) {
+    result[i] = (row0[2*i] + row0[2*i+1] + row1[2*i] + row1[2*i+1] + 2) >> 2;
+  }
+}
+
+/* SSE2 version, 16 output samples per iteration. Rounds the same way as std_halve8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_halve8(const uint8_t* row0, const uint8_t* row1, uint8_t* result, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE))
+  const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+  const __m128i two = _mm_set1_epi16(2);
+  unsigned long i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i sums[2];
+    for (int half = 0; half < 2; half++) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2*i + 16*half));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2*i + 16*half));
+      /* Horizontal pairs as 16 bit: even bytes plus odd bytes */
+      __m128i sum = _mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8));
+      sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8)));
+      sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result + i), _mm_packus_epi16(sums[0], sums[1]));
+  }
+  std_halve8(row0 + 2*i, row1 + 2*i, result + i, count - i);
+#else
+  Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
 /************************************************* DEINTERLACE FUNCTIONS *************************************************/
 
 /* Grayscale */
@@ -33,6 +33,10 @@
 #include <zlib.h>
 #endif // HAVE_ZLIB_H
 
+#include <array>
+#include <mutex>
+#include <vector>
+
 class Box;
 class Polygon;
 
@@ -47,6 +51,8 @@ typedef void (*delta_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned
 typedef void (*convert_fptr_t)(const uint8_t*, uint8_t*, unsigned long);
 typedef void (*deinterlace_4field_fptr_t)(uint8_t*, uint8_t*, unsigned int, unsigned int, unsigned int);
 typedef void* (*imgbufcpy_fptr_t)(void*, const void*, size_t);
+typedef void (*halve_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned long);
+typedef void (*maskcopy_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned long);
 
 extern imgbufcpy_fptr_t fptr_imgbufcpy;
 
@@ -76,6 +82,37 @@ inline static void DumpBuffer(uint8_t* buffer, int buffertype) {
   }
 }
 
+//
+// Annotation text rendered by Image::Annotate, kept between frames.
+// Glyphs are expanded once per size, colours and pixel format, and a
+// line is only re-rendered where its characters changed, so stamping
+// the same timestamp onto the next frame is a copy per row.
+//
+class AnnotationCache {
+ public:
+  AnnotationCache() : size_(0), fg_colour_(0), bg_colour_(0), bytes_per_pixel_(0), subpixelorder_(0) {}
+
+ private:
+  friend class Image;
+  struct Line {
+    std::string text;
+    // One row is text.size()*char_width + 1 pixels, the extra column
+    // catching the last glyph's overhang.
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> mask;  // 0xff where pixels are to be drawn
+  };
+
+  std::mutex mutex_;
+  uint8 size_;
+  Rgb fg_colour_;
+  Rgb bg_colour_;
+  unsigned int bytes_per_pixel_;
+  unsigned int subpixelorder_;
+  // Expanded glyph per codepoint, pixels followed by mask, char_width + 1
+  // columns wide. Empty until first used.
+  std::array<std::vector<uint8_t>, 256> glyphs_;
+  std::vector<Line> lines_;
+};
 
 //
 // This is image class, and represents a frame captured from a
@@ -122,6 +159,10 @@ class Image {
   static jpeg_decompress_struct *decodejpg_dcinfo;
   static struct zm_error_mgr jpg_err;
 
+  bool EncodeJpeg(jpeg_compress_struct *cinfo, zm_error_mgr &err,
+                  JOCTET *outbuffer, size_t *outbuffer_size, int quality) const;
+  void TakeScaled();
+
   unsigned int width;
   unsigned int linesize;
   unsigned int height;
@@ -137,6 +178,7 @@ class Image {
   int holdbuffer; /* Hold the buffer instead of replacing it with new one */
   uint8_t *blend_buffer_;
   size_t blend_buffer_size_;
+  Image *scale_scratch_;  // Scaled in place through this, see TakeScaled
   std::string annotation_;
   std::string filename_;
 
@@ -252,6 +294,10 @@ class Image {
 
   bool DecodeJpeg(const JOCTET *inbuffer, int inbuffer_size, unsigned int p_colours, unsigned int p_subpixelorder);
   bool EncodeJpeg(JOCTET *outbuffer, size_t *outbuffer_size, int quality_override=0) const;
+  // As EncodeJpeg, but with a compressor belonging to the calling thread
+  // instead of the shared ones behind jpeg_mutex, so that threads encoding
+  // at the same time don't queue for each other
+  bool EncodeJpegThreadLocal(JOCTET *outbuffer, size_t *outbuffer_size, int quality_override=0) const;
 
 #if HAVE_ZLIB_H
   bool Unzip(const Bytef *inbuffer, unsigned long inbuffer_size);
@@ -261,7 +307,9 @@ class Image {
   bool Crop(unsigned int lo_x, unsigned int lo_y, unsigned int hi_x, unsigned int hi_y);
   bool Crop(const Box &limits);
 
-  void Overlay(const Image &image);
+  // Copies the non-black pixels of image. With limits, only those inside the
+  // box are looked at, so the rest of image must be black.
+  void Overlay(const Image &image, const Box *limits=nullptr);
   void Overlay(const Image &image, unsigned int x, unsigned int y);
   void Blend(const Image &image, int transparency=12);
   static Image *Merge( unsigned int n_images, Image *images[] );
@@ -277,6 +325,13 @@ class Image {
                 uint8 size = 1,
                 Rgb fg_colour = kRGBWhite,
                 Rgb bg_colour = kRGBBlack);
+  // Same output, rendered through cache
+  void Annotate(AnnotationCache &cache,
+                const std::string &text,
+                const Vector2 &coord,
+                uint8 size = 1,
+                Rgb fg_colour = kRGBWhite,
+                Rgb bg_colour = kRGBBlack);
   Image *HighlightEdges( Rgb colour, unsigned int p_colours, unsigned int p_subpixelorder, const Box *limits=0 );
   //Image *HighlightEdges( Rgb colour, const Polygon &polygon );
   void Timestamp(const char *label, SystemTimePoint when, const Vector2 &coord, int label_size);
@@ -294,6 +349,17 @@ class Image {
   void Flip( bool leftright );
   void Scale( unsigned int factor );
   void Scale(unsigned int x, unsigned int y);
+  // Scale into dest, reusing its buffer when it is big enough
+  bool Scale(unsigned int x, unsigned int y, Image &dest) const;
+  // Crop to limits (inclusive) and scale the result into dest in one pass
+  bool Scale(const Box &limits, unsigned int x, unsigned int y, Image &dest) const;
+  // 2x2 box filter into dest, which must already be (width/2)x(height/2).
+  // Adopts our pixel format but never reallocates dest, so it can be held.
+  bool HalfScale(Image &dest) const;
+  // Box filter the luma (or the grey level of RGB) down by factor 2 or 4
+  // into dest as GRAY8, or just extract it for 1. Follows our linesize, so
+  // decoder planes work too.
+  bool DecimateLuma(unsigned int factor, Image &dest) const;
 
   void Deinterlace_Discard();
   void Deinterlace_Linear();
@@ -303,32 +369,6 @@ class Image {
   const std::string toString();
 };
 
-// Scan-line polygon fill algorithm
-namespace PolygonFill {
-class Edge {
- public:
-  Edge() = default;
-  Edge(int32 min_y, int32 max_y, double min_x, double _1_m) : min_y(min_y), max_y(max_y), min_x(min_x), _1_m(_1_m) {}
-
-  static bool CompareYX(const Edge &e1, const Edge &e2) {
-    if (e1.min_y == e2.min_y) {
-      return e1.min_x < e2.min_x;
-    }
-    return e1.min_y < e2.min_y;
-  }
-
-  static bool CompareX(const Edge &e1, const Edge &e2) {
-    return e1.min_x < e2.min_x;
-  }
-
- public:
-  int32 min_y;
-  int32 max_y;
-  double min_x;
-  double _1_m;
-};
-}
-
 #endif // ZM_IMAGE_H
 
 /* Blend functions */
@@ -404,6 +444,14 @@ void zm_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long
 void zm_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
 void zm_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
 
+/* Masked copy functions */
+void std_masked_copy8(const uint8_t* src, const uint8_t* mask, uint8_t* result, unsigned long count);
+void sse2_masked_copy8(const uint8_t* src, const uint8_t* mask, uint8_t* result, unsigned long count);
+
+/* 2x2 box filter functions */
+void std_halve8(const uint8_t* row0, const uint8_t* row1, uint8_t* result, unsigned long count);
+void sse2_halve8(const uint8_t* row0, const uint8_t* row1, uint8_t* result, unsigned long count);
+
 /* Deinterlace_4Field functions */
 void std_deinterlace_4field_gray8(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void std_deinterlace_4field_rgb(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
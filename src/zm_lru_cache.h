@@ -0,0 +1,94 @@
+//
+// ZoneMinder LRU Cache Template
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_LRU_CACHE_H
+#define ZM_LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// A fixed capacity map that forgets the least recently used entry when full.
+// Not thread safe, callers hold their own lock.
+template<typename Key, typename Value>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  size_t Capacity() const { return capacity_; }
+  size_t Size() const { return index_.size(); }
+
+  // The value for key, marked as most recently used, or nullptr
+  Value *Find(const Key &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) return nullptr;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Adds or replaces the value for key, evicting the least recently used
+  // entry if that makes the cache too big
+  Value &Insert(const Key &key, Value value) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      it->second->second = std::move(value);
+      return it->second->second;
+    }
+
+    if (index_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_.emplace(key, entries_.begin());
+    return entries_.front().second;
+  }
+
+  bool Erase(const Key &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) return false;
+    entries_.erase(it->second);
+    index_.erase(it);
+    return true;
+  }
+
+  void Clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  // Evicts the least recently used entries that no longer fit
+  void SetCapacity(size_t capacity) {
+    capacity_ = capacity ? capacity : 1;
+    while (index_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+ private:
+  typedef std::list<std::pair<Key, Value>> EntryList;
+
+  size_t capacity_;
+  EntryList entries_;
+  std::unordered_map<Key, typename EntryList::iterator> index_;
+};
+
+#endif // ZM_LRU_CACHE_H
@@ -19,6 +19,8 @@
 
 #include "zm_monitor.h"
 
+#include "zm_db_snapshot.h"
+#include "zm_event_rollover.h"
 #include "zm_eventstream.h"
 #include "zm_ffmpeg_camera.h"
 #include "zm_fifo.h"
@@ -50,10 +52,12 @@
 
 #include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string>
+#include <thread>
 #include <utility>
 
 #if ZM_MEM_MAPPED
@@ -159,7 +163,8 @@ std::string Decoding_Strings[] = {
   "On demand",
   "Keyframes",
   "Keyframes + Ondemand",
-  "Always"
+  "Always",
+  "Adaptive"
 };
 
 std::string RTSP2Web_Strings[] = {
@@ -244,6 +249,7 @@ Monitor::Monitor() :
   section_length_warn(true),
   min_section_length(0),
   startstop_on_section_length(false),
+  section_phase(0),
   adaptive_skip(false),
   frame_skip(0),
   motion_frame_skip(0),
@@ -256,6 +262,8 @@ Monitor::Monitor() :
   fps_report_interval(0),
   ref_blend_perc(0),
   alarm_ref_blend_perc(0),
+  analysis_scale(1),
+  analysis_engine(ANALYSIS_ENGINE_BLEND),
   track_motion(false),
   signal_check_points(0),
   signal_check_colour(0),
@@ -276,6 +284,11 @@ Monitor::Monitor() :
   last_capture_image_count(0),
   analysis_image_count(0),
   decoding_image_count(0),
+  last_decoding_image_count(0),
+  decode_cpu_us(0),
+  last_decode_cpu_us(0),
+  decode_escalate(false),
+  decode_all_frames(false),
   motion_frame_count(0),
   last_motion_frame_count(0),
   ready_count(0),
@@ -301,7 +314,10 @@ Monitor::Monitor() :
   shared_images(nullptr),
   image_pixelformats(nullptr),
   analysis_image_pixelformats(nullptr),
+  image_seqs(nullptr),
   shm_slot_size(0),
+  pyramid_slot_size{0, 0},
+  pyramid_pixelformats(nullptr),
   video_stream_id(-1),
   audio_stream_id(-1),
   video_fifo(nullptr),
@@ -533,6 +549,14 @@ void Monitor::Load(MYSQL_ROW dbrow, bool load_zones=true, Purpose p = QUERY) {
   col++;
   width = (orientation==ROTATE_90||orientation==ROTATE_270) ? camera_height : camera_width;
   height = (orientation==ROTATE_90||orientation==ROTATE_270) ? camera_width : camera_height;
+  analysis_scale = (config.analysis_scale == 2 || config.analysis_scale == 4) ? config.analysis_scale : 1;
+  if (strcmp(config.analysis_engine, "statistical") == 0) {
+    analysis_engine = ANALYSIS_ENGINE_STATISTICAL;
+  } else {
+    if (strcmp(config.analysis_engine, "blend") != 0)
+      Warning("Unknown value for analysis_engine: %s", config.analysis_engine);
+    analysis_engine = ANALYSIS_ENGINE_BLEND;
+  }
   deinterlacing = atoi(dbrow[col]);
   col++;
   deinterlacing_value = deinterlacing & 0xff;
@@ -632,6 +656,9 @@ void Monitor::Load(MYSQL_ROW dbrow, bool load_zones=true, Purpose p = QUERY) {
             static_cast<int64>(Seconds(min_section_length).count())
            );
   }
+  section_phase = EventRollover::Phase(id, section_length);
+  if (section_phase != Seconds(0))
+    Debug(1, "Section boundaries offset by %" PRIi64 "s", static_cast<int64>(section_phase.count()));
   event_close_mode = static_cast<Monitor::EventCloseMode>(dbrow[col] ? atoi(dbrow[col]) : 0);
   col++;
   switch (event_close_mode) {
@@ -970,6 +997,15 @@ void Monitor::LoadCamera() {
 }
 
 std::shared_ptr<Monitor> Monitor::Load(unsigned int p_id, bool load_zones, Purpose purpose) {
+  if (dbSnapshot.IsOpen()) {
+    if (MYSQL_ROW dbrow = dbSnapshot.FindRow("Monitors", 0, p_id)) {
+      std::shared_ptr<Monitor> monitor = std::make_shared<Monitor>();
+      monitor->Load(dbrow, load_zones, purpose);
+      return monitor;
+    }
+    Debug(1, "Monitor %u is not in the database snapshot", p_id);
+  }
+
   std::string sql = load_monitor_sql + stringtf(" WHERE Id=%d", p_id);
 
   zmDbRow dbrow;
@@ -984,6 +1020,24 @@ std::shared_ptr<Monitor> Monitor::Load(unsigned int p_id, bool load_zones, Purpo
   return monitor;
 }
 
+bool Monitor::ReadPublishedSharedData(SharedData &published) const {
+#if ZM_MEM_MAPPED
+  int fd = open(stringtf("%s/zm.mmap.%u", staticConfig.PATH_MAP.c_str(), id).c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  ssize_t bytes = pread(fd, &published, sizeof(published), 0);
+  close(fd);
+  if (bytes != sizeof(published)) return false;
+#else // ZM_MEM_MAPPED
+  int published_id = shmget((config.shm_key&0xffff0000)|id, 0, 0);
+  if (published_id < 0) return false;
+  void *published_ptr = shmat(published_id, nullptr, SHM_RDONLY);
+  if (published_ptr == reinterpret_cast<void *>(-1)) return false;
+  memcpy(&published, published_ptr, sizeof(published));
+  shmdt(published_ptr);
+#endif // ZM_MEM_MAPPED
+  return published.size == sizeof(SharedData);
+}
+
 bool Monitor::connect() {
   ReloadZones();
   if (zones.size() != zone_count) {
@@ -1010,6 +1064,28 @@ bool Monitor::connect() {
     image_size = static_cast<size_t>(upper_bound);
   }
   shm_slot_size = image_size;
+
+  // Whether there is a pyramid is up to zmc.  Everyone else follows what it
+  // published, as their ZM_STREAM_PYRAMID may have changed since it started.
+  bool pyramid = config.stream_pyramid;
+  if (purpose != CAPTURE) {
+    SharedData published;
+    if (ReadPublishedSharedData(published))
+      pyramid = published.pyramid;
+  }
+
+  // Each pyramid level halves the one before it, slots sized the same way
+  size_t pyramid_size = 0;
+  if (pyramid and (width >> PYRAMID_LEVELS) and (height >> PYRAMID_LEVELS)) {
+    for (int level = 0; level < PYRAMID_LEVELS; level++) {
+      int level_size = av_image_get_buffer_size(AV_PIX_FMT_RGBA, width >> (level+1), height >> (level+1), 32);
+      pyramid_slot_size[level] = level_size > 0 ? level_size : 0;
+      pyramid_size += image_buffer_count * pyramid_slot_size[level];
+    }
+    // per-slot pyramid pix fmt, and up to 63 bytes to 64-byte align the images
+    pyramid_size += (image_buffer_count * sizeof(AVPixelFormat)) + 63;
+  }
+
   mem_size = sizeof(SharedData)
              + sizeof(TriggerData)
              + (zone_count * sizeof(int)) // Per zone scores
@@ -1019,6 +1095,8 @@ bool Monitor::connect() {
              + (image_buffer_count*image_size) // analysis image ring (alarm_images)
              + (image_buffer_count*sizeof(AVPixelFormat)) // per-slot capture pix fmt
              + (image_buffer_count*sizeof(AVPixelFormat)) // per-slot analysis pix fmt (cross-process sync)
+             + (image_buffer_count*sizeof(std::atomic<uint32_t>)) // per-slot seqlock
+             + pyramid_size // optional half and quarter size copies
              // Padding covers two independent alignment adjustments:
              //   * up to 63 bytes to push shared_images to a 64-byte boundary
              //   * up to alignof(AVPixelFormat)-1 bytes to push
@@ -1193,9 +1271,35 @@ bool Monitor::connect() {
   pixfmt_addr = (pixfmt_addr + pixfmt_align - 1) & ~(pixfmt_align - 1);
   image_pixelformats = reinterpret_cast<AVPixelFormat *>(pixfmt_addr);
   analysis_image_pixelformats = image_pixelformats + image_buffer_count;
+  // AVPixelFormat is an int, so this is already suitably aligned
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+                "image_seqs has to be a plain lock free word to be shared between processes");
+  image_seqs = reinterpret_cast<std::atomic<uint32_t> *>(analysis_image_pixelformats + image_buffer_count);
+
+  pyramid_pixelformats = nullptr;
+  if (pyramid_size) {
+    pyramid_pixelformats = reinterpret_cast<AVPixelFormat *>(image_seqs + image_buffer_count);
+    uintptr_t pyramid_addr = reinterpret_cast<uintptr_t>(pyramid_pixelformats + image_buffer_count);
+    unsigned char *pyramid_images = reinterpret_cast<unsigned char *>((pyramid_addr + 63) & ~static_cast<uintptr_t>(63));
+    for (int level = 0; level < PYRAMID_LEVELS; level++) {
+      pyramid_buffer[level].resize(image_buffer_count);
+      for (int32_t i = 0; i < image_buffer_count; i++) {
+        pyramid_buffer[level][i] = new Image(width >> (level+1), height >> (level+1),
+                                             ZM_COLOUR_YUV420P, ZM_SUBPIX_ORDER_YUV420P,
+                                             pyramid_images, pyramid_slot_size[level], 0);
+        pyramid_buffer[level][i]->HoldBuffer(true);
+        pyramid_images += pyramid_slot_size[level];
+      }
+    }
+    if (pyramid_images > mem_ptr + mem_size) {
+      Warning("Pyramid images exceed memsize by %td bytes!", pyramid_images - (mem_ptr + mem_size));
+    }
+  }
 
   if (purpose == CAPTURE) {
     memset(mem_ptr, 0, mem_size);
+    if (pyramid_pixelformats)
+      std::fill_n(pyramid_pixelformats, image_buffer_count, AV_PIX_FMT_NONE);
     shared_data->size = sizeof(SharedData);
     shared_data->analysing = analysing;
     shared_data->capturing = capturing;
@@ -1203,6 +1307,10 @@ bool Monitor::connect() {
     shared_data->signal = false;
     shared_data->capture_fps = 0.0;
     shared_data->analysis_fps = 0.0;
+    shared_data->decode_fps = 0.0;
+    shared_data->decode_cpu = 0;
+    shared_data->decode_all_frames = 0;
+    shared_data->pyramid = pyramid_size ? 1 : 0;
     shared_data->latitude = latitude;
     shared_data->longitude = longitude;
     shared_data->state = state = IDLE;
@@ -1367,6 +1475,11 @@ bool Monitor::disconnect() {
     delete analysis_image_buffer[i];
     analysis_image_buffer[i] = nullptr;
   }
+  for (int level = 0; level < PYRAMID_LEVELS; level++) {
+    for (Image *image : pyramid_buffer[level]) delete image;
+    pyramid_buffer[level].clear();
+  }
+  pyramid_pixelformats = nullptr;
 
   return true;
 }  // end bool Monitor::disconnect()
@@ -1535,7 +1648,7 @@ int Monitor::GetImage(int32_t index, int scale) {
     }
 
     if (!config.timestamp_on_capture) {
-      TimestampImage(&image, SystemTimePoint(zm::chrono::duration_cast<Microseconds>(shared_timestamps[index])));
+      TimestampImage(&image, ShmTimestamp(index));
     }
     return image.WriteJpeg(filename);
   } else {
@@ -1568,8 +1681,7 @@ std::shared_ptr<ZMPacket> Monitor::getSnapshot(int index) {
   // zmc wrote, so the ZMPacket consumer can read its bytes in the
   // correct format instead of the placeholder set at attach time.
   Image *src = ReadShmFrame(index);
-  return std::make_shared<ZMPacket>(src,
-      SystemTimePoint(zm::chrono::duration_cast<Microseconds>(shared_timestamps[index])));
+  return std::make_shared<ZMPacket>(src, ShmTimestamp(index));
 }
 
 SystemTimePoint Monitor::GetTimestamp(int index) {
@@ -2038,6 +2150,11 @@ void Monitor::UpdateFPS() {
     uint32 new_capture_bandwidth =
       static_cast<uint32>((new_camera_bytes - last_camera_bytes) / elapsed.count());
     double new_analysis_fps = (motion_frame_count - last_motion_frame_count) / elapsed.count();
+    double new_decode_fps = (decoding_image_count - last_decoding_image_count) / elapsed.count();
+    int64_t new_decode_cpu_us = decode_cpu_us;
+    // in tenths of a percent of one core
+    uint32 new_decode_cpu = static_cast<uint32>(
+        1000 * FPSeconds(Microseconds(new_decode_cpu_us - last_decode_cpu_us)).count() / elapsed.count());
 
     Debug(4, "FPS: capture count %d - last capture count %d = %d now:%lf, last %lf, elapsed %lf = capture: %lf fps analysis: %lf fps",
         shared_data->image_count,
@@ -2069,6 +2186,10 @@ void Monitor::UpdateFPS() {
     last_capture_image_count = shared_data->image_count;
     shared_data->analysis_fps = new_analysis_fps;
     last_motion_frame_count = motion_frame_count;
+    shared_data->decode_fps = new_decode_fps;
+    shared_data->decode_cpu = new_decode_cpu;
+    last_decoding_image_count = decoding_image_count;
+    last_decode_cpu_us = new_decode_cpu_us;
     last_camera_bytes = new_camera_bytes;
     last_fps_time = now;
 
@@ -2149,6 +2270,8 @@ bool Monitor::Analyse() {
     Debug(1, "Resetting reference image on resume");
     ref_image.DumpImgBuffer();
   }
+  // A new frame to decimate for motion detection
+  motion_image_source = nullptr;
 
   // Is it possible for packet->score to be ! -1 ? Not if everything is working correctly
   if (packet->score != -1) {
@@ -2232,14 +2355,17 @@ bool Monitor::Analyse() {
           }
           if (shared_data->analysing != ANALYSING_NONE) {
             if  (analysis_image == ANALYSISIMAGE_YCHANNEL) {
-              Image *y_image = packet->get_y_image();
+              const Image *y_image = MotionImage(packet->get_y_image());
               if (y_image) {
                 Debug(1, "assigning refimage from y-channel");
-                ref_image.Assign(*y_image);
+                SeedReference(*y_image);
               }
             } else if (packet->image) {
-              Debug(1, "assigning refimage from packet->image");
-              ref_image.Assign(*(packet->image));
+              const Image *motion_frame = MotionImage(packet->image);
+              if (motion_frame) {
+                Debug(1, "assigning refimage from packet->image");
+                SeedReference(*motion_frame);
+              }
             }  // end if y-image or full image
           }  // end if doing analysing
         }
@@ -2333,10 +2459,11 @@ bool Monitor::Analyse() {
 
                 if (analysis_image == ANALYSISIMAGE_YCHANNEL) {
                   // If not decoding, y_image can be null
-                  Image *y_image = packet->get_y_image();
-                  if (y_image) ref_image.Assign(*y_image);
+                  const Image *y_image = MotionImage(packet->get_y_image());
+                  if (y_image) SeedReference(*y_image);
                 } else if (packet->image) {
-                  ref_image.Assign(*(packet->image));
+                  const Image *motion_frame = MotionImage(packet->image);
+                  if (motion_frame) SeedReference(*motion_frame);
                 } else {
                   Debug(1, "No image to ref yet");
                 }
@@ -2347,7 +2474,7 @@ bool Monitor::Analyse() {
                   motion_score = 0;
                   // Get new score.
                   if (analysis_image == ANALYSISIMAGE_YCHANNEL) {
-                    Image *y_image = packet->get_y_image();
+                    const Image *y_image = MotionImage(packet->get_y_image());
                     Debug(1, "Detecting motion on image %d, y_image %p", packet->image_index, y_image);
                     if (y_image) {
                       motion_score += DetectMotion(*y_image, zoneSet);
@@ -2356,12 +2483,15 @@ bool Monitor::Analyse() {
                       Debug(1, "y_image unavailable, skipping motion detection");
                     }
                   } else {
-                    Debug(1, "Detecting motion on image %d, image %p", packet->image_index, packet->image);
-                    motion_score += DetectMotion(*(packet->image), zoneSet);
+                    const Image *motion_frame = MotionImage(packet->image);
+                    Debug(1, "Detecting motion on image %d, image %p", packet->image_index, motion_frame);
+                    if (motion_frame)
+                      motion_score += DetectMotion(*motion_frame, zoneSet);
                   }
 
-                  // Instead of showing a greyscale image, let's use the full colour
-                  if (!packet->analysis_image)
+                  // Instead of showing a greyscale image, let's use the full colour.
+                  // Only events saving analysis jpegs and analysis viewers look at it.
+                  if (!packet->analysis_image && ((savejpegs & 2) || hasAnalysisViewers()))
                     packet->analysis_image = new Image(*(packet->image));
 
                   // lets construct alarm cause. It will contain cause + names of zones alarmed
@@ -2373,8 +2503,9 @@ bool Monitor::Analyse() {
                     if (zone.Alarmed()) {
                       if (!packet->alarm_cause.empty()) packet->alarm_cause += ",";
                       packet->alarm_cause += zone.Label();
-                      if (zone.AlarmImage())
-                        packet->analysis_image->Overlay(*(zone.AlarmImage()));
+                      // The highlight is black outside the alarmed blobs
+                      if (packet->analysis_image && zone.AlarmImage())
+                        packet->analysis_image->Overlay(*(zone.AlarmImage()), &stats.alarm_box_);
                     }
                     Debug(4, "Setting score for zone %d to %d", zone_index, zone.Score());
                     zone_scores[zone_index] = zone.Score();
@@ -2405,9 +2536,10 @@ bool Monitor::Analyse() {
 
                 if (analysis_image == ANALYSISIMAGE_YCHANNEL) {
                   Debug(1, "Blending from y-channel");
-                  Image *y_image = packet->get_y_image();
+                  // Already decimated for detection unless that was skipped this frame
+                  const Image *y_image = MotionImage(packet->get_y_image());
                   if (y_image) {
-                    ref_image.Blend(*y_image, ( state==ALARM ? alarm_ref_blend_perc : ref_blend_perc ));
+                    UpdateReference(*y_image);
                   } else {
                     Debug(1, "y_image unavailable, skipping blend");
                   }
@@ -2418,7 +2550,9 @@ bool Monitor::Analyse() {
                         AV_PIX_FMT_YUV420P,
                         AV_PIX_FMT_YUVJ420P
                        );
-                  ref_image.Blend(*(packet->image), ( state==ALARM ? alarm_ref_blend_perc : ref_blend_perc ));
+                  const Image *motion_frame = MotionImage(packet->image);
+                  if (motion_frame)
+                    UpdateReference(*motion_frame);
                   Debug(1, "Done Blending");
                 } else {
                   Debug(1, "Not able to blend");
@@ -2437,6 +2571,19 @@ bool Monitor::Analyse() {
         // Set this before any state changes so that it's value is picked up immediately by linked monitors
         shared_data->last_frame_score = score;
 
+        if (decoding == DECODING_ADAPTIVE) {
+          // Any activity, including ONVIF, linked monitor and external
+          // triggers, has every frame decoded for a while.
+          if (score or (state != IDLE))
+            decode_escalated_until = packet->timestamp + Seconds(config.adaptive_decode_hold);
+          bool escalate = packet->timestamp < decode_escalated_until;
+          if (escalate != decode_escalate) {
+            Debug(1, "%s: %03d - %s decoding of all frames", name.c_str(), packet->image_index,
+                  escalate ? "Requesting" : "Ending");
+            decode_escalate = escalate;
+          }
+        }
+
         if (score) {
           if ((state == IDLE) || (state == PREALARM)) {
             if ((!pre_event_count) || (Event::PreAlarmCount() >= alarm_frame_count-1)) {
@@ -2523,7 +2670,12 @@ bool Monitor::Analyse() {
             }
 
             if (shared_data->recording == RECORDING_ALWAYS) {
-              if (event_close_mode == CLOSE_ALARM) {
+              if (config.event_segment_size > 0
+                  and event->VideoBytes() >= static_cast<int64_t>(config.event_segment_size) * 1024 * 1024) {
+                Info("%s: %03d - Closing event %" PRIu64 ", video size %" PRId64 " reached segment size %dMB",
+                     name.c_str(), packet->image_index, event->Id(), event->VideoBytes(), config.event_segment_size);
+                rolloverEvent(packet->timestamp);
+              } else if (event_close_mode == CLOSE_ALARM) {
                 Debug(1, "CLOSE_MODE Alarm");
                 if (state == ALARM) {
                   // If we should end the previous continuous event and start a new non-continuous event
@@ -2567,15 +2719,16 @@ bool Monitor::Analyse() {
                 }
               } else if (event_close_mode == CLOSE_TIME) {
                 Debug(1, "CLOSE_MODE Time");
-                if (std::chrono::duration_cast<Seconds>(packet->timestamp.time_since_epoch()) % section_length == Seconds(0)) {
-                  Info("%s: %03d - Closing event %" PRIu64 ", section end forced %" PRIi64 " %% %" PRIi64 " = 0",
+                if ((std::chrono::duration_cast<Seconds>(packet->timestamp.time_since_epoch()) - section_phase) % section_length == Seconds(0)) {
+                  Info("%s: %03d - Closing event %" PRIu64 ", section end forced (%" PRIi64 " - %" PRIi64 ") %% %" PRIi64 " = 0",
                        name.c_str(),
                        packet->image_index,
                        event->Id(),
                        static_cast<int64>(std::chrono::duration_cast<Seconds>(packet->timestamp.time_since_epoch()).count()),
+                       static_cast<int64>(section_phase.count()),
                        static_cast<int64>(Seconds(section_length).count())
                        );
-                  closeEvent();
+                  rolloverEvent(packet->timestamp);
                 }
               } else if (event_close_mode == CLOSE_IDLE) {
                 Debug(1, "CLOSE_MODE Idle");
@@ -2589,7 +2742,7 @@ bool Monitor::Analyse() {
                          static_cast<int64>(std::chrono::duration_cast<Seconds>(event->StartTime().time_since_epoch()).count()),
                          static_cast<int64>(std::chrono::duration_cast<Seconds>(packet->timestamp - event->StartTime()).count()),
                          static_cast<int64>(Seconds(section_length).count()));
-                    closeEvent();
+                    rolloverEvent(packet->timestamp);
                   }
                 }  // end if IDLE
               } else if (event_close_mode == CLOSE_DURATION) {
@@ -2601,7 +2754,7 @@ bool Monitor::Analyse() {
                        event->Id(),
                        static_cast<int64>(std::chrono::duration_cast<Seconds>(event->Duration()).count()),
                        static_cast<int64>(Seconds(section_length).count()));
-                  closeEvent();
+                  rolloverEvent(packet->timestamp);
                 }
               } else {
                 Warning("CLOSE_MODE Unknown %d", event_close_mode);
@@ -2899,8 +3052,7 @@ int Monitor::Capture() {
     // last_write_index as the commit step. Readers gate on
     // last_write_index, so every piece of per-slot state they consume
     // must be visible before this final assignment.
-    WriteShmFrame(index, capture_image);
-    shared_timestamps[index] = zm::chrono::duration_cast<timeval>(packet->timestamp.time_since_epoch());
+    WriteShmFrame(index, capture_image, packet->timestamp);
     shared_data->last_write_time = std::chrono::system_clock::to_time_t(packet->timestamp);
     shared_data->last_write_index = index;
     delete capture_image;
@@ -2934,6 +3086,10 @@ int Monitor::Capture() {
         }
         video_fifo->writePacket(*packet);
       }
+      if (packet_ring.IsOpen()) {
+        packet_ring.Write(packet->packet->data, packet->packet->size,
+                          packet->packet->pts, packet->packet->dts, packet->keyframe);
+      }
     } else if (packet->codec_type == AVMEDIA_TYPE_AUDIO) {
       if (audio_fifo)
         audio_fifo->writePacket(*packet);
@@ -2957,6 +3113,7 @@ int Monitor::Capture() {
 
     // Will only be queued if there are iterators allocated in the queue.
     packetqueue.queuePacket(packet);
+    if (decoder) decoder->Wake();
   } else { // result == 0
     // Question is, do we update last_write_index etc?
     return 0;
@@ -3011,7 +3168,13 @@ bool Monitor::setupConvertContext(const AVFrame *input_frame, const Image *image
   return (convert_context != nullptr);
 }
 
-void Monitor::WriteShmFrame(unsigned int index, Image *capture_image) {
+void Monitor::WriteShmFrame(unsigned int index, Image *capture_image, SystemTimePoint timestamp) {
+  // Readers copy nothing, they check the slot's sequence before and after
+  // using it, so mark the slot as being written first.
+  uint32_t seq = image_seqs[index].load(std::memory_order_relaxed);
+  image_seqs[index].store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
   // No conversion at the SHM-write side. zmc records the format the bytes
   // were actually written in via image_pixelformats[index]; consumers in
   // other processes (zms etc.) sync image_buffer[index] from that array
@@ -3030,7 +3193,8 @@ void Monitor::WriteShmFrame(unsigned int index, Image *capture_image) {
   // slot would make readers misinterpret the previous slot contents.
   const AVPixelFormat src_fmt = capture_image->PixFormat();
   image_buffer[index]->Assign(*capture_image);
-  if (image_buffer[index]->PixFormat() == src_fmt) {
+  bool assigned = (image_buffer[index]->PixFormat() == src_fmt);
+  if (assigned) {
     image_pixelformats[index] = src_fmt;
   } else {
     Warning("WriteShmFrame: slot %u assign failed (dst fmt %s != src fmt %s); "
@@ -3038,6 +3202,62 @@ void Monitor::WriteShmFrame(unsigned int index, Image *capture_image) {
             index, zm_get_pix_fmt_name(image_buffer[index]->PixFormat()),
             zm_get_pix_fmt_name(src_fmt));
   }
+  if (pyramid_pixelformats) {
+    // Each level is made from the one above, so streams never pay for it
+    for (int level = 0; assigned and level < PYRAMID_LEVELS; level++) {
+      const Image *src = level ? pyramid_buffer[level-1][index] : image_buffer[index];
+      assigned = src->HalfScale(*pyramid_buffer[level][index]);
+    }
+    pyramid_pixelformats[index] = assigned ? src_fmt : AV_PIX_FMT_NONE;
+  }
+  shared_timestamps[index] = zm::chrono::duration_cast<timeval>(timestamp.time_since_epoch());
+  image_seqs[index].store(seq + 2, std::memory_order_release);
+}
+
+uint32_t Monitor::BeginShmRead(unsigned int index) const {
+  if (!image_seqs) return 0;
+  uint32_t seq = image_seqs[index].load(std::memory_order_acquire);
+  // A write is a single frame copy. Don't wait forever on a zmc that died
+  // in the middle of one though, an odd sequence never validates.
+  for (int i = 0; (seq & 1) and (i < 1000); i++) {
+    std::this_thread::yield();
+    seq = image_seqs[index].load(std::memory_order_acquire);
+  }
+  return seq;
+}
+
+bool Monitor::ValidShmRead(unsigned int index, uint32_t seq) const {
+  if (!image_seqs) return true;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return !(seq & 1) and (image_seqs[index].load(std::memory_order_relaxed) == seq);
+}
+
+Image *Monitor::ReadShmPyramid(unsigned int index, int scale, int &level_scale) {
+  if (!pyramid_pixelformats or (scale <= 0)) return nullptr;
+  AVPixelFormat fmt = pyramid_pixelformats[index];
+  if (fmt == AV_PIX_FMT_NONE) return nullptr;
+
+  // Smallest level first, we only ever want to scale down from here
+  for (int level = PYRAMID_LEVELS - 1; level >= 0; level--) {
+    int this_scale = ZM_SCALE_BASE >> (level+1);
+    if (this_scale < scale) continue;
+
+    Image *image = pyramid_buffer[level][index];
+    if (image->PixFormat() != fmt) {
+      // Same precautions as ReadShmFrame, the format comes from another process
+      unsigned int probe_colours, probe_subpix;
+      int required = av_image_get_buffer_size(fmt, image->Width(), image->Height(), 32);
+      if (!zm_colours_from_pixformat(fmt, probe_colours, probe_subpix)
+          or (required < 0) or (static_cast<size_t>(required) > pyramid_slot_size[level])) {
+        Warning("ReadShmPyramid: ignoring unusable pixelformat %d in slot %u", fmt, index);
+        return nullptr;
+      }
+      image->AVPixFormat(fmt);
+    }
+    level_scale = this_scale;
+    return image;
+  }
+  return nullptr;
 }
 
 Image *Monitor::ReadShmFrame(unsigned int index) {
@@ -3082,6 +3302,15 @@ Image *Monitor::ReadShmFrame(unsigned int index) {
   return image_buffer[index];
 }
 
+Image *Monitor::ReadShmFrame(unsigned int index, int scale, int &level_scale) {
+  if (scale < ZM_SCALE_BASE) {
+    Image *pyramid_image = ReadShmPyramid(index, scale, level_scale);
+    if (pyramid_image) return pyramid_image;
+  }
+  level_scale = ZM_SCALE_BASE;
+  return ReadShmFrame(index);
+}
+
 void Monitor::applyOrientation(Image *image) {
   if (orientation == ROTATE_0) return;
 
@@ -3152,7 +3381,20 @@ void Monitor::flushDecoderQueue() {
   packetqueue.notify_all();  // wake the analysis thread if it's waiting
 }
 
-bool Monitor::Decode() {
+static Microseconds ThreadCPUTime() {
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return Microseconds(0);
+  return std::chrono::duration_cast<Microseconds>(Seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+bool Monitor::Decode(bool wait) {
+  Microseconds start = ThreadCPUTime();
+  bool ret = Decode_(wait);
+  decode_cpu_us += (ThreadCPUTime() - start).count();
+  return ret;
+}
+
+bool Monitor::Decode_(bool wait) {
   AVCodecContext *context = camera->getVideoCodecContext();
   ZMPacketLock packet_lock;
   std::shared_ptr<ZMPacket> packet;
@@ -3170,6 +3412,7 @@ bool Monitor::Decode() {
     bool needs_decoding =
       (decoding == DECODING_ALWAYS) ||
       (decoding == DECODING_KEYFRAMES) ||
+      (decoding == DECODING_ADAPTIVE) ||
       ((decoding == DECODING_ONDEMAND) && (hasViewers() || shared_data->last_write_index == image_buffer_count)) ||
       ((decoding == DECODING_KEYFRAMESONDEMAND) && hasViewers());
 
@@ -3224,7 +3467,7 @@ bool Monitor::Decode() {
     }
 
     // Get next packet from the main packet queue
-    packet_lock = packetqueue.get_packet(decoder_it);
+    packet_lock = wait ? packetqueue.get_packet(decoder_it) : packetqueue.get_packet_no_wait(decoder_it);
     packet = packet_lock.packet_;
     if (!packet) {
       Debug(2, "No packet available");
@@ -3241,13 +3484,23 @@ bool Monitor::Decode() {
       return true;
     }
 
+    // Adaptive decoding only changes between keyframes and all frames at a
+    // keyframe, so that all frames decoded belong to complete GOPs.
+    if ((decoding == DECODING_ADAPTIVE) && packet->keyframe && (decode_all_frames != decode_escalate)) {
+      decode_all_frames = decode_escalate;
+      shared_data->decode_all_frames = decode_all_frames;
+      Info("%s: %03d - Decoding %s", name.c_str(), packet->image_index,
+           decode_all_frames ? "all frames" : "keyframes only");
+    }
+
     // Check if this packet needs to be sent to the decoder
     bool already_decoded = packet->image || packet->in_frame || !packet->packet->size;
     bool should_decode = !already_decoded && (
       (decoding == DECODING_ALWAYS) ||
       ((decoding == DECODING_ONDEMAND) && (hasViewers() || shared_data->last_write_index == image_buffer_count)) ||
       ((decoding == DECODING_KEYFRAMES) && packet->keyframe) ||
-      ((decoding == DECODING_KEYFRAMESONDEMAND) && (hasViewers() || packet->keyframe))
+      ((decoding == DECODING_KEYFRAMESONDEMAND) && (hasViewers() || packet->keyframe)) ||
+      ((decoding == DECODING_ADAPTIVE) && (decode_all_frames || packet->keyframe))
     );
 
     if (!should_decode && !decoder_queue.empty()) {
@@ -3427,8 +3680,7 @@ bool Monitor::Decode() {
     // Write to shared image buffer.
     unsigned int index = (shared_data->last_write_index + 1) % image_buffer_count;
     decoding_image_count++;
-    WriteShmFrame(index, capture_image);
-    shared_timestamps[index] = zm::chrono::duration_cast<timeval>(packet->timestamp.time_since_epoch());
+    WriteShmFrame(index, capture_image, packet->timestamp);
     shared_data->signal = signal_check_points ? CheckSignal(capture_image) : true;
     shared_data->last_write_index = index;
     shared_data->last_write_time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -3525,7 +3777,7 @@ void Monitor::TimestampImage(Image *ts_image, SystemTimePoint ts_time) const {
     return;
   const std::string label_text = Substitute(label_format, ts_time);
 
-  ts_image->Annotate(label_text.c_str(), label_coord, label_size);
+  ts_image->Annotate(timestamp_cache, label_text, label_coord, label_size);
   Debug(2, "done annotating %s", label_text.c_str());
 } // end void Monitor::TimestampImage
 
@@ -3534,12 +3786,24 @@ Event * Monitor::openEvent(
   const std::string &cause,
   const Event::StringSetMap &noteSetMap) {
 
+  TimePoint open_start = std::chrono::steady_clock::now();
   // FIXME this iterator is not protected from invalidation
   packetqueue_iterator *start_it = packetqueue.get_event_start_packet_it(
       *analysis_it,
       (cause == "Continuous" ? 0 : (pre_event_count > alarm_frame_count ? pre_event_count : alarm_frame_count))
       );
 
+  // A handoff only carries on into an event that starts at its boundary,
+  // never into one opened long after the section it came from ended.
+  auto take_handoff = [this](SystemTimePoint start) {
+    if (segment_handoff and start - segment_handoff->boundary > MAX_SEGMENT_HANDOFF_WAIT) {
+      Debug(1, "Event starts %.2fs after the segment boundary, not continuing its video",
+          FPSeconds(start - segment_handoff->boundary).count());
+      segment_handoff.reset();
+    }
+    return std::move(segment_handoff);
+  };
+
   if (*start_it != *analysis_it) {
     ZMPacketLock starting_packet = packetqueue.get_packet(start_it);
 
@@ -3549,7 +3813,8 @@ Event * Monitor::openEvent(
     }
     packet_lock->unlock();
     ZM_DUMP_PACKET(starting_packet.packet_->packet, "First packet from start");
-    event = new Event(this, start_it, starting_packet.packet_->timestamp, cause, noteSetMap);
+    event = new Event(this, start_it, starting_packet.packet_->timestamp, cause, noteSetMap,
+        take_handoff(starting_packet.packet_->timestamp));
     float start_duration = FPSeconds(packet_lock->packet_->timestamp - starting_packet.packet_->timestamp).count();
     Debug(1, "Event duration at start: %.2f", start_duration);
     if (start_duration >= Seconds(min_section_length).count()) {
@@ -3561,12 +3826,15 @@ Event * Monitor::openEvent(
     SetVideoWriterStartTime(starting_packet.packet_->timestamp);
   } else {
     ZM_DUMP_PACKET(packet_lock->packet_->packet, "First packet from alarm");
-    event = new Event(this, start_it, packet_lock->packet_->timestamp, cause, noteSetMap);
+    event = new Event(this, start_it, packet_lock->packet_->timestamp, cause, noteSetMap,
+        take_handoff(packet_lock->packet_->timestamp));
     SetVideoWriterStartTime(packet_lock->packet_->timestamp);
   }
 
   shared_data->last_event_id = event->Id();
   strncpy(shared_data->alarm_cause, cause.c_str(), sizeof(shared_data->alarm_cause)-1);
+  EventRollover::RecordOpen(id,
+      std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - open_start));
 
 #if MOSQUITTOPP_FOUND
   if (mqtt) mqtt->send(stringtf("event start: %" PRId64, event->Id()));
@@ -3605,6 +3873,8 @@ Event * Monitor::openEvent(
 
 /* Caller must hold the event lock */
 void Monitor::closeEvent() {
+  // Whatever this event was handed has been taken or is of no use now
+  segment_handoff.reset();
   if (!event) return;
 
   if (close_event_thread.joinable()) {
@@ -3617,12 +3887,23 @@ void Monitor::closeEvent() {
   if (mqtt) mqtt->send(stringtf("event end: %" PRId64, event->Id()));
 #endif
   Debug(1, "Starting thread to close event");
-  close_event_thread = std::thread([](Event *e, const std::string &command) {
+  close_event_thread = std::thread([](Event *e, const std::string &command, SharedData *shared_data) {
+    TimePoint close_start = std::chrono::steady_clock::now();
     int64_t event_id = e->Id();
     int monitor_id = e->MonitorId();
-    Debug(1, "close_event_thread: deleting event %" PRId64, event_id);
-    delete e;
-    Debug(1, "close_event_thread: event %" PRId64 " deleted", event_id);
+    // Not finalizing yet, so this doesn't need to hold a rollover slot.
+    e->WaitHandOff();
+    {
+      EventRollover::Slot slot;
+      Debug(1, "close_event_thread: deleting event %" PRId64, event_id);
+      delete e;
+      Debug(1, "close_event_thread: event %" PRId64 " deleted", event_id);
+    }
+    Microseconds latency = std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - close_start);
+    EventRollover::RecordClose(monitor_id, latency);
+    if (shared_data) {
+      shared_data->last_rollover_ms = std::chrono::duration_cast<Milliseconds>(latency).count();
+    }
 
     if (!command.empty()) {
       if (fork() == 0) {
@@ -3650,12 +3931,31 @@ void Monitor::closeEvent() {
         std::quick_exit(0);
       }
     }
-  }, event, event_end_command);
+  }, event, event_end_command, shared_data);
   Debug(1, "Nulling event");
   event = nullptr;
   if (shared_data) video_store_data->recording = {};
 } // end bool Monitor::closeEvent()
 
+/* Caller must hold the event lock.
+ * Closes the event at the end of a continuous recording section. With the
+ * segmenter enabled the event's muxer is kept open and passed on to the next
+ * event, which takes over at the first keyframe after boundary.
+ */
+void Monitor::rolloverEvent(SystemTimePoint boundary) {
+  if (!event) return;
+
+  // Encoders hold back frames, so only a passthrough muxer can be cut cleanly.
+  std::shared_ptr<Event::SegmentHandoff> handoff;
+  if (config.event_segmenter and (videowriter == PASSTHROUGH)) {
+    handoff = std::make_shared<Event::SegmentHandoff>(boundary);
+    event->HandOff(handoff);
+  }
+  closeEvent();
+  // Only the event opened next gets to continue this one's video
+  segment_handoff = std::move(handoff);
+}
+
 unsigned int Monitor::DetectMotion(const Image &comp_image, Event::StringSet &zoneSet) {
   bool alarm = false;
   unsigned int score = 0;
@@ -3665,11 +3965,16 @@ unsigned int Monitor::DetectMotion(const Image &comp_image, Event::StringSet &zo
     return 0;
   }
 
-  if (!ref_image.Delta(comp_image, &delta_image)) {
+  if (analysis_engine == ANALYSIS_ENGINE_STATISTICAL) {
+    if (!background_model.Delta(comp_image, &delta_image))
+      return 0;
+  } else if (!ref_image.Delta(comp_image, &delta_image)) {
     return 0;
   }
 
   if (config.record_diag_images) {
+    if (analysis_engine == ANALYSIS_ENGINE_STATISTICAL)
+      background_model.Mean(ref_image);
     ref_image.WriteJpeg(diag_path_ref, config.record_diag_images_fifo);
     delta_image.WriteJpeg(diag_path_delta, config.record_diag_images_fifo);
   }
@@ -3682,7 +3987,7 @@ unsigned int Monitor::DetectMotion(const Image &comp_image, Event::StringSet &zo
     if (!zone.IsInactive())
       continue;
     Debug(3, "Blanking inactive zone %s", zone.Label());
-    delta_image.Fill(kRGBBlack, zone.GetPolygon());
+    delta_image.Fill(kRGBBlack, zone.GetAnalysisPolygon());
   } // end foreach zone
 
   // Check preclusive zones first
@@ -3798,16 +4103,52 @@ unsigned int Monitor::DetectMotion(const Image &comp_image, Event::StringSet &zo
   return score ? score : alarm;
 } // end DetectMotion
 
+const Image *Monitor::MotionImage(const Image *image) {
+  if (!image)
+    return image;
+  // The background model only keeps luma
+  if (analysis_scale <= 1
+      && (analysis_engine != ANALYSIS_ENGINE_STATISTICAL || zm_bytes_per_pixel(image->PixFormat()) == 1))
+    return image;
+  if (image != motion_image_source) {
+    if (!image->DecimateLuma(analysis_scale, motion_image))
+      return nullptr;
+    motion_image_source = image;
+  }
+  return &motion_image;
+}
+
+void Monitor::SeedReference(const Image &image) {
+  ref_image.Assign(image);
+  if (analysis_engine == ANALYSIS_ENGINE_STATISTICAL)
+    background_model.Reset(image);
+}
+
+void Monitor::UpdateReference(const Image &image) {
+  int blend = (state == ALARM) ? alarm_ref_blend_perc : ref_blend_perc;
+  if (analysis_engine == ANALYSIS_ENGINE_STATISTICAL) {
+    // ref_image keeps the seed frame so that it is never empty, the mean is
+    // only copied into it when diagnostic images are written.
+    background_model.Update(image, blend);
+  } else {
+    ref_image.Blend(image, blend);
+  }
+}
+
 unsigned int Monitor::AnalyseFrame(const Image &frame_image, Event::StringSet &zoneSet) {
+  motion_image_source = nullptr;
+  const Image *motion_frame = MotionImage(&frame_image);
+  if (!motion_frame)
+    return 0;
+
   if (!ref_image.Buffer()) {
-    ref_image.Assign(frame_image);
+    SeedReference(*motion_frame);
     return 0;
   }
 
-  unsigned int score = DetectMotion(frame_image, zoneSet);
+  unsigned int score = DetectMotion(*motion_frame, zoneSet);
 
-  int blend = (state == ALARM) ? alarm_ref_blend_perc : ref_blend_perc;
-  ref_image.Blend(frame_image, blend);
+  UpdateReference(*motion_frame);
 
   return score;
 } // end AnalyseFrame
@@ -3816,10 +4157,11 @@ unsigned int Monitor::AnalyseFrame(const Image &frame_image, Event::StringSet &z
   unsigned int score = AnalyseFrame(frame_image, zoneSet);
 
   if (analysis_image && score) {
+    // Assign reuses analysis_image's buffer when the caller keeps it across frames
     analysis_image->Assign(frame_image);
     for (const Zone &zone : zones) {
       if (zone.Alarmed() && zone.AlarmImage()) {
-        analysis_image->Overlay(*(zone.AlarmImage()));
+        analysis_image->Overlay(*(zone.AlarmImage()), &zone.GetStats().alarm_box_);
       }
     }
   }
@@ -3889,6 +4231,8 @@ bool Monitor::DumpSettings(char *output, bool verbose) {
               : 0.0);
   result += stringtf("Reference Blend %%ge : %d\n", ref_blend_perc);
   result += stringtf("Alarm Reference Blend %%ge : %d\n", alarm_ref_blend_perc);
+  result += stringtf("Analysis Engine : %s\n",
+                     analysis_engine == ANALYSIS_ENGINE_STATISTICAL ? "statistical" : "blend");
   result += stringtf("Track Motion : %d\n", track_motion);
   result += stringtf("Capturing %d - %s\n", capturing,
           Capturing_Strings[shared_data->capturing].c_str());
@@ -3962,6 +4306,9 @@ int Monitor::PrimeCapture() {
                avcodec_get_name(videoStream->codecpar->codec_id)
               );
       video_fifo = new Fifo(shared_data->video_fifo_path, true);
+      packet_ring.Open(GetPacketRingPath(), videoStream->codecpar->codec_id,
+                       videoStream->time_base.num, videoStream->time_base.den,
+                       videoStream->codecpar->extradata, videoStream->codecpar->extradata_size);
     }
     if (record_audio and (audio_stream_id >= 0)) {
       AVStream *audioStream = camera->getAudioStream();
@@ -4139,12 +4486,17 @@ int Monitor::Close() {
     Debug(1, "video fifo deleted");
     video_fifo = nullptr;
   }
+  packet_ring.Close();
 
   return 1;
 } // end Monitor::Close()
 
 Monitor::Orientation Monitor::getOrientation() const { return orientation; }
 
+std::string Monitor::GetPacketRingPath() const {
+  return stringtf("%s/zm.packets.%u", staticConfig.PATH_MAP.c_str(), id);
+}
+
 // Wait for camera to get an image, and then assign it as the base reference image.
 // So this should be done as the first task in the analysis thread startup.
 // This function is deprecated.
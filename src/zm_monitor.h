@@ -23,6 +23,7 @@
 #include "zm_define.h"
 #include "zm_camera.h"
 #include "zm_analysis_thread.h"
+#include "zm_background_model.h"
 #include "zm_poll_thread.h"
 #include "zm_decoder_thread.h"
 #include "zm_event.h"
@@ -30,6 +31,7 @@
 #include "zm_image.h"
 #include "zm_mqtt.h"
 #include "zm_packet.h"
+#include "zm_packet_ring.h"
 #include "zm_packetqueue.h"
 #include "zm_utils.h"
 #include "zm_zone.h"
@@ -59,6 +61,7 @@ class MonitorLinkExpression;
 //
 class Monitor : public std::enable_shared_from_this<Monitor> {
   friend class MonitorStream;
+  friend class StreamServer;
   friend class MonitorLinkExpression;
   friend class ONVIF;
 
@@ -107,7 +110,8 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
     DECODING_ONDEMAND,
     DECODING_KEYFRAMES,
     DECODING_KEYFRAMESONDEMAND,
-    DECODING_ALWAYS
+    DECODING_ALWAYS,
+    DECODING_ADAPTIVE
   } DecodingOption;
 
   typedef enum {
@@ -179,6 +183,8 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
 
   typedef enum { CLOSE_UNKNOWN=0, CLOSE_SYSTEM, CLOSE_TIME, CLOSE_DURATION, CLOSE_IDLE, CLOSE_ALARM } EventCloseMode;
 
+  typedef enum { ANALYSIS_ENGINE_BLEND=0, ANALYSIS_ENGINE_STATISTICAL } AnalysisEngine;
+
   /* sizeof(SharedData) expected to be 472 bytes on 32bit and 64bit */
   typedef struct {
     uint32_t size;              /* +0    */
@@ -252,22 +258,33 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
      * last_analysis_index is the slot most recently written (or
      * image_buffer_count as the "nothing written yet" sentinel);
      * analysis_image_count is a monotonic counter of analysis images published.
-     * Appended at the end so no earlier SharedData offset shifts. */
-    int32_t last_analysis_index;   /* +864 */
-    int32_t analysis_image_count;  /* +868 */
-    uint32_t analysis_pad[2];      /* +872  keep 16-byte multiple */
-    /* 880 total */
+     * Appended at the end so no earlier SharedData offset shifts. From here
+     * on the offsets are the real ones, which Monitor.php uses. */
+    int32_t last_analysis_index;   /* +872 */
+    int32_t analysis_image_count;  /* +876 */
+    uint32_t last_rollover_ms;     /* +880  time taken to finalize the last closed event */
+    /* Decoder statistics. decode_all_frames is set while the adaptive
+     * decoding mode is decoding every frame rather than just keyframes;
+     * decode_cpu is the decoder's CPU time per second in tenths of a percent
+     * of one core. */
+    uint32_t decode_all_frames;    /* +884 */
+    double decode_fps;             /* +888 */
+    uint32_t decode_cpu;           /* +896 */
+    /* Set by zmc when ZM_STREAM_PYRAMID copies follow the images. Readers
+     * size the map from this rather than their own config. */
+    uint32_t pyramid;              /* +900 */
+    /* 904 total */
   } SharedData;
   // Cross-process ABI guard: zmc/zma/zms plus the Perl (Memory.pm) and PHP
   // (Monitor.php) SHM readers all assume this exact layout. If it changes,
   // update those readers in lockstep and bump the size below.
   // Cross-process ABI guard. The struct is naturally aligned (NOT packed), so
   // two 4-byte pads exist (before capture_fps and before the startup_time
-  // union); the /* +N */ comments above are the packed-layout ideal and do NOT
-  // reflect real offsets. zmc/zma/zms and the Perl (Memory.pm, which computes
+  // union); the /* +N */ comments above up to janus_pin are the packed-layout
+  // ideal and do NOT reflect real offsets. zmc/zma/zms and the Perl (Memory.pm, which computes
   // alignment) SHM reader assume this exact layout. If it changes, update the
   // readers in lockstep and bump the size here.
-  static_assert(sizeof(SharedData) == 888, "SharedData layout changed; update Memory.pm and Monitor.php offsets");
+  static_assert(sizeof(SharedData) == 904, "SharedData layout changed; update Memory.pm and Monitor.php offsets");
 
   enum TriggerState : uint32 {
     TRIGGER_CANCEL,
@@ -599,6 +616,7 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   std::string     label_format;    // The format of the timestamp on the images
   Vector2      label_coord;      // The coordinates of the timestamp on the images
   int        label_size;         // Size of the timestamp on the images
+  mutable AnnotationCache timestamp_cache;  // Rendered timestamp, reused across frames
   int32_t    image_buffer_count;        // Size of circular image buffer, kept in /dev/shm
   int32_t    max_image_buffer_count;    // Max # of video packets to keep in packet queue
   int        warmup_count;              // How many images to process before looking for events
@@ -609,6 +627,7 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   bool        section_length_warn;  // Whether to log a warning when a motion event exceeds desired section_length
   Seconds    min_section_length;   // Minimum event length when using event_close_mode == ALARM
   bool       startstop_on_section_length; // Whether to start/stop events on time % section_length
+  Seconds    section_phase;        // Offset of CLOSE_TIME section boundaries, staggers rollover between monitors
   bool       adaptive_skip;        // Whether to use the newer adaptive algorithm for this monitor
   int        frame_skip;        // How many frames to skip in continuous modes
   int        motion_frame_skip;      // How many frames to skip in motion detection
@@ -622,6 +641,8 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   int        fps_report_interval;  // How many images should be captured/processed between reporting the current FPS
   int        ref_blend_perc;      // Percentage of new image going into reference image.
   int        alarm_ref_blend_perc;      // Percentage of new image going into reference image during alarm.
+  unsigned int analysis_scale;    // Motion detection runs on frames decimated by this, see ZM_ANALYSIS_SCALE
+  AnalysisEngine analysis_engine;  // How the reference is kept, see ZM_ANALYSIS_ENGINE
   bool       track_motion;      // Whether this monitor tries to track detected motion
   int         signal_check_points;  // Number of points in the image to check for signal
   Rgb         signal_check_colour;  // The colour that the camera will emit when no video signal detected
@@ -645,6 +666,13 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   int        last_capture_image_count; // last value of image_count when calculating capture fps
   int        analysis_image_count;    // How many frames have been processed by analysis thread.
   int        decoding_image_count;    // How many frames have been processed by analysis thread.
+  int        last_decoding_image_count; // last value of decoding_image_count when calculating decode fps
+  std::atomic<int64_t> decode_cpu_us;  // CPU time spent in Decode()
+  int64_t    last_decode_cpu_us;
+  // Adaptive decoding: analysis asks for all frames, the decoder switches at the next keyframe
+  std::atomic<bool> decode_escalate;
+  bool       decode_all_frames;
+  SystemTimePoint decode_escalated_until;
   int        motion_frame_count;      // How many frames have had motion detection performed on them.
   int         last_motion_frame_count; // last value of motion_frame_count when calculating fps
   int        ready_count;
@@ -683,12 +711,25 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   // analysis_image_buffer slot), mirroring image_pixelformats for the capture
   // ring. Replaces the former single alarm_image_pixelformat.
   AVPixelFormat *analysis_image_pixelformats;
+  // Per-slot seqlock sequence for the capture ring. Odd while zmc is writing
+  // the slot, bumped again once the image and its timestamp are complete.
+  std::atomic<uint32_t> *image_seqs;
   size_t shm_slot_size;  // per-slot byte capacity, sized to RGBA upper bound
+  // Optional (ZM_STREAM_PYRAMID) half and quarter size copies of each capture
+  // slot, written under the slot's seqlock. pyramid_pixelformats[index] is
+  // AV_PIX_FMT_NONE when the copies for that slot couldn't be made.
+  static constexpr int PYRAMID_LEVELS = 2;
+  std::vector<Image *> pyramid_buffer[PYRAMID_LEVELS];
+  size_t pyramid_slot_size[PYRAMID_LEVELS];
+  AVPixelFormat *pyramid_pixelformats;
+  // Reads the SharedData zmc has published, false if there isn't any yet
+  bool ReadPublishedSharedData(SharedData &published) const;
 
   int video_stream_id; // will be filled in PrimeCapture
   int audio_stream_id; // will be filled in PrimeCapture
   Fifo *video_fifo;
   Fifo *audio_fifo;
+  PacketRing::Writer packet_ring;  // Video packets for passthrough viewers
 
   std::shared_ptr<Camera> camera;
   Event       *event;
@@ -705,6 +746,8 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   std::unique_ptr<DecoderThread> decoder;
   SwsContext   *convert_context;
   std::thread  close_event_thread;
+  // Pending muxer handoff from the last rolled over event to the next one
+  std::shared_ptr<Event::SegmentHandoff> segment_handoff;
 
   std::vector<Zone> zones;
 
@@ -728,6 +771,9 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
 
   Image        delta_image;
   Image        ref_image;
+  Image        motion_image;   // Luma of the frame being analysed, when decimated or for the statistical engine
+  BackgroundModel background_model;  // Takes the place of blending into ref_image for ANALYSIS_ENGINE_STATISTICAL
+  const Image *motion_image_source{nullptr};  // The frame motion_image was decimated from
   // ref_image is owned by the analysis thread (Analyse/DetectMotion). The
   // capture thread (CheckAction) must not touch its buffer directly; on
   // suspend-resume it sets this flag instead and the analysis thread drops the
@@ -757,6 +803,8 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   Rgb colour_val; /* RGB32 color */
   int usedsubpixorder;
 
+  bool Decode_(bool wait);
+
  public:
   explicit Monitor();
 
@@ -922,6 +970,10 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
 
   unsigned int Width() const { return width; }
   unsigned int Height() const { return height; }
+  // Size of the frames motion detection, the reference image and zone masks work at
+  unsigned int AnalysisScale() const { return analysis_scale; }
+  unsigned int AnalysisWidth() const { return width / analysis_scale; }
+  unsigned int AnalysisHeight() const { return height / analysis_scale; }
   unsigned int Colours() const;
   unsigned int SubpixelOrder() const;
 
@@ -959,6 +1011,7 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   std::string GetSecondPath() const { return second_path; };
   std::string GetVideoFifoPath() const { return shared_data ? shared_data->video_fifo_path : ""; };
   std::string GetAudioFifoPath() const { return shared_data ? shared_data->audio_fifo_path : ""; };
+  std::string GetPacketRingPath() const;
   std::string GetRTSPStreamName() const { return rtsp_streamname; };
 
   const std::string &getONVIF_URL() const { return onvif_url; };
@@ -1022,6 +1075,12 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
 
   void CheckAction();
 
+  // The image motion detection runs on for a frame: image itself, or its
+  // luma (decimated) in motion_image. nullptr if there is none.
+  const Image *MotionImage(const Image *image);
+  // Start the reference over from, or fold in, a motion image
+  void SeedReference(const Image &image);
+  void UpdateReference(const Image &image);
   unsigned int DetectMotion( const Image &comp_image, Event::StringSet &zoneSet );
   unsigned int AnalyseFrame( const Image &frame_image, Event::StringSet &zoneSet );
   unsigned int AnalyseFrame( const Image &frame_image, Event::StringSet &zoneSet, Image *analysis_image );
@@ -1033,16 +1092,34 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   // Write capture_image into image_buffer[index] without conversion and
   // record its AVPixelFormat in image_pixelformats[index] so reading
   // processes can adopt that format via ReadShmFrame.
-  void WriteShmFrame(unsigned int index, Image *capture_image);
+  // The slot's timestamp is written under the same seqlock as the image.
+  void WriteShmFrame(unsigned int index, Image *capture_image, SystemTimePoint timestamp);
 
   // Read-side counterpart: ensures image_buffer[index]'s metadata matches
   // the format zmc wrote via image_pixelformats[index] before returning
   // it. Use this from zms / zma / event paths instead of touching
   // image_buffer[index] directly.
   Image *ReadShmFrame(unsigned int index);
+  // Seqlock read side. Take the sequence before reading slot index in place
+  // and check it afterwards; if ValidShmRead() fails zmc has overwritten the
+  // slot in the meantime and what was read may be torn.
+  uint32_t BeginShmRead(unsigned int index) const;
+  bool ValidShmRead(unsigned int index, uint32_t seq) const;
+  // The smallest pyramid copy of slot index that is still at least scale
+  // percent of full size, or nullptr if there isn't one. level_scale is set
+  // to that copy's scale.
+  Image *ReadShmPyramid(unsigned int index, int scale, int &level_scale);
+  // What a viewer at scale percent should start from: the pyramid copy from
+  // ReadShmPyramid when there is one, otherwise the full frame with
+  // level_scale set to ZM_SCALE_BASE.
+  Image *ReadShmFrame(unsigned int index, int scale, int &level_scale);
+  SystemTimePoint ShmTimestamp(unsigned int index) const {
+    return SystemTimePoint(zm::chrono::duration_cast<Microseconds>(shared_timestamps[index]));
+  }
   void applyOrientation(Image *image);
   bool applyDeinterlacing(std::shared_ptr<ZMPacket> &packet, Image *capture_image);
-  bool Decode();
+  // With wait false, returns false instead of blocking when there is no packet
+  bool Decode(bool wait = true);
   bool Poll();
   void DumpImage( Image *dump_image ) const;
   std::string Substitute(const std::string &format, SystemTimePoint ts_time) const;
@@ -1052,6 +1129,7 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
     const std::string &cause,
     const Event::StringSetMap &noteSetMap);
   void closeEvent();
+  void rolloverEvent(SystemTimePoint boundary);
 
   void Reload();
   void ReloadZones();
@@ -1086,6 +1164,9 @@ class Monitor : public std::enable_shared_from_this<Monitor> {
   int StartupDelay() const { return startup_delay; }
 };
 
+// The official SQL to load a Monitor, append a WHERE clause to select one
+extern std::string load_monitor_sql;
+
 #define MOD_ADD( var, delta, limit ) (((var)+(limit)+(delta))%(limit))
 
 #endif // ZM_MONITOR_H
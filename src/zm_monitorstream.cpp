@@ -20,6 +20,7 @@
 #include "zm_monitorstream.h"
 
 #include "zm_monitor.h"
+#include "zm_sendfile.h"
 #include "zm_signal.h"
 #include "zm_time.h"
 
@@ -357,28 +358,19 @@ bool MonitorStream::sendFrame(const std::string &filepath, SystemTimePoint times
     Image temp_image(filepath.c_str());
     return sendFrame(&temp_image, timestamp);
   } else {
-    int img_buffer_size = 0;
-    static unsigned char img_buffer[ZM_MAX_IMAGE_SIZE];
-
-    if (FILE *fdj = fopen(filepath.c_str(), "r")) {
-      img_buffer_size = fread(img_buffer, 1, sizeof(img_buffer), fdj);
-      fclose(fdj);
-    } else {
-      Error("Can't open %s: %s", filepath.c_str(), strerror(errno));
-      return false;
-    }
-
     // Calculate how long it takes to actually send the frame
     TimePoint send_start_time = std::chrono::steady_clock::now();
 
-    if (
-      (0 > fprintf(stdout, "Content-Length: %d\r\nX-Timestamp: %.6f\r\n\r\n",
-                   img_buffer_size, std::chrono::duration_cast<FPSeconds>(timestamp.time_since_epoch()).count()))
-      ||
-      (fwrite(img_buffer, img_buffer_size, 1, stdout) != 1)
-    ) {
-      if (!zm_terminate)
-        Warning("Unable to send stream frame: %s", strerror(errno));
+    fflush(stdout);
+    std::string headers = stringtf("--" BOUNDARY "\r\nContent-Type: image/jpeg\r\nX-Timestamp: %.6f\r\n",
+                                   std::chrono::duration_cast<FPSeconds>(timestamp.time_since_epoch()).count());
+    int err = zm_sendfile_part(fileno(stdout), filepath, headers);
+    if (err) {
+      if (err == ENOENT or err == EACCES or err == ENODATA) {
+        Error("Can't send %s: %s", filepath.c_str(), strerror(err));
+      } else if (!zm_terminate) {
+        Warning("Unable to send stream frame: %s", strerror(err));
+      }
       return false;
     }
     fputs("\r\n", stdout);
@@ -408,11 +400,11 @@ bool MonitorStream::sendFrame(Image *image, SystemTimePoint timestamp) {
   }
   Image *send_image = prepareImage(image);
 
-  fputs("--" BOUNDARY "\r\n", stdout);
   // Calculate how long it takes to actually send the frame
   TimePoint send_start_time = std::chrono::steady_clock::now();
 
   if (type == STREAM_MPEG) {
+    fputs("--" BOUNDARY "\r\n", stdout);
     if (!vid_stream) {
       vid_stream = new VideoStream("pipe:", format, bitrate, effective_fps, send_image->Colours(), send_image->SubpixelOrder(), send_image->Width(), send_image->Height());
       fprintf(stdout, "Content-Type: %s\r\n\r\n", vid_stream->MimeType());
@@ -437,19 +429,22 @@ bool MonitorStream::sendFrame(Image *image, SystemTimePoint timestamp) {
     size_t img_buffer_size = 0;
     unsigned char *img_buffer = temp_img_buffer;
 
+    const char *content_type = nullptr;
     switch (type) {
     case STREAM_JPEG :
       send_image->EncodeJpeg(img_buffer, &img_buffer_size);
-      fputs("Content-Type: image/jpeg\r\n", stdout);
+      content_type = "image/jpeg";
       break;
     case STREAM_RAW :
-      fputs("Content-Type: image/x-rgb\r\n", stdout);
-      img_buffer = send_image->Buffer();
+      content_type = "image/x-rgb";
+      // Copied so that what we validate below is what gets sent, rather than
+      // a slot zmc may still be writing to while we do.
       img_buffer_size = send_image->Size();
+      memcpy(img_buffer, send_image->Buffer(), img_buffer_size);
       break;
     case STREAM_ZIP :
 #if HAVE_ZLIB_H
-      fputs("Content-Type: image/x-rgbz\r\n", stdout);
+      content_type = "image/x-rgbz";
       unsigned long zip_buffer_size;
       send_image->Zip(img_buffer, &zip_buffer_size);
       img_buffer_size = zip_buffer_size;
@@ -462,9 +457,16 @@ bool MonitorStream::sendFrame(Image *image, SystemTimePoint timestamp) {
       Error("Unexpected frame type %d", type);
       return false;
     }
+    // The image was encoded or copied straight out of shared memory. If zmc
+    // has lapped us and rewritten the slot meanwhile the result may be torn,
+    // so drop it before any of the part has been written; the caller will
+    // send the newer frame instead.
+    if ((shm_index >= 0) and !monitor->ValidShmRead(shm_index, shm_seq)) {
+      Debug(1, "Shm slot %d was overwritten while encoding, skipping frame", shm_index);
+      return true;
+    }
     if (
-      (0 > fprintf(stdout, "Content-Length: %zu\r\nX-Timestamp: %.6f\r\n\r\n",
-                   img_buffer_size, std::chrono::duration_cast<FPSeconds>(timestamp.time_since_epoch()).count()))
+      (0 > fputs(MultipartHeader(content_type, img_buffer_size, timestamp).c_str(), stdout))
       ||
       (fwrite(img_buffer, img_buffer_size, 1, stdout) != 1)
     ) {
@@ -670,7 +672,7 @@ void MonitorStream::runStream() {
         int index = monitor->shared_data->last_write_index % monitor->image_buffer_count;
         Debug(1, "Saving paused image from index %d",index);
         paused_image = new Image(*monitor->ReadShmFrame(index));
-        paused_timestamp = SystemTimePoint(zm::chrono::duration_cast<Microseconds>(monitor->shared_timestamps[index]));
+        paused_timestamp = monitor->ShmTimestamp(index);
       }
     } else if (paused_image) {
       delete paused_image;
@@ -706,6 +708,11 @@ void MonitorStream::runStream() {
                 if (!sendFrame(temp_image_buffer[temp_index].file_name, temp_image_buffer[temp_index].timestamp)) {
                   zm_terminate = true;
                 }
+                // Have the next frame to be replayed waiting in the page cache
+                int next_step = frame_mod % temp_image_buffer_count;
+                int next_index = MOD_ADD(temp_index, (replay_rate > 0 ? next_step : -next_step), temp_image_buffer_count);
+                if (temp_image_buffer[next_index].valid)
+                  zm_readahead(temp_image_buffer[next_index].file_name);
                 frame_count++;
                 last_frame_timestamp = swap_image->timestamp;
                 // frame_sent = true;
@@ -769,25 +776,35 @@ void MonitorStream::runStream() {
                 index, last_write_index, monitor->image_buffer_count, frame_mod, frame_count, last_image_count, monitor->shared_data->image_count, paused, delayed);
           last_read_index = last_write_index;
           last_image_count = monitor->shared_data->image_count;
+          uint32_t seq = monitor->BeginShmRead(index);
           // Send the next frame
           //
           // Perhaps we should use NOW instead.
-          last_frame_timestamp =
-            SystemTimePoint(zm::chrono::duration_cast<Microseconds>(monitor->shared_timestamps[index]));
+          last_frame_timestamp = monitor->ShmTimestamp(index);
 
           Image *send_image = nullptr;
+          shm_index = -1;
           if ((frame_type == FRAME_ANALYSIS) &&
               (monitor->Analysing() != Monitor::ANALYSING_NONE)) {
               Debug(1, "Sending analysis image");
             send_image = monitor->GetAlarmImage();
             if (!send_image) {
               Debug(1, "Falling back");
+              shm_seq = seq;
+              shm_index = index;
               send_image = monitor->ReadShmFrame(index);
             }
           } else {
             //AVPixelFormat pixformat = monitor->image_pixelformats[index];
             //Debug(1, "Sending regular image index %d, pix format is %d %s", index, pixformat, av_get_pix_fmt_name(pixformat));
-            send_image = monitor->ReadShmFrame(index);
+            shm_seq = seq;
+            shm_index = index;
+            // Start from zmc's pre-scaled copy nearest to what we want
+            if (zoom == ZM_SCALE_BASE) {
+              send_image = monitor->ReadShmFrame(index, scale, source_scale);
+            } else {
+              send_image = monitor->ReadShmFrame(index);
+            }
           }
 
           if (!sendFrame(send_image, last_frame_timestamp)) {
@@ -805,6 +822,8 @@ void MonitorStream::runStream() {
               break;
             }
           }
+          shm_index = -1;
+          source_scale = ZM_SCALE_BASE;
 
           temp_read_index = temp_write_index;
         } else {
@@ -853,8 +872,7 @@ void MonitorStream::runStream() {
               temp_image_buffer[temp_index].valid = true;
             }
 
-            temp_image_buffer[temp_index].timestamp =
-              SystemTimePoint(zm::chrono::duration_cast<Microseconds>(monitor->shared_timestamps[index]));
+            temp_image_buffer[temp_index].timestamp = monitor->ShmTimestamp(index);
             monitor->ReadShmFrame(index)->WriteJpeg(temp_image_buffer[temp_index].file_name, config.jpeg_file_quality);
             temp_write_index = MOD_ADD(temp_write_index, 1, temp_image_buffer_count);
             if (temp_write_index == temp_read_index) {
@@ -1014,8 +1032,7 @@ void MonitorStream::SingleImage(int scale) {
   Debug(1, "Sending regular image index %d, pix format is %d %s", index, pixformat, zm_get_pix_fmt_name(pixformat));
   Image *snap_image = monitor->ReadShmFrame(index);
   if (!config.timestamp_on_capture) {
-    monitor->TimestampImage(snap_image,
-                            SystemTimePoint(zm::chrono::duration_cast<Microseconds>(monitor->shared_timestamps[index])));
+    monitor->TimestampImage(snap_image, monitor->ShmTimestamp(index));
   }
 
   if ( scale != ZM_SCALE_BASE ) {
@@ -47,6 +47,10 @@ class MonitorStream : public StreamBase {
   int temp_image_buffer_count;
   int temp_read_index;
   int temp_write_index;
+  // SHM slot being sent and its seqlock sequence, shm_index is -1 when the
+  // image being sent isn't read in place from the capture ring
+  int shm_index;
+  uint32_t shm_seq;
 
  protected:
   Microseconds ttl;
@@ -70,6 +74,8 @@ class MonitorStream : public StreamBase {
     temp_image_buffer_count(0),
     temp_read_index(0),
     temp_write_index(0),
+    shm_index(-1),
+    shm_seq(0),
     ttl(0),
     playback_buffer(0),
     delayed(false)
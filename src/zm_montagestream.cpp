@@ -0,0 +1,554 @@
+//
+// ZoneMinder Montage Stream Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_montagestream.h"
+
+#include "zm_db.h"
+#include "zm_logger.h"
+#include "zm_signal.h"
+#include "zm_utils.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <sys/socket.h>
+
+constexpr Milliseconds MontageTile::FETCH_WAIT;
+constexpr Seconds MontageTile::RECHECK_INTERVAL;
+constexpr Seconds MontageStream::MAX_SINGLE_WAIT;
+
+namespace {
+
+// Image::ReadJpeg shares one decompressor between every Image
+std::mutex read_jpeg_mutex;
+
+}  // namespace
+
+MontageTile::MontageTile(int p_monitor_id) :
+  have_frame_(false),
+  pending_(false),
+  step_(1),
+  have_gap_(false),
+  open_event_(false),
+  drawn_event_id_(0),
+  drawn_frame_id_(0),
+  drawn_blank_(false) {
+  monitor_id = p_monitor_id;
+}
+
+bool MontageTile::locate(SystemTimePoint time) {
+  const TimePoint now = std::chrono::steady_clock::now();
+  if (have_gap_ and time >= gap_start_ and time < gap_end_ and now - gap_checked_ < RECHECK_INTERVAL)
+    return false;
+  // Past what we have of an event still being recorded, show its last frame for now
+  if (event_data and open_event_ and time > event_data->end_time and now - loaded_at_ < RECHECK_INTERVAL)
+    return true;
+
+  const intmax_t t = std::chrono::system_clock::to_time_t(time);
+
+  // The last event to start at or before time.  Walking back from time keeps
+  // this to the monitor's recent events rather than its whole history.
+  std::string sql = stringtf("SELECT `Id`, unix_timestamp(`EndDateTime`) FROM `Events` "
+                             "WHERE `MonitorId` = %d AND `StartDateTime` <= from_unixtime(%jd) "
+                             "ORDER BY `StartDateTime` DESC, `Id` DESC LIMIT 1",
+                             monitor_id, t);
+  MYSQL_RES *result = zmDbFetch(sql);
+  if (!result) return false;
+  uint64_t event_id = 0;
+  bool have_end = false;
+  intmax_t end = 0;
+  if (MYSQL_ROW dbrow = mysql_fetch_row(result)) {
+    event_id = strtoull(dbrow[0], nullptr, 10);
+    have_end = dbrow[1] != nullptr;
+    end = have_end ? strtoll(dbrow[1], nullptr, 10) : 0;
+  }
+  mysql_free_result(result);
+
+  if (event_id and have_end and end >= t)
+    return load(event_id, false, now);
+
+  // Either time is past the end of that event, or it has no end yet
+  sql = stringtf("SELECT `Id`, unix_timestamp(`StartDateTime`) FROM `Events` "
+                 "WHERE `MonitorId` = %d AND `StartDateTime` > from_unixtime(%jd) "
+                 "ORDER BY `StartDateTime`, `Id` LIMIT 1",
+                 monitor_id, t);
+  result = zmDbFetch(sql);
+  if (!result) return false;
+  uint64_t next_event_id = 0;
+  SystemTimePoint next_start = SystemTimePoint::max();
+  if (MYSQL_ROW dbrow = mysql_fetch_row(result)) {
+    next_event_id = strtoull(dbrow[0], nullptr, 10);
+    next_start = SystemTimePoint(Seconds(dbrow[1] ? atoll(dbrow[1]) : 0));
+  }
+  mysql_free_result(result);
+
+  if (event_id and !have_end) {
+    // With nothing after it, the event is still being recorded
+    if (!next_event_id)
+      return load(event_id, true, now);
+    // Otherwise zmc never closed it, and it only covers as far as its frames
+    // go.  loadEventData took its missing end time to be now, which would
+    // have it cover everything since, so end it at its last frame instead.
+    if (!event_data or event_data->event_id != event_id)
+      load(event_id, false, now);
+    if (event_data and event_data->event_id == event_id) {
+      event_data->end_time = event_data->frames.empty() ? event_data->start_time
+                             : event_data->frames[event_data->frames.size() - 1].timestamp;
+      if (time <= event_data->end_time) return true;
+    }
+  }
+
+  if (next_event_id) {
+    Debug(2, "Monitor %d has nothing recorded until event %" PRIu64, monitor_id, next_event_id);
+  } else {
+    Debug(2, "No events for monitor %d after %.2f", monitor_id, FPSeconds(time.time_since_epoch()).count());
+  }
+  have_gap_ = true;
+  gap_start_ = time;
+  gap_end_ = next_start;
+  gap_checked_ = now;
+  return false;
+}
+
+bool MontageTile::load(uint64_t event_id, bool open_event, TimePoint now) {
+  have_gap_ = false;
+  open_event_ = open_event;
+  if (!event_data or event_data->event_id != event_id or open_event) {
+    Debug(1, "Monitor %d loading event %" PRIu64, monitor_id, event_id);
+    loadEventData(event_id);
+    loaded_at_ = now;
+  }
+  return event_data != nullptr;
+}
+
+void MontageTile::position(SystemTimePoint time, int rate) {
+  replay_rate = rate;
+  const uint64_t previous_event_id = event_data ? event_data->event_id : 0;
+  if (!event_data or time < event_data->start_time or time > event_data->end_time) {
+    if (!locate(time)) {
+      have_frame_ = false;
+      return;
+    }
+  }
+  if (event_data->frames.empty()) {
+    have_frame_ = false;
+    return;
+  }
+
+  // The last frame at or before time, or the first if time is before them all
+  size_t index = event_data->frames.LowerBound(time);
+  if (index == event_data->frames.size() or (index != 0 and event_data->frames[index].timestamp > time))
+    --index;
+  const int frame_id = static_cast<int>(index) + 1;
+
+  // Tells the prefetcher how far apart the frames we show are
+  if (have_frame_ and event_data->event_id == previous_event_id and frame_id != curr_frame_id) {
+    step_ = frame_id - curr_frame_id;
+  } else if (event_data->event_id != previous_event_id) {
+    step_ = rate < 0 ? -1 : 1;
+  }
+  curr_frame_id = frame_id;
+  curr_stream_time = time;
+  have_frame_ = true;
+}
+
+Image *MontageTile::fetch() {
+  if (prefetch_stale_) startPrefetch();
+
+  EventFramePrefetcher::Frame frame;
+  bool have_prefetched = false;
+  if (prefetcher_.Running()) {
+    prefetcher_.Request(curr_frame_id, step_, keyframesOnly());
+    have_prefetched = prefetcher_.Get(curr_frame_id, frame, FETCH_WAIT);
+  }
+  if (have_prefetched and frame.image) {
+    fetched_ = std::move(frame.image);
+    return fetched_.get();
+  }
+
+  const std::string path = have_prefetched ? frame.path :
+                           EventFramePrefetcher::FramePath(event_data->path, event_data->SaveJPEGs,
+                                                           frame_type == FRAME_ANALYSIS, curr_frame_id);
+  if (path.empty()) {
+    Debug(2, "Frame %d of event %" PRIu64 " isn't decoded yet", curr_frame_id, event_data->event_id);
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lck(read_jpeg_mutex);
+  if (!decoded_.ReadJpeg(path, ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA)) {
+    Warning("Unable to read %s", path.c_str());
+    return nullptr;
+  }
+  return &decoded_;
+}
+
+bool MontageTile::render(Image &montage, const Box &cell) {
+  pending_ = false;
+  if (!have_frame_) {
+    if (drawn_blank_) return false;
+    montage.Fill(kRGBBlack, &cell);
+    drawn_blank_ = true;
+    drawn_event_id_ = 0;
+    drawn_frame_id_ = 0;
+    return true;
+  }
+  if (!drawn_blank_ and drawn_event_id_ == event_data->event_id and drawn_frame_id_ == curr_frame_id)
+    return false;
+
+  Image *image = fetch();
+  if (!image) {
+    pending_ = true;
+    return false;
+  }
+
+  const int cell_width = cell.Width() + 1;
+  const int cell_height = cell.Height() + 1;
+  int width, height;
+  MontageStream::fitSize(image->Width(), image->Height(), cell_width, cell_height, width, height);
+  const Image *fitted = image;
+  if (width != static_cast<int>(image->Width()) or height != static_cast<int>(image->Height())) {
+    if (!image->Scale(width, height, scaled_)) return false;
+    fitted = &scaled_;
+  }
+  if (width < cell_width or height < cell_height)
+    montage.Fill(kRGBBlack, &cell);
+  montage.Overlay(*fitted, cell.Lo().x_ + (cell_width - width) / 2, cell.Lo().y_ + (cell_height - height) / 2);
+
+  drawn_blank_ = false;
+  drawn_event_id_ = event_data->event_id;
+  drawn_frame_id_ = curr_frame_id;
+  return true;
+}
+
+void MontageTile::invalidate() {
+  drawn_blank_ = false;
+  drawn_event_id_ = 0;
+  drawn_frame_id_ = 0;
+}
+
+MontageStream::MontageStream() :
+  redraw(true),
+  relayout(false),
+  base_width(0),
+  base_height(0),
+  columns(1),
+  rows(1),
+  cell_width(0),
+  cell_height(0),
+  render_generation(0),
+  rendered(0),
+  render_changed(false),
+  render_pending(false),
+  render_quit(false) {
+}
+
+void MontageStream::gridSize(size_t count, int &p_columns, int &p_rows) {
+  p_columns = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count)))));
+  p_rows = std::max(1, static_cast<int>((count + p_columns - 1) / p_columns));
+}
+
+void MontageStream::fitSize(int width, int height, int p_cell_width, int p_cell_height, int &fit_width, int &fit_height) {
+  if (width <= 0 or height <= 0) {
+    fit_width = p_cell_width;
+    fit_height = p_cell_height;
+  } else if (static_cast<int64_t>(width) * p_cell_height >= static_cast<int64_t>(height) * p_cell_width) {
+    fit_width = p_cell_width;
+    fit_height = static_cast<int>(static_cast<int64_t>(height) * p_cell_width / width);
+  } else {
+    fit_height = p_cell_height;
+    fit_width = static_cast<int>(static_cast<int64_t>(width) * p_cell_height / height);
+  }
+  fit_width = std::max(1, fit_width);
+  fit_height = std::max(1, fit_height);
+}
+
+void MontageStream::setStreamStart(const std::vector<int> &monitor_ids, SystemTimePoint time) {
+  stream_time = time;
+  for (int id : monitor_ids) {
+    if (tiles.size() == MAX_TILES) {
+      Warning("Only showing the first %zu monitors", MAX_TILES);
+      break;
+    }
+    std::shared_ptr<Monitor> tile_monitor = Monitor::Load(id, false, Monitor::QUERY);
+    if (!tile_monitor) {
+      Error("Unable to load monitor %d for the montage", id);
+      continue;
+    }
+    base_width = std::max(base_width, static_cast<int>(tile_monitor->Width()));
+    base_height = std::max(base_height, static_cast<int>(tile_monitor->Height()));
+    tiles.push_back(std::make_unique<MontageTile>(id));
+  }
+}
+
+void MontageStream::layout() {
+  gridSize(tiles.size(), columns, rows);
+  cell_width = std::max(2, static_cast<int>(static_cast<int64_t>(base_width) * scale / ZM_SCALE_BASE) & ~1);
+  cell_height = std::max(2, static_cast<int>(static_cast<int64_t>(base_height) * scale / ZM_SCALE_BASE) & ~1);
+  montage = std::make_unique<Image>(cell_width * columns, cell_height * rows, ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA);
+  montage->Clear();
+  for (auto &tile : tiles)
+    tile->invalidate();
+  Debug(1, "Montage of %zu tiles is %dx%d cells of %dx%d", tiles.size(), columns, rows, cell_width, cell_height);
+}
+
+Box MontageStream::cell(size_t index) const {
+  const int x = static_cast<int>(index % columns) * cell_width;
+  const int y = static_cast<int>(index / columns) * cell_height;
+  return Box({x, y}, {x + cell_width - 1, y + cell_height - 1});
+}
+
+void MontageStream::renderWorker(size_t index) {
+  int generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lck(render_mutex);
+      render_condition.wait(lck, [this, generation] { return render_quit or render_generation != generation; });
+      if (render_quit) return;
+      generation = render_generation;
+    }
+
+    // Cells don't overlap, so tiles can draw into the montage at the same time
+    MontageTile &tile = *tiles[index];
+    const bool changed = tile.render(*montage, cell(index));
+
+    {
+      std::lock_guard<std::mutex> lck(render_mutex);
+      render_changed |= changed;
+      render_pending |= tile.pending();
+      rendered++;
+    }
+    rendered_condition.notify_one();
+  }
+}
+
+bool MontageStream::renderTiles(bool &pending) {
+  std::unique_lock<std::mutex> lck(render_mutex);
+  render_changed = false;
+  render_pending = false;
+  rendered = 0;
+  render_generation++;
+  render_condition.notify_all();
+  rendered_condition.wait(lck, [this] { return rendered == tiles.size(); });
+  pending = render_pending;
+  return render_changed;
+}
+
+bool MontageStream::sendMontage() {
+  reserveTempImgBuffer(montage->Size());
+  size_t img_buffer_size = 0;
+  montage->EncodeJpeg(temp_img_buffer, &img_buffer_size);
+
+  if (type != STREAM_SINGLE)
+    fputs("--" BOUNDARY "\r\n", stdout);
+  if (0 > fprintf(stdout, "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", img_buffer_size)) {
+    Debug(1, "Unable to send montage: %s", strerror(errno));
+    return false;
+  }
+  if (fwrite(temp_img_buffer, img_buffer_size, 1, stdout) != 1) {
+    if (!zm_terminate)
+      Error("Unable to send montage: %s", strerror(errno));
+    return false;
+  }
+  fputs("\r\n", stdout);
+  fflush(stdout);
+  last_frame_sent = now;
+  frame_count++;
+  return true;
+}
+
+void MontageStream::runStream() {
+  openComms();
+
+  if (type == STREAM_JPEG)
+    fputs("Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n\r\n", stdout);
+
+  if (tiles.empty()) {
+    sendTextFrame("No monitors to show");
+    zm_terminate = true;
+    return;
+  }
+
+  layout();
+  for (size_t i = 0; i < tiles.size(); i++) {
+    tiles[i]->setStreamFrameType(frame_type);
+    render_threads.emplace_back(&MontageStream::renderWorker, this, i);
+  }
+
+  std::thread command_processor;
+  if (connkey) {
+    command_processor = std::thread(&MontageStream::checkCommandQueue, this);
+  }
+
+  const Microseconds frame_interval(lround(Microseconds::period::den / (maxfps > 0.0 ? maxfps : DEFAULT_MAXFPS)));
+  TimePoint last_tick = std::chrono::steady_clock::now();
+  const TimePoint started = last_tick;
+  bool pending = false;
+
+  while (!zm_terminate) {
+    now = std::chrono::steady_clock::now();
+
+    bool render = false;
+    bool keepalive = false;
+    SystemTimePoint time;
+    int rate = ZM_RATE_BASE;
+    {
+      std::scoped_lock lck{mutex};
+      // A single image stays at the time asked for while its tiles load
+      if (!paused and !stopped and type != STREAM_SINGLE) {
+        stream_time += std::chrono::duration_cast<SystemTimePoint::duration>((now - last_tick) * replay_rate / ZM_RATE_BASE);
+      }
+      render = !stopped and (!paused or redraw or pending);
+      keepalive = !stopped and (now - last_frame_sent > MAX_STREAM_DELAY);
+      redraw = false;
+      if (relayout) {
+        relayout = false;
+        layout();
+      }
+      time = stream_time;
+      rate = replay_rate;
+    }
+    last_tick = now;
+
+    bool changed = false;
+    if (render) {
+      // The only seeks for this moment, one per tile
+      for (auto &tile : tiles)
+        tile->position(time, rate);
+      changed = renderTiles(pending);
+    }
+    if (type == STREAM_SINGLE) {
+      // There's only the one image, so rather than send tiles that are
+      // still black, give them a while to fetch their frames
+      if (!pending or now - started >= MAX_SINGLE_WAIT) {
+        if (pending)
+          Warning("Sending montage with tiles still fetching after %" PRIi64 " s",
+                  static_cast<int64>(MAX_SINGLE_WAIT.count()));
+        if (!sendMontage())
+          zm_terminate = true;
+        Debug(1, "Single, exiting.");
+        break;
+      }
+    } else if (changed or keepalive) {
+      if (!sendMontage()) {
+        zm_terminate = true;
+        break;
+      }
+    }
+
+    TimePoint::duration elapsed = std::chrono::steady_clock::now() - now;
+    if (elapsed < frame_interval)
+      std::this_thread::sleep_for(frame_interval - elapsed);
+  }  // end while ! zm_terminate
+
+  {
+    std::lock_guard<std::mutex> lck(render_mutex);
+    render_quit = true;
+  }
+  render_condition.notify_all();
+  for (std::thread &thread : render_threads)
+    thread.join();
+  render_threads.clear();
+
+  if (command_processor.joinable()) {
+    command_processor.join();
+  }
+}  // end void MontageStream::runStream()
+
+void MontageStream::processCommand(const CmdMsg *msg) {
+  Debug(2, "Got message, type %d, msg %d", msg->msg_type, msg->msg_data[0]);
+
+  std::scoped_lock lck{mutex};
+
+  switch ((MsgCommand)msg->msg_data[0]) {
+  case CMD_PAUSE :
+    Debug(1, "Got PAUSE command");
+    stopped = false;
+    paused = true;
+    break;
+  case CMD_PLAY :
+    Debug(1, "Got PLAY command");
+    stopped = false;
+    paused = false;
+    replay_rate = ZM_RATE_BASE;
+    break;
+  case CMD_VARPLAY :
+    Debug(1, "Got VARPLAY command");
+    stopped = false;
+    paused = false;
+    replay_rate = (((unsigned char)msg->msg_data[1]<<8)|(unsigned char)msg->msg_data[2])-VARPLAY_RATE_OFFSET;
+    replay_rate = std::clamp(replay_rate, -50 * ZM_RATE_BASE, 50 * ZM_RATE_BASE);
+    break;
+  case CMD_STOP :
+    Debug(1, "Got STOP command");
+    stopped = true;
+    paused = false;
+    break;
+  case CMD_SCALE :
+    scale = ((unsigned char)msg->msg_data[1]<<8)|(unsigned char)msg->msg_data[2];
+    if (!scale) scale = DEFAULT_SCALE;
+    Debug(1, "Got SCALE command, to %d", scale);
+    relayout = true;
+    redraw = true;
+    break;
+  case CMD_SEEK : {
+    const uint32_t int_part = ((uint32_t)(unsigned char)msg->msg_data[1] << 24)
+                              | ((uint32_t)(unsigned char)msg->msg_data[2] << 16)
+                              | ((uint32_t)(unsigned char)msg->msg_data[3] << 8)
+                              | (uint32_t)(unsigned char)msg->msg_data[4];
+    const uint32_t dec_part = ((uint32_t)(unsigned char)msg->msg_data[5] << 24)
+                              | ((uint32_t)(unsigned char)msg->msg_data[6] << 16)
+                              | ((uint32_t)(unsigned char)msg->msg_data[7] << 8)
+                              | (uint32_t)(unsigned char)msg->msg_data[8];
+    stream_time = SystemTimePoint(Seconds(int_part)) + Microseconds(dec_part);
+    Debug(1, "Got SEEK command, to %.3f", FPSeconds(stream_time.time_since_epoch()).count());
+    redraw = true;
+    break;
+  }
+  case CMD_QUERY :
+    Debug(1, "Got QUERY command, sending STATUS");
+    break;
+  case CMD_QUIT :
+    Info("User initiated exit - CMD_QUIT");
+    zm_terminate = true;
+    break;
+  default :
+    // Do nothing, for now
+    break;
+  }
+
+  struct {
+    double time;
+    int rate;
+    int scale;
+    bool paused;
+    bool stopped;
+  } status_data = {};
+
+  status_data.time = FPSeconds(stream_time.time_since_epoch()).count();
+  status_data.rate = replay_rate;
+  status_data.scale = scale;
+  status_data.paused = paused;
+  status_data.stopped = stopped;
+
+  DataMsg status_msg;
+  status_msg.msg_type = MSG_DATA_MONTAGE;
+  memcpy(&status_msg.msg_data, &status_data, sizeof(status_data));
+  if (sendto(sd, &status_msg, sizeof(status_msg), MSG_DONTWAIT, (sockaddr *)&rem_addr, sizeof(rem_addr)) < 0) {
+    Error("Can't sendto on sd %d: %s", sd, strerror(errno));
+  }
+}  // void MontageStream::processCommand(const CmdMsg *msg)
@@ -0,0 +1,143 @@
+//
+// ZoneMinder Montage Stream Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_MONTAGESTREAM_H
+#define ZM_MONTAGESTREAM_H
+
+#include "zm_box.h"
+#include "zm_eventstream.h"
+#include "zm_image.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One monitor's recordings, followed through time on behalf of a
+// MontageStream.  Positioning finds the frame showing at a given time,
+// loading whichever event covers it, and so may touch the database.
+// Rendering only decodes and scales the frame already chosen, so the tiles
+// of a montage can render in parallel.
+class MontageTile : public EventStream {
+ public:
+  // How long a tile may hold up a montage frame waiting for its prefetcher.
+  // A slow tile keeps showing its last frame and catches up on a later one.
+  static constexpr Milliseconds FETCH_WAIT = Milliseconds(200);
+  // How long a gap between events, or the end of an event still being
+  // recorded, is trusted before the database is asked again
+  static constexpr Seconds RECHECK_INTERVAL = Seconds(2);
+
+  explicit MontageTile(int p_monitor_id);
+
+  // Chooses the frame showing at time, rate being the montage's replay rate
+  void position(SystemTimePoint time, int rate);
+  // Draws the chosen frame into cell of montage, fitted and centred.  The
+  // cell's Hi is inclusive, as for Image::Fill.  False if the cell already
+  // shows it.
+  bool render(Image &montage, const Box &cell);
+  // The last render couldn't get its frame yet
+  bool pending() const { return pending_; }
+  // Forgets what was drawn, so the next render draws again
+  void invalidate();
+
+ private:
+  // Loads the event covering time, false if there isn't one
+  bool locate(SystemTimePoint time);
+  // Makes event_id the tile's event, reloading it if it is still being recorded
+  bool load(uint64_t event_id, bool open_event, TimePoint now);
+  Image *fetch();
+
+  bool have_frame_;
+  bool pending_;
+  int step_;
+  TimePoint loaded_at_;
+  // No event of this monitor covers [gap_start_, gap_end_)
+  SystemTimePoint gap_start_;
+  SystemTimePoint gap_end_;
+  TimePoint gap_checked_;
+  bool have_gap_;
+  bool open_event_;  // The loaded event is still being recorded
+
+  uint64_t drawn_event_id_;
+  int drawn_frame_id_;
+  bool drawn_blank_;
+  std::shared_ptr<Image> fetched_;
+  Image decoded_;
+  Image scaled_;
+};
+
+// Plays back the recordings of several monitors side by side from one
+// process, tiled into a single jpeg stream.  Every tile follows one clock, so
+// they can't drift apart, and a seek moves them all at once.  Commands arrive
+// on the usual socket.  CMD_SEEK carries a unix time rather than an offset
+// into an event, in the same encoding.
+class MontageStream : public StreamBase {
+ public:
+  static constexpr size_t MAX_TILES = 16;
+  // How long a single image waits for tiles still fetching their frames
+  static constexpr Seconds MAX_SINGLE_WAIT = Seconds(5);
+
+  MontageStream();
+
+  void setStreamStart(const std::vector<int> &monitor_ids, SystemTimePoint time);
+  void runStream() override;
+
+  // A grid about as wide as it is tall for count tiles
+  static void gridSize(size_t count, int &columns, int &rows);
+  // The largest size with the aspect ratio of width x height fitting in
+  // cell_width x cell_height
+  static void fitSize(int width, int height, int cell_width, int cell_height, int &fit_width, int &fit_height);
+
+ protected:
+  void processCommand(const CmdMsg *msg) override;
+
+ private:
+  void layout();
+  Box cell(size_t index) const;
+  // Renders every tile in parallel, true if any of them changed
+  bool renderTiles(bool &pending);
+  void renderWorker(size_t index);
+  bool sendMontage();
+
+  std::mutex mutex;
+  SystemTimePoint stream_time;
+  bool redraw;           // Render even when paused, after a seek or a change of scale
+  bool relayout;         // The scale has changed
+
+  std::vector<std::unique_ptr<MontageTile>> tiles;
+  int base_width;        // Largest monitor dimensions, before scaling
+  int base_height;
+  int columns;
+  int rows;
+  int cell_width;
+  int cell_height;
+  std::unique_ptr<Image> montage;
+
+  std::mutex render_mutex;
+  std::condition_variable render_condition;
+  std::condition_variable rendered_condition;
+  int render_generation;
+  size_t rendered;
+  bool render_changed;
+  bool render_pending;
+  bool render_quit;
+  std::vector<std::thread> render_threads;
+};
+
+#endif // ZM_MONTAGESTREAM_H
@@ -0,0 +1,315 @@
+//
+// ZoneMinder Packet Ring Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_packet_ring.h"
+
+#include "zm_logger.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'Z', 'M', 'P', 'A', 'C', 'K', 'E', 'T'};
+
+// Packet data goes into a byte ring after the slots.  data_written only
+// ever grows, a packet's offset being what it was when the packet was
+// started, so a reader knows a packet is still intact as long as no more
+// than data_size bytes have been claimed since.
+struct RingHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t slot_count;
+  uint64_t data_size;
+  uint64_t map_size;
+  int32_t codec_id;
+  int32_t time_base_num;
+  int32_t time_base_den;
+  uint32_t extradata_size;
+  std::atomic<uint32_t> open;  // Cleared when the writer closes
+  uint32_t reserved;
+  std::atomic<uint64_t> write_count;
+  std::atomic<uint64_t> data_written;
+  uint8_t extradata[PacketRing::kMaxExtradata];
+};
+
+struct RingSlot {
+  std::atomic<uint64_t> number;  // Packet number + 1, 0 while being written
+  int64_t pts;
+  int64_t dts;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t keyframe;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "packet ring needs lock free atomics to be shared");
+static_assert(sizeof(RingHeader) == 72 + PacketRing::kMaxExtradata, "packet ring header must not have padding");
+static_assert(sizeof(RingSlot) == 40, "packet ring slots must not have padding");
+
+RingHeader *Header(void *map) {
+  return static_cast<RingHeader *>(map);
+}
+
+RingSlot *Slots(void *map) {
+  return reinterpret_cast<RingSlot *>(static_cast<uint8_t *>(map) + sizeof(RingHeader));
+}
+
+uint8_t *Data(void *map) {
+  return static_cast<uint8_t *>(map) + sizeof(RingHeader) + sizeof(RingSlot) * Header(map)->slot_count;
+}
+
+}  // namespace
+
+PacketRing::Writer::Writer() : map_(nullptr), map_size_(0) {}
+
+PacketRing::Writer::~Writer() {
+  Close();
+}
+
+bool PacketRing::Writer::Open(const std::string &path, int codec_id, int time_base_num, int time_base_den,
+                              const uint8_t *extradata, size_t extradata_size, size_t data_size) {
+  Close();
+
+  if (extradata_size > kMaxExtradata) {
+    Warning("Extradata of %zu bytes is too big for the packet ring, leaving it out", extradata_size);
+    extradata_size = 0;
+  }
+
+  // A new file rather than a rewrite, so that readers of the old one see it
+  // go instead of finding packets from a different stream
+  unlink(path.c_str());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+  if (fd < 0) {
+    Error("Can't create %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  const size_t map_size = sizeof(RingHeader) + sizeof(RingSlot) * kSlots + data_size;
+  if (ftruncate(fd, map_size) < 0) {
+    Error("Can't extend %s to %zu bytes: %s", path.c_str(), map_size, strerror(errno));
+    close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+  void *map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    Error("Can't map %s: %s", path.c_str(), strerror(errno));
+    unlink(path.c_str());
+    return false;
+  }
+
+  // The file starts out zeroed, which leaves every slot empty
+  RingHeader *header = Header(map);
+  header->format_version = kFormatVersion;
+  header->slot_count = kSlots;
+  header->data_size = data_size;
+  header->map_size = map_size;
+  header->codec_id = codec_id;
+  header->time_base_num = time_base_num;
+  header->time_base_den = time_base_den;
+  header->extradata_size = extradata_size;
+  if (extradata_size)
+    memcpy(header->extradata, extradata, extradata_size);
+  header->open.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, kMagic, sizeof(kMagic));
+
+  map_ = map;
+  map_size_ = map_size;
+  path_ = path;
+  Debug(1, "Writing packets to %s, %zu bytes", path_.c_str(), map_size_);
+  return true;
+}
+
+bool PacketRing::Writer::Write(const uint8_t *data, size_t size, int64_t pts, int64_t dts, bool keyframe) {
+  if (!map_) return false;
+  RingHeader *header = Header(map_);
+  // Anything bigger could overwrite itself, or leave no room for the packets
+  // a reader needs alongside it
+  if (size > header->data_size / 4) {
+    Warning("Packet of %zu bytes is too big for %s", size, path_.c_str());
+    return false;
+  }
+
+  const uint64_t count = header->write_count.load(std::memory_order_relaxed);
+  RingSlot &slot = Slots(map_)[count % header->slot_count];
+  slot.number.store(0, std::memory_order_relaxed);
+  // Claim the data space before overwriting it, so that readers still
+  // copying from it can tell
+  const uint64_t offset = header->data_written.load(std::memory_order_relaxed);
+  header->data_written.store(offset + size, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint8_t *ring_data = Data(map_);
+  const size_t start = offset % header->data_size;
+  const size_t first = std::min(size, static_cast<size_t>(header->data_size - start));
+  memcpy(ring_data + start, data, first);
+  memcpy(ring_data, data + first, size - first);
+
+  slot.pts = pts;
+  slot.dts = dts;
+  slot.offset = offset;
+  slot.size = size;
+  slot.keyframe = keyframe;
+  slot.number.store(count + 1, std::memory_order_release);
+  header->write_count.store(count + 1, std::memory_order_release);
+  return true;
+}
+
+void PacketRing::Writer::Close() {
+  if (!map_) return;
+  Header(map_)->open.store(0, std::memory_order_release);
+  munmap(map_, map_size_);
+  unlink(path_.c_str());
+  map_ = nullptr;
+  map_size_ = 0;
+}
+
+PacketRing::PacketRing() : map_(nullptr), map_size_(0), inode_(0), next_(0) {}
+
+PacketRing::~PacketRing() {
+  Close();
+}
+
+bool PacketRing::Open(const std::string &path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Debug(1, "Can't open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 or static_cast<size_t>(st.st_size) < sizeof(RingHeader)) {
+    Debug(1, "%s isn't a packet ring", path.c_str());
+    close(fd);
+    return false;
+  }
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    Error("Can't map %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // The magic goes in last, after everything else is set up
+  const RingHeader *header = Header(map);
+  const bool ready = memcmp(header->magic, kMagic, sizeof(kMagic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!ready or header->format_version != kFormatVersion or header->map_size != static_cast<size_t>(st.st_size)
+      or !header->open.load(std::memory_order_relaxed)) {
+    Debug(1, "%s isn't ready", path.c_str());
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  map_ = map;
+  map_size_ = st.st_size;
+  path_ = path;
+  inode_ = st.st_ino;
+  next_ = header->write_count.load(std::memory_order_acquire);
+  last_check_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+void PacketRing::Close() {
+  if (!map_) return;
+  munmap(map_, map_size_);
+  map_ = nullptr;
+  map_size_ = 0;
+}
+
+int PacketRing::CodecId() const {
+  return Header(map_)->codec_id;
+}
+
+int PacketRing::TimeBaseNum() const {
+  return Header(map_)->time_base_num;
+}
+
+int PacketRing::TimeBaseDen() const {
+  return Header(map_)->time_base_den;
+}
+
+std::vector<uint8_t> PacketRing::Extradata() const {
+  const RingHeader *header = Header(map_);
+  return std::vector<uint8_t>(header->extradata, header->extradata + header->extradata_size);
+}
+
+// Whether the file has been replaced by a new zmc, one that crashed having
+// never marked this one closed
+bool PacketRing::Replaced() const {
+  struct stat st;
+  return stat(path_.c_str(), &st) < 0 or st.st_ino != inode_;
+}
+
+PacketRing::ReadResult PacketRing::Read(Packet &packet) {
+  if (!map_) return READ_CLOSED;
+  RingHeader *header = Header(map_);
+
+  const uint64_t count = header->write_count.load(std::memory_order_acquire);
+  if (next_ >= count) {
+    if (!header->open.load(std::memory_order_acquire))
+      return READ_CLOSED;
+    const TimePoint now = std::chrono::steady_clock::now();
+    if (now - last_check_ > Seconds(1)) {
+      last_check_ = now;
+      if (Replaced()) return READ_CLOSED;
+    }
+    return READ_NONE;
+  }
+  last_check_ = std::chrono::steady_clock::now();
+  if (count - next_ > header->slot_count) {
+    next_ = count - 1;
+    return READ_SKIPPED;
+  }
+
+  const RingSlot &slot = Slots(map_)[next_ % header->slot_count];
+  const uint64_t number = slot.number.load(std::memory_order_acquire);
+  if (number == next_ + 1) {
+    packet.pts = slot.pts;
+    packet.dts = slot.dts;
+    packet.keyframe = slot.keyframe;
+    const uint64_t offset = slot.offset;
+    const size_t size = std::min(static_cast<uint64_t>(slot.size), header->data_size);
+
+    const uint8_t *ring_data = Data(map_);
+    const size_t start = offset % header->data_size;
+    const size_t first = std::min(size, static_cast<size_t>(header->data_size - start));
+    packet.data.resize(size);
+    memcpy(packet.data.data(), ring_data + start, first);
+    memcpy(packet.data.data() + first, ring_data, size - first);
+
+    // Anything the writer did while we copied shows up here
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.number.load(std::memory_order_relaxed) == number
+        and header->data_written.load(std::memory_order_relaxed) - offset <= header->data_size) {
+      next_++;
+      return READ_PACKET;
+    }
+  }
+
+  next_ = header->write_count.load(std::memory_order_acquire) - 1;
+  return READ_SKIPPED;
+}
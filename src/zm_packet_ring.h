@@ -0,0 +1,108 @@
+//
+// ZoneMinder Packet Ring Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_PACKET_RING_H
+#define ZM_PACKET_RING_H
+
+#include "zm_time.h"
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// A monitor's most recent compressed video packets, in a memory mapped file
+// that zmc writes and any number of viewers read.  Unlike a fifo, reading
+// takes nothing away from anyone else, so every viewer gets every packet,
+// and nobody has to wait for another to finish.  The writer never waits on
+// readers either: one that falls too far behind finds its packets have been
+// overwritten, and has to pick up again from the next keyframe.
+//
+// Packets keep the pts and dts they were captured with, in the time base
+// given when the ring was created.
+class PacketRing {
+ public:
+  static constexpr uint32_t kFormatVersion = 1;
+  static constexpr uint32_t kSlots = 256;
+  static constexpr size_t kMaxExtradata = 4096;
+  static constexpr size_t kDefaultDataSize = 8 * 1024 * 1024;
+
+  struct Packet {
+    int64_t pts;
+    int64_t dts;
+    bool keyframe;
+    std::vector<uint8_t> data;
+  };
+
+  enum ReadResult {
+    READ_PACKET,   // packet holds the next packet
+    READ_NONE,     // Nothing new yet
+    READ_SKIPPED,  // Packets were overwritten before they were read
+    READ_CLOSED,   // The writer has gone
+  };
+
+  class Writer {
+   public:
+    Writer();
+    ~Writer();
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Replaces whatever is at path, so readers of an old ring see it closed
+    bool Open(const std::string &path, int codec_id, int time_base_num, int time_base_den,
+              const uint8_t *extradata, size_t extradata_size, size_t data_size = kDefaultDataSize);
+    bool IsOpen() const { return map_ != nullptr; }
+    bool Write(const uint8_t *data, size_t size, int64_t pts, int64_t dts, bool keyframe);
+    void Close();
+
+   private:
+    void *map_;
+    size_t map_size_;
+    std::string path_;
+  };
+
+  PacketRing();
+  ~PacketRing();
+  PacketRing(const PacketRing &) = delete;
+  PacketRing &operator=(const PacketRing &) = delete;
+
+  // Reading starts with the next packet written
+  bool Open(const std::string &path);
+  void Close();
+  bool IsOpen() const { return map_ != nullptr; }
+
+  int CodecId() const;
+  int TimeBaseNum() const;
+  int TimeBaseDen() const;
+  std::vector<uint8_t> Extradata() const;
+
+  // Doesn't wait, READ_NONE means try again later
+  ReadResult Read(Packet &packet);
+
+ private:
+  bool Replaced() const;
+
+  void *map_;
+  size_t map_size_;
+  std::string path_;
+  ino_t inode_;
+  uint64_t next_;
+  TimePoint last_check_;
+};
+
+#endif // ZM_PACKET_RING_H
@@ -0,0 +1,298 @@
+//
+// ZoneMinder Passthrough Stream
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_passthrough_stream.h"
+
+#include "zm_monitor.h"
+#include "zm_signal.h"
+#include <cinttypes>
+#include <thread>
+
+static const AVRational PASSTHROUGH_TIME_BASE = {1, 90000};
+// How often to look for new packets, a small fraction of a frame
+static const Milliseconds PASSTHROUGH_POLL_INTERVAL = Milliseconds(5);
+
+PassthroughStream::~PassthroughStream() {
+  closeOutput();
+  ring.Close();
+}
+
+void PassthroughStream::InspectNals(AVCodecID codec_id, const uint8_t *data, size_t size,
+                                    bool &has_parameter_sets, bool &has_keyframe, bool &has_slice) {
+  has_parameter_sets = has_keyframe = has_slice = false;
+
+  for (size_t i = 0; i + 3 < size; i++) {
+    if (data[i] != 0 or data[i+1] != 0 or data[i+2] != 1) continue;
+    uint8_t header = data[i+3];
+    i += 2;
+
+    if (codec_id == AV_CODEC_ID_H264) {
+      int nal_type = header & 0x1f;
+      if (nal_type == 7 or nal_type == 8) {
+        has_parameter_sets = true;
+      } else if (nal_type == 5) {
+        has_keyframe = has_slice = true;
+      } else if (nal_type >= 1 and nal_type <= 4) {
+        has_slice = true;
+      }
+    } else if (codec_id == AV_CODEC_ID_HEVC) {
+      int nal_type = (header >> 1) & 0x3f;
+      if (nal_type >= 32 and nal_type <= 34) {
+        has_parameter_sets = true;
+      } else if (nal_type >= 16 and nal_type <= 23) {
+        has_keyframe = has_slice = true;
+      } else if (nal_type < 16) {
+        has_slice = true;
+      }
+    }
+  }
+}
+
+bool PassthroughStream::setStreamStart(int p_monitor_id) {
+  return loadMonitor(p_monitor_id);
+}
+
+void PassthroughStream::processCommand(const CmdMsg *msg) {
+  switch (msg->msg_data[0]) {
+  case CMD_QUIT :
+    Info("User initiated exit - CMD_QUIT");
+    zm_terminate = true;
+    break;
+  default :
+    Debug(1, "Ignoring command %d on passthrough stream", msg->msg_data[0]);
+    break;
+  }
+}
+
+bool PassthroughStream::openRing() {
+  const std::string path = monitor->GetPacketRingPath();
+  if (!ring.Open(path)) {
+    Error("Monitor %d is not publishing its video packets in %s. RTSPServer must be enabled for passthrough streaming.",
+          monitor->Id(), path.c_str());
+    return false;
+  }
+
+  codec_id = static_cast<AVCodecID>(ring.CodecId());
+  if (codec_id != AV_CODEC_ID_H264 and codec_id != AV_CODEC_ID_HEVC) {
+    Error("Passthrough streaming only supports H.264 and H.265, not %s", avcodec_get_name(codec_id));
+    return false;
+  }
+  ring_time_base = {ring.TimeBaseNum(), ring.TimeBaseDen()};
+  if (ring_time_base.num <= 0 or ring_time_base.den <= 0) {
+    Error("Monitor %d's packets have no time base", monitor->Id());
+    return false;
+  }
+  extradata = ring.Extradata();
+  Debug(1, "Reading %s packets from %s", avcodec_get_name(codec_id), path.c_str());
+  return true;
+}
+
+// Waits for the next packet from the ring.  skipped is set when packets were
+// lost because we fell behind, after which the stream can only carry on
+// from a keyframe.
+bool PassthroughStream::readPacket(bool &skipped) {
+  while (!zm_terminate) {
+    switch (ring.Read(packet)) {
+    case PacketRing::READ_PACKET :
+      return true;
+    case PacketRing::READ_SKIPPED :
+      Debug(1, "Fell behind monitor %d, waiting for a keyframe", monitor->Id());
+      skipped = true;
+      break;
+    case PacketRing::READ_NONE :
+      checkCommandQueue();
+      std::this_thread::sleep_for(PASSTHROUGH_POLL_INTERVAL);
+      break;
+    case PacketRing::READ_CLOSED :
+      Info("Monitor %d stopped writing packets", monitor->Id());
+      return false;
+    }
+  }
+  return false;
+}
+
+bool PassthroughStream::openOutput() {
+  int ret = avformat_alloc_output_context2(&oc, nullptr, "mp4", nullptr);
+  if (ret < 0 or !oc) {
+    Error("Unable to allocate mp4 output context: %s", av_err2str(ret));
+    return false;
+  }
+
+  out_stream = avformat_new_stream(oc, nullptr);
+  if (!out_stream) {
+    Error("Unable to allocate output stream");
+    return false;
+  }
+  out_stream->time_base = PASSTHROUGH_TIME_BASE;
+
+  AVCodecParameters *par = out_stream->codecpar;
+  par->codec_type = AVMEDIA_TYPE_VIDEO;
+  par->codec_id = codec_id;
+  par->width = monitor->Width();
+  par->height = monitor->Height();
+  // Safari will only play hevc tagged as hvc1
+  if (codec_id == AV_CODEC_ID_HEVC)
+    par->codec_tag = MKTAG('h', 'v', 'c', '1');
+  par->extradata = static_cast<uint8_t *>(av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+  if (!par->extradata) {
+    Error("Unable to allocate extradata");
+    return false;
+  }
+  memcpy(par->extradata, extradata.data(), extradata.size());
+  par->extradata_size = extradata.size();
+
+  // Headers have gone out through stdio, the muxer writes straight to fd 1.
+  fflush(stdout);
+  ret = avio_open2(&oc->pb, "pipe:1", AVIO_FLAG_WRITE, nullptr, nullptr);
+  if (ret < 0) {
+    Error("Unable to open stdout for writing: %s", av_err2str(ret));
+    return false;
+  }
+  oc->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+
+  // One fragment per frame keeps latency to a single frame.  We only start
+  // on a keyframe so the first fragment is always decodable.
+  AVDictionary *opts = nullptr;
+  av_dict_set(&opts, "movflags", "empty_moov+default_base_moof+frag_every_frame", 0);
+  ret = avformat_write_header(oc, &opts);
+  av_dict_free(&opts);
+  if (ret < 0) {
+    Error("Unable to write mp4 header: %s", av_err2str(ret));
+    out_stream = nullptr;  // Nothing to write a trailer for
+    return false;
+  }
+
+  stream_start = now;
+  first_ts = AV_NOPTS_VALUE;
+  last_dts = AV_NOPTS_VALUE;
+  Debug(1, "Started %s passthrough for monitor %d, %dx%d extradata %zu bytes",
+        avcodec_get_name(codec_id), monitor->Id(), par->width, par->height, extradata.size());
+  return true;
+}
+
+void PassthroughStream::closeOutput() {
+  if (!oc) return;
+  if (out_stream and oc->pb)
+    av_write_trailer(oc);
+  if (oc->pb)
+    avio_closep(&oc->pb);
+  avformat_free_context(oc);
+  oc = nullptr;
+  out_stream = nullptr;
+}
+
+bool PassthroughStream::writePacket(bool keyframe) {
+  // Keep the capture timing, just starting from zero.  Packets without
+  // timestamps are stamped with the time we read them.
+  int64_t pts, dts;
+  if (packet.pts == AV_NOPTS_VALUE) {
+    pts = dts = av_rescale_q(std::chrono::duration_cast<Microseconds>(now - stream_start).count(),
+                             AV_TIME_BASE_Q, PASSTHROUGH_TIME_BASE);
+  } else {
+    const int64_t ring_dts = (packet.dts == AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+    if (first_ts == AV_NOPTS_VALUE) first_ts = ring_dts;
+    pts = av_rescale_q(packet.pts - first_ts, ring_time_base, PASSTHROUGH_TIME_BASE);
+    dts = av_rescale_q(ring_dts - first_ts, ring_time_base, PASSTHROUGH_TIME_BASE);
+  }
+  // The muxer refuses anything going backwards, as after a camera reconnects
+  if (last_dts != AV_NOPTS_VALUE and dts <= last_dts) {
+    Debug(1, "Packet dts %" PRId64 " isn't after %" PRId64 ", adjusting", dts, last_dts);
+    pts += last_dts + 1 - dts;
+    dts = last_dts + 1;
+  }
+  if (pts < dts) pts = dts;
+  last_dts = dts;
+
+  av_packet_ptr pkt { av_packet_alloc() };
+  if (!pkt or av_new_packet(pkt.get(), packet.data.size()) < 0) {
+    Error("Unable to allocate packet of %zu bytes", packet.data.size());
+    return false;
+  }
+  memcpy(pkt->data, packet.data.data(), packet.data.size());
+  pkt->stream_index = out_stream->index;
+  pkt->pts = av_rescale_q(pts, PASSTHROUGH_TIME_BASE, out_stream->time_base);
+  pkt->dts = av_rescale_q(dts, PASSTHROUGH_TIME_BASE, out_stream->time_base);
+  if (keyframe)
+    pkt->flags |= AV_PKT_FLAG_KEY;
+
+  int ret = av_write_frame(oc, pkt.get());
+  if (ret < 0) {
+    if (!zm_terminate)
+      Debug(1, "Unable to write packet, client gone? %s", av_err2str(ret));
+    return false;
+  }
+  last_frame_sent = now;
+  frame_count++;
+  return true;
+}
+
+void PassthroughStream::runStream() {
+  if (!checkInitialised()) {
+    Error("Not initialized");
+    return;
+  }
+  if (!openRing()) return;
+
+  fputs("Content-Type: video/mp4\r\n\r\n", stdout);
+  fflush(stdout);
+
+  bool need_keyframe = true;
+  while (!zm_terminate) {
+    now = std::chrono::steady_clock::now();
+    checkCommandQueue();
+
+    bool skipped = false;
+    if (!readPacket(skipped)) break;
+    if (skipped) need_keyframe = true;
+    now = std::chrono::steady_clock::now();
+
+    bool has_parameter_sets, has_keyframe, has_slice;
+    InspectNals(codec_id, packet.data.data(), packet.data.size(),
+                has_parameter_sets, has_keyframe, has_slice);
+    has_keyframe = has_keyframe or packet.keyframe;
+
+    if (!has_slice) {
+      // Some cameras send their parameter sets on their own
+      if (has_parameter_sets) extradata = packet.data;
+      continue;
+    }
+
+    // Players can only join, or carry on after lost packets, on a keyframe
+    if (need_keyframe and !has_keyframe) continue;
+    need_keyframe = false;
+
+    if (!oc) {
+      if (extradata.empty()) {
+        if (!has_parameter_sets) {
+          Debug(1, "Keyframe without parameter sets, waiting for the next one");
+          need_keyframe = true;
+          continue;
+        }
+        // The muxer picks the parameter sets out of the keyframe
+        extradata = packet.data;
+      }
+      if (!openOutput()) break;
+    }
+
+    if (!writePacket(has_keyframe)) break;
+  }
+
+  closeOutput();
+  ring.Close();
+}
@@ -0,0 +1,79 @@
+//
+// ZoneMinder Passthrough Stream
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+#ifndef ZM_PASSTHROUGH_STREAM_H
+#define ZM_PASSTHROUGH_STREAM_H
+
+#include "zm_ffmpeg.h"
+#include "zm_packet_ring.h"
+#include "zm_stream.h"
+#include <vector>
+
+class Monitor;
+
+// Serves a monitor's live video as fragmented MP4 without decoding or
+// re-encoding.  The compressed packets are read from the monitor's packet
+// ring (written by zmc when the monitor has RTSPServer enabled) and remuxed
+// with stream copy, so the cost per viewer is a memcpy rather than a JPEG
+// encode per frame.  Every viewer reads the ring independently, so any
+// number can watch at once.  Only Annex-B H.264 and H.265 are supported.
+class PassthroughStream : public StreamBase {
+ private:
+  PacketRing ring;
+  PacketRing::Packet packet;
+  AVRational ring_time_base;
+
+  AVCodecID codec_id;
+  std::vector<uint8_t> extradata;
+
+  AVFormatContext *oc;
+  AVStream *out_stream;
+  TimePoint stream_start;
+  int64_t first_ts;  // Ring timestamp of the first packet sent
+  int64_t last_dts;
+
+  bool openRing();
+  bool readPacket(bool &skipped);
+  bool openOutput();
+  void closeOutput();
+  bool writePacket(bool keyframe);
+
+ protected:
+  void processCommand(const CmdMsg *msg) override;
+
+ public:
+  PassthroughStream() :
+    StreamBase(),
+    ring_time_base({0, 1}),
+    codec_id(AV_CODEC_ID_NONE),
+    oc(nullptr),
+    out_stream(nullptr),
+    first_ts(AV_NOPTS_VALUE),
+    last_dts(AV_NOPTS_VALUE)
+  {}
+  ~PassthroughStream() override;
+
+  bool setStreamStart(int monitor_id);
+  void runStream() override;
+
+  // Scans an Annex-B buffer and reports whether it carries parameter sets
+  // (SPS/PPS/VPS), an IDR/IRAP slice, and any slice at all.
+  static void InspectNals(AVCodecID codec_id, const uint8_t *data, size_t size,
+                          bool &has_parameter_sets, bool &has_keyframe, bool &has_slice);
+};
+#endif  // ZM_PASSTHROUGH_STREAM_H
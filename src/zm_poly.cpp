@@ -20,12 +20,15 @@
 #include "zm_poly.h"
 
 #include "zm_line.h"
+#include <algorithm>
 #include <cmath>
 
 Polygon::Polygon(std::vector<Vector2> vertices) : vertices_(std::move(vertices)), area(0) {
   UpdateExtent();
   UpdateArea();
   UpdateCentre();
+  UpdateSpans();
+  UpdateOutlineSpans();
 }
 
 void Polygon::UpdateExtent() {
@@ -74,6 +77,131 @@ void Polygon::UpdateCentre() {
   centre = Vector2(static_cast<int32>(std::lround(float_x)), static_cast<int32>(std::lround(float_y)));
 }
 
+// Polygon filling is based on the Scan-line Polygon filling algorithm
+void Polygon::UpdateSpans() {
+  spans_.clear();
+
+  size_t n_coords = vertices_.size();
+  if (n_coords < 3)
+    return;
+
+  std::vector<PolygonFill::Edge> global_edges;
+  global_edges.reserve(n_coords);
+  for (size_t j = 0, i = n_coords - 1; j < n_coords; i = j++) {
+    const Vector2 &p1 = vertices_[i];
+    const Vector2 &p2 = vertices_[j];
+
+    // Do not add horizontal edges to the global edge table.
+    if (p1.y_ == p2.y_)
+      continue;
+
+    Vector2 d = p2 - p1;
+
+    global_edges.emplace_back(std::min(p1.y_, p2.y_),
+                              std::max(p1.y_, p2.y_),
+                              p1.y_ < p2.y_ ? p1.x_ : p2.x_,
+                              d.x_ / static_cast<double>(d.y_));
+  }
+
+  if (global_edges.empty()) return;
+
+  std::sort(global_edges.begin(), global_edges.end(), PolygonFill::Edge::CompareYX);
+  std::vector<PolygonFill::Edge> active_edges;
+  active_edges.reserve(global_edges.size());
+  // The global edges are sorted by min_y, so they activate in order
+  size_t next_edge = 0;
+  int32 scan_line = global_edges[0].min_y;
+  while (next_edge < global_edges.size() || !active_edges.empty()) {
+    // Deactivate edges with max_y < current scan line
+    for (auto it = active_edges.begin(); it != active_edges.end();) {
+      if (scan_line >= it->max_y) {
+        it = active_edges.erase(it);
+      } else {
+        it->min_x += it->_1_m;
+        ++it;
+      }
+    }
+
+    // Activate edges with min_y == current scan line
+    while (next_edge < global_edges.size() && global_edges[next_edge].min_y == scan_line) {
+      active_edges.emplace_back(global_edges[next_edge++]);
+    }
+
+    if (active_edges.size() >= 2) {
+      std::sort(active_edges.begin(), active_edges.end(), PolygonFill::Edge::CompareX);
+
+      // Spans run between pairs of active edges (parity rule). Stepping one
+      // edge at a time would incorrectly fill the gaps between arms of
+      // a non-convex polygon (e.g. a banana shape).
+      for (auto it = active_edges.begin(); it + 1 < active_edges.end(); it += 2) {
+        int32 lo_x = static_cast<int32>(it->min_x);
+        int32 hi_x = static_cast<int32>((it + 1)->min_x);
+        if (lo_x <= hi_x)
+          spans_.push_back({scan_line, lo_x, hi_x});
+      }
+    }
+
+    scan_line++;
+  }
+}
+
+// Walks each edge one pixel per step along its major axis, from its first
+// vertex up to but not including its second.
+void Polygon::UpdateOutlineSpans() {
+  outline_spans_.clear();
+
+  size_t n_coords = vertices_.size();
+  if (!n_coords)
+    return;
+
+  std::vector<Vector2> pixels;
+  for (size_t j = 0, i = n_coords - 1; j < n_coords; i = j++) {
+    int x1 = vertices_[i].x_;
+    int y1 = vertices_[i].y_;
+    int x2 = vertices_[j].x_;
+    int y2 = vertices_[j].y_;
+
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+
+    if (std::fabs(dx) <= std::fabs(dy)) {
+      // When y1 == y2 here the edge is a single point and draws nothing
+      double grad = (y1 != y2) ? dx / dy : 0.0;
+      int yinc = (y1 < y2) ? 1 : -1;
+      grad *= yinc;
+
+      double x;
+      int y;
+      for (x = x1, y = y1; y != y2; y += yinc, x += grad)
+        pixels.emplace_back(static_cast<int32>(std::round(x)), y);
+    } else {
+      double grad = dy / dx;
+      int xinc = (x1 < x2) ? 1 : -1;
+      grad *= xinc;
+
+      double y;
+      int x;
+      for (y = y1, x = x1; x != x2; x += xinc, y += grad)
+        pixels.emplace_back(x, static_cast<int32>(std::round(y)));
+    }
+  }
+
+  std::sort(pixels.begin(), pixels.end(), [](const Vector2 &a, const Vector2 &b) {
+    return a.y_ < b.y_ || (a.y_ == b.y_ && a.x_ < b.x_);
+  });
+
+  for (const Vector2 &pixel : pixels) {
+    if (!outline_spans_.empty()) {
+      PolygonFill::Span &last = outline_spans_.back();
+      if (last.y == pixel.y_ && pixel.x_ <= last.hi_x + 1) {
+        last.hi_x = std::max(last.hi_x, pixel.x_);
+        continue;
+      }
+    }
+    outline_spans_.push_back({pixel.y_, pixel.x_, pixel.x_});
+  }
+}
+
 bool Polygon::Contains(const Vector2 &coord) const {
   bool inside = false;
   for (size_t i = 0, j = vertices_.size() - 1; i < vertices_.size(); j = i++) {
@@ -118,4 +246,6 @@ void Polygon::Clip(const Box &boundary) {
   UpdateExtent();
   UpdateArea();
   UpdateCentre();
+  UpdateSpans();
+  UpdateOutlineSpans();
 }
@@ -23,6 +23,39 @@
 #include "zm_box.h"
 #include <vector>
 
+// Scan-line polygon fill algorithm
+namespace PolygonFill {
+class Edge {
+ public:
+  Edge() = default;
+  Edge(int32 min_y, int32 max_y, double min_x, double _1_m) : min_y(min_y), max_y(max_y), min_x(min_x), _1_m(_1_m) {}
+
+  static bool CompareYX(const Edge &e1, const Edge &e2) {
+    if (e1.min_y == e2.min_y) {
+      return e1.min_x < e2.min_x;
+    }
+    return e1.min_y < e2.min_y;
+  }
+
+  static bool CompareX(const Edge &e1, const Edge &e2) {
+    return e1.min_x < e2.min_x;
+  }
+
+ public:
+  int32 min_y;
+  int32 max_y;
+  double min_x;
+  double _1_m;
+};
+
+// A run of pixels on row y from lo_x to hi_x inclusive
+struct Span {
+  int32 y;
+  int32 lo_x;
+  int32 hi_x;
+};
+}
+
 // This class represents convex or concave non-self-intersecting polygons.
 class Polygon {
  public:
@@ -39,18 +72,28 @@ class Polygon {
 
   bool Contains(const Vector2 &coord) const;
 
+  // The interior as scan-line spans, ordered by row then x. Built whenever the
+  // vertices change so that filling doesn't rebuild the edge table each time.
+  const std::vector<PolygonFill::Span> &Spans() const { return spans_; }
+  // The pixels of the edges as drawn by Image::Outline, merged into spans.
+  const std::vector<PolygonFill::Span> &OutlineSpans() const { return outline_spans_; }
+
   void Clip(const Box &boundary);
 
  private:
   void UpdateExtent();
   void UpdateArea();
   void UpdateCentre();
+  void UpdateSpans();
+  void UpdateOutlineSpans();
 
  private:
   std::vector<Vector2> vertices_;
   Box extent;
   int32 area;
   Vector2 centre;
+  std::vector<PolygonFill::Span> spans_;
+  std::vector<PolygonFill::Span> outline_spans_;
 };
 
 #endif // ZM_POLY_H
@@ -1,20 +1,29 @@
 #ifndef ZM_SENDFILE_H
 #define ZM_SENDFILE_H
 
+#include "zm_logger.h"
+#include "zm_utils.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #if defined(HAVE_SENDFILE) && defined(HAVE_SENDFILE4_SUPPORT)
 #include <sys/sendfile.h>
 #elif defined(HAVE_SENDFILE) && defined(HAVE_SENDFILE7_SUPPORT)
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/uio.h>
-#else
-#include <unistd.h>
-#include <stdio.h>
 #endif
 
-/* Function to send the contents of a file. Will use sendfile or fall back to reading/writing */
+/* Function to send the contents of a file. Will use sendfile or fall back to reading/writing.
+ * When offset is given the file position is left alone and *offset is advanced instead.
+ * Returns the number of bytes sent, 0 at end of file, or -errno. */
 
-ssize_t zm_sendfile(int out_fd, int in_fd, off_t *offset, size_t size) {
+inline ssize_t zm_sendfile(int out_fd, int in_fd, off_t *offset, size_t size) {
 #if defined(HAVE_SENDFILE) && defined(HAVE_SENDFILE4_SUPPORT)
   ssize_t err = sendfile(out_fd, in_fd, offset, size);
   if (err < 0) {
@@ -23,22 +32,28 @@ ssize_t zm_sendfile(int out_fd, int in_fd, off_t *offset, size_t size) {
   return err;
 
 #elif defined(HAVE_SENDFILE) && defined(HAVE_SENDFILE7_SUPPORT)
-  off_t sbytes;
-  ssize_t err = sendfile(in_fd, out_fd, (offset ? *offset: 0), size, nullptr, &sbytes, 0);
-  if (err && errno != EAGAIN)
+  off_t sbytes = 0;
+  int err = sendfile(in_fd, out_fd, (offset ? *offset : lseek(in_fd, 0, SEEK_CUR)), size, nullptr, &sbytes, 0);
+  if (err && errno != EAGAIN && errno != EINTR)
     return -errno;
+  if (!sbytes && err)
+    return -errno;
+  if (offset)
+    *offset += sbytes;
+  else
+    lseek(in_fd, sbytes, SEEK_CUR);
   return sbytes;
 #else
   uint8_t buffer[4096];
-  ssize_t chunk_size = (size > 4096 ? 4096 : size);
+  ssize_t chunk_size = (size > sizeof(buffer) ? sizeof(buffer) : size);
 
-  ssize_t err = read(in_fd, buffer, chunk_size);
+  ssize_t err = offset ? pread(in_fd, buffer, chunk_size, *offset) : read(in_fd, buffer, chunk_size);
   if (err < 0) {
-    Error("Unable to read %zu bytes of %zu: %s", chunk_size, size, strerror(errno));
+    Error("Unable to read %zd bytes of %zu: %s", chunk_size, size, strerror(errno));
     return -errno;
   }
   if (!err) {
-    Error("Got EOF despite wanting to read %d bytes", 4096);
+    Error("Got EOF despite wanting to read %zd bytes", chunk_size);
     return err;
   }
 
@@ -46,14 +61,109 @@ ssize_t zm_sendfile(int out_fd, int in_fd, off_t *offset, size_t size) {
 
   err = write(out_fd, buffer, chunk_size);
   if (err < 0) {
-    Error("Unable to write %zu bytes: %s", chunk_size, strerror(errno));
+    Error("Unable to write %zd bytes: %s", chunk_size, strerror(errno));
     return -errno;
   } else if (err != chunk_size) {
-    Debug(1, "Sent less than desired %zu < %zu", err, chunk_size);
+    Debug(1, "Sent less than desired %zd < %zd", err, chunk_size);
+    if (!offset) lseek(in_fd, err - chunk_size, SEEK_CUR);
   }
+  if (offset) *offset += err;
 
   return err;
 #endif
 }
 
+/* Waits for out_fd to take more data after it returned EAGAIN. */
+
+inline bool zm_wait_writable(int out_fd) {
+  pollfd pfd = {out_fd, POLLOUT, 0};
+  int rc;
+  while ((rc = poll(&pfd, 1, 5000)) < 0 && errno == EINTR) {}
+  return rc > 0 && !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+}
+
+/* Writes all of iov, carrying on after short writes. */
+
+inline bool zm_writev_all(int out_fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t written = writev(out_fd, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN && zm_wait_writable(out_fd)) continue;
+      return false;
+    }
+    while (iovcnt > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+/* Asks the kernel to start reading path into the page cache, so that it is
+ * already there when it comes to be sent. */
+
+inline void zm_readahead(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+/* Sends path as one part of a multipart/x-mixed-replace stream on out_fd.
+ * headers are the boundary line and the part's own headers, each ending in
+ * \r\n, to which Content-Length is added.  The headers go out in a single
+ * writev and the body is copied by the kernel straight from the page cache.
+ * The \r\n closing the part is left to the caller.  Anything still buffered
+ * in stdio for out_fd must be flushed first.
+ * Returns 0 on success, otherwise an errno, ENODATA for an empty file. */
+
+inline int zm_sendfile_part(int out_fd, const std::string &path, const std::string &headers) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return errno;
+
+  struct stat filestat;
+  if (fstat(fd, &filestat) < 0) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+  if (!filestat.st_size) {
+    close(fd);
+    return ENODATA;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::string length = stringtf("Content-Length: %jd\r\n\r\n", static_cast<intmax_t>(filestat.st_size));
+  struct iovec iov[2] = {
+    { const_cast<char *>(headers.data()), headers.size() },
+    { const_cast<char *>(length.data()), length.size() },
+  };
+  if (!zm_writev_all(out_fd, iov, 2)) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+
+  off_t offset = 0;
+  while (offset < filestat.st_size) {
+    ssize_t rc = zm_sendfile(out_fd, fd, &offset, filestat.st_size - offset);
+    if (rc == -EINTR) continue;
+    if (rc == -EAGAIN && zm_wait_writable(out_fd)) continue;
+    if (rc <= 0) {
+      // The file shrank under us, which leaves the part short of its
+      // Content-Length; the stream can't be resynchronised.
+      close(fd);
+      return rc ? -rc : EIO;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
 #endif // ZM_SENDFILE_H
@@ -20,8 +20,10 @@
 #include "zm_storage.h"
 
 #include "zm_db.h"
+#include "zm_db_snapshot.h"
 #include "zm_logger.h"
 #include "zm_utils.h"
+#include <cinttypes>
 #include <cstring>
 
 Storage::Storage() : id(0) {
@@ -45,13 +47,7 @@ Storage::Storage(MYSQL_ROW &dbrow) {
   strncpy(path, dbrow[index++], sizeof(path) - 1);
   type_str = std::string(dbrow[index++]);
   scheme_str = std::string(dbrow[index++]);
-  if (scheme_str == "Deep") {
-    scheme = DEEP;
-  } else if (scheme_str == "Medium") {
-    scheme = MEDIUM;
-  } else {
-    scheme = SHALLOW;
-  }
+  scheme = SchemeFromString(scheme_str);
   size_t length = strlen(path);
   while (length and *(path+length-1) == '/') {
     *(path+length-1) = 0;
@@ -59,13 +55,19 @@ Storage::Storage(MYSQL_ROW &dbrow) {
   }
 }
 
+std::string load_storage_sql = "SELECT `Id`, `Name`, `Path`, `Type`, `Scheme` FROM `Storage`";
+
 /* If a zero or invalid p_id is passed, then the old default path will be assumed.  */
 Storage::Storage(unsigned int p_id) : id(p_id) {
   if (id) {
-    std::string sql = stringtf("SELECT `Id`, `Name`, `Path`, `Type`, `Scheme` FROM `Storage` WHERE `Id`=%u", id);
-    Debug(2, "Loading Storage for %u using %s", id, sql.c_str());
-    zmDbRow dbrow;
-    if (!dbrow.fetch(sql)) {
+    zmDbRow db_row;
+    MYSQL_ROW dbrow = dbSnapshot.IsOpen() ? dbSnapshot.FindRow("Storage", 0, id) : nullptr;
+    if (!dbrow) {
+      std::string sql = load_storage_sql + stringtf(" WHERE `Id`=%u", id);
+      Debug(2, "Loading Storage for %u using %s", id, sql.c_str());
+      if (db_row.fetch(sql)) dbrow = db_row.mysql_row();
+    }
+    if (!dbrow) {
       Error("Unable to load storage area for id %d: %s", id, mysql_error(&dbconn));
     } else {
       unsigned int index = 0;
@@ -74,13 +76,7 @@ Storage::Storage(unsigned int p_id) : id(p_id) {
       strncpy(path, dbrow[index++], sizeof(path) - 1);
       type_str = std::string(dbrow[index++]);
       scheme_str = std::string(dbrow[index++]);
-      if (scheme_str == "Deep") {
-        scheme = DEEP;
-      } else if (scheme_str == "Medium") {
-        scheme = MEDIUM;
-      } else {
-        scheme = SHALLOW;
-      }
+      scheme = SchemeFromString(scheme_str);
       Debug(1, "Loaded Storage area %d '%s'", id, name);
     }
   }
@@ -101,3 +97,32 @@ Storage::Storage(unsigned int p_id) : id(p_id) {
 
 Storage::~Storage() {
 }
+
+Storage::Schemes Storage::SchemeFromString(const std::string &scheme_str) {
+  if (scheme_str == "Deep") return DEEP;
+  if (scheme_str == "Medium") return MEDIUM;
+  return SHALLOW;
+}
+
+std::string Storage::EventPath(const char *storage_path, Schemes scheme,
+                               unsigned int monitor_id, uint64_t event_id, SystemTimePoint start_time) {
+  std::string base = storage_path[0] == '/'
+                     ? stringtf("%s/%u", storage_path, monitor_id)
+                     : stringtf("%s/%s/%u", staticConfig.PATH_WEB.c_str(), storage_path, monitor_id);
+
+  if (scheme == SHALLOW)
+    return stringtf("%s/%" PRIu64, base.c_str(), event_id);
+
+  tm event_time = {};
+  time_t start_time_t = std::chrono::system_clock::to_time_t(start_time);
+  localtime_r(&start_time_t, &event_time);
+
+  if (scheme == DEEP) {
+    return stringtf("%s/%02d/%02d/%02d/%02d/%02d/%02d", base.c_str(),
+                    event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
+                    event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
+  }
+  return stringtf("%s/%04d-%02d-%02d/%" PRIu64, base.c_str(),
+                  event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
+                  event_id);
+}
@@ -21,6 +21,7 @@
 #define ZM_STORAGE_H
 
 #include "zm_db.h"
+#include "zm_time.h"
 #include <string>
 
 class Storage {
@@ -50,6 +51,18 @@ class Storage {
   const char *Path() const { return path; }
   Schemes  Scheme() const { return scheme; }
   std::string  SchemeString() const { return scheme_str; }
+
+  // Parses the Scheme column of Events/Storage, anything unknown is SHALLOW
+  static Schemes SchemeFromString(const std::string &scheme_str);
+  // The directory an event's files are kept in.  A relative storage_path is
+  // taken to be relative to ZM_PATH_WEB.
+  static std::string EventPath(const char *storage_path, Schemes scheme,
+                               unsigned int monitor_id, uint64_t event_id, SystemTimePoint start_time);
+  std::string EventPath(unsigned int monitor_id, uint64_t event_id, SystemTimePoint start_time) const {
+    return EventPath(path, scheme, monitor_id, event_id, start_time);
+  }
 };
 
+extern std::string load_storage_sql;
+
 #endif // ZM_STORAGE_H
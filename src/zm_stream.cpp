@@ -22,6 +22,7 @@
 #include "zm_box.h"
 #include "zm_monitor.h"
 #include "zm_signal.h"
+#include "zm_utils.h"
 
 #include <cmath>
 #include <sys/file.h>
@@ -35,9 +36,20 @@ constexpr Milliseconds StreamBase::MAX_SLEEP;
 StreamBase::~StreamBase() {
   delete vid_stream;
   delete[] temp_img_buffer;
+  delete zoomed_image;
+  delete scaled_image;
   closeComms();
 }
 
+std::string StreamBase::MultipartHeader(const char *content_type, size_t length, SystemTimePoint timestamp) {
+  std::string header = "--" BOUNDARY "\r\n";
+  if (content_type)
+    header += stringtf("Content-Type: %s\r\n", content_type);
+  header += stringtf("Content-Length: %zu\r\nX-Timestamp: %.6f\r\n\r\n",
+                     length, std::chrono::duration_cast<FPSeconds>(timestamp.time_since_epoch()).count());
+  return header;
+}
+
 bool StreamBase::loadMonitor(int p_monitor_id) {
   monitor_id = p_monitor_id;
 
@@ -226,21 +238,21 @@ Image *StreamBase::prepareImage(Image *image) {
     last_crop = Box({lo_x*ZM_SCALE_BASE/zoom, lo_y*ZM_SCALE_BASE/zoom}, {hi_x*ZM_SCALE_BASE/zoom, hi_y*ZM_SCALE_BASE/zoom});
 
     Debug(3, "Cropping to %d,%d -> %d,%d", last_crop.Lo().x_, last_crop.Lo().y_, last_crop.Hi().x_, last_crop.Hi().y_);
-    if ( !image_copied ) {
-      static Image copy_image;
-      copy_image.Assign(*image);
-      image = &copy_image;
+    // Only the visible window is scaled, straight out of the source image
+    if (!zoomed_image) zoomed_image = new Image();
+    if (image->Scale(last_crop, disp_image_width, disp_image_height, *zoomed_image)) {
+      image = zoomed_image;
+      image_copied = true;
+    }
+  } else if (scale != source_scale) {
+    Debug(3, "scaling by %d from %dx%d at %d", scale, image->Width(), image->Height(), source_scale);
+    // Scale straight into an image that is kept across frames, rather than
+    // copying the frame and allocating a new buffer for every scaled copy.
+    if (!scaled_image) scaled_image = new Image();
+    if (image->Scale(image->Width() * scale / source_scale, image->Height() * scale / source_scale, *scaled_image)) {
+      image = scaled_image;
       image_copied = true;
     }
-    image->Crop(last_crop);
-    image->Scale(disp_image_width, disp_image_height);
-  } else if (scale != ZM_SCALE_BASE) {
-    Debug(3, "scaling by %d from %dx%d", scale, image->Width(), image->Height());
-    static Image copy_image;
-    copy_image.Assign(*image);
-    image = &copy_image;
-    image_copied = true;
-    image->Scale(scale);
   }
   Debug(3, "Sending %dx%d", image->Width(), image->Height());
 
@@ -72,7 +72,8 @@ class StreamBase {
   typedef enum {
     MSG_CMD=1,
     MSG_DATA_WATCH,
-    MSG_DATA_EVENT
+    MSG_DATA_EVENT,
+    MSG_DATA_MONTAGE
   } MsgType;
 
   typedef enum {
@@ -122,6 +123,7 @@ class StreamBase {
   int replay_rate;
   int scale;
   int last_scale;
+  int source_scale;  // scale of the image being sent, when it is a pre-scaled copy
   int zoom;
   int last_zoom;
   Box last_crop;
@@ -169,6 +171,9 @@ class StreamBase {
   uint8_t *temp_img_buffer;     // Used when encoding or sending file data
   size_t temp_img_buffer_size;
 
+  Image *zoomed_image;  // Kept across frames by prepareImage, so that their
+  Image *scaled_image;  // buffers are reused
+
  protected:
   std::mutex monitor_mutex;  // Protects monitor connect/disconnect vs command thread access
 
@@ -190,6 +195,7 @@ class StreamBase {
     replay_rate(DEFAULT_RATE),
     scale(DEFAULT_SCALE),
     last_scale(DEFAULT_SCALE),
+    source_scale(DEFAULT_SCALE),
     zoom(DEFAULT_ZOOM),
     last_zoom(DEFAULT_ZOOM),
     bitrate(DEFAULT_BITRATE),
@@ -216,7 +222,9 @@ class StreamBase {
     frames_to_send(-1),
     got_command(false),
     temp_img_buffer(nullptr),
-    temp_img_buffer_size(0) {
+    temp_img_buffer_size(0),
+    zoomed_image(nullptr),
+    scaled_image(nullptr) {
     memset(&loc_sock_path, 0, sizeof(loc_sock_path));
     memset(&loc_addr, 0, sizeof(loc_addr));
     memset(&rem_sock_path, 0, sizeof(rem_sock_path));
@@ -229,6 +237,10 @@ class StreamBase {
   }
   virtual ~StreamBase();
 
+  // The headers of one part of a multipart/x-mixed-replace stream, up to and
+  // including the blank line before the data. content_type may be null.
+  static std::string MultipartHeader(const char *content_type, size_t length, SystemTimePoint timestamp);
+
   void setStreamType(StreamType p_type) {
     type = p_type;
 #if ! HAVE_ZLIB_H
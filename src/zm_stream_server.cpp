@@ -0,0 +1,811 @@
+//
+// ZoneMinder Stream Server Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_stream_server.h"
+
+#include "zm_config.h"
+#include "zm_monitor.h"
+#include "zm_stream.h"
+#include "zm_user.h"
+#include "zm_utils.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sstream>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Longest request we'll wait for the end of
+#define STREAM_SERVER_MAX_REQUEST 8192
+// How long a client gets to send its request, and how long a monitor's
+// encoding is kept around after its last viewer goes
+static const Seconds STREAM_SERVER_IDLE_TIMEOUT = Seconds(10);
+// How long the answer to a set of credentials is reused for, so a change
+// to a user's permissions takes up to this long to reach zmsd
+static const Seconds STREAM_SERVER_AUTH_CACHE_TIME = Seconds(60);
+
+static const char * const STREAM_SERVER_NO_CACHE =
+  "Expires: Mon, 26 Jul 1997 05:00:00 GMT\r\n"
+  "Cache-Control: no-store, no-cache, must-revalidate\r\n"
+  "Cache-Control: post-check=0, pre-check=0\r\n"
+  "Pragma: no-cache\r\n";
+
+StreamServer::StreamServer(const std::string &address, int port) :
+  address_(address),
+  port_(port),
+  listen_fd_(-1),
+  epoll_fd_(-1),
+  worker_event_fd_(-1),
+  now_(std::chrono::steady_clock::now()),
+  last_expire_(now_),
+  next_auth_id_(1),
+  worker_terminate_(false) {
+}
+
+StreamServer::~StreamServer() {
+  if (worker_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lck(worker_mutex_);
+      worker_terminate_ = true;
+    }
+    worker_cond_.notify_all();
+    worker_thread_.join();
+  }
+  for (auto &client_pair : clients_)
+    close(client_pair.first);
+  clients_.clear();
+  if (listen_fd_ >= 0) close(listen_fd_);
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+  if (worker_event_fd_ >= 0) close(worker_event_fd_);
+  for (auto &monitor_pair : monitors_)
+    monitor_pair.second->disconnect();
+  for (auto &loaded : loaded_monitors_) {
+    if (loaded.second) loaded.second->disconnect();
+  }
+}
+
+bool StreamServer::Start() {
+  addrinfo hints = {};
+  hints.ai_family = address_.empty() ? AF_INET : AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  addrinfo *addresses = nullptr;
+  const std::string port = std::to_string(port_);
+  int rc = getaddrinfo(address_.empty() ? nullptr : address_.c_str(), port.c_str(), &hints, &addresses);
+  if (rc != 0) {
+    Error("Can't listen on address '%s': %s", address_.c_str(), gai_strerror(rc));
+    return false;
+  }
+  listen_fd_ = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    Error("Can't create socket: %s", strerror(errno));
+    freeaddrinfo(addresses);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  rc = bind(listen_fd_, addresses->ai_addr, addresses->ai_addrlen);
+  freeaddrinfo(addresses);
+  if (rc < 0) {
+    Error("Can't bind to %s port %d: %s", address_.empty() ? "any address" : address_.c_str(), port_, strerror(errno));
+    return false;
+  }
+  if (listen(listen_fd_, SOMAXCONN) < 0) {
+    Error("Can't listen on port %d: %s", port_, strerror(errno));
+    return false;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    Error("Can't create epoll instance: %s", strerror(errno));
+    return false;
+  }
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) < 0) {
+    Error("Can't watch listening socket: %s", strerror(errno));
+    return false;
+  }
+
+  worker_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (worker_event_fd_ < 0) {
+    Error("Can't create eventfd: %s", strerror(errno));
+    return false;
+  }
+  event.data.fd = worker_event_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, worker_event_fd_, &event) < 0) {
+    Error("Can't watch eventfd: %s", strerror(errno));
+    return false;
+  }
+  worker_thread_ = std::thread(&StreamServer::WorkerThread, this);
+
+  Info("Stream server listening on %s port %d", address_.empty() ? "any address" : address_.c_str(), port_);
+  return true;
+}
+
+bool StreamServer::ParseRequestLine(const std::string &request, std::string &query) {
+  const std::string line = request.substr(0, request.find_first_of("\r\n"));
+  if (line.compare(0, 4, "GET ") != 0)
+    return false;
+
+  const size_t target_end = line.find(' ', 4);
+  const std::string target = line.substr(4, target_end == std::string::npos ? std::string::npos : target_end - 4);
+  if (target.empty())
+    return false;
+
+  const size_t query_start = target.find('?');
+  query = (query_start == std::string::npos) ? "" : target.substr(query_start + 1);
+  return true;
+}
+
+std::string StreamServer::RequestHeader(const std::string &request, const char *name) {
+  const size_t name_len = strlen(name);
+  size_t line_start = request.find('\n');
+  while (line_start != std::string::npos) {
+    line_start++;
+    const size_t line_end = request.find('\n', line_start);
+    const std::string line = request.substr(line_start, line_end == std::string::npos ? std::string::npos : line_end - line_start);
+    if (line.size() > name_len and line[name_len] == ':' and strncasecmp(line.c_str(), name, name_len) == 0) {
+      const size_t value_start = line.find_first_not_of(" \t", name_len + 1);
+      const size_t value_end = line.find_last_not_of(" \t\r");
+      if (value_start == std::string::npos or value_end < value_start) return "";
+      return line.substr(value_start, value_end - value_start + 1);
+    }
+    line_start = line_end;
+  }
+  return "";
+}
+
+std::string StreamServer::ZmsLocation(const std::string &host, const std::string &path_zms, const std::string &query) {
+  // zms is served by the web server, on its own port rather than ours
+  std::string hostname = host;
+  if (!hostname.empty() and hostname[0] == '[') {
+    hostname = hostname.substr(0, hostname.find(']') + 1);
+  } else {
+    hostname = hostname.substr(0, hostname.find(':'));
+  }
+  if (hostname.empty()) hostname = "localhost";
+  return "http://" + hostname + path_zms + (query.empty() ? "" : "?" + query);
+}
+
+void StreamServer::Poll(Milliseconds timeout) {
+  epoll_event events[64];
+  int count = epoll_wait(epoll_fd_, events, 64, timeout.count());
+  if (count < 0 and errno != EINTR) {
+    Error("epoll_wait failed: %s", strerror(errno));
+    return;
+  }
+  now_ = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i++) {
+    const int fd = events[i].data.fd;
+    if (fd == listen_fd_) {
+      while (Accept()) {}
+      continue;
+    }
+    if (fd == worker_event_fd_) {
+      FinishWork();
+      continue;
+    }
+    auto client_it = clients_.find(fd);
+    if (client_it == clients_.end()) continue;
+    Client &client = client_it->second;
+
+    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+      client.state = DONE;
+      continue;
+    }
+    // A peer closing its end shows up as EPOLLIN with a read of 0
+    if (events[i].events & EPOLLIN) {
+      if (client.state == READING_REQUEST) {
+        ReadRequest(client);
+      } else {
+        // Nothing more is expected from a viewer, this is just to notice it going
+        char discard[512];
+        ssize_t len = recv(fd, discard, sizeof(discard), 0);
+        if (len == 0 or (len < 0 and errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR))
+          client.state = DONE;
+      }
+    }
+    if ((events[i].events & EPOLLOUT) and client.state != DONE)
+      WriteClient(client);
+  }
+
+  PollSources();
+  if (now_ - last_expire_ >= Seconds(1))
+    Expire();
+
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    const Client &client = it->second;
+    const int fd = it->first;
+    ++it;
+    if (client.state == DONE or (client.state == FLUSHING and client.queue.Empty()))
+      CloseClient(fd);
+  }
+}
+
+bool StreamServer::Accept() {
+  sockaddr_storage addr = {};
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept4(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) {
+    if (errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR)
+      Warning("Can't accept connection: %s", strerror(errno));
+    return false;
+  }
+
+  char host[INET6_ADDRSTRLEN] = "";
+  if (addr.ss_family == AF_INET) {
+    inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(&addr)->sin_addr, host, sizeof(host));
+  } else if (addr.ss_family == AF_INET6) {
+    inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_addr, host, sizeof(host));
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    Warning("Can't watch client socket: %s", strerror(errno));
+    close(fd);
+    return true;
+  }
+
+  Client &client = clients_[fd];
+  client.fd = fd;
+  client.peer = host;
+  client.state = READING_REQUEST;
+  client.connected = now_;
+  client.auth_id = 0;
+  client.monitor_id = 0;
+  client.scale = ZM_SCALE_BASE;
+  client.single = false;
+  client.frame_interval = Microseconds(0);
+  client.frames_to_send = -1;
+  client.frames_sent = 0;
+  client.want_write = false;
+  Debug(1, "Stream client %d connected from %s, %zu clients", fd, host, clients_.size());
+  return true;
+}
+
+void StreamServer::CloseClient(int fd) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) return;
+  if (it->second.queue.Dropped())
+    Debug(1, "Stream client %d dropped %u frames for being slow", fd, it->second.queue.Dropped());
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  clients_.erase(it);
+  Debug(1, "Stream client %d closed, %zu clients", fd, clients_.size());
+}
+
+void StreamServer::ReadRequest(Client &client) {
+  char buffer[2048];
+  while (true) {
+    ssize_t len = recv(client.fd, buffer, sizeof(buffer), 0);
+    if (len > 0) {
+      client.request.append(buffer, len);
+      if (client.request.size() > STREAM_SERVER_MAX_REQUEST) {
+        SendResponse(client, "HTTP/1.0 413 Request Entity Too Large\r\n\r\n");
+        return;
+      }
+    } else if (len == 0) {
+      client.state = DONE;
+      return;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+      break;
+    } else {
+      client.state = DONE;
+      return;
+    }
+  }
+
+  if (client.request.find("\r\n\r\n") == std::string::npos and client.request.find("\n\n") == std::string::npos)
+    return;
+
+  std::string query;
+  if (!ParseRequestLine(client.request, query)) {
+    SendResponse(client, "HTTP/1.0 400 Bad Request\r\n\r\n");
+    return;
+  }
+  const std::string host = RequestHeader(client.request, "Host");
+  client.request.clear();
+  StartStream(client, query, host);
+}
+
+void StreamServer::StartStream(Client &client, const std::string &query, const std::string &host) {
+  std::istringstream query_stream(query);
+  QueryString params(query_stream);
+  auto param = [&params](const char *name) -> std::string {
+    const QueryParameter *parameter = params.get(name);
+    return (parameter and parameter->size()) ? parameter->firstValue() : "";
+  };
+
+  client.monitor_id = atoi(param("monitor").c_str());
+  const std::string mode = param("mode");
+  if (!client.monitor_id or params.has("event") or params.has("source")
+      or !(mode.empty() or mode == "jpeg" or mode == "single")) {
+    // Event playback, fifo and video modes stay with zms
+    Debug(1, "Stream client %d asked for something other than live jpeg, sending it to zms: %s",
+          client.fd, query.c_str());
+    SendResponse(client, stringtf("HTTP/1.0 302 Found\r\nLocation: %s\r\n%s\r\n",
+                                  ZmsLocation(host, staticConfig.PATH_ZMS, query).c_str(), STREAM_SERVER_NO_CACHE));
+    return;
+  }
+  client.single = (mode == "single");
+  if (params.has("scale")) {
+    int scale = atoi(param("scale").c_str());
+    client.scale = scale > 0 ? std::min(scale, 1600) : ZM_SCALE_BASE;
+  }
+  if (params.has("maxfps")) {
+    double maxfps = atof(param("maxfps").c_str());
+    if (maxfps > 0.0)
+      client.frame_interval = Microseconds(lround(Microseconds::period::den / maxfps));
+  }
+  if (params.has("frames"))
+    client.frames_to_send = atoi(param("frames").c_str());
+
+  if (!config.opt_use_auth) {
+    BeginStream(client);
+    return;
+  }
+
+  AuthRequest request;
+  request.fd = client.fd;
+  request.peer = client.peer;
+  request.monitor_id = client.monitor_id;
+  request.username = param(params.has("username") ? "username" : "user");
+  if (params.has("token")) {
+    request.token = param("token");
+    request.key = "token\n" + request.token;
+  } else if (strcmp(config.auth_relay, "none") == 0) {
+    request.key = "none\n" + request.username;
+  } else if (params.has("auth")) {
+    request.auth = param("auth");
+    request.key = "auth\n" + request.auth + "\n" + request.username;
+  } else {
+    request.password = param(params.has("password") ? "password" : "pass");
+    request.key = "user\n" + request.username + "\n" + request.password;
+  }
+  request.key += stringtf("\n%s\n%d", client.peer.c_str(), client.monitor_id);
+
+  auto cached = auth_cache_.find(request.key);
+  if (cached != auth_cache_.end() and now_ < cached->second.expires) {
+    if (cached->second.allowed) {
+      BeginStream(client);
+    } else {
+      SendResponse(client, "HTTP/1.0 403 Forbidden\r\n\r\n");
+    }
+    return;
+  }
+
+  request.id = client.auth_id = next_auth_id_++;
+  request.allowed = false;
+  client.state = AUTHENTICATING;
+  {
+    std::lock_guard<std::mutex> lck(worker_mutex_);
+    auth_requests_.push_back(std::move(request));
+  }
+  worker_cond_.notify_one();
+}
+
+// Checks credentials against the database, so only runs on the worker thread
+bool StreamServer::Authenticate(const AuthRequest &request) {
+  User *user = nullptr;
+  if (!request.token.empty()) {
+    user = zmLoadTokenUser(request.token, false);
+  } else if (strcmp(config.auth_relay, "none") == 0) {
+    if (checkUser(request.username))
+      user = zmLoadUser(request.username);
+  } else if (!request.auth.empty()) {
+    user = zmLoadAuthUserFrom(request.auth, request.username, config.auth_hash_ips ? request.peer : std::string());
+  } else if (!request.username.empty() and !request.password.empty()) {
+    user = zmLoadUser(request.username, request.password);
+  }
+
+  bool allowed = false;
+  if (!user) {
+    Warning("Unable to authenticate stream client %s for monitor %d", request.peer.c_str(), request.monitor_id);
+  } else if (user->getStream() < User::PERM_VIEW or !user->canAccess(request.monitor_id)) {
+    Warning("Insufficient privileges for user %s to stream monitor %d", user->getUsername(), request.monitor_id);
+  } else {
+    allowed = true;
+  }
+  delete user;
+  return allowed;
+}
+
+// Loads and attaches to a monitor, which means querying the database, so
+// only runs on the worker thread
+std::shared_ptr<Monitor> StreamServer::LoadMonitor(int monitor_id) {
+  std::shared_ptr<Monitor> monitor = Monitor::Load(monitor_id, false, Monitor::QUERY);
+  if (!monitor) {
+    Error("Unable to load monitor id %d for streaming", monitor_id);
+    return nullptr;
+  }
+  if (monitor->Capturing() == Monitor::CAPTURING_NONE) {
+    Info("Monitor %d has capturing == NONE. Will not be able to connect to it.", monitor_id);
+    return nullptr;
+  }
+  if (!monitor->connect()) {
+    Info("Unable to connect to monitor id %d for streaming", monitor_id);
+    monitor->disconnect();
+    return nullptr;
+  }
+  return monitor;
+}
+
+void StreamServer::WorkerThread() {
+  std::unique_lock<std::mutex> lck(worker_mutex_);
+  while (true) {
+    worker_cond_.wait(lck, [this] {
+      return worker_terminate_ or !auth_requests_.empty() or !load_requests_.empty();
+    });
+    if (worker_terminate_) return;
+
+    if (!load_requests_.empty()) {
+      const int monitor_id = load_requests_.front();
+      load_requests_.pop_front();
+
+      lck.unlock();
+      std::shared_ptr<Monitor> monitor = LoadMonitor(monitor_id);
+      lck.lock();
+
+      loaded_monitors_.emplace_back(monitor_id, std::move(monitor));
+    } else {
+      AuthRequest request = std::move(auth_requests_.front());
+      auth_requests_.pop_front();
+
+      lck.unlock();
+      request.allowed = Authenticate(request);
+      lck.lock();
+
+      auth_answers_.push_back(std::move(request));
+    }
+    const uint64_t one = 1;
+    if (write(worker_event_fd_, &one, sizeof(one)) < 0 and errno != EAGAIN)
+      Warning("Can't signal the stream server: %s", strerror(errno));
+  }
+}
+
+// Asks the worker thread for a fresh copy of a monitor, unless it already
+// has been
+void StreamServer::RequestMonitor(int monitor_id) {
+  if (!loading_.insert(monitor_id).second) return;
+  {
+    std::lock_guard<std::mutex> lck(worker_mutex_);
+    load_requests_.push_back(monitor_id);
+  }
+  worker_cond_.notify_one();
+}
+
+// Picks up whatever the worker thread has finished
+void StreamServer::FinishWork() {
+  uint64_t count;
+  while (read(worker_event_fd_, &count, sizeof(count)) < 0 and errno == EINTR) {}
+
+  std::deque<AuthRequest> answers;
+  std::deque<std::pair<int, std::shared_ptr<Monitor>>> loaded;
+  {
+    std::lock_guard<std::mutex> lck(worker_mutex_);
+    answers.swap(auth_answers_);
+    loaded.swap(loaded_monitors_);
+  }
+  for (auto &monitor_pair : loaded)
+    FinishLoading(monitor_pair.first, std::move(monitor_pair.second));
+  FinishAuthentication(answers);
+}
+
+// Lets the clients waiting on credentials start streaming, or turns them
+// away
+void StreamServer::FinishAuthentication(std::deque<AuthRequest> &answers) {
+  for (const AuthRequest &answer : answers) {
+    auth_cache_[answer.key] = {answer.allowed, now_ + STREAM_SERVER_AUTH_CACHE_TIME};
+
+    // The client may have gone, and its fd been reused, while it waited
+    auto client_it = clients_.find(answer.fd);
+    if (client_it == clients_.end()) continue;
+    Client &client = client_it->second;
+    if (client.state != AUTHENTICATING or client.auth_id != answer.id) continue;
+    if (answer.allowed) {
+      BeginStream(client);
+    } else {
+      SendResponse(client, "HTTP/1.0 403 Forbidden\r\n\r\n");
+    }
+  }
+}
+
+// Swaps in a newly loaded monitor, new or because zmc has restarted and the
+// old mapping is stale, and starts or turns away the clients waiting on it
+void StreamServer::FinishLoading(int monitor_id, std::shared_ptr<Monitor> monitor) {
+  loading_.erase(monitor_id);
+  auto it = monitors_.find(monitor_id);
+  if (monitor) {
+    if (it != monitors_.end()) {
+      it->second->disconnect();
+      it->second = std::move(monitor);
+    } else {
+      monitors_[monitor_id] = std::move(monitor);
+    }
+  } else if (it != monitors_.end() and !it->second->ShmValid()) {
+    it->second->disconnect();
+    monitors_.erase(it);
+  }
+
+  it = monitors_.find(monitor_id);
+  const bool ready = (it != monitors_.end()) and it->second->ShmValid();
+  for (auto &client_pair : clients_) {
+    Client &client = client_pair.second;
+    if (client.state != LOADING_MONITOR or client.monitor_id != monitor_id) continue;
+    if (ready) {
+      BeginStream(client);
+    } else {
+      SendResponse(client, "HTTP/1.0 503 Service Unavailable\r\n\r\n");
+    }
+  }
+}
+
+void StreamServer::BeginStream(Client &client) {
+  auto monitor_it = monitors_.find(client.monitor_id);
+  if (monitor_it == monitors_.end() or !monitor_it->second->ShmValid()) {
+    client.state = LOADING_MONITOR;
+    RequestMonitor(client.monitor_id);
+    return;
+  }
+  Monitor *monitor = monitor_it->second.get();
+
+  client.state = STREAMING;
+  client.next_frame = now_;
+  if (!client.single) {
+    client.queue.Push(std::make_shared<std::string>(stringtf(
+                        "HTTP/1.0 200 OK\r\n"
+                        "Server: ZoneMinder Video Server/%s\r\n"
+                        "%s"
+                        "Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY "\r\n\r\n",
+                        ZM_VERSION, STREAM_SERVER_NO_CACHE)), false);
+  }
+
+  const SourceKey key(client.monitor_id, client.scale);
+  auto source_it = sources_.find(key);
+  if (source_it == sources_.end()) {
+    Source &source = sources_[key];
+    source.scale = client.scale;
+    source.last_write_index = -1;
+    source.last_image_count = 0;
+    source.jpeg_size = 0;
+    source.last_used = now_;
+    Debug(1, "Encoding monitor %d at scale %u", client.monitor_id, client.scale);
+  } else if (source_it->second.part and now_ - source_it->second.last_frame < Seconds(1)) {
+    // Recent enough to start the viewer off with
+    SendFrame(client, source_it->second);
+  }
+  WriteClient(client);
+  monitor->setLastViewed();
+}
+
+void StreamServer::SendResponse(Client &client, const std::string &response) {
+  client.queue.Push(std::make_shared<std::string>(response), false);
+  client.state = FLUSHING;
+  WriteClient(client);
+}
+
+void StreamServer::SendFrame(Client &client, const Source &source) {
+  if (client.single) {
+    std::string response = stringtf(
+                             "HTTP/1.0 200 OK\r\n"
+                             "Server: ZoneMinder Video Server/%s\r\n"
+                             "%s"
+                             "Content-Type: image/jpeg\r\n"
+                             "Content-Length: %zu\r\n\r\n",
+                             ZM_VERSION, STREAM_SERVER_NO_CACHE, source.jpeg_size);
+    response.append(reinterpret_cast<const char *>(source.jpeg.data()), source.jpeg_size);
+    client.queue.Push(std::make_shared<std::string>(std::move(response)), false);
+    client.state = FLUSHING;
+    return;
+  }
+
+  // The first frame waits behind the header rather than being replaced, and
+  // is sent twice as Chrome will not display it until it receives another
+  const bool first = !client.frames_sent;
+  client.queue.Push(source.part, !first);
+  if (first)
+    client.queue.Push(source.part, false);
+  client.frames_sent++;
+  client.next_frame = now_ + client.frame_interval;
+  if (client.frames_to_send > 0 and client.frames_sent >= client.frames_to_send)
+    client.state = FLUSHING;
+}
+
+void StreamServer::WriteClient(Client &client) {
+  while (!client.queue.Empty()) {
+    ssize_t len = send(client.fd, client.queue.Data(), client.queue.Remaining(), MSG_NOSIGNAL);
+    if (len > 0) {
+      client.queue.Consume(len);
+    } else if (len < 0 and errno == EINTR) {
+      continue;
+    } else if (len < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+      SetWriteInterest(client, true);
+      return;
+    } else {
+      Debug(1, "Stream client %d from %s gone: %s", client.fd, client.peer.c_str(), strerror(errno));
+      client.state = DONE;
+      return;
+    }
+  }
+  SetWriteInterest(client, false);
+}
+
+void StreamServer::SetWriteInterest(Client &client, bool want_write) {
+  if (client.want_write == want_write) return;
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0);
+  event.data.fd = client.fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client.fd, &event) < 0) {
+    Warning("Can't update client socket: %s", strerror(errno));
+    client.state = DONE;
+    return;
+  }
+  client.want_write = want_write;
+}
+
+// Encodes the monitor's newest frame for source if there is one it hasn't
+// seen yet.  Returns whether it did.
+bool StreamServer::EncodeFrame(int monitor_id, Source &source) {
+  auto monitor_it = monitors_.find(monitor_id);
+  if (monitor_it == monitors_.end()) return false;
+  Monitor *monitor = monitor_it->second.get();
+  if (!monitor->ShmValid()) return false;
+
+  const int last_write_index = monitor->shared_data->last_write_index;
+  const unsigned int image_count = monitor->shared_data->image_count;
+  if (last_write_index == monitor->image_buffer_count) return false;  // Nothing captured yet
+  if (last_write_index == source.last_write_index and image_count <= source.last_image_count)
+    return false;
+
+  const int index = last_write_index % monitor->image_buffer_count;
+  uint32_t seq = monitor->BeginShmRead(index);
+  int level_scale = ZM_SCALE_BASE;
+  Image *shm_image = monitor->ReadShmFrame(index, source.scale, level_scale);
+  if (!shm_image) return false;
+  source.image.Assign(*shm_image);
+  const SystemTimePoint timestamp = monitor->ShmTimestamp(index);
+  if (!monitor->ValidShmRead(index, seq)) {
+    Debug(1, "Shm slot %d of monitor %d was overwritten while copying, trying again", index, monitor_id);
+    return false;
+  }
+  source.last_write_index = last_write_index;
+  source.last_image_count = image_count;
+
+  if (!config.timestamp_on_capture)
+    monitor->TimestampImage(&source.image, timestamp);
+  // Both images keep their buffers from one frame to the next
+  const Image *send_image = &source.image;
+  if (source.scale != static_cast<unsigned int>(level_scale)
+      and source.image.Scale(std::max(1u, source.image.Width() * source.scale / level_scale),
+                             std::max(1u, source.image.Height() * source.scale / level_scale),
+                             source.scaled)) {
+    send_image = &source.scaled;
+  }
+
+  if (source.jpeg.size() < send_image->Size())
+    source.jpeg.resize(send_image->Size());
+  source.jpeg_size = 0;
+  if (!send_image->EncodeJpeg(source.jpeg.data(), &source.jpeg_size)) {
+    Error("Unable to encode frame for monitor %d", monitor_id);
+    return false;
+  }
+
+  std::string part = StreamBase::MultipartHeader("image/jpeg", source.jpeg_size, timestamp);
+  part.reserve(part.size() + source.jpeg_size + 2);
+  part.append(reinterpret_cast<const char *>(source.jpeg.data()), source.jpeg_size);
+  part.append("\r\n");
+  source.part = std::make_shared<std::string>(std::move(part));
+  source.last_frame = now_;
+  return true;
+}
+
+void StreamServer::PollSources() {
+  for (auto &source_pair : sources_) {
+    const SourceKey &key = source_pair.first;
+    Source &source = source_pair.second;
+    if (!EncodeFrame(key.first, source)) continue;
+
+    for (auto &client_pair : clients_) {
+      Client &client = client_pair.second;
+      if (client.state != STREAMING or client.monitor_id != key.first or client.scale != key.second)
+        continue;
+      source.last_used = now_;
+      if (now_ < client.next_frame) continue;
+      SendFrame(client, source);
+      WriteClient(client);
+    }
+  }
+}
+
+// Once a second: drop clients that never finished a request, encodings
+// nobody is watching and monitors with no encodings, and reattach to
+// monitors whose zmc has restarted.
+void StreamServer::Expire() {
+  last_expire_ = now_;
+
+  std::map<int, unsigned int> viewers;
+  for (auto &client_pair : clients_) {
+    Client &client = client_pair.second;
+    if (client.state == READING_REQUEST and now_ - client.connected > STREAM_SERVER_IDLE_TIMEOUT) {
+      Debug(1, "Stream client %d from %s never sent a request", client.fd, client.peer.c_str());
+      client.state = DONE;
+    } else if (client.state == STREAMING) {
+      viewers[client.monitor_id]++;
+      auto source_it = sources_.find(SourceKey(client.monitor_id, client.scale));
+      if (source_it != sources_.end())
+        source_it->second.last_used = now_;
+    }
+  }
+
+  for (auto it = sources_.begin(); it != sources_.end();) {
+    if (now_ - it->second.last_used > STREAM_SERVER_IDLE_TIMEOUT) {
+      Debug(1, "No viewers of monitor %d at scale %u, stopping", it->first.first, it->first.second);
+      it = sources_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = auth_cache_.begin(); it != auth_cache_.end();) {
+    if (now_ >= it->second.expires) {
+      it = auth_cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = monitors_.begin(); it != monitors_.end();) {
+    const int monitor_id = it->first;
+    bool in_use = false;
+    for (const auto &source_pair : sources_) {
+      if (source_pair.first.first == monitor_id) {
+        in_use = true;
+        break;
+      }
+    }
+    if (!in_use) {
+      Debug(1, "Detaching from monitor %d", monitor_id);
+      it->second->disconnect();
+      it = monitors_.erase(it);
+      continue;
+    }
+    Monitor *monitor = it->second.get();
+    ++it;
+    if (!viewers[monitor_id]) continue;
+    if (monitor->ShmValid()) {
+      // Keeps on-demand capture going
+      monitor->setLastViewed();
+    } else {
+      RequestMonitor(monitor_id);
+    }
+  }
+}
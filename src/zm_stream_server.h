@@ -0,0 +1,221 @@
+//
+// ZoneMinder Stream Server Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_STREAM_SERVER_H
+#define ZM_STREAM_SERVER_H
+
+#include "zm_image.h"
+#include "zm_time.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Monitor;
+
+// Frames waiting to be written to one client.  The frame being written is
+// always finished, and anything pushed as not droppable (the HTTP header, a
+// client's first frame) is always sent, but of the other frames only the
+// newest is kept, so a slow client costs at most a couple of frames of
+// memory and just sees a lower frame rate.
+class StreamFrameQueue {
+ public:
+  typedef std::shared_ptr<const std::string> Frame;
+
+  StreamFrameQueue() : offset_(0), dropped_(0) {}
+
+  void Push(Frame frame, bool droppable = true) {
+    if (!current_) {
+      current_ = std::move(frame);
+      offset_ = 0;
+      return;
+    }
+    if (droppable and !pending_.empty() and pending_.back().second) {
+      pending_.pop_back();
+      dropped_++;
+    }
+    pending_.emplace_back(std::move(frame), droppable);
+  }
+  bool Empty() const { return !current_; }
+  const char *Data() const { return current_->data() + offset_; }
+  size_t Remaining() const { return current_->size() - offset_; }
+  // Marks bytes of the current frame as written, moving on to the next
+  // frame once it is all gone
+  void Consume(size_t bytes) {
+    offset_ += bytes;
+    if (offset_ >= current_->size()) {
+      current_.reset();
+      offset_ = 0;
+      if (!pending_.empty()) {
+        current_ = std::move(pending_.front().first);
+        pending_.pop_front();
+      }
+    }
+  }
+  unsigned int Dropped() const { return dropped_; }
+
+ private:
+  Frame current_;
+  std::deque<std::pair<Frame, bool>> pending_;  // Frame, droppable
+  size_t offset_;
+  unsigned int dropped_;
+};
+
+// Serves live monitor streams to many HTTP clients from one process, in
+// place of a zms process per viewer.  Each monitor is loaded and attached
+// once, and each new frame is encoded once per requested scale and shared by
+// every client watching at that scale.  Requests take the same query
+// parameters and authentication as zms (monitor, mode=jpeg|single, scale,
+// maxfps, frames, auth/token/user/pass), and anything else, such as event
+// playback, is redirected to zms.  Checking credentials and loading monitors
+// need the database, so they are done on a worker thread of its own, and
+// credentials' answers cached for a while, leaving the thread serving
+// sockets free to get on with streaming.
+class StreamServer {
+ public:
+  // address is where to listen, empty for every address
+  StreamServer(const std::string &address, int port);
+  ~StreamServer();
+
+  bool Start();
+  // Handles whatever sockets are ready and sends any new frames, waiting at
+  // most timeout for something to happen
+  void Poll(Milliseconds timeout);
+  size_t ClientCount() const { return clients_.size(); }
+
+  // Picks the query string out of the request line of an HTTP GET
+  static bool ParseRequestLine(const std::string &request, std::string &query);
+  // The value of the named header, empty when there isn't one
+  static std::string RequestHeader(const std::string &request, const char *name);
+  // Where zms answers the same query, on the host the client reached us by
+  static std::string ZmsLocation(const std::string &host, const std::string &path_zms, const std::string &query);
+
+ private:
+  // FLUSHING clients are closed once their queue is written, DONE ones
+  // straight away
+  enum ClientState { READING_REQUEST, AUTHENTICATING, LOADING_MONITOR, STREAMING, FLUSHING, DONE };
+
+  struct Client {
+    int fd;
+    std::string peer;
+    ClientState state;
+    std::string request;
+    TimePoint connected;
+    uint64_t auth_id;  // Of the check this client is waiting on
+
+    int monitor_id;
+    unsigned int scale;
+    bool single;
+    Microseconds frame_interval;
+    TimePoint next_frame;
+    int frames_to_send;
+    int frames_sent;
+
+    bool want_write;
+    StreamFrameQueue queue;
+  };
+
+  typedef std::pair<int, unsigned int> SourceKey;  // monitor id, scale
+
+  // Credentials to be checked on the worker thread.  key identifies them, the
+  // client's address and the monitor in the cache of answers.
+  struct AuthRequest {
+    uint64_t id;
+    int fd;
+    std::string key;
+    std::string peer;
+    int monitor_id;
+    std::string token;
+    std::string auth;
+    std::string username;
+    std::string password;
+    bool allowed;
+  };
+  struct AuthAnswer {
+    bool allowed;
+    TimePoint expires;
+  };
+
+  // One encoding of a monitor's frames, shared by the clients at its scale
+  struct Source {
+    unsigned int scale;
+    int last_write_index;
+    unsigned int last_image_count;
+    Image image;
+    Image scaled;
+    std::vector<uint8_t> jpeg;
+    size_t jpeg_size;
+    StreamFrameQueue::Frame part;  // Multipart part holding the latest frame
+    TimePoint last_frame;
+    TimePoint last_used;
+  };
+
+  bool Accept();
+  void CloseClient(int fd);
+  void ReadRequest(Client &client);
+  void StartStream(Client &client, const std::string &query, const std::string &host);
+  void BeginStream(Client &client);
+  void WorkerThread();
+  static bool Authenticate(const AuthRequest &request);
+  static std::shared_ptr<Monitor> LoadMonitor(int monitor_id);
+  void RequestMonitor(int monitor_id);
+  void FinishWork();
+  void FinishAuthentication(std::deque<AuthRequest> &answers);
+  void FinishLoading(int monitor_id, std::shared_ptr<Monitor> monitor);
+  void SendResponse(Client &client, const std::string &response);
+  void SendFrame(Client &client, const Source &source);
+  void WriteClient(Client &client);
+  void SetWriteInterest(Client &client, bool want_write);
+
+  bool EncodeFrame(int monitor_id, Source &source);
+  void PollSources();
+  void Expire();
+
+  std::string address_;
+  int port_;
+  int listen_fd_;
+  int epoll_fd_;
+  int worker_event_fd_;  // Wakes up Poll when the worker thread has answers
+  TimePoint now_;
+  TimePoint last_expire_;
+
+  std::map<int, Client> clients_;
+  std::map<int, std::shared_ptr<Monitor>> monitors_;
+  std::set<int> loading_;  // Monitors waiting on the worker thread
+  std::map<SourceKey, Source> sources_;
+
+  uint64_t next_auth_id_;
+  std::map<std::string, AuthAnswer> auth_cache_;
+  std::thread worker_thread_;
+  std::mutex worker_mutex_;
+  std::condition_variable worker_cond_;
+  bool worker_terminate_;
+  std::deque<AuthRequest> auth_requests_;
+  std::deque<AuthRequest> auth_answers_;
+  std::deque<int> load_requests_;
+  std::deque<std::pair<int, std::shared_ptr<Monitor>>> loaded_monitors_;  // nullptr if it couldn't be
+};
+
+#endif // ZM_STREAM_SERVER_H
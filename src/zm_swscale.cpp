@@ -22,8 +22,45 @@
 #include "zm_image.h"
 #include "zm_logger.h"
 
+std::mutex SwsContextCache::mutex_;
+std::list<std::pair<SwsContextCache::Key, struct SwsContext *>> SwsContextCache::idle_;
+
+struct SwsContext *SwsContextCache::Acquire(const Key &key) {
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+      if (it->first == key) {
+        struct SwsContext *ctx = it->second;
+        idle_.erase(it);
+        return ctx;
+      }
+    }
+  }
+  Debug(3, "New swscale context %dx%d %s -> %dx%d %s",
+        key.src_width, key.src_height, av_get_pix_fmt_name(key.src_format),
+        key.dst_width, key.dst_height, av_get_pix_fmt_name(key.dst_format));
+  return sws_getContext(key.src_width, key.src_height, key.src_format,
+                        key.dst_width, key.dst_height, key.dst_format,
+                        key.flags, nullptr, nullptr, nullptr);
+}
+
+void SwsContextCache::Release(const Key &key, struct SwsContext *ctx) {
+  if (!ctx) return;
+  struct SwsContext *evicted = nullptr;
+  {
+    std::lock_guard<std::mutex> lck(mutex_);
+    idle_.emplace_front(key, ctx);
+    if (idle_.size() > max_idle_) {
+      evicted = idle_.back().second;
+      idle_.pop_back();
+    }
+  }
+  if (evicted) sws_freeContext(evicted);
+}
+
 SWScale::SWScale() :
-  swscale_ctx(nullptr) {
+  swscale_ctx(nullptr),
+  swscale_key({}) {
   Debug(4, "SWScale object created");
 }
 
@@ -44,15 +81,23 @@ bool SWScale::init() {
 
 SWScale::~SWScale() {
 
-  /* Free up everything */
+  /* Keep the context for the next user */
   if ( swscale_ctx ) {
-    sws_freeContext(swscale_ctx);
+    SwsContextCache::Release(swscale_key, swscale_ctx);
     swscale_ctx = nullptr;
   }
 
   Debug(4, "SWScale object destroyed");
 }
 
+struct SwsContext *SWScale::GetContext(const SwsContextCache::Key &key) {
+  if (swscale_ctx and (key == swscale_key)) return swscale_ctx;
+  SwsContextCache::Release(swscale_key, swscale_ctx);
+  swscale_ctx = SwsContextCache::Acquire(key);
+  swscale_key = key;
+  return swscale_ctx;
+}
+
 int SWScale::Convert(
   AVFrame *in_frame,
   AVFrame *out_frame
@@ -61,10 +106,9 @@ int SWScale::Convert(
   AVPixelFormat orig_format = (AVPixelFormat)in_frame->format;
   AVPixelFormat format = fix_deprecated_pix_fmt(orig_format);
   /* Get the context */
-  swscale_ctx = sws_getCachedContext(swscale_ctx,
-                                     in_frame->width, in_frame->height, format,
-                                     out_frame->width, out_frame->height, (AVPixelFormat)out_frame->format,
-                                     SWS_FAST_BILINEAR, NULL, NULL, NULL);
+  GetContext({in_frame->width, in_frame->height, format,
+              out_frame->width, out_frame->height, (AVPixelFormat)out_frame->format,
+              SWS_FAST_BILINEAR});
   if ( swscale_ctx == NULL ) {
     Error("Failed getting swscale context");
     return -6;
@@ -150,10 +194,9 @@ int SWScale::Convert(
   }
 
   /* Get the context */
-  swscale_ctx = sws_getCachedContext(swscale_ctx,
-                                     width, height, in_pf,
-                                     new_width, new_height, out_pf,
-                                     SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+  GetContext({static_cast<int>(width), static_cast<int>(height), in_pf,
+              static_cast<int>(new_width), static_cast<int>(new_height), out_pf,
+              SWS_FAST_BILINEAR});
   if (swscale_ctx == nullptr) {
     Error("Failed getting swscale context");
     return -6;
@@ -225,6 +268,66 @@ int SWScale::Convert(
   return Convert(img->Buffer(), img->Size(), out_buffer, out_buffer_size, in_pf, out_pf, width, height, 32, out_alignment);
 }
 
+int SWScale::Convert(
+  const uint8_t* const in_data[4],
+  const int in_linesize[4],
+  enum _AVPIXELFORMAT in_pf,
+  unsigned int width,
+  unsigned int height,
+  uint8_t* out_buffer,
+  const size_t out_buffer_size,
+  enum _AVPIXELFORMAT out_pf,
+  unsigned int new_width,
+  unsigned int new_height,
+  int out_alignment) {
+  if (in_data[0] == nullptr) {
+    Error("NULL Input buffer");
+    return -1;
+  }
+  if (out_buffer == nullptr) {
+    Error("NULL output buffer");
+    return -1;
+  }
+  if (!width || !height || !new_height || !new_width) {
+    Error("Invalid width or height");
+    return -3;
+  }
+
+  const enum _AVPIXELFORMAT orig_in_pf = in_pf;
+  in_pf = fix_deprecated_pix_fmt(in_pf);
+
+  size_t needed_outsize = GetBufferSize(out_pf, new_width, new_height, out_alignment);
+  if (needed_outsize > out_buffer_size) {
+    Error("The output buffer is undersized for the output format. Required: %zu Available: %zu",
+          needed_outsize,
+          out_buffer_size);
+    return -5;
+  }
+
+  GetContext({static_cast<int>(width), static_cast<int>(height), in_pf,
+              static_cast<int>(new_width), static_cast<int>(new_height), out_pf,
+              SWS_FAST_BILINEAR});
+  if (swscale_ctx == nullptr) {
+    Error("Failed getting swscale context");
+    return -6;
+  }
+  zm_sws_set_input_range(swscale_ctx, orig_in_pf);
+
+  if (av_image_fill_arrays(output_avframe->data, output_avframe->linesize,
+                           out_buffer, out_pf, new_width, new_height, out_alignment) <= 0) {
+    Error("Failed filling output frame with output buffer");
+    return -8;
+  }
+
+  if (!sws_scale(swscale_ctx, in_data, in_linesize, 0, height,
+                 output_avframe->data, output_avframe->linesize)) {
+    Error("swscale conversion failed");
+    return -10;
+  }
+
+  return 0;
+}
+
 size_t SWScale::GetBufferSize(enum _AVPIXELFORMAT pf, unsigned int width, unsigned int height, int alignment) {
   return av_image_get_buffer_size(pf, width, height, alignment);
 }
@@ -4,8 +4,44 @@
 #include "zm_config.h"
 #include "zm_ffmpeg.h"
 
+#include <list>
+#include <mutex>
+
 class Image;
 
+/* Process-wide pool of idle SwsContexts. Initialising a context is far more
+ * expensive than using one, and many SWScale objects are short lived (one per
+ * Image::Scale call), so contexts are handed back here instead of being freed.
+ * A context is only ever used by one SWScale at a time. */
+class SwsContextCache {
+ public:
+  struct Key {
+    int src_width;
+    int src_height;
+    AVPixelFormat src_format;
+    int dst_width;
+    int dst_height;
+    AVPixelFormat dst_format;
+    int flags;
+
+    bool operator==(const Key &other) const {
+      return src_width == other.src_width && src_height == other.src_height && src_format == other.src_format
+        && dst_width == other.dst_width && dst_height == other.dst_height && dst_format == other.dst_format
+        && flags == other.flags;
+    }
+  };
+
+  static struct SwsContext *Acquire(const Key &key);
+  static void Release(const Key &key, struct SwsContext *ctx);
+
+ private:
+  // Idle contexts kept, most recently used first
+  static constexpr size_t max_idle_ = 32;
+
+  static std::mutex mutex_;
+  static std::list<std::pair<Key, struct SwsContext *>> idle_;
+};
+
 /* SWScale wrapper class to make our life easier and reduce code reuse */
 class SWScale {
  public:
@@ -20,10 +56,16 @@ class SWScale {
   int Convert(const Image* img, uint8_t* out_buffer, const size_t out_buffer_size, enum _AVPIXELFORMAT in_pf, enum _AVPIXELFORMAT out_pf, unsigned int width, unsigned int height, int out_alignment);
   int Convert(const uint8_t* in_buffer, const size_t in_buffer_size, uint8_t* out_buffer, const size_t out_buffer_size, enum _AVPIXELFORMAT in_pf, enum _AVPIXELFORMAT out_pf, unsigned int width, unsigned int height, int in_alignment, int out_alignment);
   int Convert(const uint8_t* in_buffer, const size_t in_buffer_size, uint8_t* out_buffer, const size_t out_buffer_size, enum _AVPIXELFORMAT in_pf, enum _AVPIXELFORMAT out_pf, unsigned int width, unsigned int height, unsigned int new_width, unsigned int new_height, int in_alignment, int out_alignment);
+  // Source given as plane pointers, e.g. a window into a larger image
+  int Convert(const uint8_t* const in_data[4], const int in_linesize[4], enum _AVPIXELFORMAT in_pf, unsigned int width, unsigned int height, uint8_t* out_buffer, const size_t out_buffer_size, enum _AVPIXELFORMAT out_pf, unsigned int new_width, unsigned int new_height, int out_alignment);
   static size_t GetBufferSize(enum _AVPIXELFORMAT in_pf, unsigned int width, unsigned int height, int alignment);
 
  protected:
+  // Swaps swscale_ctx for one matching key if it doesn't already
+  struct SwsContext *GetContext(const SwsContextCache::Key &key);
+
   struct SwsContext* swscale_ctx;
+  SwsContextCache::Key swscale_key;
   av_frame_ptr input_avframe;
   av_frame_ptr output_avframe;
 };
@@ -0,0 +1,325 @@
+//
+// ZoneMinder Event Thumbnailer Class Implementation
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "zm_thumbnailer.h"
+
+#include "zm_config.h"
+#include "zm_db.h"
+#include "zm_ffmpeg_input.h"
+#include "zm_image.h"
+#include "zm_logger.h"
+#include "zm_signal.h"
+#include "zm_storage.h"
+#include "zm_utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+namespace {
+
+// Event ids per query when looking events up
+const size_t kLookupBatch = 500;
+
+Microseconds RequestOffset(const ThumbnailEvent &event, const ThumbnailRequest &request) {
+  return request.has_offset ? request.offset : event.max_score_offset;
+}
+
+bool WriteFile(const std::string &filename, const uint8_t *data, size_t size) {
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (!file) {
+    Error("Unable to open %s: %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+  const bool ok = (fwrite(data, size, 1, file) == 1);
+  if (fclose(file) != 0 or !ok) {
+    Error("Unable to write %s: %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+Thumbnailer::Thumbnailer(const Options &options) :
+  options_(options),
+  events_(nullptr),
+  next_(0),
+  written_(0) {
+}
+
+bool Thumbnailer::ParseRequest(const std::string &spec, ThumbnailRequest &request) {
+  const size_t first = spec.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) return false;
+  const size_t last = spec.find_last_not_of(" \t\r\n");
+  const std::string trimmed = spec.substr(first, last - first + 1);
+
+  const size_t at = trimmed.find('@');
+  const std::string id_str = trimmed.substr(0, at);
+  if (id_str.empty() or id_str.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+
+  ThumbnailRequest parsed;
+  parsed.event_id = strtoull(id_str.c_str(), nullptr, 10);
+  if (!parsed.event_id) return false;
+
+  if (at != std::string::npos) {
+    const std::string offset_str = trimmed.substr(at + 1);
+    char *end = nullptr;
+    double seconds = strtod(offset_str.c_str(), &end);
+    if (offset_str.empty() or *end != '\0' or !(seconds >= 0)) return false;
+    parsed.has_offset = true;
+    parsed.offset = std::chrono::duration_cast<Microseconds>(FPSeconds(seconds));
+  }
+
+  request = parsed;
+  return true;
+}
+
+std::string Thumbnailer::FileName(const std::string &name, const ThumbnailRequest &request) {
+  if (!request.has_offset) return name;
+
+  const std::string suffix = stringtf("-%" PRIi64,
+                                      static_cast<int64>(std::chrono::duration_cast<Milliseconds>(request.offset).count()));
+  const size_t dot = name.rfind('.');
+  if (dot == std::string::npos or dot == 0) return name + suffix;
+  return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+void Thumbnailer::ScaledSize(int width, int height, int target_width, int scale, int &out_width, int &out_height) {
+  if (target_width > 0 and width > 0) {
+    out_width = target_width;
+    out_height = static_cast<int>((static_cast<int64_t>(height) * target_width + width / 2) / width);
+  } else {
+    out_width = static_cast<int>(static_cast<int64_t>(width) * scale / 100);
+    out_height = static_cast<int>(static_cast<int64_t>(height) * scale / 100);
+  }
+  out_width = std::max(2, out_width & ~1);
+  out_height = std::max(2, out_height & ~1);
+}
+
+std::vector<ThumbnailEvent> Thumbnailer::LoadEvents(const std::vector<ThumbnailRequest> &requests) {
+  std::map<uint64_t, std::vector<ThumbnailRequest>> wanted;
+  for (const ThumbnailRequest &request : requests)
+    wanted[request.event_id].push_back(request);
+
+  std::vector<uint64_t> ids;
+  ids.reserve(wanted.size());
+  for (const auto &entry : wanted)
+    ids.push_back(entry.first);
+
+  std::map<unsigned int, std::unique_ptr<Storage>> storage_areas;
+  std::vector<ThumbnailEvent> events;
+  events.reserve(ids.size());
+
+  for (size_t start = 0; start < ids.size(); start += kLookupBatch) {
+    std::string id_list;
+    for (size_t i = start; i < std::min(ids.size(), start + kLookupBatch); i++) {
+      if (!id_list.empty()) id_list += ',';
+      id_list += std::to_string(ids[i]);
+    }
+
+    std::string sql = "SELECT `E`.`Id`, `E`.`MonitorId`, `E`.`StorageId`, unix_timestamp(`E`.`StartDateTime`), "
+                      "`E`.`DefaultVideo`, `E`.`Scheme`, `E`.`Orientation`+0, `M`.`VideoWriter`, `F`.`Delta` "
+                      "FROM `Events` AS `E` "
+                      "LEFT JOIN `Monitors` AS `M` ON `M`.`Id` = `E`.`MonitorId` "
+                      "LEFT JOIN `Frames` AS `F` ON `F`.`EventId` = `E`.`Id` AND `F`.`FrameId` = `E`.`MaxScoreFrameId` "
+                      "WHERE `E`.`Id` IN (" + id_list + ")";
+    MYSQL_RES *result = zmDbFetch(sql);
+    if (!result) {
+      Error("Unable to look up events");
+      continue;
+    }
+
+    while (MYSQL_ROW dbrow = mysql_fetch_row(result)) {
+      ThumbnailEvent event;
+      event.event_id = strtoull(dbrow[0], nullptr, 10);
+      unsigned int monitor_id = atoi(dbrow[1]);
+      unsigned int storage_id = dbrow[2] ? atoi(dbrow[2]) : 0;
+      SystemTimePoint start_time = SystemTimePoint(Seconds(dbrow[3] ? atoi(dbrow[3]) : 0));
+      event.video_file = dbrow[4] ? dbrow[4] : "";
+      Storage::Schemes scheme = Storage::SchemeFromString(dbrow[5] ? dbrow[5] : "");
+      // when stored as an mp4, we just have the rotation as a flag in the headers
+      int video_writer = dbrow[7] ? atoi(dbrow[7]) : Monitor::PASSTHROUGH;
+      event.orientation = (dbrow[6] and video_writer == Monitor::PASSTHROUGH) ?
+                          static_cast<Monitor::Orientation>(atoi(dbrow[6])) : Monitor::ROTATE_0;
+      event.max_score_offset = std::chrono::duration_cast<Microseconds>(FPSeconds(dbrow[8] ? atof(dbrow[8]) : 0));
+
+      std::unique_ptr<Storage> &storage = storage_areas[storage_id];
+      if (!storage) storage = std::make_unique<Storage>(storage_id);
+      event.path = Storage::EventPath(storage->Path(), scheme, monitor_id, event.event_id, start_time);
+
+      // In order, so the keyframe seeks only go forwards
+      event.requests = std::move(wanted[event.event_id]);
+      std::stable_sort(event.requests.begin(), event.requests.end(),
+      [&event](const ThumbnailRequest &a, const ThumbnailRequest &b) {
+        return RequestOffset(event, a) < RequestOffset(event, b);
+      });
+      wanted.erase(event.event_id);
+      events.push_back(std::move(event));
+    }
+    mysql_free_result(result);
+  }
+
+  for (const auto &entry : wanted)
+    Warning("Event %" PRIu64 " not found", entry.first);
+  return events;
+}
+
+unsigned int Thumbnailer::Run(const std::vector<ThumbnailEvent> &events) {
+  events_ = &events;
+  next_ = 0;
+  written_ = 0;
+
+  const size_t thread_count = std::min<size_t>(std::max(1u, options_.jobs), events.size());
+  Debug(1, "Writing thumbnails for %zu events with %zu threads", events.size(), thread_count);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; i++)
+    threads.emplace_back(&Thumbnailer::Work, this);
+  for (std::thread &thread : threads)
+    thread.join();
+
+  events_ = nullptr;
+  return written_;
+}
+
+void Thumbnailer::Work() {
+  // Image::Assign(frame) converts with a context shared by the whole process,
+  // so each thread keeps its own.
+  SwsContext *convert_context = nullptr;
+  std::vector<uint8_t> jpeg;
+  while (!zm_terminate) {
+    const size_t index = next_++;
+    if (index >= events_->size()) break;
+    written_ += Generate((*events_)[index], convert_context, jpeg);
+  }
+  sws_freeContext(convert_context);
+}
+
+unsigned int Thumbnailer::Generate(const ThumbnailEvent &event, SwsContext *&convert_context,
+                                   std::vector<uint8_t> &jpeg) {
+  if (event.video_file.empty()) {
+    Warning("Event %" PRIu64 " has no video to make thumbnails from", event.event_id);
+    return 0;
+  }
+
+  std::vector<std::string> filenames;
+  filenames.reserve(event.requests.size());
+  bool any_wanted = false;
+  for (const ThumbnailRequest &request : event.requests) {
+    filenames.push_back(event.path + "/" + FileName(options_.name, request));
+    if (options_.overwrite or access(filenames.back().c_str(), F_OK) != 0)
+      any_wanted = true;
+  }
+  if (!any_wanted) {
+    Debug(1, "Thumbnails of event %" PRIu64 " already exist", event.event_id);
+    return 0;
+  }
+
+  const std::string video_path = event.path + "/" + event.video_file;
+  FFmpeg_Input input;
+  if (input.Open(video_path.c_str()) < 0 or input.get_video_stream_id() < 0) {
+    Warning("Unable to open %s for event %" PRIu64, video_path.c_str(), event.event_id);
+    return 0;
+  }
+  const int stream_id = input.get_video_stream_id();
+
+  unsigned int written = 0;
+  std::unique_ptr<Image> image;
+  int64_t image_pts = AV_NOPTS_VALUE;
+  for (size_t i = 0; i < event.requests.size(); i++) {
+    if (!options_.overwrite and access(filenames[i].c_str(), F_OK) == 0)
+      continue;
+
+    // The highest scoring frame is the one the snapshot is meant to show, so
+    // is decoded up to exactly. Anything else makes do with a keyframe.
+    input.set_keyframes_only(event.requests[i].has_offset);
+    const Microseconds offset = RequestOffset(event, event.requests[i]);
+    AVFrame *frame = input.get_frame(stream_id, FPSeconds(offset).count());
+    if (!frame) {
+      Warning("No frame at %.3fs in %s", FPSeconds(offset).count(), video_path.c_str());
+      continue;
+    }
+
+    // Offsets that land on the same keyframe share its image
+    if (!image or frame->pts != image_pts) {
+      int width, height;
+      ScaledSize(frame->width, frame->height, options_.width, options_.scale, width, height);
+
+      const AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+      convert_context = sws_getCachedContext(
+                          convert_context,
+                          frame->width, frame->height, fix_deprecated_pix_fmt(format),
+                          width, height, AV_PIX_FMT_RGBA,
+                          SWS_BICUBIC,
+                          nullptr, nullptr, nullptr);
+      if (!convert_context) {
+        Error("Unable to create conversion context for %s", video_path.c_str());
+        return written;
+      }
+      zm_sws_set_input_range(convert_context, format);
+
+      image = std::make_unique<Image>(width, height, ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA);
+      if (!image->Assign(frame, convert_context)) {
+        image.reset();
+        continue;
+      }
+      image_pts = frame->pts;
+
+      switch (event.orientation) {
+      case Monitor::ROTATE_0 :
+        break;
+      case Monitor::ROTATE_90 :
+      case Monitor::ROTATE_180 :
+      case Monitor::ROTATE_270 :
+        image->Rotate((event.orientation-1)*90);
+        break;
+      case Monitor::FLIP_HORI :
+      case Monitor::FLIP_VERT :
+        image->Flip(event.orientation==Monitor::FLIP_HORI);
+        break;
+      default:
+        Error("Invalid Orientation: %d", event.orientation);
+      }
+    }
+
+    // Each thread has a compressor of its own, rather than queueing for
+    // the one WriteJpeg shares
+    if (jpeg.size() < image->Size())
+      jpeg.resize(image->Size());
+    size_t jpeg_size = 0;
+    if (!image->EncodeJpegThreadLocal(jpeg.data(), &jpeg_size, config.jpeg_file_quality)) {
+      Error("Unable to encode %s", filenames[i].c_str());
+      continue;
+    }
+    if (WriteFile(filenames[i], jpeg.data(), jpeg_size)) {
+      Debug(1, "Wrote %s", filenames[i].c_str());
+      written++;
+    }
+  }
+  return written;
+}
@@ -0,0 +1,96 @@
+//
+// ZoneMinder Event Thumbnailer Class Interfaces
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#ifndef ZM_THUMBNAILER_H
+#define ZM_THUMBNAILER_H
+
+#include "zm_monitor.h"
+#include "zm_time.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct SwsContext;
+
+// One image wanted from an event, written as "<event_id>" or
+// "<event_id>@<seconds into the event>"
+struct ThumbnailRequest {
+  uint64_t event_id;
+  bool has_offset;     // Otherwise the event's highest scoring frame
+  Microseconds offset;
+
+  ThumbnailRequest() : event_id(0), has_offset(false), offset(0) {}
+};
+
+// Everything needed to write the thumbnails of one event, looked up from
+// the database before any decoding starts
+struct ThumbnailEvent {
+  uint64_t event_id;
+  std::string path;
+  std::string video_file;
+  Monitor::Orientation orientation;  // Applied to the decoded frames
+  Microseconds max_score_offset;
+  std::vector<ThumbnailRequest> requests;
+};
+
+// Writes jpegs of events from their videos, a whole list of them at a time,
+// spread over a number of threads.  Each event's video is opened once.  The
+// highest scoring frame is decoded exactly, but for other offsets only the
+// nearest keyframe at or before each is, so a thumbnail costs a seek and the
+// decode of a single frame.  Each thread scales with its own cached swscale
+// context and encodes with its own jpeg compressor.
+class Thumbnailer {
+ public:
+  struct Options {
+    std::string name;  // File name to write in the event directory
+    int width;         // Width to scale to, 0 to use scale instead
+    int scale;         // Percentage of the video's size
+    bool overwrite;
+    unsigned int jobs;
+
+    Options() : name("snapshot.jpg"), width(0), scale(100), overwrite(true), jobs(1) {}
+  };
+
+  explicit Thumbnailer(const Options &options);
+
+  // Looks up the events the requests refer to, grouping the requests by
+  // event.  Events that can't be found are logged and dropped.
+  static std::vector<ThumbnailEvent> LoadEvents(const std::vector<ThumbnailRequest> &requests);
+  // Writes the thumbnails of every event, returning how many were written
+  unsigned int Run(const std::vector<ThumbnailEvent> &events);
+
+  static bool ParseRequest(const std::string &spec, ThumbnailRequest &request);
+  // name for the event's highest scoring frame, otherwise name with the
+  // offset in milliseconds added before its extension
+  static std::string FileName(const std::string &name, const ThumbnailRequest &request);
+  // The size to scale a width x height frame to.  Both come out even, as
+  // the jpeg encoder and most scalers prefer.
+  static void ScaledSize(int width, int height, int target_width, int scale, int &out_width, int &out_height);
+
+ private:
+  void Work();
+  unsigned int Generate(const ThumbnailEvent &event, SwsContext *&convert_context, std::vector<uint8_t> &jpeg);
+
+  Options options_;
+  const std::vector<ThumbnailEvent> *events_;
+  std::atomic<size_t> next_;
+  std::atomic<unsigned int> written_;
+};
+
+#endif // ZM_THUMBNAILER_H
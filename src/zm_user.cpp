@@ -23,8 +23,20 @@
 #include "zm_logger.h"
 #include "zm_time.h"
 #include "zm_utils.h"
+#include <cctype>
+#include <cinttypes>
 #include <cstring>
 
+namespace {
+
+// How long an auth hash is good for. PHP's authHashTtl() follows the same
+// rule, so that both sides agree on which hashes have expired.
+Hours AuthHashTtl() {
+  return Hours(config.auth_hash_ttl ? config.auth_hash_ttl : 2);
+}
+
+}  // namespace
+
 User::User() : id(0), enabled(false), role_id(0) {
   username[0] = password[0] = 0;
   stream = events = control = monitors = system = PERM_NONE;
@@ -272,23 +284,61 @@ User *User::find(int id) {
 }
 
 std::string User::getAuthHash() {
+  int64_t hour = std::chrono::duration_cast<Hours>(std::chrono::system_clock::now().time_since_epoch()).count();
+  return zmAuthHashToken(*this, (config.auth_hash_ips ? "127.0.0.1" : ""), hour);
+}
+
+std::string zmAuthHashToken(const User &user, const std::string &remote_addr, int64_t issue_hour) {
+  std::string prefix = stringtf("%d.%" PRId64, user.Id(), issue_hour);
+  std::string message = stringtf("%s.%s.%s.%s",
+                                 prefix.c_str(), user.getUsername(), user.getPassword(), remote_addr.c_str());
+  zm::crypto::SHA1::Digest hmac = zm::crypto::HmacSHA1(config.auth_hash_secret, message);
+  return prefix + "." + ByteArrayToHexString(hmac);
+}
+
+bool zmParseAuthHashToken(const std::string &auth, int &user_id, int64_t &issue_hour) {
+  const size_t first_dot = auth.find('.');
+  const size_t second_dot = (first_dot == std::string::npos) ? first_dot : auth.find('.', first_dot + 1);
+  if (second_dot == std::string::npos
+      or first_dot == 0 or first_dot > 9
+      or second_dot == first_dot + 1 or second_dot - first_dot > 12
+      or auth.size() - second_dot - 1 != 2 * zm::crypto::SHA1::DIGEST_LENGTH) {
+    return false;
+  }
+  for (size_t i = 0; i < auth.size(); i++) {
+    if (i == first_dot or i == second_dot) continue;
+    const char c = auth[i];
+    if (!(isdigit(c) or (i > second_dot and c >= 'a' and c <= 'f')))
+      return false;
+  }
+
+  user_id = atoi(auth.c_str());
+  issue_hour = strtoll(auth.c_str() + first_dot + 1, nullptr, 10);
+  return true;
+}
+
+static User *zmLoadAuthHashTokenUser(const std::string &auth, int user_id, int64_t issue_hour,
+                                     const std::string &remote_addr) {
   SystemTimePoint now = std::chrono::system_clock::now();
-  time_t now_t = std::chrono::system_clock::to_time_t(now);
-  tm now_tm = {};
-  localtime_r(&now_t, &now_tm);
-  std::string auth_key = stringtf("%s%s%s%s%d%d%d%d",
-      config.auth_hash_secret,
-      username,
-      password,
-      (config.auth_hash_ips ? "127.0.0.1" : ""),
-      now_tm.tm_hour,
-      now_tm.tm_mday,
-      now_tm.tm_mon,
-      now_tm.tm_year);
-  Debug(1, "Creating auth_key '%s'", auth_key.c_str());
-
-  zm::crypto::MD5::Digest md5_digest = zm::crypto::MD5::GetDigestOf(auth_key);
-  return ByteArrayToHexString(md5_digest);
+  int64_t now_hour = std::chrono::duration_cast<Hours>(now.time_since_epoch()).count();
+  const int64_t ttl = AuthHashTtl().count();
+  if (issue_hour > now_hour or issue_hour <= now_hour - ttl) {
+    Debug(1, "Auth hash for user %d from hour %" PRId64 " is outside the %" PRId64 " h TTL", user_id, issue_hour, ttl);
+    return nullptr;
+  }
+
+  User *user = User::find(user_id);
+  if (!user) {
+    Warning("Unable to authenticate user %d from auth hash, no such enabled user", user_id);
+    return nullptr;
+  }
+  if (!zm::crypto::ConstantTimeEquals(auth, zmAuthHashToken(*user, remote_addr, issue_hour))) {
+    Warning("Unable to authenticate user '%s', auth hash doesn't match", user->getUsername());
+    delete user;
+    return nullptr;
+  }
+  Debug(1, "Authenticated user '%s' from auth hash", user->getUsername());
+  return user;
 }
 
 // Function to load a user from username and password
@@ -400,8 +450,21 @@ User *zmLoadAuthUser(const std::string &auth, const std::string &username, bool
     }
   }
 
+  return zmLoadAuthUserFrom(auth, username, remote_addr);
+}  // end User *zmLoadAuthUser( const std::string &auth, const std::string &username, bool use_remote_addr )
+
+// As above, for callers that aren't CGIs and know the client's address themselves
+User *zmLoadAuthUserFrom(const std::string &auth, const std::string &username, const std::string &remote_addr_str) {
+  const char *remote_addr = remote_addr_str.c_str();
   Debug(1, "Attempting to authenticate user %s from auth string '%s', remote addr(%s)",
         username.c_str(), auth.c_str(), remote_addr);
+
+  int token_user_id;
+  int64_t token_issue_hour;
+  if (zmParseAuthHashToken(auth, token_user_id, token_issue_hour))
+    return zmLoadAuthHashTokenUser(auth, token_user_id, token_issue_hour, remote_addr);
+
+  // Legacy MD5 auth hash, which could be from any user and any hour in the TTL
   std::string sql = "SELECT `Id`, `Username`, `Password`, `Enabled`,"
                     " `Stream`+0, `Events`+0, `Control`+0, `Monitors`+0, `System`+0,"
                     " COALESCE(`RoleId`, 0)"
@@ -422,11 +485,10 @@ User *zmLoadAuthUser(const std::string &auth, const std::string &username, bool
   }
 
   SystemTimePoint now = std::chrono::system_clock::now();
-  Hours hours = Hours(config.auth_hash_ttl);
+  const Hours hours = AuthHashTtl();
 
-  if (hours == Hours(0)) {
+  if (!config.auth_hash_ttl) {
     Warning("No value set for ZM_AUTH_HASH_TTL. Defaulting to 2.");
-    hours = Hours(2);
   } else {
     Debug(1, "AUTH_HASH_TTL is %" PRIi64 " h, time is %" PRIi64 " s",
           static_cast<int64>(Hours(hours).count()),
@@ -473,7 +535,7 @@ User *zmLoadAuthUser(const std::string &auth, const std::string &username, bool
 
   Debug(1, "No user found for auth_key %s", auth.c_str());
   return nullptr;
-}  // end User *zmLoadAuthUser( const std::string &auth, const std::string &username, bool use_remote_addr )
+}  // end User *zmLoadAuthUserFrom( const std::string &auth, const std::string &username, const std::string &remote_addr )
 
 // Function to check Username length
 bool checkUser(const std::string &username) {
@@ -90,8 +90,21 @@ class User {
   void loadRoleGroupPermissions();
 };
 
+// Auth hashes are "<user id>.<issue hour>.<hex HMAC-SHA1>", where the hour is
+// counted from the epoch and the HMAC, keyed with ZM_AUTH_HASH_SECRET, covers
+// the id, hour, username, password hash and remote address.  Checking one is
+// a single HMAC, unlike the legacy MD5 hashes which have to be tried against
+// every user for every hour of ZM_AUTH_HASH_TTL.  Nothing is cached here:
+// each zms checks one hash and exits, and zmsd keeps its own cache of
+// answers, so a cache in this process would only hold a second copy.
+std::string zmAuthHashToken(const User &user, const std::string &remote_addr, int64_t issue_hour);
+bool zmParseAuthHashToken(const std::string &auth, int &user_id, int64_t &issue_hour);
+
 User *zmLoadUser(const std::string&username, const std::string &password="");
 User *zmLoadAuthUser(const std::string &auth, const std::string &user, bool use_remote_addr);
+// Named apart from zmLoadAuthUser so that a literal address can't quietly
+// pick the bool overload
+User *zmLoadAuthUserFrom(const std::string &auth, const std::string &user, const std::string &remote_addr);
 User *zmLoadTokenUser(const std::string &jwt, bool use_remote_addr);
 bool checkUser(const std::string &username);
 bool checkPass(const std::string &password);
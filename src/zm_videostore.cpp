@@ -24,13 +24,18 @@
 #include "zm_monitor.h"
 #include "zm_signal.h"
 #include "zm_time.h"
+#include "zm_utils.h"
 
 extern "C" {
 #include <libavutil/time.h>
 #include <libavutil/display.h>
 }
 
+#include <algorithm>
 #include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 VideoStore::VideoStore(
   const char *filename_in,
@@ -77,7 +82,16 @@ VideoStore::VideoStore(
   last_fragment_offset_(0),
   last_fragment_start_dts_(AV_NOPTS_VALUE),
   init_segment_end_(0),
-  finalized_(false) {
+  finalized_(false),
+  part_duration_(0),
+  last_part_offset_(0),
+  last_part_start_dts_(AV_NOPTS_VALUE),
+  part_independent_(false),
+  m3u8_segment_count_(0),
+  m3u8_max_duration_(0),
+  muxer_opts_(nullptr),
+  segment_start_(AV_NOPTS_VALUE),
+  rebase_segment_(false) {
   FFMPEGInit();
   swscale.init();
   opkt = av_packet_ptr{av_packet_alloc()};
@@ -545,7 +559,10 @@ bool VideoStore::open() {
 
   /* open the out file, if needed */
   if (!(out_format->flags & AVFMT_NOFILE)) {
-    ret = avio_open2(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE, nullptr, nullptr);
+    AVDictionary *avio_opts = nullptr;
+    if (preallocate(filename)) av_dict_set(&avio_opts, "truncate", "0", 0);
+    ret = avio_open2(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE, nullptr, &avio_opts);
+    av_dict_free(&avio_opts);
     if (ret < 0) {
       Error("Could not open out file '%s': %s", filename.c_str(), av_make_error_string(ret).c_str());
       return false;
@@ -572,6 +589,8 @@ bool VideoStore::open() {
               "monitor's encoder options to avoid trailer-write failures.");
     }
   }
+  // Kept for the header of every segment file after this one
+  av_dict_copy(&muxer_opts_, opts, 0);
   if ((ret = avformat_write_header(oc, &opts)) < 0) {
     // we crash if we try again
     if (ENOSPC != ret) {
@@ -608,7 +627,19 @@ bool VideoStore::open() {
   if (oc->pb) {
     init_segment_end_ = avio_tell(oc->pb);
     last_fragment_offset_ = init_segment_end_;
+    last_part_offset_ = init_segment_end_;
     Debug(1, "Init segment ends at byte %" PRId64, init_segment_end_);
+
+    // LL-HLS parts need the muxer to accept a flush request mid-fragment.
+    if (config.hls_part_duration > 0) {
+      if (oc->oformat->flags & AVFMT_ALLOW_FLUSH) {
+        part_duration_ = static_cast<double>(config.hls_part_duration) / 1000;
+        Debug(1, "LL-HLS parts enabled, target part duration %.3f", part_duration_);
+      } else {
+        Warning("LL-HLS parts requested but format %s does not support flushing fragments",
+                oc->oformat->name);
+      }
+    }
   }
   return true;
 } // end bool VideoStore::open()
@@ -788,6 +819,7 @@ VideoStore::~VideoStore() {
   Debug(4, "free context");
   /* free the streams */
   avformat_free_context(oc);
+  av_dict_free(&muxer_opts_);
   delete[] next_dts;
   next_dts = nullptr;
 } // VideoStore::~VideoStore()
@@ -1566,6 +1598,36 @@ int VideoStore::write_packet(AVPacket *pkt, AVStream *stream) {
   // Snapshot the keyframe's dts before the write call may modify the packet.
   int64_t this_keyframe_dts = is_video_keyframe ? pkt->dts : AV_NOPTS_VALUE;
 
+  // LL-HLS: close the current part before this packet if including it would
+  // take the part past its target duration. Keyframes are skipped because
+  // frag_keyframe already makes the muxer flush on them.
+  if (part_duration_ > 0 && stream == video_out_stream && !is_video_keyframe
+      && last_part_start_dts_ != AV_NOPTS_VALUE && pkt->dts > last_part_start_dts_
+      && oc && oc->pb) {
+    int64_t part_ticks = pkt->dts - last_part_start_dts_ + (pkt->duration > 0 ? pkt->duration : 0);
+    double part_seconds = static_cast<double>(part_ticks) * stream->time_base.num / stream->time_base.den;
+    if (part_seconds > part_duration_) {
+      // Drain the interleaving queue so every packet belonging to this part is
+      // handed to the muxer, then ask the muxer to write out its fragment.
+      av_interleaved_write_frame(oc, nullptr);
+      av_write_frame(oc, nullptr);
+      avio_flush(oc->pb);
+      record_part(avio_tell(oc->pb), pkt->dts, false);
+      part_independent_ = false;
+    }
+  }
+
+  // Files after the first start from zero. Everything above works on the
+  // timeline carried over from the previous file, so the shift only applies
+  // to what the muxer sees.
+  if (rebase_segment_) {
+    if (segment_start_ == AV_NOPTS_VALUE)
+      segment_start_ = av_rescale_q(pkt->dts, stream->time_base, AV_TIME_BASE_Q);
+    int64_t offset = av_rescale_q(segment_start_, AV_TIME_BASE_Q, stream->time_base);
+    pkt->dts = std::max(pkt->dts - offset, static_cast<int64_t>(0));
+    pkt->pts = std::max(pkt->pts - offset, pkt->dts);
+  }
+
   int ret = av_interleaved_write_frame(oc, pkt);
   if (ret != 0) {
     Error("Error writing packet: %s", av_make_error_string(ret).c_str());
@@ -1596,6 +1658,12 @@ int VideoStore::write_packet(AVPacket *pkt, AVStream *stream) {
               fragments_.size() - 1, last_fragment_offset_, frag_size, duration);
       }
     }
+    if (part_duration_ > 0) {
+      // The flushed fragment also ends the last part of that segment.
+      record_part(pos_after, this_keyframe_dts, true);
+      part_independent_ = true;
+    }
+
     last_fragment_offset_ = pos_after;
     last_fragment_start_dts_ = this_keyframe_dts;
   }
@@ -1603,15 +1671,7 @@ int VideoStore::write_packet(AVPacket *pkt, AVStream *stream) {
   return ret;
 }  // end int VideoStore::write_packet(AVPacket *pkt, AVStream *stream)
 
-void VideoStore::finalize() {
-  if (finalized_) return;
-  finalized_ = true;
-
-  if (!oc || !oc->pb) return;
-
-  // Drain reorder queues before writing the trailer — the destructor would
-  // otherwise try to run these packets through av_interleaved_write_frame()
-  // after we've already closed oc->pb here.
+void VideoStore::drain_reorder_queues() {
   for (auto &n : reorder_queues) {
     auto &queue = n.second;
     Debug(1, "Queue for %d length is %zu", n.first, queue.size());
@@ -1625,9 +1685,26 @@ void VideoStore::finalize() {
       }
     }
   }
+}
+
+void VideoStore::finalize() {
+  if (finalized_) return;
+  finalized_ = true;
+
+  if (!oc || !oc->pb) return;
+
+  // Drain reorder queues before writing the trailer — the destructor would
+  // otherwise try to run these packets through av_interleaved_write_frame()
+  // after we've already closed oc->pb here.
+  drain_reorder_queues();
 
   flush_codecs();
 
+  // Record the final fragment that no subsequent keyframe was around to record.
+  record_last_fragment(close_file());
+}
+
+int64_t VideoStore::close_file() {
   Debug(4, "Flushing interleaved queues");
   av_interleaved_write_frame(oc, nullptr);
 
@@ -1686,13 +1763,17 @@ void VideoStore::finalize() {
     }
   }
 
-  // Record the final fragment that no subsequent keyframe was around to record.
+  release_preallocation();
+  return fragment_n_end;
+}
+
+void VideoStore::record_last_fragment(int64_t end_offset) {
   if (last_fragment_start_dts_ != AV_NOPTS_VALUE
-      && fragment_n_end > last_fragment_offset_
+      && end_offset > last_fragment_offset_
       && video_out_stream && video_out_stream->time_base.den > 0
       && last_dts.count(video_out_stream->index)
       && last_dts[video_out_stream->index] != AV_NOPTS_VALUE) {
-    int64_t frag_size = fragment_n_end - last_fragment_offset_;
+    int64_t frag_size = end_offset - last_fragment_offset_;
     double duration = static_cast<double>(
         last_dts[video_out_stream->index]
         + last_duration[video_out_stream->index]
@@ -1704,45 +1785,254 @@ void VideoStore::finalize() {
       Debug(1, "HLS final fragment: offset=%" PRId64 " size=%" PRId64 " duration=%.3f",
             last_fragment_offset_, frag_size, duration);
     }
+    if (part_duration_ > 0) {
+      record_part(end_offset,
+          last_dts[video_out_stream->index] + last_duration[video_out_stream->index], true);
+    }
   }
 }
 
-void VideoStore::writeM3U8(const std::string &m3u8_path, const std::string &video_url, bool is_complete) {
-  if (fragments_.empty()) return;
+void VideoStore::record_part(int64_t end_offset, int64_t end_dts, bool closes_segment) {
+  if (last_part_start_dts_ != AV_NOPTS_VALUE && end_offset > last_part_offset_
+      && video_out_stream->time_base.den > 0) {
+    double duration = static_cast<double>(end_dts - last_part_start_dts_)
+                      * video_out_stream->time_base.num
+                      / video_out_stream->time_base.den;
+    if (duration > 0) {
+      // The in-progress segment is only pushed onto fragments_ once it is
+      // complete, which has already happened when this part closes it.
+      size_t segment = fragments_.size();
+      if (closes_segment && segment) segment--;
+      parts_.push_back({last_part_offset_, end_offset - last_part_offset_, duration, segment, part_independent_});
+      Debug(2, "LL-HLS part %zu of segment %zu: offset=%" PRId64 " size=%" PRId64 " duration=%.3f",
+            parts_.size() - 1, segment, last_part_offset_, end_offset - last_part_offset_, duration);
+    }
+  }
+  last_part_offset_ = end_offset;
+  last_part_start_dts_ = end_dts;
+}
 
-  // Calculate max duration for EXT-X-TARGETDURATION (must be integer, rounded up)
-  double max_duration = 0;
-  for (const auto &frag : fragments_) {
-    if (frag.duration > max_duration) max_duration = frag.duration;
+bool VideoStore::preallocate(const std::string &path) const {
+  if (config.event_segment_size <= 0) return false;
+#ifdef __linux__
+  int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    Warning("Can't open %s to preallocate: %s", path.c_str(), strerror(errno));
+    return false;
   }
-  int target_duration = static_cast<int>(ceil(max_duration));
-  if (target_duration < 1) target_duration = 1;
+  // KEEP_SIZE reserves the extents without changing the file length, so a
+  // reader of the incomplete file only ever sees what has been written.
+  off_t bytes = static_cast<off_t>(config.event_segment_size) * 1024 * 1024;
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, bytes) != 0) {
+    Debug(1, "Can't preallocate %" PRId64 " bytes for %s: %s",
+          static_cast<int64>(bytes), path.c_str(), strerror(errno));
+  }
+  ::close(fd);
+  return true;
+#else
+  return false;
+#endif
+}
 
-  FILE *fp = fopen(m3u8_path.c_str(), "w");
-  if (!fp) {
-    Error("Failed to open %s for writing: %s", m3u8_path.c_str(), strerror(errno));
-    return;
+void VideoStore::release_preallocation() const {
+  if (config.event_segment_size <= 0 or filename.empty()) return;
+#ifdef __linux__
+  int fd = ::open(filename.c_str(), O_WRONLY);
+  if (fd < 0) return;
+  // Whatever preallocate() reserved past the end of what got written would
+  // otherwise stay allocated to the file for as long as it exists.
+  struct stat st;
+  off_t bytes = static_cast<off_t>(config.event_segment_size) * 1024 * 1024;
+  if (fstat(fd, &st) == 0 and st.st_size < bytes) {
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, st.st_size, bytes - st.st_size) != 0
+        and ftruncate(fd, st.st_size) != 0) {
+      Debug(1, "Can't release preallocated space of %s: %s", filename.c_str(), strerror(errno));
+    }
   }
+  ::close(fd);
+#endif
+}
+
+bool VideoStore::closeSegment() {
+  if (!oc || !oc->pb || finalized_) return false;
+
+  drain_reorder_queues();
+  // The codecs keep running into the next file, so only the muxer is flushed.
+  // Each file gets its own trailer and so its own mfra.
+  record_last_fragment(close_file());
+  Debug(1, "Closed segment %s with %zu fragments", filename.c_str(), fragments_.size());
+  return true;
+}
+
+bool VideoStore::openSegment(const std::string &new_filename) {
+  if (!oc || oc->pb || finalized_) return false;
+
+  // A new muxer for each file, so that its timestamps, fragment numbers and
+  // mfra start over instead of carrying on from the previous file.
+  AVFormatContext *new_oc = nullptr;
+  int ret = avformat_alloc_output_context2(&new_oc, out_format, nullptr, new_filename.c_str());
+  if (ret < 0) {
+    Error("Could not create output context for %s: %s", new_filename.c_str(), av_make_error_string(ret).c_str());
+    return false;
+  }
+  av_dict_copy(&new_oc->metadata, oc->metadata, 0);
+  for (unsigned int i = 0; i < oc->nb_streams; i++) {
+    AVStream *stream = avformat_new_stream(new_oc, nullptr);
+    if (!stream or avcodec_parameters_copy(stream->codecpar, oc->streams[i]->codecpar) < 0) {
+      Error("Could not copy stream %u for %s", i, new_filename.c_str());
+      avformat_free_context(new_oc);
+      return false;
+    }
+    stream->time_base = oc->streams[i]->time_base;
+    av_dict_copy(&stream->metadata, oc->streams[i]->metadata, 0);
+#if !LIBAVCODEC_VERSION_CHECK(60, 31, 102, 31, 102)
+    // The display matrix lives on the stream rather than codecpar here
+    for (int j = 0; j < oc->streams[i]->nb_side_data; j++) {
+      const AVPacketSideData &side_data = oc->streams[i]->side_data[j];
+      uint8_t *data = av_stream_new_side_data(stream, side_data.type, side_data.size);
+      if (data) memcpy(data, side_data.data, side_data.size);
+    }
+#endif
+  }
+
+  if (!(out_format->flags & AVFMT_NOFILE)) {
+    AVDictionary *avio_opts = nullptr;
+    if (preallocate(new_filename)) {
+      // Don't let the file protocol truncate away the extents we just reserved
+      av_dict_set(&avio_opts, "truncate", "0", 0);
+    }
+    ret = avio_open2(&new_oc->pb, new_filename.c_str(), AVIO_FLAG_WRITE, nullptr, &avio_opts);
+    av_dict_free(&avio_opts);
+    if (ret < 0) {
+      Error("Could not open out file '%s': %s", new_filename.c_str(), av_make_error_string(ret).c_str());
+      avformat_free_context(new_oc);
+      return false;
+    }
+  }
+
+  AVDictionary *opts = nullptr;
+  av_dict_copy(&opts, muxer_opts_, 0);
+  ret = avformat_write_header(new_oc, &opts);
+  av_dict_free(&opts);
+  if (ret < 0) {
+    Error("Error occurred when writing out file header to %s: %s",
+          new_filename.c_str(), av_make_error_string(ret).c_str());
+    avio_closep(&new_oc->pb);
+    avformat_free_context(new_oc);
+    return false;
+  }
+
+  int video_index = video_out_stream ? video_out_stream->index : -1;
+  int audio_index = audio_out_stream ? audio_out_stream->index : -1;
+  avformat_free_context(oc);
+  oc = new_oc;
+  if (video_index >= 0) video_out_stream = oc->streams[video_index];
+  if (audio_index >= 0) audio_out_stream = oc->streams[audio_index];
+  set_filename(new_filename);
+  segment_start_ = AV_NOPTS_VALUE;
+  rebase_segment_ = true;
+
+  init_segment_end_ = avio_tell(oc->pb);
+  fragments_.clear();
+  parts_.clear();
+  last_fragment_offset_ = last_part_offset_ = init_segment_end_;
+  last_fragment_start_dts_ = last_part_start_dts_ = AV_NOPTS_VALUE;
+  m3u8_url_.clear();
+  m3u8_segments_.clear();
+  m3u8_segment_count_ = 0;
+  m3u8_max_duration_ = 0;
+  Debug(1, "Opened segment %s", new_filename.c_str());
+  return true;
+}
+
+int64_t VideoStore::bytes_written() const {
+  return (oc && oc->pb) ? avio_tell(oc->pb) : 0;
+}
+
+void VideoStore::writeM3U8(const std::string &m3u8_path, const std::string &video_url, bool is_complete) {
+  // Segments close to the live edge also carry their parts so a low latency
+  // client can start mid-segment.
+  static constexpr size_t part_segments = 3;
+  bool with_parts = (part_duration_ > 0) && !is_complete;
+  if (fragments_.empty() && !(with_parts && !parts_.empty())) return;
+  size_t plain_count = fragments_.size();
+  if (with_parts) plain_count = (plain_count > part_segments) ? plain_count - part_segments : 0;
+
+  // Completed segments never change, so only the ones we haven't seen yet get
+  // rendered. A new url (e.g. the file was renamed) invalidates the lot.
+  if (video_url != m3u8_url_ || plain_count < m3u8_segment_count_) {
+    m3u8_url_ = video_url;
+    m3u8_segments_.clear();
+    m3u8_segment_count_ = 0;
+  }
+  for (; m3u8_segment_count_ < plain_count; m3u8_segment_count_++) {
+    const Fragment &frag = fragments_[m3u8_segment_count_];
+    m3u8_segments_ += stringtf("#EXTINF:%.3f,\n#EXT-X-BYTERANGE:%" PRId64 "@%" PRId64 "\n%s\n",
+                               frag.duration, frag.size, frag.offset, video_url.c_str());
+    if (frag.duration > m3u8_max_duration_) m3u8_max_duration_ = frag.duration;
+  }
+  // EXT-X-TARGETDURATION must be an integer, rounded up
+  for (size_t i = plain_count; i < fragments_.size(); i++) {
+    if (fragments_[i].duration > m3u8_max_duration_) m3u8_max_duration_ = fragments_[i].duration;
+  }
+  int target_duration = static_cast<int>(ceil(m3u8_max_duration_));
+  if (target_duration < 1) target_duration = 1;
 
-  fprintf(fp, "#EXTM3U\n");
-  fprintf(fp, "#EXT-X-VERSION:7\n");
-  fprintf(fp, "#EXT-X-TARGETDURATION:%d\n", target_duration);
-  fprintf(fp, "#EXT-X-MEDIA-SEQUENCE:0\n");
-  fprintf(fp, "#EXT-X-PLAYLIST-TYPE:%s\n", is_complete ? "VOD" : "EVENT");
-  fprintf(fp, "#EXT-X-MAP:URI=\"%s\",BYTERANGE=\"%" PRId64 "@0\"\n",
-          video_url.c_str(), init_segment_end_);
-
-  for (const auto &frag : fragments_) {
-    fprintf(fp, "#EXTINF:%.3f,\n", frag.duration);
-    fprintf(fp, "#EXT-X-BYTERANGE:%" PRId64 "@%" PRId64 "\n", frag.size, frag.offset);
-    fprintf(fp, "%s\n", video_url.c_str());
+  std::string content = "#EXTM3U\n#EXT-X-VERSION:7\n";
+  content += stringtf("#EXT-X-TARGETDURATION:%d\n", target_duration);
+  if (with_parts) {
+    content += stringtf("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n", 3 * part_duration_);
+    content += stringtf("#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_duration_);
+  }
+  content += "#EXT-X-MEDIA-SEQUENCE:0\n";
+  content += stringtf("#EXT-X-PLAYLIST-TYPE:%s\n", is_complete ? "VOD" : "EVENT");
+  content += stringtf("#EXT-X-MAP:URI=\"%s\",BYTERANGE=\"%" PRId64 "@0\"\n",
+                      video_url.c_str(), init_segment_end_);
+  content += m3u8_segments_;
+
+  if (with_parts) {
+    // parts_ is ordered by segment, so walk back to the first part we need.
+    size_t first_part = parts_.size();
+    while (first_part > 0 && parts_[first_part - 1].segment >= plain_count) first_part--;
+
+    for (size_t segment = plain_count; segment <= fragments_.size(); segment++) {
+      for (; first_part < parts_.size() && parts_[first_part].segment == segment; first_part++) {
+        const Part &part = parts_[first_part];
+        content += stringtf("#EXT-X-PART:DURATION=%.3f,URI=\"%s\",BYTERANGE=\"%" PRId64 "@%" PRId64 "\"%s\n",
+                            part.duration, video_url.c_str(), part.size, part.offset,
+                            part.independent ? ",INDEPENDENT=YES" : "");
+      }
+      // The in-progress segment (index fragments_.size()) only has parts.
+      if (segment < fragments_.size()) {
+        const Fragment &frag = fragments_[segment];
+        content += stringtf("#EXTINF:%.3f,\n#EXT-X-BYTERANGE:%" PRId64 "@%" PRId64 "\n%s\n",
+                            frag.duration, frag.size, frag.offset, video_url.c_str());
+      }
+    }
   }
 
   if (is_complete) {
-    fprintf(fp, "#EXT-X-ENDLIST\n");
+    content += "#EXT-X-ENDLIST\n";
   }
 
+  std::string tmp_path = m3u8_path + ".tmp";
+  FILE *fp = fopen(tmp_path.c_str(), "w");
+  if (!fp) {
+    Error("Failed to open %s for writing: %s", tmp_path.c_str(), strerror(errno));
+    return;
+  }
+  if (fwrite(content.data(), 1, content.size(), fp) != content.size()) {
+    Error("Failed to write %s: %s", tmp_path.c_str(), strerror(errno));
+    fclose(fp);
+    unlink(tmp_path.c_str());
+    return;
+  }
   fclose(fp);
-  Debug(1, "Wrote m3u8 %s with %zu fragments (complete=%d)",
-        m3u8_path.c_str(), fragments_.size(), is_complete);
+  if (rename(tmp_path.c_str(), m3u8_path.c_str()) != 0) {
+    Error("Failed to rename %s to %s: %s", tmp_path.c_str(), m3u8_path.c_str(), strerror(errno));
+    unlink(tmp_path.c_str());
+    return;
+  }
+  Debug(1, "Wrote m3u8 %s with %zu fragments %zu parts (complete=%d)",
+        m3u8_path.c_str(), fragments_.size(), parts_.size(), is_complete);
 }
@@ -32,6 +32,15 @@ class VideoStore {
     int64_t size;      // bytes (moof+mdat)
     double duration;   // seconds
   };
+  // LL-HLS partial segment. A fragment (segment) is made up of one or more
+  // parts; the first part of each segment starts on a keyframe.
+  struct Part {
+    int64_t offset;    // byte offset in file
+    int64_t size;      // bytes (moof+mdat)
+    double duration;   // seconds
+    size_t segment;    // index into fragments_ of the segment this part belongs to
+    bool independent;  // starts with a keyframe
+  };
 
  private:
 
@@ -108,6 +117,36 @@ class VideoStore {
   int64_t init_segment_end_;        // byte offset where init segment (ftyp+moov) ends
   bool    finalized_;               // true once finalize() has run trailer + last-fragment recording
 
+  // LL-HLS part tracking. When part_duration_ is non-zero we force the muxer
+  // to flush a fragment (moof+mdat) every part_duration_ seconds in between
+  // keyframes so that a live playlist can advertise EXT-X-PART entries.
+  double  part_duration_;           // target part duration in seconds, 0 disables LL-HLS
+  std::vector<Part> parts_;
+  int64_t last_part_offset_;        // byte offset where the current (in-progress) part starts
+  int64_t last_part_start_dts_;     // DTS of the packet that started the current part
+  bool    part_independent_;        // current part started on a keyframe
+
+  // Incremental playlist state. Completed segments older than the parts
+  // window never change, so their lines are rendered once and kept here.
+  std::string m3u8_url_;            // video_url the cached lines were rendered with
+  std::string m3u8_segments_;       // rendered lines for fragments_[0, m3u8_segment_count_)
+  size_t  m3u8_segment_count_;
+  double  m3u8_max_duration_;
+
+  void record_part(int64_t end_offset, int64_t end_dts, bool closes_segment);
+  void record_last_fragment(int64_t end_offset);
+  void drain_reorder_queues();
+
+  // Muxer options, so that every segment file gets the same header.
+  AVDictionary *muxer_opts_;
+  // Where the current file's timeline starts, in AV_TIME_BASE units, when it
+  // isn't the first one written by this VideoStore.
+  int64_t segment_start_;
+  bool    rebase_segment_;
+  bool preallocate(const std::string &path) const;
+  void release_preallocation() const;
+  int64_t close_file();
+
   bool setup_resampler();
   int write_packet(AVPacket *pkt, AVStream *stream);
 
@@ -131,7 +170,12 @@ class VideoStore {
   int write_packets(PacketQueue &queue);
   void flush_codecs();
   const std::vector<Fragment> &fragments() const { return fragments_; }
+  const std::vector<Part> &parts() const { return parts_; }
   int64_t init_segment_end() const { return init_segment_end_; }
+  // Writes the playlist to path via a temporary file and rename() so that
+  // readers never see a partially written manifest. When LL-HLS parts are
+  // enabled and the playlist is not complete, EXT-X-PART entries are written
+  // for the most recent segments and the in-progress one.
   void writeM3U8(const std::string &path, const std::string &video_url, bool is_complete);
   // Flush queues, write trailer, close output, and record the final fragment.
   // Call this before writeM3U8(true) so the manifest contains every fragment.
@@ -139,6 +183,14 @@ class VideoStore {
   // the trailer write if finalize() has already run.
   void finalize();
 
+  // Continuous recording segmenter. closeSegment() ends the current file on a
+  // fragment boundary without tearing down the codecs. openSegment() then
+  // carries on into a new file with a muxer of its own, whose timestamps
+  // start from zero. Call closeSegment() just before writing a keyframe.
+  bool closeSegment();
+  bool openSegment(const std::string &new_filename);
+  int64_t bytes_written() const;
+
   const char *get_codec() {
     if (chosen_codec_data)
       return chosen_codec_data->codec_codec;
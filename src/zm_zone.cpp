@@ -19,10 +19,12 @@
 
 #include "zm_zone.h"
 
+#include "zm_db_snapshot.h"
 #include "zm_fifo.h"
 #include "zm_fifo_debug.h"
 #include "zm_monitor.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 void Zone::Setup(
@@ -67,24 +69,51 @@ void Zone::Setup(
          id, label.c_str(), type, polygon.Width(), polygon.Height(), alarm_rgb, check_method, min_pixel_threshold, max_pixel_threshold, min_alarm_pixels, max_alarm_pixels, filter_box.X(), filter_box.Y(), min_filter_pixels, max_filter_pixels, min_blob_pixels, max_blob_pixels, min_blobs, max_blobs, overload_frames, extend_alarm_frames );
 #endif
 
+  // Detection runs on frames decimated by the monitor's analysis scale, so
+  // it needs the polygon and the pixel count thresholds at that scale too.
+  const int scale = monitor->AnalysisScale();
+  if (scale > 1) {
+    std::vector<Vector2> vertices;
+    vertices.reserve(polygon.GetVertices().size());
+    const int max_x = static_cast<int>(monitor->AnalysisWidth()) - 1;
+    const int max_y = static_cast<int>(monitor->AnalysisHeight()) - 1;
+    for (const Vector2 &vertex : polygon.GetVertices())
+      vertices.emplace_back(std::min(vertex.x_ / scale, max_x), std::min(vertex.y_ / scale, max_y));
+    analysis_polygon = Polygon(vertices);
+
+    auto scale_pixels = [scale](int pixels) {
+      return pixels > 0 ? std::max((pixels + scale * scale / 2) / (scale * scale), 1) : pixels;
+    };
+    min_alarm_pixels = scale_pixels(min_alarm_pixels);
+    max_alarm_pixels = scale_pixels(max_alarm_pixels);
+    min_filter_pixels = scale_pixels(min_filter_pixels);
+    max_filter_pixels = scale_pixels(max_filter_pixels);
+    min_blob_pixels = scale_pixels(min_blob_pixels);
+    max_blob_pixels = scale_pixels(max_blob_pixels);
+    filter_box = Vector2(std::max((filter_box.x_ + scale / 2) / scale, 1),
+                         std::max((filter_box.y_ + scale / 2) / scale, 1));
+  } else {
+    analysis_polygon = polygon;
+  }
+
   ResetStats();
   image = nullptr;
 
   overload_count = 0;
   extend_alarm_count = 0;
 
-  pg_image = new Image(monitor->Width(), monitor->Height(), 1, ZM_SUBPIX_ORDER_NONE);
+  pg_image = new Image(monitor->AnalysisWidth(), monitor->AnalysisHeight(), 1, ZM_SUBPIX_ORDER_NONE);
   pg_image->Clear();
-  pg_image->Fill(0xff, polygon);
-  pg_image->Outline(0xff, polygon);
+  pg_image->Fill(0xff, analysis_polygon);
+  pg_image->Outline(0xff, analysis_polygon);
 
-  ranges = new Range[monitor->Height()];
-  for ( unsigned int y = 0; y < monitor->Height(); y++ ) {
+  ranges = new Range[monitor->AnalysisHeight()];
+  for ( unsigned int y = 0; y < monitor->AnalysisHeight(); y++ ) {
     ranges[y].lo_x = -1;
     ranges[y].hi_x = 0;
     ranges[y].off_x = 0;
     const uint8_t *ppoly = pg_image->Buffer( 0, y );
-    for ( unsigned int x = 0; x < monitor->Width(); x++, ppoly++ ) {
+    for ( unsigned int x = 0; x < monitor->AnalysisWidth(); x++, ppoly++ ) {
       if ( *ppoly ) {
         if ( ranges[y].lo_x == -1 ) {
           ranges[y].lo_x = x;
@@ -195,6 +224,38 @@ bool Zone::CheckExtendAlarmCount() {
 }  // end bool Zone::CheckExtendAlarmCount
 
 bool Zone::CheckAlarms(const Image *delta_image) {
+  bool alarm = CheckDelta(delta_image);
+  if (monitor->AnalysisScale() > 1)
+    ScaleStatsToCapture();
+  return alarm;
+}
+
+// Stats come out of CheckDelta in analysis coordinates, report them in
+// capture ones like the zone's settings are.
+void Zone::ScaleStatsToCapture() {
+  const int scale = monitor->AnalysisScale();
+  const int area = scale * scale;
+
+  stats.alarm_pixels_ *= area;
+  stats.alarm_filter_pixels_ *= area;
+  stats.alarm_blob_pixels_ *= area;
+  stats.min_blob_size_ *= area;
+  stats.max_blob_size_ *= area;
+  if (stats.score_) {
+    const int max_x = static_cast<int>(monitor->Width()) - 1;
+    const int max_y = static_cast<int>(monitor->Height()) - 1;
+    stats.alarm_box_ = Box(
+        Vector2(stats.alarm_box_.Lo().x_ * scale, stats.alarm_box_.Lo().y_ * scale),
+        Vector2(std::min(stats.alarm_box_.Hi().x_ * scale + scale - 1, max_x),
+                std::min(stats.alarm_box_.Hi().y_ * scale + scale - 1, max_y)));
+    if (stats.alarm_centre_.x_ >= 0 && stats.alarm_centre_.y_ >= 0) {
+      stats.alarm_centre_ = Vector2(std::min(stats.alarm_centre_.x_ * scale + scale / 2, max_x),
+                                    std::min(stats.alarm_centre_.y_ * scale + scale / 2, max_y));
+    }
+  }
+}
+
+bool Zone::CheckDelta(const Image *delta_image) {
   ResetStats();
 
   if (overload_count) {
@@ -248,10 +309,10 @@ bool Zone::CheckAlarms(const Image *delta_image) {
   int alarm_mid_x = -1;
   int alarm_mid_y = -1;
 
-  //int lo_x = polygon.Extent().Lo().x_;
-  int lo_y = polygon.Extent().Lo().y_;
-  int hi_x = polygon.Extent().Hi().x_;
-  int hi_y = polygon.Extent().Hi().y_;
+  //int lo_x = analysis_polygon.Extent().Lo().x_;
+  int lo_y = analysis_polygon.Extent().Lo().y_;
+  int hi_x = analysis_polygon.Extent().Hi().x_;
+  int hi_y = analysis_polygon.Extent().Hi().y_;
 
   // Clamp polygon extents to image dimensions to prevent buffer overflows.
   // This can happen if zone polygon coordinates exceed the actual frame size
@@ -309,7 +370,7 @@ bool Zone::CheckAlarms(const Image *delta_image) {
     return false;
   }
 
-  stats.score_ = (100*stats.alarm_pixels_)/(max_alarm_pixels ? max_alarm_pixels : polygon.Area());
+  stats.score_ = (100*stats.alarm_pixels_)/(max_alarm_pixels ? max_alarm_pixels : analysis_polygon.Area());
   if (stats.score_ < 1)
     stats.score_ = 1; /* Fix for score of 0 when frame meets thresholds but alarmed area is not big enough */
   Debug(5, "Current score is %d", stats.score_);
@@ -398,7 +459,7 @@ bool Zone::CheckAlarms(const Image *delta_image) {
     if (max_filter_pixels != 0)
       stats.score_ = (100*stats.alarm_filter_pixels_)/max_filter_pixels;
     else
-      stats.score_ = (100*stats.alarm_filter_pixels_)/polygon.Area();
+      stats.score_ = (100*stats.alarm_filter_pixels_)/analysis_polygon.Area();
 
     if (stats.score_ < 1)
       stats.score_ = 1; /* Fix for score of 0 when frame meets thresholds but alarmed area is not big enough */
@@ -681,16 +742,16 @@ bool Zone::CheckAlarms(const Image *delta_image) {
       if (max_blob_pixels != 0)
         stats.score_ = (100*stats.alarm_blob_pixels_)/max_blob_pixels;
       else
-        stats.score_ = (100*stats.alarm_blob_pixels_)/polygon.Area();
+        stats.score_ = (100*stats.alarm_blob_pixels_)/analysis_polygon.Area();
 
       if (stats.score_ < 1)
         stats.score_ = 1; /* Fix for score of 0 when frame meets thresholds but alarmed area is not big enough */
       Debug(5, "Current score is %d", stats.score_);
 
-      alarm_lo_x = polygon.Extent().Hi().x_ + 1;
-      alarm_hi_x = polygon.Extent().Lo().x_ - 1;
-      alarm_lo_y = polygon.Extent().Hi().y_ + 1;
-      alarm_hi_y = polygon.Extent().Lo().y_ - 1;
+      alarm_lo_x = analysis_polygon.Extent().Hi().x_ + 1;
+      alarm_hi_x = analysis_polygon.Extent().Lo().x_ - 1;
+      alarm_lo_y = analysis_polygon.Extent().Hi().y_ + 1;
+      alarm_hi_y = analysis_polygon.Extent().Lo().y_ - 1;
 
       for (uint32 i = 1; i < kWhite; i++) {
         BlobStats *bs = &blob_stats[i];
@@ -752,7 +813,7 @@ bool Zone::CheckAlarms(const Image *delta_image) {
 
     if ((type < PRECLUSIVE) && (check_method >= BLOBS) && (monitor->GetOptSaveJPEGs() > 1)) {
 
-      int lo_x = polygon.Extent().Lo().x_;
+      int lo_x = analysis_polygon.Extent().Lo().x_;
       // First mask out anything we don't want
       for (int y = lo_y; y <= hi_y; y++) {
         int lo_x2 = ranges[y].lo_x;
@@ -795,12 +856,19 @@ bool Zone::CheckAlarms(const Image *delta_image) {
       // aliases both GRAY8 and planar YUV420P, so resolve the real format first:
       // a true GRAY8 monitor has no colour to carry, so upgrade its highlight to
       // RGB24; YUV420P keeps its format and carries the alarm colour in chroma.
+      // The mask is at the analysis scale; the highlight has to be at capture
+      // size, so blow the mask up first and keep the edges one pixel wide.
+      Image *edge_mask = diff_image;
+      if (monitor->AnalysisScale() > 1)
+        edge_mask = UpscaleMask(*diff_image);
       AVPixelFormat capture_fmt = zm_pixformat_from_colours(monitor->Colours(), monitor->SubpixelOrder());
       if (capture_fmt == AV_PIX_FMT_GRAY8) {
-        image = diff_image->HighlightEdges(alarm_rgb, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, &polygon.Extent());
+        image = edge_mask->HighlightEdges(alarm_rgb, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, &polygon.Extent());
       } else {
-        image = diff_image->HighlightEdges(alarm_rgb, monitor->Colours(), monitor->SubpixelOrder(), &polygon.Extent());
+        image = edge_mask->HighlightEdges(alarm_rgb, monitor->Colours(), monitor->SubpixelOrder(), &polygon.Extent());
       }
+      if (edge_mask != diff_image)
+        delete edge_mask;
 
       // Only need to delete this when 'image' becomes detached and points somewhere else
       delete diff_image;
@@ -813,6 +881,33 @@ bool Zone::CheckAlarms(const Image *delta_image) {
   return true;
 }
 
+// Nearest neighbour copy of an analysis scale mask to capture size, over the
+// zone's extent only; the rest is left black.
+Image *Zone::UpscaleMask(const Image &mask) const {
+  const int scale = monitor->AnalysisScale();
+  const int mask_width = mask.Width();
+  const int mask_height = mask.Height();
+  const int width = monitor->Width();
+  const int height = monitor->Height();
+
+  Image *capture_mask = new Image(width, width, height, 1, ZM_SUBPIX_ORDER_NONE);
+  memset(capture_mask->Buffer(), 0, static_cast<size_t>(width) * height);
+
+  const int lo_x = std::max(polygon.Extent().Lo().x_, 0);
+  const int hi_x = std::min(polygon.Extent().Hi().x_, width - 1);
+  const int lo_y = std::max(polygon.Extent().Lo().y_, 0);
+  const int hi_y = std::min(polygon.Extent().Hi().y_, height - 1);
+  for (int y = lo_y; y <= hi_y; y++) {
+    const int sy = y / scale;
+    if (sy >= mask_height) break;
+    const uint8_t *src = mask.Buffer(0, sy);
+    uint8_t *dst = capture_mask->Buffer(0, y);
+    for (int x = lo_x; x <= hi_x && x / scale < mask_width; x++)
+      dst[x] = src[x / scale];
+  }
+  return capture_mask;
+}
+
 bool Zone::ParsePolygonString(const char *poly_string, Polygon &polygon) {
   char *str = (char *)poly_string;
   int max_n_coords = strlen(str)/4;
@@ -929,26 +1024,37 @@ bool Zone::ParseZoneString(const char *zone_string, unsigned int &zone_id, int &
   return result;
 }  // end bool Zone::ParseZoneString(const char *zone_string, int &zone_id, int &colour, Polygon &polygon)
 
+std::string load_zone_sql =
+  "SELECT Id,Name,Type+0,Units,Coords,AlarmRGB,CheckMethod+0,"
+  "MinPixelThreshold,MaxPixelThreshold,MinAlarmPixels,MaxAlarmPixels,"
+  "FilterX,FilterY,MinFilterPixels,MaxFilterPixels,"
+  "MinBlobPixels,MaxBlobPixels,MinBlobs,MaxBlobs,"
+  "OverloadFrames,ExtendAlarmFrames,MonitorId"
+  " FROM Zones";
+
 std::vector<Zone> Zone::Load(const std::shared_ptr<Monitor> &monitor) {
-  std::string sql = stringtf("SELECT Id,Name,Type+0,Units,Coords,AlarmRGB,CheckMethod+0,"
-                             "MinPixelThreshold,MaxPixelThreshold,MinAlarmPixels,MaxAlarmPixels,"
-                             "FilterX,FilterY,MinFilterPixels,MaxFilterPixels,"
-                             "MinBlobPixels,MaxBlobPixels,MinBlobs,MaxBlobs,"
-                             "OverloadFrames,ExtendAlarmFrames"
-                             " FROM Zones WHERE MonitorId = %d ORDER BY Type, Id", monitor->Id());
-
-  MYSQL_RES *result = zmDbFetch(sql);
-  if (!result) {
-    return {};
+  MYSQL_RES *result = nullptr;
+  std::vector<MYSQL_ROW> rows;
+
+  if (dbSnapshot.IsOpen() and dbSnapshot.Find("Zones")) {
+    rows = dbSnapshot.FindRows("Zones", 21 /* MonitorId */, monitor->Id());
+  } else {
+    std::string sql = load_zone_sql + stringtf(" WHERE MonitorId = %d ORDER BY Type, Id", monitor->Id());
+    result = zmDbFetch(sql);
+    if (!result) {
+      return {};
+    }
+    rows.reserve(mysql_num_rows(result));
+    while (MYSQL_ROW dbrow = mysql_fetch_row(result))
+      rows.push_back(dbrow);
   }
 
-  uint32 n_zones = mysql_num_rows(result);
-  Debug(1, "Got %d zones for monitor %s", n_zones, monitor->Name());
+  Debug(1, "Got %zu zones for monitor %s", rows.size(), monitor->Name());
 
   std::vector<Zone> zones;
-  zones.reserve(n_zones);
+  zones.reserve(rows.size());
 
-  for (MYSQL_ROW dbrow = mysql_fetch_row(result); dbrow; dbrow = mysql_fetch_row(result)) {
+  for (MYSQL_ROW dbrow : rows) {
     int col = 0;
 
     int Id = atoi(dbrow[col++]);
@@ -1046,7 +1152,7 @@ std::vector<Zone> Zone::Load(const std::shared_ptr<Monitor> &monitor) {
         OverloadFrames, ExtendAlarmFrames);
     }
   } // end foreach row
-  mysql_free_result(result);
+  if (result) mysql_free_result(result);
   return zones;
 } // end std::vector<Zone> Zone::Load(Monitor *monitor)
 
@@ -1132,8 +1238,8 @@ void Zone::std_alarmedpixels(
   const int img_width = static_cast<int>(pdelta_image->Width());
   const int img_height = static_cast<int>(pdelta_image->Height());
 
-  int lo_y = polygon.Extent().Lo().y_;
-  int hi_y = polygon.Extent().Hi().y_;
+  int lo_y = analysis_polygon.Extent().Lo().y_;
+  int hi_y = analysis_polygon.Extent().Hi().y_;
 
   // Clamp to image bounds
   if (hi_y >= img_height) hi_y = img_height - 1;
@@ -1169,6 +1275,7 @@ Zone::Zone(const Zone &z) :
   label(z.label),
   type(z.type),
   polygon(z.polygon),
+  analysis_polygon(z.analysis_polygon),
   alarm_rgb(z.alarm_rgb),
   check_method(z.check_method),
   min_pixel_threshold(z.min_pixel_threshold),
@@ -1192,8 +1299,8 @@ Zone::Zone(const Zone &z) :
   diag_path(z.diag_path) {
   std::copy(z.blob_stats, z.blob_stats+256, blob_stats);
   pg_image = z.pg_image ? new Image(*z.pg_image) : nullptr;
-  ranges = new Range[monitor->Height()];
-  std::copy(z.ranges, z.ranges+monitor->Height(), ranges);
+  ranges = new Range[monitor->AnalysisHeight()];
+  std::copy(z.ranges, z.ranges+monitor->AnalysisHeight(), ranges);
   image = z.image ? new Image(*z.image) : nullptr;
   //z.stats.debug("Copy Source");
   stats.DumpToLog("Copy dest");
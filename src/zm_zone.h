@@ -68,6 +68,7 @@ class Zone {
   std::string label;
   ZoneType    type;
   Polygon     polygon;
+  Polygon     analysis_polygon;  // polygon at the monitor's analysis scale
   Rgb         alarm_rgb;
   CheckMethod    check_method;
 
@@ -122,6 +123,10 @@ class Zone {
     int p_overload_frames,
     int p_extend_alarm_frames);
 
+  bool CheckDelta(const Image *delta_image);
+  void ScaleStatsToCapture();
+  Image *UpscaleMask(const Image &mask) const;
+
   void std_alarmedpixels(const Image* pdelta_image, Image* pmask_image, const Image* ppoly_image, unsigned int* pixel_count, unsigned int* pixel_sum);
 
  public:
@@ -189,6 +194,8 @@ class Zone {
   inline bool IsPrivacy() const { return( type == PRIVACY ); }
   inline const Image *AlarmImage() const { return image; }
   inline const Polygon &GetPolygon() const { return polygon; }
+  // The polygon in the coordinates of the delta images CheckAlarms is given
+  inline const Polygon &GetAnalysisPolygon() const { return analysis_polygon; }
   inline bool Alarmed() const { return alarmed; }
   inline bool WasAlarmed() const { return was_alarmed; }
   inline void SetAlarm() { was_alarmed = alarmed; alarmed = true; }
@@ -231,4 +238,7 @@ class Zone {
   inline const Range *getRanges() const { return ranges; }
 };
 
+// The SQL used to load Zones, MonitorId is the last column
+extern std::string load_zone_sql;
+
 #endif // ZM_ZONE_H
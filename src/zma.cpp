@@ -133,56 +133,6 @@ static void FinalizeCreatedEvent(ReanalysisEvent &ev, SystemTimePoint end_time,
        ev.db_event_id, ev.frames, ev.alarm_frames, ev.max_score);
 }
 
-// Build the filesystem path for a new event based on the storage scheme
-static std::string BuildNewEventPath(
-    const char *storage_path,
-    unsigned int monitor_id,
-    uint64_t new_event_id,
-    SystemTimePoint event_start,
-    Storage::Schemes scheme) {
-  if (scheme == Storage::DEEP) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(event_start);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      return stringtf("%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                      storage_path, monitor_id,
-                      event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                      event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    } else {
-      return stringtf("%s/%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                      staticConfig.PATH_WEB.c_str(), storage_path, monitor_id,
-                      event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                      event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    }
-  } else if (scheme == Storage::MEDIUM) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(event_start);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      return stringtf("%s/%u/%04d-%02d-%02d/%" PRIu64,
-                      storage_path, monitor_id,
-                      event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                      new_event_id);
-    } else {
-      return stringtf("%s/%s/%u/%04d-%02d-%02d/%" PRIu64,
-                      staticConfig.PATH_WEB.c_str(), storage_path, monitor_id,
-                      event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                      new_event_id);
-    }
-  } else {
-    if (storage_path[0] == '/') {
-      return stringtf("%s/%u/%" PRIu64, storage_path, monitor_id, new_event_id);
-    } else {
-      return stringtf("%s/%s/%u/%" PRIu64,
-                      staticConfig.PATH_WEB.c_str(), storage_path, monitor_id,
-                      new_event_id);
-    }
-  }
-}
-
 // Hard link (or copy as fallback) video files from source event to new event directory,
 // and set DefaultVideo in DB
 static void LinkEventFiles(
@@ -349,14 +299,7 @@ int main(int argc, char *argv[]) {
   std::string scheme_str = dbrow[7] ? std::string(dbrow[7]) : std::string();
   int save_jpegs = dbrow[8] ? atoi(dbrow[8]) : 0;
 
-  Storage::Schemes scheme;
-  if (scheme_str == "Deep") {
-    scheme = Storage::DEEP;
-  } else if (scheme_str == "Medium") {
-    scheme = Storage::MEDIUM;
-  } else {
-    scheme = Storage::SHALLOW;
-  }
+  Storage::Schemes scheme = Storage::SchemeFromString(scheme_str);
 
   mysql_free_result(result);
 
@@ -368,49 +311,7 @@ int main(int argc, char *argv[]) {
   // Step 2: Construct event path
   Storage storage(storage_id);
   const char *storage_path = storage.Path();
-  std::string event_path;
-
-  if (scheme == Storage::DEEP) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(start_time);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      event_path = stringtf("%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                            storage_path, event_monitor_id,
-                            event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                            event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    } else {
-      event_path = stringtf("%s/%s/%u/%02d/%02d/%02d/%02d/%02d/%02d",
-                            staticConfig.PATH_WEB.c_str(), storage_path, event_monitor_id,
-                            event_time.tm_year - 100, event_time.tm_mon + 1, event_time.tm_mday,
-                            event_time.tm_hour, event_time.tm_min, event_time.tm_sec);
-    }
-  } else if (scheme == Storage::MEDIUM) {
-    tm event_time = {};
-    time_t start_time_t = std::chrono::system_clock::to_time_t(start_time);
-    localtime_r(&start_time_t, &event_time);
-
-    if (storage_path[0] == '/') {
-      event_path = stringtf("%s/%u/%04d-%02d-%02d/%" PRIu64,
-                            storage_path, event_monitor_id,
-                            event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                            event_id);
-    } else {
-      event_path = stringtf("%s/%s/%u/%04d-%02d-%02d/%" PRIu64,
-                            staticConfig.PATH_WEB.c_str(), storage_path, event_monitor_id,
-                            event_time.tm_year + 1900, event_time.tm_mon + 1, event_time.tm_mday,
-                            event_id);
-    }
-  } else {
-    if (storage_path[0] == '/') {
-      event_path = stringtf("%s/%u/%" PRIu64, storage_path, event_monitor_id, event_id);
-    } else {
-      event_path = stringtf("%s/%s/%u/%" PRIu64,
-                            staticConfig.PATH_WEB.c_str(), storage_path, event_monitor_id,
-                            event_id);
-    }
-  }
+  std::string event_path = Storage::EventPath(storage_path, scheme, event_monitor_id, event_id, start_time);
 
   Info("Event path: %s", event_path.c_str());
 
@@ -539,6 +440,8 @@ int main(int argc, char *argv[]) {
   }
 
   // Step 6: Process each frame
+  // Kept across frames so that AnalyseFrame reuses its buffer
+  Image analysis_image;
   for (size_t frame_idx = 0; frame_idx < frames.size() && !zm_terminate; frame_idx++) {
     const FrameData &fd = frames[frame_idx];
     Image *frame_image = nullptr;
@@ -572,7 +475,6 @@ int main(int argc, char *argv[]) {
 
     // Run motion detection
     Event::StringSet zoneSet;
-    Image analysis_image;
     unsigned int score = monitor->AnalyseFrame(*frame_image, zoneSet,
                                                save_analysis ? &analysis_image : nullptr);
     analysis_count++;
@@ -629,8 +531,8 @@ int main(int argc, char *argv[]) {
               Info("Created new event %" PRIu64 " from re-analysis of event %" PRIu64, new_event_id, event_id);
 
               // Create directory and copy video files to new event
-              std::string new_event_path = BuildNewEventPath(
-                storage_path, monitor->Id(), new_event_id, fd.timestamp, scheme);
+              std::string new_event_path = Storage::EventPath(
+                storage_path, scheme, monitor->Id(), new_event_id, fd.timestamp);
               LinkEventFiles(event_path, new_event_path, video_file, new_event_id);
             } else {
               Error("Failed to create re-analysis event in database");
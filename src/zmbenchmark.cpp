@@ -24,9 +24,11 @@
 #include <random>
 #include <utility>
 
+#include "zm_background_model.h"
 #include "zm_config.h"
 #include "zm_image.h"
 #include "zm_monitor.h"
+#include "zm_poly.h"
 #include "zm_time.h"
 #include "zm_utils.h"
 #include "zm_zone.h"
@@ -297,6 +299,260 @@ void RunDetectMotionBenchmarks(
     timings);
 }
 
+//
+// Generate a colour image filled with random data, as a camera frame.
+//
+std::shared_ptr<Image> GenerateRandomColourImage(const int width = 1920, const int height = 1080) {
+  Image *image = new Image(width, height, ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA);
+  for (int y = 0 ; y < height ; y++) {
+    uint8_t *row = image->Buffer(0, y);
+    for (int x = 0 ; x < width * 4 ; x++) {
+      row[x] = (uint8_t) mt_rand();
+    }
+  }
+  return std::shared_ptr<Image>(image);
+}
+
+//
+// Time scaling a frame for a wall of streams, the way zms does it for every
+// frame it sends at a non-100 scale.
+//
+// Args:
+//  image: The frame to scale.
+//
+//  scale: The stream scale, in percent.
+//
+//  reuse: Scale into a persistent image like StreamBase::prepareImage does,
+//    rather than copying the frame and scaling the copy in place.
+//
+// Return:
+//  The average time taken to scale one frame.
+//
+Microseconds RunScaleBenchmark(const std::string &label,
+                               const std::shared_ptr<Image> &image,
+                               const int scale,
+                               const bool reuse) {
+  const unsigned int new_width = image->Width() * scale / ZM_SCALE_BASE;
+  const unsigned int new_height = image->Height() * scale / ZM_SCALE_BASE;
+  Image scaled_image;
+
+  Microseconds totalTimeTaken(0);
+
+  const int numPasses = 300;
+  for (int i = 0 ; i < numPasses ; i++) {
+    if (!(i % 30)) {
+      printf("\r%s - pass %3d / %3d   ", label.c_str(), i + 1, numPasses);
+      fflush(stdout);
+    }
+
+    TimeSegmentAdder adder(totalTimeTaken);
+
+    if (reuse) {
+      image->Scale(new_width, new_height, scaled_image);
+    } else {
+      Image copy_image(*image);
+      copy_image.Scale(new_width, new_height);
+    }
+  }
+  printf("\n");
+
+  return totalTimeTaken / numPasses;
+}
+
+void RunScaleBenchmarks(TimingsTable &table, const std::vector<int> &scales, const bool reuse) {
+  std::shared_ptr<Image> image = GenerateRandomColourImage();
+  std::vector<Microseconds> timings;
+
+  for (int scale : scales) {
+    timings.push_back(RunScaleBenchmark(
+                        std::string("Scale: ") + (reuse ? "reused image" : "copy") + ", " + std::to_string(scale) + "%",
+                        image, scale, reuse));
+  }
+
+  table.AddRow(reuse ? "scale into reused image" : "copy and scale", timings);
+}
+
+//
+// Keep a reference for motion detection: compute the delta against it and
+// then fold the frame in, as the analysis thread does for every frame.
+//
+// Args:
+//  width, height: The size of the greyscale frames.
+//
+//  statistical: Use a BackgroundModel (ZM_ANALYSIS_ENGINE=statistical)
+//    rather than Image::Delta and Image::Blend on a reference image.
+//
+// Return:
+//  The average time taken per frame.
+//
+Microseconds RunReferenceBenchmark(const std::string &label,
+                                   const int width,
+                                   const int height,
+                                   const bool statistical) {
+  // A few frames of the same scene with sensor noise, reused round robin
+  std::vector<std::shared_ptr<Image>> frames;
+  for (int f = 0 ; f < 4 ; f++) {
+    Image *frame = new Image(width, height, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+    for (int y = 0 ; y < height ; y++) {
+      uint8_t *row = frame->Buffer(0, y);
+      for (int x = 0 ; x < width ; x++) {
+        row[x] = (uint8_t) (((x ^ y) & 0x7f) + (mt_rand() & 0xf));
+      }
+    }
+    frames.emplace_back(frame);
+  }
+
+  Image ref_image(*frames[0]);
+  BackgroundModel model;
+  model.Reset(*frames[0]);
+  Image delta_image;
+
+  Microseconds totalTimeTaken(0);
+
+  const int numPasses = 100;
+  for (int i = 0 ; i < numPasses ; i++) {
+    if (!(i % 10)) {
+      printf("\r%s - pass %3d / %3d   ", label.c_str(), i + 1, numPasses);
+      fflush(stdout);
+    }
+    const Image &frame = *frames[i % frames.size()];
+
+    TimeSegmentAdder adder(totalTimeTaken);
+    if (statistical) {
+      model.Delta(frame, &delta_image);
+      model.Update(frame, 6);
+    } else {
+      ref_image.Delta(frame, &delta_image);
+      ref_image.Blend(frame, 6);
+    }
+  }
+  printf("\n");
+
+  return totalTimeTaken / numPasses;
+}
+
+void RunReferenceBenchmarks(TimingsTable &table, const bool statistical) {
+  const std::vector<std::pair<int, int>> sizes = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+  std::vector<Microseconds> timings;
+  for (const auto &size : sizes) {
+    timings.push_back(RunReferenceBenchmark(
+                        std::string(statistical ? "Statistical: " : "Blend: ")
+                        + std::to_string(size.first) + "x" + std::to_string(size.second),
+                        size.first, size.second, statistical));
+  }
+  table.AddRow(statistical ? "model delta+update" : "blend delta+blend", timings);
+}
+
+//
+// Time stamping a capture frame with its timestamp, as zmc does for every
+// frame when timestamp_on_capture is set.
+//
+// Args:
+//  colours, subpixelorder: The frame's format.
+//
+//  cached: Render through an AnnotationCache like Monitor::TimestampImage,
+//    rather than drawing every glyph bit by bit.
+//
+// Return:
+//  The average time taken to annotate one frame.
+//
+Microseconds RunAnnotateBenchmark(const std::string &label,
+                                  const int colours,
+                                  const int subpixelorder,
+                                  const bool cached) {
+  Image image(1920, 1080, colours, subpixelorder);
+  AnnotationCache cache;
+
+  Microseconds totalTimeTaken(0);
+
+  const int numPasses = 3000;
+  for (int i = 0 ; i < numPasses ; i++) {
+    if (!(i % 300)) {
+      printf("\r%s - pass %4d / %4d   ", label.c_str(), i + 1, numPasses);
+      fflush(stdout);
+    }
+    // A new timestamp each second at 25 fps
+    const std::string text = stringtf("Front Door - 24/10/18 12:%02d:%02d", (i / 1500) % 60, (i / 25) % 60);
+
+    TimeSegmentAdder adder(totalTimeTaken);
+    if (cached) {
+      image.Annotate(cache, text, Vector2(10, 10), 2);
+    } else {
+      image.Annotate(text, Vector2(10, 10), 2);
+    }
+  }
+  printf("\n");
+
+  return totalTimeTaken / numPasses;
+}
+
+void RunAnnotateBenchmarks(TimingsTable &table, const bool cached) {
+  std::vector<Microseconds> timings;
+  timings.push_back(RunAnnotateBenchmark(std::string("Annotate: gray8") + (cached ? " cached" : ""),
+                                         ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE, cached));
+  timings.push_back(RunAnnotateBenchmark(std::string("Annotate: rgb24") + (cached ? " cached" : ""),
+                                         ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, cached));
+  timings.push_back(RunAnnotateBenchmark(std::string("Annotate: rgb32") + (cached ? " cached" : ""),
+                                         ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA, cached));
+
+  table.AddRow(cached ? "cached annotate" : "annotate", timings);
+}
+
+//
+// Draw a zone-like polygon, as DetectMotion does to blank inactive zones and
+// the zone overlays do every frame.
+//
+// Args:
+//  colours, subpixelorder: The image's format.
+//
+//  density: Fill every density'th row and column, 0 to draw the outline.
+//
+// Return:
+//  The average time taken to draw the polygon once.
+//
+Microseconds RunPolygonBenchmark(const std::string &label,
+                                 const int colours,
+                                 const int subpixelorder,
+                                 const int density) {
+  Image image(1920, 1080, colours, subpixelorder);
+  // A concave "W" covering most of the frame
+  Polygon polygon({
+      {100, 50}, {700, 50}, {960, 500}, {1220, 50}, {1820, 50},
+      {1700, 1030}, {1300, 1030}, {960, 700}, {620, 1030}, {220, 1030}
+  });
+
+  Microseconds totalTimeTaken(0);
+
+  const int numPasses = 100;
+  for (int i = 0 ; i < numPasses ; i++) {
+    printf("\r%s - pass %2d / %2d   ", label.c_str(), i + 1, numPasses);
+    fflush(stdout);
+
+    TimeSegmentAdder adder(totalTimeTaken);
+    if (density) {
+      image.Fill(kRGBGreen, density, polygon);
+    } else {
+      image.Outline(kRGBGreen, polygon);
+    }
+  }
+  printf("\n");
+
+  return totalTimeTaken / numPasses;
+}
+
+void RunPolygonBenchmarks(TimingsTable &table, const int density) {
+  std::string name = density ? stringtf("fill density %d", density) : "outline";
+  std::vector<Microseconds> timings;
+  timings.push_back(RunPolygonBenchmark("Polygon " + name + ": gray8",
+                                        ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE, density));
+  timings.push_back(RunPolygonBenchmark("Polygon " + name + ": rgb24",
+                                        ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, density));
+  timings.push_back(RunPolygonBenchmark("Polygon " + name + ": rgb32",
+                                        ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA, density));
+
+  table.AddRow("polygon " + name, timings);
+}
+
 int main(int argc, char *argv[]) {
   // Init global stuff that we need.
   config.font_file_location = "../fonts/default.zmfnt";
@@ -321,6 +577,43 @@ int main(int argc, char *argv[]) {
   }
 
   table.Print();
+
+  // Scaled streaming: 1080p RGBA frames at typical montage and zoom scales.
+  const std::vector<int> scales = {25, 50, 150};
+  std::vector<std::string> scale_columns(scales.size());
+  std::transform(scales.begin(), scales.end(), scale_columns.begin(),
+  [](const int scale) { return std::to_string(scale) + "% scale (s)"; });
+  TimingsTable scale_table(scale_columns);
+
+  RunScaleBenchmarks(scale_table, scales, false);
+  RunScaleBenchmarks(scale_table, scales, true);
+
+  scale_table.Print();
+
+  // Reference maintenance per analysed frame, on greyscale frames
+  TimingsTable reference_table({"720p", "1080p", "2160p"});
+
+  RunReferenceBenchmarks(reference_table, false);
+  RunReferenceBenchmarks(reference_table, true);
+
+  reference_table.Print();
+
+  // Timestamping capture frames
+  TimingsTable annotate_table({"gray8", "rgb24", "rgb32"});
+
+  RunAnnotateBenchmarks(annotate_table, false);
+  RunAnnotateBenchmarks(annotate_table, true);
+
+  annotate_table.Print();
+
+  // Zone fills and outlines
+  TimingsTable polygon_table({"gray8", "rgb24", "rgb32"});
+
+  RunPolygonBenchmarks(polygon_table, 1);
+  RunPolygonBenchmarks(polygon_table, 2);
+  RunPolygonBenchmarks(polygon_table, 0);
+
+  polygon_table.Print();
   return 0;
 }
 
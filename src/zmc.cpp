@@ -56,6 +56,7 @@ possible, this should run at more or less constant speed.
 #include "zm.h"
 #include "zm_camera.h"
 #include "zm_db.h"
+#include "zm_db_snapshot.h"
 #include "zm_define.h"
 #include "zm_fifo.h"
 #include "zm_monitor.h"
@@ -65,6 +66,7 @@ possible, this should run at more or less constant speed.
 
 #include <getopt.h>
 #include <iostream>
+#include <thread>
 #include <unistd.h>
 
 void Usage() {
@@ -187,8 +189,22 @@ int main(int argc, char *argv[]) {
   zmLoadStaticConfig();
   zmDbConnect();
   zmLoadDBConfig();
+  DbSnapshot::RefreshIfStale();
   logInit(log_id_string);
 
+  // zms and zmu only fall back to refreshing the snapshot themselves, so keep
+  // it from expiring.  Off the capture loop, as it means querying the database.
+  std::thread snapshot_thread;
+  if (config.db_snapshot) {
+    snapshot_thread = std::thread([]() {
+      while (!zm_terminate) {
+        for (Seconds waited = Seconds(0); waited < DbSnapshot::kRefreshInterval and !zm_terminate; waited += Seconds(1))
+          std::this_thread::sleep_for(Seconds(1));
+        if (!zm_terminate) DbSnapshot::RefreshIfStale(DbSnapshot::kRefreshAge);
+      }
+    });
+  }
+
   HwCapsDetect();
 #if HAVE_LIBCURL
   curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -397,6 +413,7 @@ int main(int argc, char *argv[]) {
     if (zm_reload) {
       zmLoadStaticConfig();
       zmLoadDBConfig();
+      DbSnapshot::RefreshIfStale();
       for (std::shared_ptr<Monitor> &monitor : monitors) {
         monitor->Reload();
       }
@@ -421,6 +438,7 @@ int main(int argc, char *argv[]) {
   curl_global_cleanup();
 #endif  // HAVE_LIBCURL
   Debug(1, "terminating");
+  if (snapshot_thread.joinable()) snapshot_thread.join();
   dbQueue.stop();
   zmDbClose();
   logTerm();
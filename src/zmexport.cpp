@@ -0,0 +1,183 @@
+//
+// ZoneMinder Event Export Utility
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+/*
+
+=head1 NAME
+
+zmexport - The ZoneMinder Event Export utility
+
+=head1 SYNOPSIS
+
+ zmexport -m <monitor_id> -s <start> -e <end> -o <file.mp4>
+ zmexport -h
+ zmexport --help
+ zmexport -V
+ zmexport --version
+
+=head1 DESCRIPTION
+
+This utility joins the recorded videos of a monitor between two times into a
+single mp4, without re-encoding. Times are unix seconds or local time as
+YYYY-MM-DD HH:MM:SS. The first event is cut at the keyframe at or before the
+start time and the last at the end time. The gaps between events are closed
+up, so the export plays straight through.
+
+Events whose video has a different codec or size to the first are skipped.
+
+=head1 OPTIONS
+
+ -m, --monitor <monitor_id>       - Monitor to export
+ -s, --start <time>               - Start of the export
+ -e, --end <time>                 - End of the export
+ -o, --output <file>              - mp4 file to write
+ -v, --verbose                    - Increase verbosity
+ -h, --help                       - Display usage information
+ -V, --version                    - Print the installed version of ZoneMinder
+
+=cut
+
+*/
+
+#include "zm.h"
+#include "zm_config.h"
+#include "zm_db.h"
+#include "zm_event_export.h"
+#include "zm_signal.h"
+#include "zm_utils.h"
+
+#include <getopt.h>
+#include <iostream>
+
+void Usage() {
+  fprintf(stderr, "zmexport -m <monitor_id> -s <start> -e <end> -o <file.mp4>\n");
+  fprintf(stderr, "\nTimes are unix seconds or local time as YYYY-MM-DD HH:MM:SS.\n");
+  fprintf(stderr, "\nOptions:\n");
+  fprintf(stderr, "  -m, --monitor <monitor_id>   : Monitor to export\n");
+  fprintf(stderr, "  -s, --start <time>           : Start of the export\n");
+  fprintf(stderr, "  -e, --end <time>             : End of the export\n");
+  fprintf(stderr, "  -o, --output <file>          : mp4 file to write\n");
+  fprintf(stderr, "  -v, --verbose                : Increase debug verbosity\n");
+  fprintf(stderr, "  -h, --help                   : This screen\n");
+  fprintf(stderr, "  -V, --version                : Report the installed version of ZoneMinder\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  self = argv[0];
+
+  srand(getpid() * time(nullptr));
+
+  int monitor_id = -1;
+  SystemTimePoint start_time;
+  SystemTimePoint end_time;
+  bool have_start = false;
+  bool have_end = false;
+  std::string output_path;
+  int verbose = 0;
+
+  static struct option long_options[] = {
+    {"monitor", 1, nullptr, 'm'},
+    {"start", 1, nullptr, 's'},
+    {"end", 1, nullptr, 'e'},
+    {"output", 1, nullptr, 'o'},
+    {"verbose", 0, nullptr, 'v'},
+    {"help", 0, nullptr, 'h'},
+    {"version", 0, nullptr, 'V'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "m:s:e:o:vhV", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'm':
+      monitor_id = atoi(optarg);
+      break;
+    case 's':
+      have_start = EventExporter::ParseTime(optarg, start_time);
+      if (!have_start) fprintf(stderr, "Invalid start time '%s'\n", optarg);
+      break;
+    case 'e':
+      have_end = EventExporter::ParseTime(optarg, end_time);
+      if (!have_end) fprintf(stderr, "Invalid end time '%s'\n", optarg);
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'v':
+      verbose++;
+      break;
+    case 'h':
+    case '?':
+      Usage();
+      break;
+    case 'V':
+      std::cout << ZM_VERSION << "\n";
+      exit(0);
+    default:
+      break;
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "Extraneous options, ");
+    while (optind < argc)
+      fprintf(stderr, "%s ", argv[optind++]);
+    fprintf(stderr, "\n");
+    Usage();
+  }
+  if (monitor_id <= 0 or !have_start or !have_end or output_path.empty()) {
+    fprintf(stderr, "A monitor, start time, end time and output file are all needed\n");
+    Usage();
+  }
+  if (end_time <= start_time) {
+    fprintf(stderr, "The end time must be after the start time\n");
+    exit(-1);
+  }
+
+  const char *log_id_string = "zmexport";
+  logInit(log_id_string);
+  zmLoadStaticConfig();
+  zmDbConnect();
+  zmLoadDBConfig();
+  logInit(log_id_string);
+  if (verbose) {
+    Logger::fetch()->level(static_cast<Logger::Level>(Logger::DEBUG1 + verbose - 1));
+  }
+
+  zmSetDefaultTermHandler();
+  zmSetDefaultDieHandler();
+
+  std::vector<EventExporter::Segment> segments = EventExporter::FindSegments(monitor_id, start_time, end_time);
+  Info("Exporting %zu events of monitor %d to %s", segments.size(), monitor_id, output_path.c_str());
+
+  EventExporter exporter;
+  bool ok = exporter.Export(segments, start_time, end_time, output_path);
+
+  Debug(1, "Terminating");
+  dbQueue.stop();
+  zmDbClose();
+  logTerm();
+
+  return ok ? 0 : 1;
+}
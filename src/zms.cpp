@@ -19,15 +19,19 @@
 
 #include "zm.h"
 #include "zm_db.h"
+#include "zm_db_snapshot.h"
 #include "zm_user.h"
 #include "zm_signal.h"
 #include "zm_monitorstream.h"
 #include "zm_eventstream.h"
+#include "zm_montagestream.h"
 #include "zm_fifo_stream.h"
+#include "zm_passthrough_stream.h"
 #include <iomanip>
 #include <sstream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
 bool ValidateAccess(User *user, int mon_id) {
   bool allowed = true;
@@ -55,10 +59,11 @@ int main(int argc, const char *argv[], char **envp) {
 
   srand(getpid() * time(nullptr));
 
-  enum { ZMS_UNKNOWN, ZMS_MONITOR, ZMS_EVENT, ZMS_FIFO } source = ZMS_UNKNOWN;
-  enum { ZMS_JPEG, ZMS_MPEG, ZMS_RAW, ZMS_ZIP, ZMS_SINGLE } mode = ZMS_JPEG;
+  enum { ZMS_UNKNOWN, ZMS_MONITOR, ZMS_EVENT, ZMS_FIFO, ZMS_MONTAGE } source = ZMS_UNKNOWN;
+  enum { ZMS_JPEG, ZMS_MPEG, ZMS_RAW, ZMS_ZIP, ZMS_SINGLE, ZMS_FMP4 } mode = ZMS_JPEG;
   char format[32] = "";
   int monitor_id = 0;
+  std::vector<int> montage_monitor_ids;
   SystemTimePoint event_time = std::chrono::system_clock::time_point::min();
   uint64_t event_id = 0;
   unsigned int frame_id = 1;
@@ -91,8 +96,16 @@ int main(int argc, const char *argv[], char **envp) {
   char log_id_string[32] = "zms";
   logInit(log_id_string);
   zmLoadStaticConfig();
-  zmDbConnect();
-  zmLoadDBConfig();
+  if (!zmLoadSnapshotConfig()) {
+    zmDbConnect();
+    zmLoadDBConfig();
+    DbSnapshot::RefreshIfStale();
+  } else if (config.opt_use_auth or config.log_level_database > Logger::NOLOG) {
+    // The snapshot saves the config queries, but authentication and database
+    // logging still need a connection, and logInit only enables the latter
+    // if there is one.
+    zmDbConnect();
+  }
   logInit(log_id_string);
 
   for (char **env = envp; *env != 0; env++) {
@@ -133,6 +146,8 @@ int main(int argc, const char *argv[], char **envp) {
         source = ZMS_EVENT;
       } else if ( !strcmp(value, "fifo") ) {
         source = ZMS_FIFO;
+      } else if ( !strcmp(value, "montage") ) {
+        source = ZMS_MONTAGE;
       } else {
         source = ZMS_MONITOR;
       }
@@ -147,6 +162,8 @@ int main(int argc, const char *argv[], char **envp) {
         mode = ZMS_ZIP;
       } else if (!strcmp(value, "mpeg")) {
         mode = ZMS_MPEG;
+      } else if (!strcmp(value, "fmp4")) {
+        mode = ZMS_FMP4;
       } else if (!strcmp(value, "paused")) {
         mode = ZMS_JPEG;
       } else {
@@ -158,6 +175,12 @@ int main(int argc, const char *argv[], char **envp) {
       monitor_id = atoi(value);
       if ( source == ZMS_UNKNOWN )
         source = ZMS_MONITOR;
+    } else if ( !strcmp(name, "monitors") ) {
+      for (const std::string &id : Split(UriDecode(value), ',')) {
+        if (atoi(id.c_str()) > 0)
+          montage_monitor_ids.push_back(atoi(id.c_str()));
+      }
+      source = ZMS_MONTAGE;
     } else if ( !strcmp(name, "datetime") ) {
       std::tm tm = {};
       std::stringstream ss(value);
@@ -233,6 +256,8 @@ int main(int argc, const char *argv[], char **envp) {
     snprintf(log_id_string, sizeof(log_id_string), "zms_e%" PRIu64, event_id);
   } else if ( monitor_id ) {
     snprintf(log_id_string, sizeof(log_id_string), "zms_m%d", monitor_id);
+  } else if ( source == ZMS_MONTAGE ) {
+    snprintf(log_id_string, sizeof(log_id_string), "zms_montage");
   }
   logInit(log_id_string);
 
@@ -278,7 +303,14 @@ int main(int argc, const char *argv[], char **envp) {
               remote ? remote : "");
       return exit_zm(0);
     }
-    if ( !ValidateAccess(user, monitor_id) ) {
+    bool allowed = ValidateAccess(user, monitor_id);
+    if ( source == ZMS_MONTAGE ) {
+      // Recordings of every monitor shown
+      allowed = allowed && ValidateAccess(user, 0);
+      for (int montage_monitor_id : montage_monitor_ids)
+        allowed = allowed && ValidateAccess(user, montage_monitor_id);
+    }
+    if ( !allowed ) {
       delete user;
       user = nullptr;
       fputs("HTTP/1.0 403 Forbidden\r\n\r\n", stdout);
@@ -315,7 +347,12 @@ int main(int argc, const char *argv[], char **envp) {
     "Pragma: no-cache\r\n",
     stdout);
 
-  if ( source == ZMS_MONITOR ) {
+  if ( source == ZMS_MONITOR && mode == ZMS_FMP4 ) {
+    PassthroughStream stream;
+    stream.setStreamQueue(connkey);
+    if (stream.setStreamStart(monitor_id))
+      stream.runStream();
+  } else if ( source == ZMS_MONITOR ) {
     MonitorStream stream;
     stream.setStreamScale(scale);
     stream.setStreamReplayRate(rate);
@@ -346,6 +383,17 @@ int main(int argc, const char *argv[], char **envp) {
     stream.setStreamMaxFPS(maxfps);
     stream.setStreamStart(monitor_id, format);
     stream.runStream();
+  } else if ( source == ZMS_MONTAGE ) {
+    MontageStream stream;
+    stream.setStreamScale(scale);
+    stream.setStreamReplayRate(rate);
+    stream.setStreamMaxFPS(maxfps);
+    stream.setStreamQueue(connkey);
+    stream.setStreamFrameType(analysis_frames ? StreamBase::FRAME_ANALYSIS: StreamBase::FRAME_NORMAL);
+    stream.setStreamType(mode == ZMS_SINGLE ? StreamBase::STREAM_SINGLE : StreamBase::STREAM_JPEG);
+    stream.setStreamStart(montage_monitor_ids,
+                          event_time != std::chrono::system_clock::time_point::min() ? event_time : std::chrono::system_clock::now());
+    stream.runStream();
   } else if ( source == ZMS_EVENT ) {
     EventStream stream;
     stream.setStreamScale(scale);
@@ -0,0 +1,167 @@
+//
+// ZoneMinder Stream Daemon
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+/*
+
+=head1 NAME
+
+zmsd - The ZoneMinder Stream Daemon
+
+=head1 SYNOPSIS
+
+ zmsd
+ zmsd -p <port>
+ zmsd --port <port>
+ zmsd -h
+ zmsd --help
+ zmsd -v
+ zmsd --version
+
+=head1 DESCRIPTION
+
+This binary serves live MJPEG streams and snapshots of any number of
+monitors to any number of HTTP clients from a single process. It accepts the
+same query strings as nph-zms for live monitor views, so a viewer can be
+pointed at http://server:ZM_STREAM_SERVER_PORT/?monitor=1&scale=50&auth=...
+instead of at nph-zms. Event playback is still done by zms.
+
+=head1 OPTIONS
+
+ -p, --port                 - Port to listen on, defaults to ZM_STREAM_SERVER_PORT
+                              The address listened on is ZM_STREAM_SERVER_ADDRESS
+ -h, --help                 - Display usage information
+ -v, --version              - Print the installed version of ZoneMinder
+
+=cut
+
+*/
+
+#include "zm.h"
+#include "zm_db.h"
+#include "zm_signal.h"
+#include "zm_stream_server.h"
+#include "zm_utils.h"
+
+#include <getopt.h>
+#include <iostream>
+
+void Usage() {
+  fprintf(stderr, "zmsd [-p <port>]\n");
+
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -p, --port <port> : Port to listen on, defaults to ZM_STREAM_SERVER_PORT\n");
+  fprintf(stderr, "  -h, --help        : This screen\n");
+  fprintf(stderr, "  -v, --version     : Report the installed version of ZoneMinder\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  self = argv[0];
+
+  srand(getpid() * time(nullptr));
+
+  int port = 0;
+
+  static struct option long_options[] = {
+    {"port", 1, nullptr, 'p'},
+    {"help", 0, nullptr, 'h'},
+    {"version", 0, nullptr, 'v'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "p:hv", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'h':
+    case '?':
+      Usage();
+      break;
+    case 'v':
+      std::cout << ZM_VERSION << "\n";
+      exit(0);
+    default:
+      break;
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "Extraneous options, ");
+    while (optind < argc)
+      printf("%s ", argv[optind++]);
+    printf("\n");
+    Usage();
+  }
+
+  const char *log_id_string = "zmsd";
+  logInit(log_id_string);
+  zmLoadStaticConfig();
+  zmDbConnect();
+  zmLoadDBConfig();
+  logInit(log_id_string);
+
+  if (!port) port = config.stream_server_port;
+  if (!port) {
+    Debug(1, "Not starting stream server because stream_server_port not set");
+    exit(-1);
+  }
+
+  HwCapsDetect();
+  Image::Initialise();
+
+  Info("Starting Stream Server version %s", ZM_VERSION);
+  zmSetDefaultHupHandler();
+  zmSetDefaultTermHandler();
+  zmSetDefaultDieHandler();
+  // Writes to departed viewers fail with EPIPE, they must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+
+  StreamServer server(config.stream_server_address, port);
+  if (!server.Start()) {
+    Error("Failed starting stream server on port %d", port);
+    exit(-1);
+  }
+
+  while (!zm_terminate) {
+    // Often enough to pick up new frames at any capture rate
+    server.Poll(Milliseconds(10));
+
+    if (zm_reload) {
+      Info("Reloading configuration");
+      logTerm();
+      zmLoadDBConfig();
+      logInit(log_id_string);
+      zm_reload = false;
+    }  // end if zm_reload
+  }  // end while !zm_terminate
+
+  Info("Stream Server shutting down, %zu clients", server.ClientCount());
+
+  Image::Deinitialise();
+  logTerm();
+  zmDbClose();
+
+  return 0;
+}
@@ -0,0 +1,210 @@
+//
+// ZoneMinder Event Thumbnail Utility
+// Copyright (C) 2024 ZoneMinder Inc
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+/*
+
+=head1 NAME
+
+zmthumb - The ZoneMinder Event Thumbnail utility
+
+=head1 SYNOPSIS
+
+ zmthumb <event_id>[@<seconds>] ...
+ zmthumb [options] < event_list
+ zmthumb -h
+ zmthumb --help
+ zmthumb -V
+ zmthumb --version
+
+=head1 DESCRIPTION
+
+This utility writes jpegs of recorded events from their videos, in bulk, for
+example to regenerate every snapshot.jpg after moving storage. Events are
+given as arguments or, when there are none, one per line on standard input.
+Each is an event id, optionally followed by @ and an offset in seconds into
+the event. Without an offset the event's highest scoring frame is used and
+the jpeg is written as snapshot.jpg. With an offset, the offset in
+milliseconds is added to the file name, e.g. snapshot-1500.jpg.
+
+Each event's video is opened once. The highest scoring frame is decoded
+exactly, but for an offset only the keyframe at or before it is decoded.
+Events are shared out over several threads.
+
+=head1 OPTIONS
+
+ -j, --jobs <count>               - Threads to use, defaults to the number of cores
+ -o, --output <name>              - File name to write in the event directory, defaults to snapshot.jpg
+ -W, --width <pixels>             - Scale to this width, keeping the aspect ratio
+ -S, --scale <percent>            - Scale by this percentage instead, defaults to 100
+ -k, --keep                       - Don't replace jpegs that already exist
+ -v, --verbose                    - Increase verbosity
+ -h, --help                       - Display usage information
+ -V, --version                    - Print the installed version of ZoneMinder
+
+=cut
+
+*/
+
+#include "zm.h"
+#include "zm_config.h"
+#include "zm_db.h"
+#include "zm_image.h"
+#include "zm_signal.h"
+#include "zm_thumbnailer.h"
+#include "zm_utils.h"
+
+#include <getopt.h>
+#include <iostream>
+#include <thread>
+
+void Usage() {
+  fprintf(stderr, "zmthumb [-j <jobs>] [-o <name>] [-W <width> | -S <scale>] [-k] [<event_id>[@<seconds>] ...]\n");
+  fprintf(stderr, "\nEvents are read from standard input, one per line, if none are given.\n");
+  fprintf(stderr, "\nOptions:\n");
+  fprintf(stderr, "  -j, --jobs <count>           : Threads to use, defaults to the number of cores\n");
+  fprintf(stderr, "  -o, --output <name>          : File name to write in the event directory, defaults to snapshot.jpg\n");
+  fprintf(stderr, "  -W, --width <pixels>         : Scale to this width, keeping the aspect ratio\n");
+  fprintf(stderr, "  -S, --scale <percent>        : Scale by this percentage instead, defaults to 100\n");
+  fprintf(stderr, "  -k, --keep                   : Don't replace jpegs that already exist\n");
+  fprintf(stderr, "  -v, --verbose                : Increase debug verbosity\n");
+  fprintf(stderr, "  -h, --help                   : This screen\n");
+  fprintf(stderr, "  -V, --version                : Report the installed version of ZoneMinder\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  self = argv[0];
+
+  srand(getpid() * time(nullptr));
+
+  Thumbnailer::Options options;
+  options.jobs = std::max(1u, std::thread::hardware_concurrency());
+  int verbose = 0;
+
+  static struct option long_options[] = {
+    {"jobs", 1, nullptr, 'j'},
+    {"output", 1, nullptr, 'o'},
+    {"width", 1, nullptr, 'W'},
+    {"scale", 1, nullptr, 'S'},
+    {"keep", 0, nullptr, 'k'},
+    {"verbose", 0, nullptr, 'v'},
+    {"help", 0, nullptr, 'h'},
+    {"version", 0, nullptr, 'V'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "j:o:W:S:kvhV", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'j':
+      options.jobs = std::max(1, atoi(optarg));
+      break;
+    case 'o':
+      options.name = optarg;
+      break;
+    case 'W':
+      options.width = atoi(optarg);
+      break;
+    case 'S':
+      options.scale = atoi(optarg);
+      break;
+    case 'k':
+      options.overwrite = false;
+      break;
+    case 'v':
+      verbose++;
+      break;
+    case 'h':
+    case '?':
+      Usage();
+      break;
+    case 'V':
+      std::cout << ZM_VERSION << "\n";
+      exit(0);
+    default:
+      break;
+    }
+  }
+
+  if (options.name.empty() or options.name.find('/') != std::string::npos) {
+    fprintf(stderr, "The output name must be a plain file name\n");
+    Usage();
+  }
+  if (options.width < 0 or options.scale <= 0) {
+    fprintf(stderr, "Width and scale must be positive\n");
+    Usage();
+  }
+
+  std::vector<ThumbnailRequest> requests;
+  auto add_request = [&requests](const std::string &spec) {
+    ThumbnailRequest request;
+    if (Thumbnailer::ParseRequest(spec, request)) {
+      requests.push_back(request);
+    } else if (spec.find_first_not_of(" \t\r\n") != std::string::npos) {
+      fprintf(stderr, "Ignoring invalid event '%s'\n", spec.c_str());
+    }
+  };
+  if (optind < argc) {
+    while (optind < argc)
+      add_request(argv[optind++]);
+  } else {
+    std::string line;
+    while (std::getline(std::cin, line))
+      add_request(line);
+  }
+  if (requests.empty()) {
+    fprintf(stderr, "No events given\n");
+    exit(-1);
+  }
+
+  const char *log_id_string = "zmthumb";
+  logInit(log_id_string);
+  zmLoadStaticConfig();
+  zmDbConnect();
+  zmLoadDBConfig();
+  logInit(log_id_string);
+  if (verbose) {
+    Logger::fetch()->level(static_cast<Logger::Level>(Logger::DEBUG1 + verbose - 1));
+  }
+
+  HwCapsDetect();
+  Image::Initialise();
+
+  zmSetDefaultTermHandler();
+  zmSetDefaultDieHandler();
+
+  std::vector<ThumbnailEvent> events = Thumbnailer::LoadEvents(requests);
+  Info("Writing %zu thumbnails of %zu events with %u threads", requests.size(), events.size(), options.jobs);
+
+  Thumbnailer thumbnailer(options);
+  unsigned int written = thumbnailer.Run(events);
+  Info("Wrote %u of %zu thumbnails", written, requests.size());
+
+  Image::Deinitialise();
+  Debug(1, "Terminating");
+  dbQueue.stop();
+  zmDbClose();
+  logTerm();
+
+  return written == requests.size() ? 0 : 1;
+}
@@ -31,6 +31,8 @@ zmc - The ZoneMinder Utility
  zmu -m monitor_id [-v] [function] [-U<username> -P<password>]
  zmu --monitor monitor_id [-v] [function] [-U<username> -P<password>]
 
+ zmu -F event_id [-o seconds] [-K] [-S scale] [-U<username> -P<password>]
+
 =head1 DESCRIPTION
 
 This binary is a handy command line interface to several useful functions. It's
@@ -82,16 +84,26 @@ Options for use with monitors:
   -P, --password <password>               - password combination of the given user
   -A, --auth <authentication>             - Pass authentication hash string instead of user details
   -x, --xtrigger                          - Output the current monitor trigger state, 0 = not triggered, 1 = triggered
+
+Options for use with event videos:
+  -F, --frame <event_id>                  - Write the frame at --offset in an event's video to disk as Frame.jpg,
+                                            --scale may be given too
+  -o, --offset <seconds>                  - With --frame, how far into the video, default 0
+  -K, --keyframe                          - With --frame, take the keyframe at or before --offset instead,
+                                            which doesn't need the frames in between decoded
 =cut
 
 */
 
 #include "zm.h"
 #include "zm_db.h"
+#include "zm_db_snapshot.h"
+#include "zm_ffmpeg_input.h"
 #include "zm_user.h"
 #include "zm_signal.h"
 #include "zm_monitor.h"
 #include "zm_local_camera.h"
+#include "zm_storage.h"
 #include <getopt.h>
 #include <unistd.h>
 
@@ -140,6 +152,12 @@ void Usage(int status=-1) {
     "  -A, --auth <authentication>  : Pass authentication hash string instead of user details\n"
     "  -T, --token <token>  : Pass JWT token string instead of user details\n"
     "  -x, --xtrigger       : Output the current monitor trigger state, 0 = not triggered, 1 = triggered\n"
+    "Options for use with event videos:\n"
+    "  -F, --frame <event_id>       : Write the frame at --offset in an event's video to disk as Frame.jpg,\n"
+    "                   --scale may be given too\n"
+    "  -o, --offset <seconds>       : With --frame, how far into the video, default 0\n"
+    "  -K, --keyframe           : With --frame, take the keyframe at or before --offset instead,\n"
+    "                   which doesn't need the frames in between decoded\n"
 
     "", stderr );
 
@@ -165,6 +183,7 @@ typedef enum {
   ZMU_HUE        = 0x00004000,
   ZMU_COLOUR     = 0x00008000,
   ZMU_RELOAD     = 0x00010000,
+  ZMU_FRAME      = 0x00020000,
   ZMU_ENABLE     = 0x00100000,
   ZMU_DISABLE    = 0x00200000,
   ZMU_SUSPEND    = 0x00400000,
@@ -180,7 +199,7 @@ bool ValidateAccess(User *user, int mon_id, int function) {
     if ( user->getStream() < User::PERM_VIEW )
       allowed = false;
   }
-  if ( function & ZMU_EVENT ) {
+  if ( function & (ZMU_EVENT|ZMU_FRAME) ) {
     if ( user->getEvents() < User::PERM_VIEW )
       allowed = false;
   }
@@ -200,6 +219,52 @@ bool ValidateAccess(User *user, int mon_id, int function) {
   return allowed;
 }
 
+// Finds an event's video, and the monitor the event belongs to
+bool FindEventVideo(uint64_t event_id, std::string &path, int &monitor_id) {
+  std::string sql = stringtf("SELECT `MonitorId`, `StorageId`, unix_timestamp(`StartDateTime`), `DefaultVideo`, `Scheme` "
+                             "FROM `Events` WHERE `Id` = %" PRIu64, event_id);
+  zmDbRow *row = zmDbFetchOne(sql);
+  if (!row) {
+    Error("Event %" PRIu64 " not found", event_id);
+    return false;
+  }
+  MYSQL_ROW dbrow = row->mysql_row();
+  monitor_id = atoi(dbrow[0]);
+  unsigned int storage_id = dbrow[1] ? atoi(dbrow[1]) : 0;
+  SystemTimePoint start_time = SystemTimePoint(Seconds(dbrow[2] ? atoi(dbrow[2]) : 0));
+  std::string video_file = dbrow[3] ? dbrow[3] : "";
+  Storage::Schemes scheme = Storage::SchemeFromString(dbrow[4] ? dbrow[4] : "");
+  delete row;
+
+  if (video_file.empty()) {
+    Error("Event %" PRIu64 " has no video", event_id);
+    return false;
+  }
+  Storage storage(storage_id);
+  path = Storage::EventPath(storage.Path(), scheme, monitor_id, event_id, start_time) + "/" + video_file;
+  return true;
+}
+
+// Writes one frame of an event video to Frame.jpg
+bool WriteVideoFrame(const std::string &path, double offset, bool keyframe, int scale) {
+  FFmpeg_Input input;
+  if (input.Open(path.c_str()) < 0 or input.get_video_stream_id() < 0) {
+    Error("Unable to open video %s", path.c_str());
+    return false;
+  }
+  input.set_keyframes_only(keyframe);
+
+  AVFrame *frame = input.get_frame(input.get_video_stream_id(), offset);
+  if (!frame) {
+    Error("Unable to get a frame at %.2fs in %s", offset, path.c_str());
+    return false;
+  }
+  Image image(frame, -1, -1);
+  if (scale > 0 and scale != ZM_SCALE_BASE)
+    image.Scale(scale);
+  return image.WriteJpeg("Frame.jpg");
+}
+
 void exit_zmu(int exit_code) {
   dbQueue.stop();
   logTerm();
@@ -253,6 +318,9 @@ int main(int argc, char *argv[]) {
     {"help", 0, nullptr, 'h'},
     {"list", 0, nullptr, 'l'},
     {"xtrigger", 0, nullptr, 'x'},
+    {"frame", 1, nullptr, 'F'},
+    {"offset", 1, nullptr, 'o'},
+    {"keyframe", 0, nullptr, 'K'},
     {nullptr, 0, nullptr, 0}
   };
 
@@ -275,6 +343,9 @@ int main(int argc, char *argv[]) {
   bool have_colour = false;
 
   char *zoneString = nullptr;
+  uint64_t frame_event_id = 0;
+  double frame_offset = 0;
+  bool keyframe = false;
   std::string username;
   std::string password;
   char *auth = nullptr;
@@ -285,7 +356,7 @@ int main(int argc, char *argv[]) {
   while (1) {
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "d:m:vsjEDLurweix::S:t::fz::ancqhlB::C::H::O::RWU:P:A:V:T:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "d:m:vsjEDLurweix::S:t::fz::ancqhlB::C::H::O::RWU:P:A:V:T:F:o:K", long_options, &option_index);
     if (c == -1) {
       break;
     }
@@ -419,6 +490,16 @@ int main(int argc, char *argv[]) {
     case 'l':
       function |= ZMU_LIST;
       break;
+    case 'F':
+      function |= ZMU_FRAME;
+      frame_event_id = strtoull(optarg, nullptr, 10);
+      break;
+    case 'o':
+      frame_offset = atof(optarg);
+      break;
+    case 'K':
+      keyframe = true;
+      break;
     default:
       //fprintf( stderr, "?? getopt returned character code 0%o ??\n", c );
       break;
@@ -437,7 +518,7 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Error, -d option cannot be used with this option\n");
     Usage();
   }
-  if ( scale != -1 && !(function&ZMU_IMAGE) ) {
+  if ( scale != -1 && !(function&(ZMU_IMAGE|ZMU_FRAME)) ) {
     fprintf(stderr, "Error, -S option cannot be used with this option\n");
     Usage();
   }
@@ -445,8 +526,16 @@ int main(int argc, char *argv[]) {
 
   logInit("zmu");
   zmLoadStaticConfig();
-  zmDbConnect();
-  zmLoadDBConfig();
+  if (!zmLoadSnapshotConfig()) {
+    zmDbConnect();
+    zmLoadDBConfig();
+    DbSnapshot::RefreshIfStale();
+  } else if (config.opt_use_auth or config.log_level_database > Logger::NOLOG or (function & ZMU_FRAME)) {
+    // The snapshot saves the config queries, but authentication, finding an
+    // event and database logging still need a connection, and logInit only
+    // enables the last if there is one.
+    zmDbConnect();
+  }
   logInit("zmu");
 
   zmSetDefaultTermHandler();
@@ -500,6 +589,25 @@ int main(int argc, char *argv[]) {
     }
   } // end if auth
 
+  if ( function & ZMU_FRAME ) {
+    std::string frame_path;
+    int frame_monitor_id = 0;
+    if ( !FindEventVideo(frame_event_id, frame_path, frame_monitor_id) )
+      exit_zmu(-1);
+    if ( user && !user->canAccess(frame_monitor_id) ) {
+      Error("Insufficient privileges for user %s for monitor %d", user->getUsername(), frame_monitor_id);
+      exit_zmu(-1);
+    }
+    if ( verbose ) {
+      printf("Dumping %s at %.2fs of %s to Frame.jpg", keyframe ? "keyframe" : "frame", frame_offset, frame_path.c_str());
+      if ( scale != -1 )
+        printf(", scaling by %d%%", scale);
+      printf("\n");
+    }
+    if ( !WriteVideoFrame(frame_path, frame_offset, keyframe, scale) )
+      exit_zmu(-1);
+  }
+
   if ( mon_id > 0 ) {
     std::shared_ptr<Monitor> monitor = Monitor::Load(mon_id, function&(ZMU_QUERY|ZMU_ZONES), Monitor::QUERY);
     if ( !monitor ) {
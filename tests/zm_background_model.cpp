@@ -0,0 +1,108 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_background_model.h"
+#include "zm_config.h"
+#include "zm_image.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+void bootstrap_image_config() {
+  config.font_file_location = "data/fonts/04_valid.zmfnt";
+}
+}  // namespace
+
+TEST_CASE("BackgroundModel: blend shift") {
+  CHECK(BackgroundModel::BlendShift(0) == 0);
+  CHECK(BackgroundModel::BlendShift(50) == 1);
+  CHECK(BackgroundModel::BlendShift(25) == 2);
+  CHECK(BackgroundModel::BlendShift(12) == 3);
+  CHECK(BackgroundModel::BlendShift(6) == 4);
+  CHECK(BackgroundModel::BlendShift(1) == 7);
+}
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE)
+TEST_CASE("BackgroundModel: SSE2 kernels match the standard ones") {
+  std::mt19937 rng(7);
+  const unsigned long count = 1000;  // Not a multiple of 16, to cover the tail
+  std::vector<uint8_t> in(count);
+  std::vector<int16_t> mean(count), deviation(count);
+  for (unsigned long i = 0; i < count; i++)
+    mean[i] = (rng() % 256) << BackgroundModel::kFractionBits;
+  std::vector<int16_t> sse2_mean = mean, sse2_deviation = deviation;
+  std::vector<uint8_t> delta(count), sse2_delta(count);
+
+  for (int pass = 0; pass < 50; pass++) {
+    for (uint8_t &pixel : in) pixel = rng() % 256;
+    const int shift = 1 + pass % BackgroundModel::kFractionBits;
+    std_background_update8(in.data(), mean.data(), deviation.data(), shift, count);
+    sse2_background_update8(in.data(), sse2_mean.data(), sse2_deviation.data(), shift, count);
+    REQUIRE(mean == sse2_mean);
+    REQUIRE(deviation == sse2_deviation);
+
+    std_background_delta8(in.data(), mean.data(), deviation.data(), delta.data(), count);
+    sse2_background_delta8(in.data(), mean.data(), deviation.data(), sse2_delta.data(), count);
+    REQUIRE(delta == sse2_delta);
+  }
+}
+#endif
+
+TEST_CASE("BackgroundModel: noisy pixels need a larger change") {
+  bootstrap_image_config();
+  const int w = 32, h = 8;
+  std::mt19937 rng(11);
+
+  // Left half static at 100, right half flickering 100 +/- 20
+  Image frame(w, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  auto fill = [&](int static_value, bool noisy) {
+    for (int y = 0; y < h; y++) {
+      uint8_t *row = frame.Buffer(0, y);
+      for (int x = 0; x < w; x++)
+        row[x] = (x < w / 2 || !noisy) ? static_value : ((rng() & 1) ? 120 : 80);
+    }
+  };
+
+  BackgroundModel model;
+  fill(100, false);
+  REQUIRE(model.Reset(frame));
+  REQUIRE(model.Width() == w);
+
+  // Nothing learnt yet, a change shows in full
+  Image delta;
+  fill(140, false);
+  REQUIRE(model.Delta(frame, &delta));
+  CHECK(delta.Buffer(0, 0)[0] == 40);
+  CHECK(delta.Buffer(w - 1, 0)[0] == 40);
+
+  for (int i = 0; i < 200; i++) {
+    fill(100, true);
+    REQUIRE(model.Update(frame, 12));
+  }
+
+  // The same 40 level step now only stands out on the static side
+  fill(140, false);
+  REQUIRE(model.Delta(frame, &delta));
+  CHECK(delta.Buffer(0, 0)[0] >= 39);
+  CHECK(delta.Buffer(w - 1, 0)[0] <= 10);
+
+  Image wrong_size(w / 2, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  CHECK_FALSE(model.Delta(wrong_size, &delta));
+}
@@ -135,3 +135,27 @@ TEST_CASE("zm::crypto::SHA1::GetDigestOf") {
   REQUIRE(digest == SHA1::Digest{0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e, 0x25, 0x71, 0x78, 0x50,
                                  0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d});
 }
+
+TEST_CASE("zm::crypto::HmacSHA1") {
+  using namespace zm::crypto;
+
+  SECTION("RFC 2202 test case 2") {
+    SHA1::Digest hmac = HmacSHA1("Jefe", "what do ya want for nothing?");
+    REQUIRE(hmac == SHA1::Digest{0xef, 0xfc, 0xdf, 0x6a, 0xe5, 0xeb, 0x2f, 0xa2, 0xd2, 0x74, 0x16, 0xd5, 0xf1, 0x84,
+                                 0xdf, 0x9c, 0x25, 0x9a, 0x7c, 0x79});
+  }
+
+  SECTION("key longer than the block size") {
+    SHA1::Digest hmac = HmacSHA1(std::string(80, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First");
+    REQUIRE(hmac == SHA1::Digest{0xaa, 0x4a, 0xe5, 0xe1, 0x52, 0x72, 0xd0, 0x0e, 0x95, 0x70, 0x56, 0x37, 0xce, 0x8a,
+                                 0x3b, 0x55, 0xed, 0x40, 0x21, 0x12});
+  }
+}
+
+TEST_CASE("zm::crypto::ConstantTimeEquals") {
+  using namespace zm::crypto;
+  REQUIRE(ConstantTimeEquals("", ""));
+  REQUIRE(ConstantTimeEquals("abc", "abc"));
+  REQUIRE_FALSE(ConstantTimeEquals("abc", "abd"));
+  REQUIRE_FALSE(ConstantTimeEquals("abc", "abcd"));
+}
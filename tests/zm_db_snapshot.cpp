@@ -0,0 +1,123 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_db_snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t kSchema = 0x1234;
+
+std::string SnapshotPath() {
+  return "/tmp/zm_db_snapshot_test." + std::to_string(getpid());
+}
+
+bool SaveMonitors(const std::string &path, SystemTimePoint created) {
+  DbSnapshot::Builder builder;
+  builder.AddTable("Monitors", 3);
+  char id1[] = "1", name1[] = "Front", id2[] = "12", name2[] = "Back", empty[] = "";
+  char *row1[] = {id1, name1, nullptr};
+  char *row2[] = {id2, name2, empty};
+  builder.AddRow(row1);
+  builder.AddRow(row2);
+  builder.AddTable("Storage", 1);
+  return builder.Save(path, kSchema, created);
+}
+
+}  // namespace
+
+TEST_CASE("DbSnapshot: rows round trip") {
+  const std::string path = SnapshotPath();
+  REQUIRE(SaveMonitors(path, std::chrono::system_clock::now()));
+
+  DbSnapshot snapshot;
+  REQUIRE(snapshot.Open(path, kSchema));
+
+  const DbSnapshot::Table *monitors = snapshot.Find("Monitors");
+  REQUIRE(monitors != nullptr);
+  REQUIRE(monitors->Fields() == 3);
+  REQUIRE(monitors->Rows() == 2);
+  CHECK(std::string(monitors->Row(1)[1]) == "Back");
+
+  MYSQL_ROW row = snapshot.FindRow("Monitors", 0, 1);
+  REQUIRE(row != nullptr);
+  CHECK(std::string(row[1]) == "Front");
+  CHECK(row[2] == nullptr);
+
+  row = snapshot.FindRow("Monitors", 0, 12);
+  REQUIRE(row != nullptr);
+  CHECK(row[2] != nullptr);
+  CHECK(*row[2] == '\0');
+
+  CHECK(snapshot.FindRow("Monitors", 0, 2) == nullptr);
+  CHECK(snapshot.FindRow("Monitors", 5, 1) == nullptr);
+  CHECK(snapshot.FindRows("Monitors", 0, 12).size() == 1);
+
+  REQUIRE(snapshot.Find("Storage") != nullptr);
+  CHECK(snapshot.Find("Storage")->Rows() == 0);
+  CHECK(snapshot.Find("Zones") == nullptr);
+
+  snapshot.Close();
+  unlink(path.c_str());
+}
+
+TEST_CASE("DbSnapshot: stale or foreign snapshots are rejected") {
+  const std::string path = SnapshotPath();
+  DbSnapshot snapshot;
+
+  SECTION("missing") {
+    unlink(path.c_str());
+    CHECK_FALSE(snapshot.Open(path, kSchema));
+  }
+
+  SECTION("different queries") {
+    REQUIRE(SaveMonitors(path, std::chrono::system_clock::now()));
+    CHECK_FALSE(snapshot.Open(path, kSchema + 1));
+  }
+
+  SECTION("too old") {
+    REQUIRE(SaveMonitors(path, std::chrono::system_clock::now() - DbSnapshot::kMaxAge - Seconds(5)));
+    CHECK_FALSE(snapshot.Open(path, kSchema));
+    CHECK(snapshot.Open(path, kSchema, DbSnapshot::kMaxAge + Seconds(60)));
+    snapshot.Close();
+  }
+
+  SECTION("truncated") {
+    REQUIRE(SaveMonitors(path, std::chrono::system_clock::now()));
+    REQUIRE(truncate(path.c_str(), 60) == 0);
+    CHECK_FALSE(snapshot.Open(path, kSchema));
+  }
+
+  SECTION("damaged") {
+    REQUIRE(SaveMonitors(path, std::chrono::system_clock::now()));
+    // Break the NUL terminating the table name
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(40 + 4 + strlen("Monitors"));
+    file.put('x');
+    file.close();
+    CHECK_FALSE(snapshot.Open(path, kSchema));
+  }
+
+  CHECK_FALSE(snapshot.IsOpen());
+  unlink(path.c_str());
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_event_export.h"
+
+#include <ctime>
+
+TEST_CASE("EventExporter: timeline joins segments") {
+  EventExporter::Timeline timeline;
+  REQUIRE(!timeline.Started());
+
+  // The first segment starts the output at zero
+  timeline.StartSegment(5000000);
+  REQUIRE(timeline.Started());
+  REQUIRE(timeline.Map(5000000) == 0);
+  REQUIRE(timeline.Map(5040000) == 40000);
+  timeline.Extend(0, 40000);
+  timeline.Extend(40000, 40000);
+  REQUIRE(timeline.End() == 80000);
+
+  // The next carries on from the end of the first, whatever its own timestamps
+  timeline.StartSegment(100);
+  REQUIRE(timeline.Map(100) == 80000);
+  REQUIRE(timeline.Map(40100) == 120000);
+
+  // Out of order packets don't pull the end back
+  timeline.Extend(120000, 40000);
+  timeline.Extend(80000, 40000);
+  REQUIRE(timeline.End() == 160000);
+  timeline.Extend(160000, -1);
+  REQUIRE(timeline.End() == 160000);
+}
+
+TEST_CASE("EventExporter: parse times") {
+  SystemTimePoint time;
+
+  REQUIRE(EventExporter::ParseTime("1700000000", time));
+  REQUIRE(time == SystemTimePoint(Seconds(1700000000)));
+
+  tm tm_time = {};
+  tm_time.tm_year = 2024 - 1900;
+  tm_time.tm_mon = 2;
+  tm_time.tm_mday = 14;
+  tm_time.tm_hour = 13;
+  tm_time.tm_min = 5;
+  tm_time.tm_sec = 9;
+  tm_time.tm_isdst = -1;
+  const SystemTimePoint expected = std::chrono::system_clock::from_time_t(mktime(&tm_time));
+
+  REQUIRE(EventExporter::ParseTime("2024-03-14 13:05:09", time));
+  REQUIRE(time == expected);
+  REQUIRE(EventExporter::ParseTime("2024-03-14T13:05:09", time));
+  REQUIRE(time == expected);
+}
+
+TEST_CASE("EventExporter: reject bad times") {
+  SystemTimePoint time = SystemTimePoint(Seconds(42));
+
+  REQUIRE(!EventExporter::ParseTime("", time));
+  REQUIRE(!EventExporter::ParseTime("-5", time));
+  REQUIRE(!EventExporter::ParseTime("12.5", time));
+  REQUIRE(!EventExporter::ParseTime("2024-03-14", time));
+  REQUIRE(!EventExporter::ParseTime("2024-03-14 13:05:09 extra", time));
+  REQUIRE(!EventExporter::ParseTime("yesterday", time));
+  // Left alone on failure
+  REQUIRE(time == SystemTimePoint(Seconds(42)));
+}
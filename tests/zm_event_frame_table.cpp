@@ -0,0 +1,121 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_event_frame_table.h"
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+std::string TablePath() {
+  return "/tmp/zm_event_frame_table_test." + std::to_string(getpid());
+}
+
+}  // namespace
+
+TEST_CASE("EventFrameTable: frames round trip") {
+  const std::string path = TablePath();
+  {
+    EventFrameTable::Writer writer;
+    REQUIRE(writer.Open(path));
+    for (int i = 0; i < 200; i++)
+      writer.Append(Milliseconds(i * 100), i % 3, i == 150 ? 42 : 0, i % 10 == 0);
+  }
+
+  EventFrameTable table;
+  REQUIRE(table.Open(path));
+  REQUIRE(table.Size() == 200);
+  CHECK(table.Offset(0) == Microseconds(0));
+  CHECK(table.Offset(199) == Milliseconds(19900));
+
+  EventFrameTable::Record record = table.At(150);
+  CHECK(record.offset == 15000000);
+  CHECK(record.score == 42);
+  CHECK(record.type == 0);
+  CHECK(record.in_db == 1);
+  CHECK(table.At(151).in_db == 0);
+
+  table.Close();
+  CHECK(!table.IsOpen());
+  unlink(path.c_str());
+}
+
+TEST_CASE("EventFrameTable: only flushed frames are visible") {
+  const std::string path = TablePath();
+  EventFrameTable::Writer writer;
+  REQUIRE(writer.Open(path));
+
+  EventFrameTable table;
+  REQUIRE(table.Open(path));
+  CHECK(table.Size() == 0);
+
+  for (int i = 0; i < 3; i++)
+    writer.Append(Seconds(i), 0, 0, false);
+  REQUIRE(table.Open(path));
+  CHECK(table.Size() == 0);
+
+  REQUIRE(writer.Flush());
+  REQUIRE(table.Open(path));
+  CHECK(table.Size() == 3);
+
+  // A record cut short by a reader catching the writer mid write is ignored
+  writer.Close();
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    file.write("partial", 7);
+  }
+  REQUIRE(table.Open(path));
+  CHECK(table.Size() == 3);
+  unlink(path.c_str());
+}
+
+TEST_CASE("EventFrameTable: upper bound") {
+  const std::string path = TablePath();
+  {
+    EventFrameTable::Writer writer;
+    REQUIRE(writer.Open(path));
+    for (int i = 0; i < 10; i++)
+      writer.Append(Seconds(i), 0, 0, false);
+  }
+
+  EventFrameTable table;
+  REQUIRE(table.Open(path));
+  CHECK(table.UpperBound(Microseconds(-1)) == 0);
+  CHECK(table.UpperBound(Seconds(0)) == 1);
+  CHECK(table.UpperBound(Milliseconds(4500)) == 5);
+  CHECK(table.UpperBound(Seconds(9)) == 10);
+  CHECK(table.UpperBound(Seconds(100)) == 10);
+  unlink(path.c_str());
+}
+
+TEST_CASE("EventFrameTable: rejects other files") {
+  const std::string path = TablePath();
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "not a frame table at all";
+  }
+  EventFrameTable table;
+  CHECK(!table.Open(path));
+  CHECK(!table.IsOpen());
+  unlink(path.c_str());
+
+  CHECK(!table.Open(path));
+}
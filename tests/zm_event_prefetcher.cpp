@@ -0,0 +1,65 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_event_prefetcher.h"
+
+TEST_CASE("EventFramePrefetcher: window forwards") {
+  REQUIRE(EventFramePrefetcher::Window(5, 1, 4, 100) == std::vector<int>{5, 6, 7, 8});
+  // Fast forward skips frames
+  REQUIRE(EventFramePrefetcher::Window(5, 4, 3, 100) == std::vector<int>{5, 9, 13});
+  // Stops at the end of the event
+  REQUIRE(EventFramePrefetcher::Window(98, 1, 8, 100) == std::vector<int>{98, 99, 100});
+}
+
+TEST_CASE("EventFramePrefetcher: window in reverse") {
+  REQUIRE(EventFramePrefetcher::Window(5, -1, 3, 100) == std::vector<int>{5, 4, 3});
+  REQUIRE(EventFramePrefetcher::Window(5, -2, 8, 100) == std::vector<int>{5, 3, 1});
+  REQUIRE(EventFramePrefetcher::Window(3, -1, 8, 100) == std::vector<int>{3, 2, 1});
+}
+
+TEST_CASE("EventFramePrefetcher: window outside the event") {
+  REQUIRE(EventFramePrefetcher::Window(0, 1, 8, 100).empty());
+  REQUIRE(EventFramePrefetcher::Window(101, -1, 8, 100) == std::vector<int>{});
+  REQUIRE(EventFramePrefetcher::Window(1, 1, 8, 0).empty());
+  // A paused stream looks forwards
+  REQUIRE(EventFramePrefetcher::Window(5, 0, 2, 100) == std::vector<int>{5, 6});
+}
+
+TEST_CASE("EventFramePrefetcher: cache size follows the frame size") {
+  REQUIRE(EventFramePrefetcher::CacheFrames(1920, 1080) == 10);
+  REQUIRE(EventFramePrefetcher::CacheFrames(1280, 720) == 24);
+  REQUIRE(EventFramePrefetcher::CacheFrames(1920, 1080, EventFramePrefetcher::kMaxCacheBytes) == 43);
+  REQUIRE(EventFramePrefetcher::CacheFrames(320, 240) == EventFramePrefetcher::kMaxCacheFrames);
+  REQUIRE(EventFramePrefetcher::CacheFrames(7680, 4320) == EventFramePrefetcher::kMinCacheFrames);
+  REQUIRE(EventFramePrefetcher::CacheFrames(0, 0) == EventFramePrefetcher::kMaxCacheFrames);
+}
+
+TEST_CASE("EventFramePrefetcher: reverse play looks back a GOP") {
+  // Forwards, or before a GOP has been seen, the window is left alone
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 30, 1, 40) == 5);
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 0, -1, 40) == 5);
+
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 30, -1, 40) == 30);
+  // Only every other frame of the GOP is shown
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 30, -2, 40) == 15);
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 30, -4, 40) == 8);
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 30, -10, 40) == 5);
+  // Bounded by the memory allowed
+  REQUIRE(EventFramePrefetcher::WindowFrames(5, 100, -1, 40) == 40);
+}
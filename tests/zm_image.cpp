@@ -19,14 +19,17 @@
 
 #include "zm_config.h"
 #include "zm_image.h"
+#include "zm_poly.h"
 #include "zm_rgb.h"
 
 extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 namespace {
 
@@ -181,6 +184,158 @@ TEST_CASE("Image::Scale YUV420P with non-32-multiple width", "[image]") {
   }
 }
 
+// Scaling in place trades buffers with a scratch image instead of
+// allocating, so going back and forth between two sizes settles on the
+// same two buffers.
+TEST_CASE("Image::Scale in place reuses its buffers", "[image]") {
+  bootstrap_image_config();
+  Image image(640, 480, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB);
+  REQUIRE(image.Buffer() != nullptr);
+  memset(image.Buffer(), 128, image.Size());
+
+  image.Scale(320, 240);
+  REQUIRE(image.Width() == 320);
+  REQUIRE(image.Height() == 240);
+  const uint8_t *small = image.Buffer();
+  image.Scale(640, 480);
+  REQUIRE(image.Width() == 640);
+  const uint8_t *large = image.Buffer();
+  CHECK(large != small);
+
+  image.Scale(320, 240);
+  CHECK(image.Buffer() == small);
+  image.Scale(640, 480);
+  CHECK(image.Buffer() == large);
+  CHECK(image.Buffer()[image.Size() / 2] == 128);
+}
+
+TEST_CASE("Image::Annotate cached matches uncached", "[image]") {
+  bootstrap_image_config();
+  const int w = 320, h = 120;
+  struct Format { int colours; int subpixelorder; };
+  const Format formats[] = {
+    { ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE },
+    { ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB },
+    { ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA },
+  };
+  // Same length texts exercise the changed character path, the others a
+  // full re-render
+  const char *texts[] = {
+    "Front - 24/10/18 12:00:01",
+    "Front - 24/10/18 12:00:02",
+    "Front - 24/10/18 12:01:19",
+    "Back\n24/10/18 12:01:19",
+    "Front - 24/10/18 12:01:20",
+  };
+
+  for (const Format &format : formats) {
+    for (Rgb bg : { kRGBBlack, kRGBTransparent }) {
+      AnnotationCache cache;
+      for (uint8 size : { 1, 2 }) {
+        for (const char *text : texts) {
+          INFO("colours " << format.colours << " bg " << bg << " size " << +size << " text " << text);
+          Image expected(w, h, format.colours, format.subpixelorder);
+          Image actual(w, h, format.colours, format.subpixelorder);
+          for (unsigned int i = 0; i < expected.Size(); i++)
+            expected.Buffer()[i] = actual.Buffer()[i] = static_cast<uint8_t>(i * 7);
+
+          expected.Annotate(text, {5, 5}, size, kRGBWhite, bg);
+          actual.Annotate(cache, text, {5, 5}, size, kRGBWhite, bg);
+          REQUIRE(memcmp(expected.Buffer(), actual.Buffer(), expected.Size()) == 0);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Image::Fill polygon with density", "[image]") {
+  bootstrap_image_config();
+  const int w = 64, h = 32;
+  struct Format { int colours; int subpixelorder; };
+  const Format formats[] = {
+    { ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE },
+    { ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB },
+    { ZM_COLOUR_RGB32, ZM_SUBPIX_ORDER_RGBA },
+  };
+  // The bottom row isn't part of the scan-line fill
+  Polygon polygon({{11, 5}, {40, 5}, {40, 25}, {11, 25}});
+
+  for (const Format &format : formats) {
+    for (int density : { 1, 2, 3 }) {
+      Image image(w, h, format.colours, format.subpixelorder);
+      memset(image.Buffer(), 0, image.Size());
+      image.Fill(kRGBWhite, density, polygon);
+
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          INFO("colours " << format.colours << " density " << density << " pixel " << x << "," << y);
+          bool inside = x >= 11 && x <= 40 && y >= 5 && y < 25;
+          bool set = inside && !(x % density) && !(y % density);
+          const uint8_t *p = image.Buffer(x, y);
+          // kRGBWhite leaves the alpha byte alone
+          for (int c = 0; c < std::min(format.colours, 3); c++)
+            REQUIRE(p[c] == (set ? 0xff : 0));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Image::HalfScale YUV420P", "[image]") {
+  bootstrap_image_config();
+  const int w = 70, h = 38;  // odd chroma width once halved
+  Image image(w, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_YUV420P);
+  Planes src = plane_view(image, AV_PIX_FMT_YUV420P, w, h);
+  // Luma alternates 10/30 across columns and 0/40 down rows, so every 2x2
+  // block averages to (10+30+50+70)/4 = 40
+  for (int y = 0; y < h; y++) {
+    uint8_t *row = src.data[0] + static_cast<size_t>(y) * src.stride[0];
+    for (int x = 0; x < w; x++)
+      row[x] = (x & 1 ? 30 : 10) + (y & 1 ? 40 : 0);
+  }
+  memset(src.data[1], 100, static_cast<size_t>(src.stride[1]) * (h / 2));
+  memset(src.data[2], 160, static_cast<size_t>(src.stride[2]) * (h / 2));
+
+  Image half(w / 2, h / 2, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_YUV420P);
+  REQUIRE(image.HalfScale(half));
+  REQUIRE(half.PixFormat() == AV_PIX_FMT_YUV420P);
+
+  Planes dst = plane_view(half, AV_PIX_FMT_YUV420P, w / 2, h / 2);
+  for (int y = 0; y < h / 2; y++) {
+    const uint8_t *row = dst.data[0] + static_cast<size_t>(y) * dst.stride[0];
+    for (int x = 0; x < w / 2; x++) {
+      INFO("luma " << x << "," << y);
+      REQUIRE(row[x] == 40);
+    }
+  }
+  // 35x19 has 18x10 chroma, the last column and row come from a single source sample
+  for (int y = 0; y < (h / 2 + 1) / 2; y++) {
+    for (int x = 0; x < (w / 2 + 1) / 2; x++) {
+      INFO("chroma " << x << "," << y);
+      REQUIRE(dst.data[1][static_cast<size_t>(y) * dst.stride[1] + x] == 100);
+      REQUIRE(dst.data[2][static_cast<size_t>(y) * dst.stride[2] + x] == 160);
+    }
+  }
+
+  Image wrong(w / 3, h / 3, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_YUV420P);
+  REQUIRE_FALSE(image.HalfScale(wrong));
+}
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(ZM_STRIP_SSE)
+TEST_CASE("sse2_halve8 matches std_halve8", "[image]") {
+  const unsigned long count = 77;  // not a multiple of the vector width
+  std::vector<uint8_t> row0(2 * count), row1(2 * count);
+  for (size_t i = 0; i < row0.size(); i++) {
+    row0[i] = static_cast<uint8_t>(i * 37 + 11);
+    row1[i] = static_cast<uint8_t>(255 - i * 13);
+  }
+  std::vector<uint8_t> expected(count), actual(count);
+  std_halve8(row0.data(), row1.data(), expected.data(), count);
+  sse2_halve8(row0.data(), row1.data(), actual.data(), count);
+  REQUIRE(expected == actual);
+}
+#endif
+
 TEST_CASE("Image::Flip YUV420P", "[image]") {
   bootstrap_image_config();
   const int w = 640, h = 480;
@@ -256,6 +411,47 @@ TEST_CASE("Image::Overlay YUV420P highlight", "[image]") {
   CHECK(out.data[2][0] == 128);
 }
 
+TEST_CASE("Image::Overlay limited to a box", "[image]") {
+  bootstrap_image_config();
+  const int w = 64, h = 48;
+
+  Image target(w, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_YUV420P);
+  Planes tgt = plane_view(target, AV_PIX_FMT_YUV420P, w, h);
+  memset(tgt.data[0], 16, static_cast<size_t>(tgt.stride[0]) * h);
+  memset(tgt.data[1], 128, static_cast<size_t>(tgt.stride[1]) * (h / 2));
+  memset(tgt.data[2], 128, static_cast<size_t>(tgt.stride[2]) * (h / 2));
+
+  Image high(w, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_YUV420P);
+  Planes hi = plane_view(high, AV_PIX_FMT_YUV420P, w, h);
+  memset(hi.data[0], 0, static_cast<size_t>(hi.stride[0]) * h);
+  memset(hi.data[1], 0, static_cast<size_t>(hi.stride[1]) * (h / 2));
+  memset(hi.data[2], 0, static_cast<size_t>(hi.stride[2]) * (h / 2));
+  // Inside the box, starting on an odd column so the chroma sample straddles it
+  hi.data[0][11 * hi.stride[0] + 11] = 200;
+  hi.data[1][5 * hi.stride[1] + 5] = 84;
+  hi.data[2][5 * hi.stride[2] + 5] = 255;
+  // Outside the box
+  hi.data[0][20 * hi.stride[0] + 20] = 150;
+  hi.data[1][10 * hi.stride[1] + 10] = 43;
+  hi.data[2][10 * hi.stride[2] + 10] = 21;
+
+  Box limits({11, 11}, {15, 15});
+  target.Overlay(high, &limits);
+
+  Planes out = plane_view(target, AV_PIX_FMT_YUV420P, w, h);
+  CHECK(out.data[0][11 * out.stride[0] + 11] == 200);
+  CHECK(out.data[1][5 * out.stride[1] + 5] == 84);
+  CHECK(out.data[2][5 * out.stride[2] + 5] == 255);
+  CHECK(out.data[0][20 * out.stride[0] + 20] == 16);
+  CHECK(out.data[1][10 * out.stride[1] + 10] == 128);
+  CHECK(out.data[2][10 * out.stride[2] + 10] == 128);
+
+  // A box entirely outside the image does nothing
+  Box outside({w + 10, 0}, {w + 20, 10});
+  target.Overlay(high, &outside);
+  CHECK(out.data[0][20 * out.stride[0] + 20] == 16);
+}
+
 // HighlightEdges must be able to emit a YUV420P highlight (so it can be
 // overlaid onto a YUV420P analysis image in the same format). A filled blob's
 // border pixels become non-zero luma markers carrying the alarm chroma.
@@ -283,3 +479,40 @@ TEST_CASE("Image::HighlightEdges YUV420P output", "[image]") {
   CHECK(hi.data[0][0] == 0);                        // outside the blob
   delete high;
 }
+
+// Motion detection runs on DecimateLuma output, so a flat block must stay
+// flat and the grey level of RGB input must match the gray8 conversion.
+TEST_CASE("Image::DecimateLuma", "[image]") {
+  bootstrap_image_config();
+  const int w = 64, h = 48;
+
+  Image grey(w, h, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE);
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+      grey.Buffer()[y * grey.LineSize() + x] = (x < w / 2) ? 40 : 200;
+
+  for (unsigned int factor : {2u, 4u}) {
+    Image small;
+    REQUIRE(grey.DecimateLuma(factor, small));
+    REQUIRE(small.Width() == w / factor);
+    REQUIRE(small.Height() == h / factor);
+    REQUIRE(small.Colours() == ZM_COLOUR_GRAY8);
+    CHECK(small.Buffer(0, 0)[0] == 40);
+    CHECK(small.Buffer(small.Width() - 1, small.Height() - 1)[0] == 200);
+  }
+
+  Image rgb(w, h, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB);
+  for (int y = 0; y < h; y++) {
+    uint8_t *row = rgb.Buffer(0, y);
+    for (int x = 0; x < w; x++) {
+      row[3 * x] = 80;
+      row[3 * x + 1] = 160;
+      row[3 * x + 2] = 240;
+    }
+  }
+  Image small;
+  REQUIRE(rgb.DecimateLuma(2, small));
+  CHECK(small.Buffer(3, 3)[0] == (2 * 80 + 5 * 160 + 240) >> 3);
+
+  CHECK_FALSE(grey.DecimateLuma(3, small));
+}
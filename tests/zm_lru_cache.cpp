@@ -0,0 +1,64 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_lru_cache.h"
+
+#include <string>
+
+TEST_CASE("LruCache: evicts the least recently used entry") {
+  LruCache<std::string, int> cache(2);
+  REQUIRE(cache.Find("a") == nullptr);
+
+  cache.Insert("a", 1);
+  cache.Insert("b", 2);
+  REQUIRE(cache.Size() == 2);
+
+  // Using a makes b the oldest
+  REQUIRE(cache.Find("a") != nullptr);
+  cache.Insert("c", 3);
+  REQUIRE(cache.Size() == 2);
+  REQUIRE(cache.Find("b") == nullptr);
+  REQUIRE(*cache.Find("a") == 1);
+  REQUIRE(*cache.Find("c") == 3);
+
+  SECTION("replacing a value keeps the size") {
+    cache.Insert("a", 10);
+    REQUIRE(cache.Size() == 2);
+    REQUIRE(*cache.Find("a") == 10);
+  }
+
+  SECTION("erase") {
+    REQUIRE(cache.Erase("a"));
+    REQUIRE_FALSE(cache.Erase("a"));
+    REQUIRE(cache.Size() == 1);
+    cache.Clear();
+    REQUIRE(cache.Size() == 0);
+  }
+
+  SECTION("changing the capacity") {
+    cache.SetCapacity(3);
+    cache.Insert("d", 4);
+    REQUIRE(cache.Size() == 3);
+    // c was used last, then d was added
+    cache.SetCapacity(1);
+    REQUIRE(cache.Size() == 1);
+    REQUIRE(cache.Find("d") != nullptr);
+    REQUIRE(cache.Find("c") == nullptr);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_montagestream.h"
+
+TEST_CASE("MontageStream: grid size") {
+  int columns, rows;
+
+  MontageStream::gridSize(1, columns, rows);
+  REQUIRE(columns == 1);
+  REQUIRE(rows == 1);
+
+  MontageStream::gridSize(2, columns, rows);
+  REQUIRE(columns == 2);
+  REQUIRE(rows == 1);
+
+  MontageStream::gridSize(4, columns, rows);
+  REQUIRE(columns == 2);
+  REQUIRE(rows == 2);
+
+  MontageStream::gridSize(5, columns, rows);
+  REQUIRE(columns == 3);
+  REQUIRE(rows == 2);
+
+  MontageStream::gridSize(9, columns, rows);
+  REQUIRE(columns == 3);
+  REQUIRE(rows == 3);
+
+  MontageStream::gridSize(MontageStream::MAX_TILES, columns, rows);
+  REQUIRE(columns == 4);
+  REQUIRE(rows == 4);
+}
+
+TEST_CASE("MontageStream: fit size") {
+  int width, height;
+
+  // Same aspect ratio fills the cell
+  MontageStream::fitSize(1920, 1080, 640, 360, width, height);
+  REQUIRE(width == 640);
+  REQUIRE(height == 360);
+
+  // Wider than the cell is letterboxed
+  MontageStream::fitSize(1920, 1080, 640, 480, width, height);
+  REQUIRE(width == 640);
+  REQUIRE(height == 360);
+
+  // Taller than the cell is pillarboxed
+  MontageStream::fitSize(1080, 1920, 640, 480, width, height);
+  REQUIRE(width == 270);
+  REQUIRE(height == 480);
+
+  // Smaller images are scaled up
+  MontageStream::fitSize(320, 240, 640, 480, width, height);
+  REQUIRE(width == 640);
+  REQUIRE(height == 480);
+
+  // Never collapses to nothing
+  MontageStream::fitSize(10000, 1, 100, 100, width, height);
+  REQUIRE(width == 100);
+  REQUIRE(height == 1);
+}
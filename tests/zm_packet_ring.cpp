@@ -0,0 +1,110 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_packet_ring.h"
+
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+std::string RingPath() {
+  return "/tmp/zm_packet_ring_test." + std::to_string(getpid());
+}
+
+std::vector<uint8_t> PacketData(int n, size_t size) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = static_cast<uint8_t>(n + i);
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("PacketRing: every reader gets every packet") {
+  const std::string path = RingPath();
+  const uint8_t extradata[] = {0, 0, 0, 1, 0x67, 0x42};
+
+  PacketRing::Writer writer;
+  REQUIRE(writer.Open(path, 27, 1, 90000, extradata, sizeof(extradata), 64 * 1024));
+
+  PacketRing first, second;
+  REQUIRE(first.Open(path));
+  REQUIRE(second.Open(path));
+  CHECK(first.CodecId() == 27);
+  CHECK(first.TimeBaseNum() == 1);
+  CHECK(first.TimeBaseDen() == 90000);
+  CHECK(first.Extradata() == std::vector<uint8_t>(extradata, extradata + sizeof(extradata)));
+
+  PacketRing::Packet packet;
+  CHECK(first.Read(packet) == PacketRing::READ_NONE);
+
+  // Enough to wrap the data around several times
+  for (int n = 0; n < 100; n++) {
+    const std::vector<uint8_t> data = PacketData(n, 5000 + n);
+    REQUIRE(writer.Write(data.data(), data.size(), n * 3000, n * 3000 - 1, n % 10 == 0));
+
+    for (PacketRing *reader : {&first, &second}) {
+      REQUIRE(reader->Read(packet) == PacketRing::READ_PACKET);
+      CHECK(packet.pts == n * 3000);
+      CHECK(packet.dts == n * 3000 - 1);
+      CHECK(packet.keyframe == (n % 10 == 0));
+      CHECK(packet.data == data);
+    }
+  }
+  CHECK(second.Read(packet) == PacketRing::READ_NONE);
+
+  writer.Close();
+  CHECK(first.Read(packet) == PacketRing::READ_CLOSED);
+  CHECK_FALSE(first.Open(path));
+}
+
+TEST_CASE("PacketRing: slow readers skip what was overwritten") {
+  const std::string path = RingPath();
+  PacketRing::Writer writer;
+  REQUIRE(writer.Open(path, 173, 1, 1000, nullptr, 0, 64 * 1024));
+
+  PacketRing reader;
+  REQUIRE(reader.Open(path));
+
+  // Fewer packets than slots, but more data than the ring holds
+  for (int n = 0; n < 20; n++) {
+    const std::vector<uint8_t> data = PacketData(n, 10000);
+    REQUIRE(writer.Write(data.data(), data.size(), n, n, false));
+  }
+
+  PacketRing::Packet packet;
+  REQUIRE(reader.Read(packet) == PacketRing::READ_SKIPPED);
+  REQUIRE(reader.Read(packet) == PacketRing::READ_PACKET);
+  CHECK(packet.pts == 19);
+  CHECK(packet.data == PacketData(19, 10000));
+
+  // Too many packets for the slots
+  for (int n = 20; n < 20 + static_cast<int>(PacketRing::kSlots) + 5; n++) {
+    const std::vector<uint8_t> data = PacketData(n, 10);
+    REQUIRE(writer.Write(data.data(), data.size(), n, n, false));
+  }
+  REQUIRE(reader.Read(packet) == PacketRing::READ_SKIPPED);
+  REQUIRE(reader.Read(packet) == PacketRing::READ_PACKET);
+  CHECK(packet.pts == 20 + PacketRing::kSlots + 4);
+
+  // Packets that could overwrite themselves are refused
+  const std::vector<uint8_t> huge = PacketData(0, 32 * 1024);
+  CHECK_FALSE(writer.Write(huge.data(), huge.size(), 0, 0, true));
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_passthrough_stream.h"
+
+TEST_CASE("PassthroughStream: H.264 NAL inspection") {
+  bool params, key, slice;
+
+  SECTION("extradata only") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1, 0x68, 0xce };
+    PassthroughStream::InspectNals(AV_CODEC_ID_H264, data, sizeof(data), params, key, slice);
+    REQUIRE(params);
+    REQUIRE_FALSE(key);
+    REQUIRE_FALSE(slice);
+  }
+
+  SECTION("IDR with inline parameter sets") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x67, 0x42, 0, 0, 1, 0x68, 0xce, 0, 0, 1, 0x65, 0x88 };
+    PassthroughStream::InspectNals(AV_CODEC_ID_H264, data, sizeof(data), params, key, slice);
+    REQUIRE(params);
+    REQUIRE(key);
+    REQUIRE(slice);
+  }
+
+  SECTION("non-IDR slice") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x41, 0x9a, 0x00 };
+    PassthroughStream::InspectNals(AV_CODEC_ID_H264, data, sizeof(data), params, key, slice);
+    REQUIRE_FALSE(params);
+    REQUIRE_FALSE(key);
+    REQUIRE(slice);
+  }
+
+  SECTION("no start code") {
+    const uint8_t data[] = { 0x01, 0x42, 0x00, 0x1e };
+    PassthroughStream::InspectNals(AV_CODEC_ID_H264, data, sizeof(data), params, key, slice);
+    REQUIRE_FALSE(params);
+    REQUIRE_FALSE(slice);
+  }
+}
+
+TEST_CASE("PassthroughStream: H.265 NAL inspection") {
+  bool params, key, slice;
+
+  SECTION("VPS/SPS/PPS") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x40, 0x01, 0, 0, 0, 1, 0x42, 0x01, 0, 0, 0, 1, 0x44, 0x01 };
+    PassthroughStream::InspectNals(AV_CODEC_ID_HEVC, data, sizeof(data), params, key, slice);
+    REQUIRE(params);
+    REQUIRE_FALSE(slice);
+  }
+
+  SECTION("IDR_W_RADL") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x26, 0x01, 0xaf };
+    PassthroughStream::InspectNals(AV_CODEC_ID_HEVC, data, sizeof(data), params, key, slice);
+    REQUIRE(key);
+    REQUIRE(slice);
+  }
+
+  SECTION("TRAIL_R") {
+    const uint8_t data[] = { 0, 0, 0, 1, 0x02, 0x01, 0xd0 };
+    PassthroughStream::InspectNals(AV_CODEC_ID_HEVC, data, sizeof(data), params, key, slice);
+    REQUIRE_FALSE(key);
+    REQUIRE(slice);
+  }
+}
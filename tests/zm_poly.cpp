@@ -69,3 +69,31 @@ TEST_CASE("Polygon: clipping") {
     REQUIRE(p.Extent().Size() == Vector2(8, 3));
   }
 }
+
+TEST_CASE("Polygon: spans") {
+  Polygon p({{2, 1}, {6, 1}, {6, 4}, {2, 4}});
+
+  // The last row belongs to the polygon below, as with Image::Fill
+  REQUIRE(p.Spans().size() == 3);
+  for (size_t i = 0; i < p.Spans().size(); i++) {
+    REQUIRE(p.Spans()[i].y == static_cast<int32>(i + 1));
+    REQUIRE(p.Spans()[i].lo_x == 2);
+    REQUIRE(p.Spans()[i].hi_x == 6);
+  }
+
+  // The outline covers every edge pixel once, merged into runs per row
+  REQUIRE(p.OutlineSpans().size() == 6);
+  REQUIRE(p.OutlineSpans().front().y == 1);
+  REQUIRE(p.OutlineSpans().front().lo_x == 2);
+  REQUIRE(p.OutlineSpans().front().hi_x == 6);
+  REQUIRE(p.OutlineSpans().back().y == 4);
+  REQUIRE(p.OutlineSpans().back().lo_x == 2);
+  REQUIRE(p.OutlineSpans().back().hi_x == 6);
+
+  SECTION("clipping rebuilds the spans") {
+    p.Clip(Box({0, 0}, {4, 9}));
+
+    REQUIRE(p.Spans().size() == 3);
+    REQUIRE(p.Spans()[0].hi_x == 4);
+  }
+}
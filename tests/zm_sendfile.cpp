@@ -0,0 +1,100 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_sendfile.h"
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+std::string FilePath() {
+  return "/tmp/zm_sendfile_test." + std::to_string(getpid());
+}
+
+std::string ReadAll(int fd) {
+  std::string data;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    data.append(buffer, n);
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("zm_sendfile_part: frames a file as a multipart part") {
+  const std::string path = FilePath();
+  std::string body;
+  for (int i = 0; i < 20000; i++)
+    body += static_cast<char>(i * 7);
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << body;
+  }
+
+  // More than a pipe holds, so collect it in a file instead
+  std::string out_path = path + ".out";
+  int out_fd = open(out_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  REQUIRE(out_fd >= 0);
+
+  const std::string headers = "--Frame\r\nContent-Type: image/jpeg\r\n";
+  REQUIRE(zm_sendfile_part(out_fd, path, headers) == 0);
+
+  lseek(out_fd, 0, SEEK_SET);
+  std::string sent = ReadAll(out_fd);
+  close(out_fd);
+  CHECK(sent == headers + "Content-Length: 20000\r\n\r\n" + body);
+
+  unlink(out_path.c_str());
+  unlink(path.c_str());
+}
+
+TEST_CASE("zm_sendfile_part: nothing is written for unusable files") {
+  const std::string path = FilePath();
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+
+  unlink(path.c_str());
+  CHECK(zm_sendfile_part(fds[1], path, "--Frame\r\n") == ENOENT);
+
+  { std::ofstream file(path, std::ios::binary); }
+  CHECK(zm_sendfile_part(fds[1], path, "--Frame\r\n") == ENODATA);
+
+  close(fds[1]);
+  CHECK(ReadAll(fds[0]).empty());
+  close(fds[0]);
+  unlink(path.c_str());
+}
+
+TEST_CASE("zm_writev_all: writes every buffer in order") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+
+  char a[] = "Content-Type: image/jpeg\r\n";
+  char b[] = "";
+  char c[] = "Content-Length: 3\r\n\r\n";
+  struct iovec iov[3] = {{a, sizeof(a) - 1}, {b, 0}, {c, sizeof(c) - 1}};
+  REQUIRE(zm_writev_all(fds[1], iov, 3));
+  close(fds[1]);
+
+  CHECK(ReadAll(fds[0]) == "Content-Type: image/jpeg\r\nContent-Length: 3\r\n\r\n");
+  close(fds[0]);
+}
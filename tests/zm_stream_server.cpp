@@ -0,0 +1,93 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_stream_server.h"
+
+TEST_CASE("StreamServer: request line") {
+  std::string query;
+
+  REQUIRE(StreamServer::ParseRequestLine("GET /?monitor=1&scale=50 HTTP/1.1\r\nHost: zm\r\n\r\n", query));
+  CHECK(query == "monitor=1&scale=50");
+
+  REQUIRE(StreamServer::ParseRequestLine("GET /cgi-bin/nph-zms?mode=single&monitor=2 HTTP/1.0\r\n\r\n", query));
+  CHECK(query == "mode=single&monitor=2");
+
+  REQUIRE(StreamServer::ParseRequestLine("GET / HTTP/1.1\r\n\r\n", query));
+  CHECK(query.empty());
+
+  CHECK_FALSE(StreamServer::ParseRequestLine("POST /?monitor=1 HTTP/1.1\r\n\r\n", query));
+  CHECK_FALSE(StreamServer::ParseRequestLine("GET  HTTP/1.1\r\n\r\n", query));
+}
+
+TEST_CASE("StreamServer: everything but live streams goes to zms") {
+  const std::string request = "GET /?event=5 HTTP/1.1\r\nhost:  zm.example.com:8081 \r\nAccept: */*\r\n\r\n";
+  CHECK(StreamServer::RequestHeader(request, "Host") == "zm.example.com:8081");
+  CHECK(StreamServer::RequestHeader(request, "Accept") == "*/*");
+  CHECK(StreamServer::RequestHeader(request, "Acc").empty());
+  CHECK(StreamServer::RequestHeader(request, "Referer").empty());
+
+  CHECK(StreamServer::ZmsLocation("zm.example.com:8081", "/zm/cgi-bin/nph-zms", "event=5")
+        == "http://zm.example.com/zm/cgi-bin/nph-zms?event=5");
+  CHECK(StreamServer::ZmsLocation("[::1]:8081", "/zm/cgi-bin/nph-zms", "event=5")
+        == "http://[::1]/zm/cgi-bin/nph-zms?event=5");
+  CHECK(StreamServer::ZmsLocation("", "/zm/cgi-bin/nph-zms", "")
+        == "http://localhost/zm/cgi-bin/nph-zms");
+}
+
+TEST_CASE("StreamFrameQueue: slow clients only keep the newest frame") {
+  StreamFrameQueue queue;
+  CHECK(queue.Empty());
+
+  auto frame = [](const char *data) { return std::make_shared<const std::string>(data); };
+
+  queue.Push(frame("header"));
+  queue.Push(frame("one"));
+  queue.Push(frame("two"));
+  queue.Push(frame("three"));
+  CHECK(queue.Dropped() == 2);
+
+  // The frame in progress is always finished
+  REQUIRE(queue.Remaining() == 6);
+  queue.Consume(2);
+  CHECK(std::string(queue.Data(), queue.Remaining()) == "ader");
+  queue.Consume(4);
+
+  CHECK(std::string(queue.Data(), queue.Remaining()) == "three");
+  queue.Consume(5);
+  CHECK(queue.Empty());
+}
+
+TEST_CASE("StreamFrameQueue: the header and first frame are never dropped") {
+  StreamFrameQueue queue;
+  auto frame = [](const char *data) { return std::make_shared<const std::string>(data); };
+
+  queue.Push(frame("response"), false);
+  queue.Push(frame("header"), false);
+  queue.Push(frame("first"), false);
+  queue.Push(frame("one"));
+  queue.Push(frame("two"));
+  CHECK(queue.Dropped() == 1);
+
+  std::string sent;
+  while (!queue.Empty()) {
+    sent += std::string(queue.Data(), queue.Remaining()) + " ";
+    queue.Consume(queue.Remaining());
+  }
+  CHECK(sent == "response header first two ");
+}
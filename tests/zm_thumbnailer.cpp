@@ -0,0 +1,95 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_thumbnailer.h"
+
+TEST_CASE("Thumbnailer: parse requests") {
+  ThumbnailRequest request;
+
+  REQUIRE(Thumbnailer::ParseRequest("1234", request));
+  REQUIRE(request.event_id == 1234);
+  REQUIRE(!request.has_offset);
+
+  REQUIRE(Thumbnailer::ParseRequest(" 42@1.5\r\n", request));
+  REQUIRE(request.event_id == 42);
+  REQUIRE(request.has_offset);
+  REQUIRE(request.offset == Milliseconds(1500));
+
+  REQUIRE(Thumbnailer::ParseRequest("7@0", request));
+  REQUIRE(request.offset == Microseconds(0));
+}
+
+TEST_CASE("Thumbnailer: reject bad requests") {
+  ThumbnailRequest request;
+  request.event_id = 99;
+
+  REQUIRE(!Thumbnailer::ParseRequest("", request));
+  REQUIRE(!Thumbnailer::ParseRequest("   ", request));
+  REQUIRE(!Thumbnailer::ParseRequest("0", request));
+  REQUIRE(!Thumbnailer::ParseRequest("-5", request));
+  REQUIRE(!Thumbnailer::ParseRequest("12x", request));
+  REQUIRE(!Thumbnailer::ParseRequest("12@", request));
+  REQUIRE(!Thumbnailer::ParseRequest("12@-1", request));
+  REQUIRE(!Thumbnailer::ParseRequest("12@1s", request));
+  REQUIRE(!Thumbnailer::ParseRequest("@3", request));
+  // Left alone on failure
+  REQUIRE(request.event_id == 99);
+}
+
+TEST_CASE("Thumbnailer: file names") {
+  ThumbnailRequest request;
+  REQUIRE(Thumbnailer::FileName("snapshot.jpg", request) == "snapshot.jpg");
+
+  request.has_offset = true;
+  request.offset = Milliseconds(1500);
+  REQUIRE(Thumbnailer::FileName("snapshot.jpg", request) == "snapshot-1500.jpg");
+  REQUIRE(Thumbnailer::FileName("thumb", request) == "thumb-1500");
+  REQUIRE(Thumbnailer::FileName(".thumb", request) == ".thumb-1500");
+}
+
+TEST_CASE("Thumbnailer: scaled size") {
+  int width, height;
+
+  Thumbnailer::ScaledSize(1920, 1080, 0, 100, width, height);
+  REQUIRE(width == 1920);
+  REQUIRE(height == 1080);
+
+  Thumbnailer::ScaledSize(1920, 1080, 0, 25, width, height);
+  REQUIRE(width == 480);
+  REQUIRE(height == 270);
+
+  // Rounded down to even
+  Thumbnailer::ScaledSize(1920, 1080, 0, 33, width, height);
+  REQUIRE(width == 632);
+  REQUIRE(height == 356);
+
+  // Width wins over scale and keeps the aspect ratio
+  Thumbnailer::ScaledSize(1920, 1080, 320, 25, width, height);
+  REQUIRE(width == 320);
+  REQUIRE(height == 180);
+
+  Thumbnailer::ScaledSize(704, 480, 161, 100, width, height);
+  REQUIRE(width == 160);
+  REQUIRE(height == 110);
+
+  // Never collapses to nothing
+  Thumbnailer::ScaledSize(64, 48, 0, 1, width, height);
+  REQUIRE(width == 2);
+  REQUIRE(height == 2);
+}
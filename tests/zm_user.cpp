@@ -0,0 +1,41 @@
+/*
+ * This file is part of the ZoneMinder Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "zm_catch2.h"
+
+#include "zm_user.h"
+
+TEST_CASE("zmParseAuthHashToken") {
+  const std::string hmac(40, 'a');
+  int user_id = 0;
+  int64_t issue_hour = 0;
+
+  REQUIRE(zmParseAuthHashToken("12.480000." + hmac, user_id, issue_hour));
+  REQUIRE(user_id == 12);
+  REQUIRE(issue_hour == 480000);
+
+  // Legacy MD5 hashes are left to the old lookup
+  REQUIRE_FALSE(zmParseAuthHashToken("0123456789abcdef0123456789abcdef", user_id, issue_hour));
+
+  REQUIRE_FALSE(zmParseAuthHashToken("", user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken(".480000." + hmac, user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken("12.." + hmac, user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken("12.480000." + hmac.substr(1), user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken("12.480000." + std::string(40, 'A'), user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken("-1.480000." + hmac, user_id, issue_hour));
+  REQUIRE_FALSE(zmParseAuthHashToken("12.480000.1." + hmac.substr(2), user_id, issue_hour));
+}
@@ -20,10 +20,11 @@ class Monitor extends ZM_Object {
   // inserts a 4-byte pad before capture_fps (after state) and another before
   // the startup_time union (after audio_channels); every field from capture_fps
   // onward therefore sits 4 or 8 bytes later than the naive packed offset. With
-  // the analysis image ring counters appended, SharedData is 888 bytes and
-  // TriggerData starts at 888. The authoritative source is the same alignment
-  // computation ZoneMinder::Memory (Memory.pm) performs; a
-  // sizeof(SharedData)==888 static_assert in zm_monitor.h guards the layout.
+  // the analysis image ring counters and decoder statistics appended,
+  // SharedData is 904 bytes and TriggerData starts at 904. The authoritative
+  // source is the same alignment computation ZoneMinder::Memory (Memory.pm)
+  // performs; a
+  // sizeof(SharedData)==904 static_assert in zm_monitor.h guards the layout.
   private $shm_offsets = ['SharedData' => [
     'size'             => [ 'type'=>'uint32', 'offset'=>0, 'size'=>4 ],
     'last_write_index' => [ 'type'=>'int32', 'offset'=>4, 'size'=>4 ],
@@ -65,21 +66,26 @@ class Monitor extends ZM_Object {
     'video_fifo'       => [ 'type'=>'int8[64]', 'offset'=>680, 'size'=>64 ],
     'audio_fifo'       => [ 'type'=>'int8[64]', 'offset'=>744, 'size'=>64 ],
     'janus_pin'        => [ 'type'=>'int8[64]', 'offset'=>808, 'size'=>64 ],
-    // Analysis image ring counters, appended at the end of SharedData followed
-    // by 8 bytes of padding (kept for the 16-byte-multiple layout invariant),
-    // so SharedData is now 888 bytes and TriggerData starts at 888.
+    // Analysis image ring counters, the last event rollover time and decoder
+    // statistics and the pyramid flag, appended at the end of SharedData,
+    // so SharedData is now 904 bytes and TriggerData starts at 904.
     'last_analysis_index'  => [ 'type'=>'int32', 'offset'=>872, 'size'=>4 ],
     'analysis_image_count' => [ 'type'=>'int32', 'offset'=>876, 'size'=>4 ],
+    'last_rollover_ms'     => [ 'type'=>'uint32', 'offset'=>880, 'size'=>4 ],
+    'decode_all_frames'    => [ 'type'=>'uint32', 'offset'=>884, 'size'=>4 ],
+    'decode_fps'           => [ 'type'=>'double', 'offset'=>888, 'size'=>8 ],
+    'decode_cpu'           => [ 'type'=>'uint32', 'offset'=>896, 'size'=>4 ],
+    'pyramid'              => [ 'type'=>'uint32', 'offset'=>900, 'size'=>4 ],
   ],
   'TriggerData' => [
-    'size'     => [ 'type'=>'uint32', 'offset'=>888, 'size'=>4 ],
-    'state'    => [ 'type'=>'uint32', 'offset'=>892, 'size'=>4 ],
-    'score'    => [ 'type'=>'uint32', 'offset'=>896, 'size'=>4 ],
-    'padding'  => [ 'type'=>'uint32', 'offset'=>900, 'size'=>4 ],
-    'cause'    => [ 'type'=>'int8[32]', 'offset'=>904, 'size'=>32 ],
-    'text'     => [ 'type'=>'int8[256]', 'offset'=>936, 'size'=>256 ],
-    'showtext' => [ 'type'=>'int8[256]', 'offset'=>1192, 'size'=>256 ],
-    // 1448
+    'size'     => [ 'type'=>'uint32', 'offset'=>904, 'size'=>4 ],
+    'state'    => [ 'type'=>'uint32', 'offset'=>908, 'size'=>4 ],
+    'score'    => [ 'type'=>'uint32', 'offset'=>912, 'size'=>4 ],
+    'padding'  => [ 'type'=>'uint32', 'offset'=>916, 'size'=>4 ],
+    'cause'    => [ 'type'=>'int8[32]', 'offset'=>920, 'size'=>32 ],
+    'text'     => [ 'type'=>'int8[256]', 'offset'=>952, 'size'=>256 ],
+    'showtext' => [ 'type'=>'int8[256]', 'offset'=>1208, 'size'=>256 ],
+    // 1464
   ]
   ];
 
@@ -187,6 +193,7 @@ class Monitor extends ZM_Object {
         'KeyFrames' =>  translate('KeyFrames Only'),
         'KeyFrames+Ondemand' => translate('Keyframes + Ondemand'),
         'Always'    =>  translate('Always'),
+        'Adaptive'  =>  translate('Adaptive'),
       );
     }
     return $DecodingOptions;
@@ -567,7 +574,16 @@ class Monitor extends ZM_Object {
   }
 
   public function getStreamSrc($args, $querySep='&amp;') {
-    $streamSrc = $this->Server()->UrlToZMS(ZM_MIN_STREAMING_PORT ? ZM_MIN_STREAMING_PORT+$this->{'Id'} : null);
+    # zmsd serves plain http live jpeg streams and stills, but takes no
+    # commands, so anything that wants to pause or zoom stays with zms
+    if (defined('ZM_STREAM_SERVER_PORT') and ZM_STREAM_SERVER_PORT
+      and empty($args['connkey'])
+      and (empty($args['mode']) or $args['mode'] == 'jpeg' or $args['mode'] == 'single')
+      and $this->Server()->Protocol() == 'http') {
+      $streamSrc = $this->Server()->Url(ZM_STREAM_SERVER_PORT).'/';
+    } else {
+      $streamSrc = $this->Server()->UrlToZMS(ZM_MIN_STREAMING_PORT ? ZM_MIN_STREAMING_PORT+$this->{'Id'} : null);
+    }
 
     $args['monitor'] = $this->{'Id'};
 
@@ -666,6 +682,7 @@ class Monitor extends ZM_Object {
       Warning('Attempt to control a monitor with no Id');
       return;
     }
+    invalidateDbSnapshot();
     if ((!defined('ZM_SERVER_ID')) or ( property_exists($this, 'ServerId') and (ZM_SERVER_ID==$this->{'ServerId'}) )) {
       if ($this->Type() == 'Local') {
         $zmcArgs = '-d '.escapeshellarg($this->{'Device'});
@@ -111,6 +111,7 @@ if ( $action == 'delete' ) {
   } # end foreach config entry
   if ( $changed ) {
     ZM\AuditAction('update', 'config', 0, 'Tab: '.$_REQUEST['tab']);
+    invalidateDbSnapshot();
     switch ( $_REQUEST['tab'] ) {
     case 'system' :
     case 'config' :
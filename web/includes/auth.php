@@ -168,6 +168,12 @@ function validateToken($token, $allowed_token_type='access') {
   return array(false, 'No such user/credentials');
 } // end function validateToken($token, $allowed_token_type='access')
 
+# How many hours an auth hash is good for. zmLoadAuthUser follows the same
+# rule, so that PHP and zms agree on which hashes have expired.
+function authHashTtl() {
+  return ZM_AUTH_HASH_TTL ? intval(ZM_AUTH_HASH_TTL) : 2;
+}
+
 function getAuthUser($auth) {
   if (ZM_OPT_USE_AUTH && (ZM_AUTH_RELAY == 'hashed') && !empty($auth)) {
     $remoteAddr = '';
@@ -186,6 +192,23 @@ function getAuthUser($auth) {
       }
     }
 
+    if (preg_match('/^(\d{1,9})\.(\d{1,11})\.[0-9a-f]{40}$/', $auth, $matches)) {
+      # Current format: the hash names its user and hour, so it takes one HMAC to check
+      $hour = intval($matches[2]);
+      $nowHour = intdiv(time(), 3600);
+      if ($hour > $nowHour or $hour <= $nowHour - authHashTtl()) {
+        ZM\Info("Auth hash for user id {$matches[1]} from hour $hour has expired");
+        return null;
+      }
+      $row = dbFetchOne('SELECT * FROM Users WHERE Enabled = 1 AND Id=?', NULL, array($matches[1]));
+      if ($row and hash_equals(authHashToken($row['Id'], $row['Username'], $row['Password'], $remoteAddr, $hour), $auth)) {
+        return new ZM\User($row);
+      }
+      ZM\Info("Unable to authenticate user id {$matches[1]} from auth hash (xff='$xff' directAddr='$directAddr')");
+      return null;
+    }
+
+    // Legacy MD5 hashes, which could be from any user and any hour in the TTL.
     // Prefer the username from the URL (matches what zms uses) so PHP and the
     // C++ side query the same row. Fall back to the session username for
     // page-internal calls that don't carry user= on the URL.
@@ -212,7 +235,7 @@ function getAuthUser($auth) {
     $rowsTried = count($rows);
     foreach ($rows as $user) {
       $now = time();
-      for ($i = 0; $i < ZM_AUTH_HASH_TTL; $i++, $now -= 3600) { // Try for last TTL hours
+      for ($i = 0; $i < authHashTtl(); $i++, $now -= 3600) { // Try for last TTL hours
         $time = localtime($now);
         $authKey = ZM_AUTH_HASH_SECRET.$user['Username'].$user['Password'].$remoteAddr.$time[2].$time[3].$time[4].$time[5];
         $authHash = md5($authKey);
@@ -235,7 +258,7 @@ function getAuthUser($auth) {
       $rowsTried += count($altRows);
       foreach ($altRows as $user) {
         $now = time();
-        for ($i = 0; $i < ZM_AUTH_HASH_TTL; $i++, $now -= 3600) { // Try for last TTL hours
+        for ($i = 0; $i < authHashTtl(); $i++, $now -= 3600) { // Try for last TTL hours
           $time = localtime($now);
           $authKey = ZM_AUTH_HASH_SECRET.$user['Username'].$user['Password'].$remoteAddr.$time[2].$time[3].$time[4].$time[5];
           $authHash = md5($authKey);
@@ -248,7 +271,7 @@ function getAuthUser($auth) {
       } // end foreach user
     } // end if
 
-    ZM\Info("Unable to authenticate user from auth hash '$auth' (filterUser='".($filterUser ?? '')."' sessionUser='".($sessionUser ?? '')."' xff='$xff' directAddr='$directAddr' rowsTried=$rowsTried ttl=".ZM_AUTH_HASH_TTL.'h)');
+    ZM\Info("Unable to authenticate user from auth hash '$auth' (filterUser='".($filterUser ?? '')."' sessionUser='".($sessionUser ?? '')."' xff='$xff' directAddr='$directAddr' rowsTried=$rowsTried ttl=".authHashTtl().'h)');
     return null;
   } // end if using auth hash
 
@@ -256,15 +279,16 @@ function getAuthUser($auth) {
   return null;
 } // end getAuthUser($auth)
 
-// TODO: MD5 is cryptographically weak. Consider migrating to hash('sha256', ...)
-// However, changing this would invalidate all existing auth hashes and require
-// a coordinated update of all components that generate/validate auth hashes.
+// Auth hashes are <user id>.<hours since the epoch>.<HMAC-SHA1>, matching
+// zmAuthHashToken in zm_user.cpp. getAuthUser still accepts the older MD5 hashes.
+function authHashToken($id, $username, $password, $remoteAddr, $hour) {
+  $prefix = $id.'.'.$hour;
+  return $prefix.'.'.hash_hmac('sha1', $prefix.'.'.$username.'.'.$password.'.'.$remoteAddr, ZM_AUTH_HASH_SECRET);
+}
+
 function calculateAuthHash($remoteAddr='') {
   global $user;
-  $local_time = localtime();
-  $authKey = ZM_AUTH_HASH_SECRET.$user->Username().$user->Password().$remoteAddr.$local_time[2].$local_time[3].$local_time[4].$local_time[5];
-  #ZM\Debug("Generated using hour:".$local_time[2] . ' mday:' . $local_time[3] . ' month:'.$local_time[4] . ' year: ' . $local_time[5] );
-  return md5($authKey);
+  return authHashToken($user->Id(), $user->Username(), $user->Password(), $remoteAddr, intdiv(time(), 3600));
 }
 
 function generateAuthHash($useRemoteAddr, $force=false) {
@@ -273,7 +297,7 @@ function generateAuthHash($useRemoteAddr, $force=false) {
   if (ZM_OPT_USE_AUTH and (ZM_AUTH_RELAY == 'hashed') and $user and $user->Username()) {
     $time = time();
     # We use 1800 so that we regenerate the hash at half the TTL
-    $mintime = $time - (ZM_AUTH_HASH_TTL * 1800);
+    $mintime = $time - (authHashTtl() * 1800);
     # The address baked into the hash, and the cache slot key, must agree. A
     # caller that asks for an IP-less hash ($useRemoteAddr false, e.g.
     # getZmuCommand) must not overwrite the IP-bound slot used by the browser,
@@ -752,6 +752,14 @@ function daemonControl($command, $daemon=false, $args=false) {
   exec($string);
 }
 
+# Makes zms and zmu load the next stream from the database, see ZM_DB_SNAPSHOT
+function invalidateDbSnapshot() {
+  $path = ZM_PATH_MAP.'/zm.dbsnapshot';
+  if (file_exists($path) and !@unlink($path)) {
+    ZM\Warning('Unable to remove database snapshot '.$path);
+  }
+}
+
 function zmcControl($monitor, $mode=false) {
   $Monitor = new ZM\Monitor($monitor);
   return $Monitor->zmcControl($mode);
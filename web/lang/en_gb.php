@@ -1098,6 +1098,7 @@ Always: A zmc process will run and immediately connect and stay connected.~~~~
 Always: every frame will be decoded, live view and thumbnails will be available.~~~~
 OnDemand: only do decoding when someone is watching.~~~~
 KeyFrames: Only keyframes will be decoded, so viewing frame rate will be very low, depending on the keyframe interval set in the camera.~~~~
+Adaptive: Only keyframes will be decoded until motion, an ONVIF or linked monitor alarm or a trigger is seen. From the next keyframe on every frame is then decoded, until the monitor has been idle for ZM_ADAPTIVE_DECODE_HOLD seconds.~~~~
 None: No frames will be decoded, live view and thumbnails will not be available~~~~
 '
   ),
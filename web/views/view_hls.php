@@ -33,6 +33,43 @@ if (!$Event->canView()) {
 
 $m3u8_path = $Event->Path() . '/index.m3u8';
 
+// Returns true if the playlist already contains media sequence number $msn
+// (and, when $part is given, that part of it) or the event has ended.
+function hlsPlaylistHas($content, $msn, $part) {
+  if (strpos($content, '#EXT-X-ENDLIST') !== false) return true;
+  $media_sequence = 0;
+  if (preg_match('/^#EXT-X-MEDIA-SEQUENCE:(\d+)/m', $content, $matches))
+    $media_sequence = intval($matches[1]);
+  // Complete segments each have an EXTINF, the in-progress one only has parts.
+  $live_msn = $media_sequence + preg_match_all('/^#EXTINF:/m', $content);
+  if ($msn < $live_msn) return true;
+  if ($msn > $live_msn or $part === null) return false;
+  $tail = substr($content, strrpos("\n".$content, "\n#EXTINF:") ?: 0);
+  return $part < preg_match_all('/^#EXT-X-PART:/m', $tail);
+}
+
+// LL-HLS blocking playlist reload: hold the request until the requested
+// segment/part has been published, for at most three target durations.
+if (isset($_REQUEST['_HLS_msn'])) {
+  $msn = validCardinal($_REQUEST['_HLS_msn']);
+  $part = isset($_REQUEST['_HLS_part']) ? validCardinal($_REQUEST['_HLS_part']) : null;
+  $content = @file_get_contents($m3u8_path);
+  $timeout = 3;
+  if ($content !== false and preg_match('/^#EXT-X-TARGETDURATION:(\d+)/m', $content, $matches))
+    $timeout = 3 * intval($matches[1]);
+  $deadline = microtime(true) + $timeout;
+  session_write_close();
+  while (($content === false) or !hlsPlaylistHas($content, $msn, $part)) {
+    if (microtime(true) >= $deadline) {
+      header('HTTP/1.1 503 Service Unavailable');
+      header('Cache-Control: no-cache');
+      exit;
+    }
+    usleep(50000);
+    $content = @file_get_contents($m3u8_path);
+  }
+}
+
 if (!file_exists($m3u8_path)) {
   header('HTTP/1.1 204 No Content');
   header('Cache-Control: no-cache');
@@ -45,7 +82,8 @@ if ($m3u8_content_check === false) {
   header('Cache-Control: no-cache');
   ZM\Debug('HLS manifest ' . $m3u8_path . ' is not available yet');
   exit;
-} else if (strpos($m3u8_content_check, '#EXTINF:') === false) {
+} else if (strpos($m3u8_content_check, '#EXTINF:') === false
+    and strpos($m3u8_content_check, '#EXT-X-PART:') === false) {
   header('HTTP/1.1 204 No Content');
   header('Cache-Control: no-cache');
   ZM\Debug('HLS manifest ' . $m3u8_path .' has no fragments yet');